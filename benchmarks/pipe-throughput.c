@@ -0,0 +1,151 @@
+/* Measure the throughput of pipes.
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Send data through a pipe from a writing thread to a reading thread,
+   with reads and writes of 512 bytes, then four times that, and so on up
+   to the given size, and print the throughput for each size.  Writes of
+   whole pages go from a page-aligned buffer, as they do from programs
+   which use large buffers, so that the server may pass them on without
+   copying; the small ones show the cost of copying and of each RPC.  */
+
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+
+static size_t size = 256 * 1024 * 1024;	/* Bytes sent for each chunk size.  */
+static size_t chunk;			/* Bytes in each read and write.  */
+
+/* Return a page-aligned buffer of LEN bytes.  */
+static char *
+alloc_buffer (size_t len)
+{
+  char *buf = mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON|MAP_PRIVATE,
+		    -1, 0);
+  if (buf == MAP_FAILED)
+    error (1, errno, "mmap");
+  return buf;
+}
+
+static void *
+writer (void *arg)
+{
+  int fd = (intptr_t) arg;
+  char *buf = alloc_buffer (chunk);
+  size_t left = size;
+
+  memset (buf, 0x5a, chunk);
+
+  while (left > 0)
+    {
+      ssize_t n = write (fd, buf, left < chunk ? left : chunk);
+      if (n < 0)
+	error (1, errno, "write");
+      left -= n;
+    }
+
+  close (fd);
+  munmap (buf, chunk);
+  return NULL;
+}
+
+static void *
+reader (void *arg)
+{
+  int fd = (intptr_t) arg;
+  char *buf = alloc_buffer (chunk);
+  size_t got = 0;
+  ssize_t n;
+
+  while ((n = read (fd, buf, chunk)) > 0)
+    got += n;
+  if (n < 0)
+    error (1, errno, "read");
+  if (got != size)
+    error (1, 0, "received %zu bytes instead of %zu", got, size);
+
+  close (fd);
+  munmap (buf, chunk);
+  return NULL;
+}
+
+/* Send SIZE bytes through a pipe in CHUNK-sized pieces, and return the
+   throughput in MiB/s.  */
+static double
+run (void)
+{
+  pthread_t threads[2];
+  struct timeval start, end;
+  double secs;
+  int fds[2];
+
+  if (pipe (fds) < 0)
+    error (1, errno, "pipe");
+
+  gettimeofday (&start, NULL);
+  if (pthread_create (&threads[0], NULL, reader, (void *) (intptr_t) fds[0])
+      || pthread_create (&threads[1], NULL, writer,
+			 (void *) (intptr_t) fds[1]))
+    error (1, 0, "pthread_create failed");
+  pthread_join (threads[0], NULL);
+  pthread_join (threads[1], NULL);
+  gettimeofday (&end, NULL);
+
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  return (size / (1024.0 * 1024.0)) / secs;
+}
+
+int
+main (int argc, char **argv)
+{
+  size_t max_chunk = 1024 * 1024;
+  int opt;
+
+  while ((opt = getopt (argc, argv, "s:r:")) != -1)
+    switch (opt)
+      {
+      case 's':
+	size = strtoul (optarg, 0, 0) * 1024 * 1024;
+	break;
+      case 'r':
+	max_chunk = strtoul (optarg, 0, 0) * 1024;
+	break;
+      default:
+	fprintf (stderr, "usage: %s [-s MiB-per-size] [-r max-KiB-per-request]\n",
+		 argv[0]);
+	exit (1);
+      }
+
+  if (optind != argc || size == 0 || max_chunk < 512)
+    error (1, 0, "bad arguments");
+
+  printf ("%zu MiB for each request size\n", size / (1024 * 1024));
+  printf ("%12s %14s\n", "request", "MiB/s");
+  for (chunk = 512; chunk <= max_chunk; chunk *= 4)
+    printf ("%12zu %14.1f\n", chunk, run ());
+
+  return 0;
+}
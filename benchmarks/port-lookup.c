@@ -0,0 +1,147 @@
+/* Measure the throughput of ports_lookup_port.
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Create a number of ports, then look them up from 1, 2, 4, ... up to
+   the given number of threads for a fixed time each, and print the
+   number of lookups per second.  */
+
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <unistd.h>
+#include <hurd/ports.h>
+
+static struct port_bucket *bucket;
+static struct port_class *class;
+
+static mach_port_t *names;
+static int nports;
+
+static volatile int running;
+
+struct worker
+{
+  pthread_t thread;
+  unsigned long lookups;
+};
+
+static void *
+worker (void *arg)
+{
+  struct worker *w = arg;
+  unsigned int i = (uintptr_t) w;
+
+  while (running)
+    {
+      struct port_info *pi;
+
+      i = i * 1103515245 + 12345;
+      pi = ports_lookup_port (bucket, names[i % nports], class);
+      if (pi == NULL)
+	error (1, 0, "lookup failed");
+      ports_port_deref (pi);
+      w->lookups++;
+    }
+
+  return NULL;
+}
+
+/* Look up ports from NTHREADS threads for SECONDS seconds, and return
+   the number of lookups per second.  */
+static double
+run (int nthreads, int seconds)
+{
+  struct worker *workers = calloc (nthreads, sizeof *workers);
+  struct timeval start, end;
+  unsigned long total = 0;
+  double elapsed;
+  int i, err;
+
+  if (workers == NULL)
+    error (1, errno, "calloc");
+
+  running = 1;
+  gettimeofday (&start, NULL);
+  for (i = 0; i < nthreads; i++)
+    {
+      err = pthread_create (&workers[i].thread, NULL, worker, &workers[i]);
+      if (err)
+	error (1, err, "pthread_create");
+    }
+
+  sleep (seconds);
+  running = 0;
+
+  for (i = 0; i < nthreads; i++)
+    {
+      pthread_join (workers[i].thread, NULL);
+      total += workers[i].lookups;
+    }
+  gettimeofday (&end, NULL);
+
+  elapsed = (end.tv_sec - start.tv_sec)
+    + (end.tv_usec - start.tv_usec) / 1000000.0;
+  free (workers);
+  return total / elapsed;
+}
+
+int
+main (int argc, char **argv)
+{
+  int max_threads, seconds, nthreads, i;
+
+  if (argc < 2 || argc > 4)
+    {
+      fprintf (stderr, "usage: %s max-threads [ports [seconds]]\n", argv[0]);
+      exit (1);
+    }
+  max_threads = atoi (argv[1]);
+  nports = argc > 2 ? atoi (argv[2]) : 1000;
+  seconds = argc > 3 ? atoi (argv[3]) : 5;
+  if (max_threads < 1 || nports < 1 || seconds < 1)
+    error (1, 0, "arguments must be positive");
+
+  bucket = ports_create_bucket ();
+  class = ports_create_class (NULL, NULL);
+  if (bucket == NULL || class == NULL)
+    error (1, errno, "ports_create_bucket");
+
+  names = calloc (nports, sizeof *names);
+  if (names == NULL)
+    error (1, errno, "calloc");
+
+  for (i = 0; i < nports; i++)
+    {
+      struct port_info *pi;
+      error_t err = ports_create_port (class, bucket, sizeof *pi, &pi);
+      if (err)
+	error (1, err, "ports_create_port");
+      names[i] = ports_get_right (pi);
+    }
+
+  printf ("%8s %16s\n", "threads", "lookups/s");
+  for (nthreads = 1; nthreads <= max_threads; nthreads *= 2)
+    printf ("%8d %16.0f\n", nthreads, run (nthreads, seconds));
+
+  return 0;
+}
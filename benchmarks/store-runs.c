@@ -0,0 +1,131 @@
+/* Measure the cost of finding runs in store_read.
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Make zero stores of 1, 4, 16, ... up to the given number of runs,
+   and read single blocks from them, at random and in sequence, with and
+   without the run index.  Print the time each read takes, which is
+   mostly spent finding the run since zero stores do nearly nothing.  */
+
+#include <errno.h>
+#include <error.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <hurd/store.h>
+
+#define BLOCK_SIZE 512
+#define RUN_BLOCKS 8
+
+static char block[BLOCK_SIZE];
+
+/* Read NREADS blocks from STORE, at random if RANDOM is set, and return
+   the number of nanoseconds each read takes.  */
+static double
+run (struct store *store, long nreads, int random)
+{
+  struct timeval start, end;
+  store_offset_t addr = 0;
+  unsigned int seed = 1;
+  long i;
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < nreads; i++)
+    {
+      void *buf = block;
+      size_t len = sizeof block;
+      error_t err;
+
+      if (random)
+	{
+	  seed = seed * 1103515245 + 12345;
+	  addr = seed % store->blocks;
+	}
+      else if (++addr == store->blocks)
+	addr = 0;
+
+      err = store_read (store, addr, BLOCK_SIZE, &buf, &len);
+      if (err)
+	error (1, err, "store_read");
+    }
+  gettimeofday (&end, NULL);
+
+  return ((end.tv_sec - start.tv_sec) * 1e9
+	  + (end.tv_usec - start.tv_usec) * 1e3) / nreads;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct store_run *runs;
+  long max_runs, nreads, nruns, i;
+
+  if (argc < 2 || argc > 3)
+    {
+      fprintf (stderr, "usage: %s max-runs [reads]\n", argv[0]);
+      exit (1);
+    }
+  max_runs = atol (argv[1]);
+  nreads = argc > 2 ? atol (argv[2]) : 1000000;
+  if (max_runs < 1 || nreads < 1)
+    error (1, 0, "arguments must be positive");
+
+  runs = calloc (max_runs, sizeof *runs);
+  if (runs == NULL)
+    error (1, errno, "calloc");
+
+  /* Runs in reverse order, so that they can't be merged.  */
+  for (i = 0; i < max_runs; i++)
+    {
+      runs[i].start = (max_runs - 1 - i) * RUN_BLOCKS;
+      runs[i].length = RUN_BLOCKS;
+    }
+
+  printf ("%10s %12s %12s %12s %12s\n", "runs", "random ns", "seq ns",
+	  "linear rnd", "linear seq");
+  for (nruns = 1; nruns <= max_runs; nruns *= 4)
+    {
+      struct store *store;
+      double random, seq, linear_random, linear_seq;
+      long linear_reads;
+      error_t err;
+
+      err = _store_create (&store_zero_class, MACH_PORT_NULL, 0, BLOCK_SIZE,
+			   runs + max_runs - nruns, nruns, 0, &store);
+      if (err)
+	error (1, err, "_store_create");
+
+      random = run (store, nreads, 1);
+      seq = run (store, nreads, 0);
+
+      /* Drop the index, so that the run list is walked instead, which
+	 takes long enough to do fewer reads.  */
+      free (store->run_offsets);
+      store->run_offsets = NULL;
+      linear_reads = nreads / nruns > 1000 ? nreads / nruns : 1000;
+      linear_random = run (store, linear_reads, 1);
+      linear_seq = run (store, linear_reads, 0);
+
+      printf ("%10ld %12.1f %12.1f %12.1f %12.1f\n", nruns,
+	      random, seq, linear_random, linear_seq);
+      store_free (store);
+    }
+
+  return 0;
+}
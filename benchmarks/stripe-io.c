@@ -0,0 +1,154 @@
+/* Measure the throughput of interleaved stores.
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Make an interleaved store of file stores, one for each of the given
+   files, which are created as needed, and read and write it with large
+   requests, which are spread over all the files at once, and with
+   requests of the interleave size, which each go to a single file, as
+   all requests did before.  Print the throughput of both.  Put the files
+   on different disks to see how well the store scales.  */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/time.h>
+#include <hurd/store.h>
+
+#define INTERLEAVE (64 * 1024)
+
+static size_t size = 64 * 1024 * 1024;	/* Bytes in each file.  */
+static size_t request = 1024 * 1024;	/* Bytes in each large request.  */
+
+static char *buffer;
+
+/* Read or write (if WRITE is true) all of STORE with requests of LEN
+   bytes, and return the throughput in MiB/s.  */
+static double
+run (struct store *store, int write, size_t len)
+{
+  struct timeval start, end;
+  store_offset_t addr;
+  double secs;
+
+  gettimeofday (&start, NULL);
+  for (addr = 0; addr < store->blocks; addr += len / store->block_size)
+    {
+      size_t amount;
+      error_t err;
+
+      if ((store->blocks - addr) * store->block_size < len)
+	len = (store->blocks - addr) * store->block_size;
+
+      if (write)
+	err = store_write (store, addr, buffer, len, &amount);
+      else
+	{
+	  void *buf = buffer;
+	  err = store_read (store, addr, len, &buf, &amount);
+	  if (! err && buf != buffer)
+	    munmap (buf, amount);
+	}
+      if (err)
+	error (1, err, write ? "store_write" : "store_read");
+      if (amount != len)
+	error (1, 0, "short %s", write ? "write" : "read");
+    }
+  gettimeofday (&end, NULL);
+
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  return store->size / (1024.0 * 1024.0) / secs;
+}
+
+int
+main (int argc, char **argv)
+{
+  struct store **files, *store;
+  int nfiles, i;
+  error_t err;
+
+  if (argc < 2)
+    {
+      fprintf (stderr, "usage: %s [-s MiB-per-file] [-r KiB-per-request]"
+	       " file...\n", argv[0]);
+      exit (1);
+    }
+
+  while ((i = getopt (argc, argv, "s:r:")) != -1)
+    switch (i)
+      {
+      case 's':
+	size = strtoul (optarg, 0, 0) * 1024 * 1024;
+	break;
+      case 'r':
+	request = strtoul (optarg, 0, 0) * 1024;
+	break;
+      default:
+	exit (1);
+      }
+
+  nfiles = argc - optind;
+  if (nfiles < 1 || size < INTERLEAVE || request < INTERLEAVE
+      || request % INTERLEAVE != 0)
+    error (1, 0, "bad arguments");
+  size -= size % INTERLEAVE;
+
+  files = calloc (nfiles, sizeof *files);
+  buffer = malloc (request);
+  if (! files || ! buffer)
+    error (1, errno, "malloc");
+  memset (buffer, 0x5a, request);
+
+  for (i = 0; i < nfiles; i++)
+    {
+      const char *name = argv[optind + i];
+      int fd = open (name, O_RDWR | O_CREAT, 0666);
+
+      if (fd < 0 || ftruncate (fd, size) < 0)
+	error (1, errno, "%s", name);
+      close (fd);
+
+      err = store_file_open (name, 0, &files[i]);
+      if (err)
+	error (1, err, "%s", name);
+    }
+
+  err = store_ileave_create (files, nfiles, INTERLEAVE, 0, &store);
+  if (err)
+    error (1, err, "store_ileave_create");
+  free (files);
+
+  printf ("%d files of %zu MiB, %zu KiB requests\n",
+	  nfiles, size / (1024 * 1024), request / 1024);
+  printf ("%10s %14s %14s\n", "", "large MiB/s", "stripe MiB/s");
+  for (i = 1; i >= 0; i--)
+    {
+      double large = run (store, i, request);
+      double stripe = run (store, i, INTERLEAVE);
+      printf ("%10s %14.1f %14.1f\n", i ? "write" : "read", large, stripe);
+    }
+
+  store_free (store);
+  return 0;
+}
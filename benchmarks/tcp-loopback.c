@@ -0,0 +1,178 @@
+/* Measure the throughput of TCP connections over the loopback device.
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Open 1, 2, 4, ... up to the given number of connections to ourselves
+   over 127.0.0.1, and send data over all of them at once, each with a
+   writing and a reading thread.  Print the throughput of all of them
+   together, which grows with the number of connections only as far as
+   the TCP/IP server handles them in parallel.  */
+
+#include <errno.h>
+#include <error.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+static size_t size = 64 * 1024 * 1024;	/* Bytes sent over each connection.  */
+static size_t chunk = 64 * 1024;	/* Bytes in each read and write.  */
+
+static void *
+writer (void *arg)
+{
+  int fd = (intptr_t) arg;
+  char *buf = malloc (chunk);
+  size_t left = size;
+
+  if (! buf)
+    error (1, errno, "malloc");
+  memset (buf, 0x5a, chunk);
+
+  while (left > 0)
+    {
+      ssize_t n = write (fd, buf, left < chunk ? left : chunk);
+      if (n < 0)
+	error (1, errno, "write");
+      left -= n;
+    }
+
+  close (fd);
+  free (buf);
+  return NULL;
+}
+
+static void *
+reader (void *arg)
+{
+  int fd = (intptr_t) arg;
+  char *buf = malloc (chunk);
+  size_t got = 0;
+  ssize_t n;
+
+  if (! buf)
+    error (1, errno, "malloc");
+
+  while ((n = read (fd, buf, chunk)) > 0)
+    got += n;
+  if (n < 0)
+    error (1, errno, "read");
+  if (got != size)
+    error (1, 0, "received %zu bytes instead of %zu", got, size);
+
+  close (fd);
+  free (buf);
+  return NULL;
+}
+
+/* Send SIZE bytes over each of NCONN connections at once, and return the
+   throughput of all of them in MiB/s.  */
+static double
+run (int nconn)
+{
+  struct sockaddr_in addr;
+  socklen_t addrlen = sizeof addr;
+  pthread_t threads[2 * nconn];
+  struct timeval start, end;
+  double secs;
+  int listener, i;
+
+  listener = socket (PF_INET, SOCK_STREAM, 0);
+  if (listener < 0)
+    error (1, errno, "socket");
+
+  memset (&addr, 0, sizeof addr);
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+  addr.sin_port = 0;
+  if (bind (listener, (struct sockaddr *) &addr, sizeof addr) < 0
+      || listen (listener, nconn) < 0
+      || getsockname (listener, (struct sockaddr *) &addr, &addrlen) < 0)
+    error (1, errno, "listening on 127.0.0.1");
+
+  gettimeofday (&start, NULL);
+  for (i = 0; i < nconn; i++)
+    {
+      int out, in;
+
+      out = socket (PF_INET, SOCK_STREAM, 0);
+      if (out < 0)
+	error (1, errno, "socket");
+      if (connect (out, (struct sockaddr *) &addr, sizeof addr) < 0)
+	error (1, errno, "connect");
+      in = accept (listener, NULL, NULL);
+      if (in < 0)
+	error (1, errno, "accept");
+
+      if (pthread_create (&threads[2 * i], NULL, reader,
+			  (void *) (intptr_t) in)
+	  || pthread_create (&threads[2 * i + 1], NULL, writer,
+			     (void *) (intptr_t) out))
+	error (1, 0, "pthread_create failed");
+    }
+
+  for (i = 0; i < 2 * nconn; i++)
+    pthread_join (threads[i], NULL);
+  gettimeofday (&end, NULL);
+  close (listener);
+
+  secs = (end.tv_sec - start.tv_sec) + (end.tv_usec - start.tv_usec) / 1e6;
+  return nconn * (size / (1024.0 * 1024.0)) / secs;
+}
+
+int
+main (int argc, char **argv)
+{
+  int max_conn = 8, nconn, opt;
+
+  while ((opt = getopt (argc, argv, "c:s:r:")) != -1)
+    switch (opt)
+      {
+      case 'c':
+	max_conn = atoi (optarg);
+	break;
+      case 's':
+	size = strtoul (optarg, 0, 0) * 1024 * 1024;
+	break;
+      case 'r':
+	chunk = strtoul (optarg, 0, 0) * 1024;
+	break;
+      default:
+	fprintf (stderr, "usage: %s [-c max-connections]"
+		 " [-s MiB-per-connection] [-r KiB-per-request]\n", argv[0]);
+	exit (1);
+      }
+
+  if (optind != argc || max_conn < 1 || size == 0 || chunk == 0)
+    error (1, 0, "bad arguments");
+
+  printf ("%zu MiB per connection, %zu KiB requests\n",
+	  size / (1024 * 1024), chunk / 1024);
+  printf ("%12s %14s\n", "connections", "total MiB/s");
+  for (nconn = 1; nconn <= max_conn; nconn *= 2)
+    printf ("%12d %14.1f\n", nconn, run (nconn));
+
+  return 0;
+}
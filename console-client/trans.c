@@ -647,7 +647,7 @@ void netfs_node_norefs (struct node *np)
     free (np->nn->symlink_path);
 
   free (np->nn);
-  free (np);
+  netfs_destroy_node (np);
 }
 
 
@@ -458,7 +458,7 @@ netfs_node_norefs (struct node *np)
   vcons_release (vcons);
 
   free (np->nn);
-  free (np);
+  netfs_destroy_node (np);
 }
 
 /* Attempt to create a file named NAME in DIR for USER with MODE.  Set
@@ -41,6 +41,7 @@
  */
 
 #include <string.h>
+#include <stdlib.h>
 #include "ext2fs.h"
 #include "bitmap.c"
 
@@ -54,6 +55,43 @@ memscan (void *buf, unsigned char ch, size_t len)
 
 #define in_range(b, first, len) ((b) >= (first) && (b) <= (first) + (len) - 1)
 
+/* Set up the allocation state of the block groups; called whenever the
+   superblock has been (re)read.  */
+void
+ext2_init_group_info (void)
+{
+  static unsigned long groups_allocated;
+  int i;
+
+  if (group_info_image && groups_allocated != groups_count)
+    {
+      for (i = 0; i < groups_allocated; i++)
+	pthread_mutex_destroy (&group_info (i)->lock);
+      free (group_info_image);
+      group_info_image = NULL;
+    }
+
+  if (! group_info_image)
+    {
+      group_info_image = calloc (groups_count, sizeof *group_info_image);
+      if (! group_info_image)
+	ext2_panic ("can't allocate block group info");
+      for (i = 0; i < groups_count; i++)
+	pthread_mutex_init (&group_info (i)->lock, NULL);
+      groups_allocated = groups_count;
+    }
+
+  for (i = 0; i < groups_count; i++)
+    {
+      struct ext2_group_info *gi = group_info (i);
+      pthread_mutex_lock (&gi->lock);
+      gi->first_free_block = 0;
+      gi->first_free_inode = 0;
+      gi->max_free_run = sblock->s_blocks_per_group;
+      pthread_mutex_unlock (&gi->lock);
+    }
+}
+
 void
 ext2_free_blocks (block_t block, unsigned long count)
 {
@@ -61,16 +99,15 @@ ext2_free_blocks (block_t block, unsigned long count)
   unsigned long block_group;
   unsigned long bit;
   unsigned long i;
+  unsigned long freed = 0;
   struct ext2_group_desc *gdp;
-
-  pthread_spin_lock (&global_lock);
+  struct ext2_group_info *gi;
 
   if (block < sblock->s_first_data_block ||
       (block + count) > sblock->s_blocks_count)
     {
       ext2_error ("freeing blocks not in datazone - "
 		  "block = %u, count = %lu", block, count);
-      pthread_spin_unlock (&global_lock);
       return;
     }
 
@@ -92,7 +129,7 @@ ext2_free_blocks (block_t block, unsigned long count)
 		      block, count);
 	}
       gdp = group_desc (block_group);
-      bh = disk_cache_block_ref (gdp->bg_block_bitmap);
+      gi = group_info (block_group);
 
       if (in_range (gdp->bg_block_bitmap, block, gcount) ||
 	  in_range (gdp->bg_inode_bitmap, block, gcount) ||
@@ -102,6 +139,9 @@ ext2_free_blocks (block_t block, unsigned long count)
 		    "block = %u, count = %lu",
 		    block, count);
 
+      pthread_mutex_lock (&gi->lock);
+      bh = disk_cache_block_ref (gdp->bg_block_bitmap);
+
       for (i = 0; i < gcount; i++)
 	{
 	  if (!clear_bit (bit + i, bh))
@@ -109,285 +149,342 @@ ext2_free_blocks (block_t block, unsigned long count)
 	  else
 	    {
 	      gdp->bg_free_blocks_count++;
-	      sblock->s_free_blocks_count++;
+	      freed++;
 	    }
 	}
 
+      if (bit < gi->first_free_block)
+	gi->first_free_block = bit;
+      /* The freed blocks may have joined neighbouring free runs.  */
+      gi->max_free_run = sblock->s_blocks_per_group;
+
       record_global_poke (bh);
       disk_cache_block_ref_ptr (gdp);
       record_global_poke (gdp);
+      pthread_mutex_unlock (&gi->lock);
 
       block += gcount;
       count -= gcount;
     } while (count > 0);
 
+  pthread_spin_lock (&global_lock);
+  sblock->s_free_blocks_count += freed;
   sblock_dirty = 1;
-
   pthread_spin_unlock (&global_lock);
 
   alloc_sync (0);
 }
 
-/*
- * ext2_new_block uses a goal block to assist allocation.  If the goal is
- * free, or there is a free block within 32 blocks of the goal, that block
- * is allocated.  Otherwise a forward search is made for a free block; within
- * each block group the search first looks for an entire free byte in the block
- * bitmap, and then for any free bit if that fails.
- */
-block_t
-ext2_new_block (block_t goal,
-		block_t prealloc_goal,
-		block_t *prealloc_count, block_t *prealloc_block)
+/* Return the first free bit at or after bit J of the block bitmap BH,
+   or the number of blocks per group if there is none.  Free bits at
+   the start of an entirely free byte are preferred, so that new files
+   don't start in the middle of small holes.  */
+static int
+find_free_bit (char *bh, int j)
 {
-  char *bh = NULL;
-  char *p, *r;
-  int i, j, k, tmp;
-  unsigned long lmap;
-  struct ext2_group_desc *gdp;
+  char *r;
+  int k;
 
-#ifdef EXT2FS_DEBUG
-  static int goal_hits = 0, goal_attempts = 0;
-#endif
+  r = memscan (bh + (j >> 3), 0, (sblock->s_blocks_per_group - j + 7) >> 3);
+  k = (r - bh) << 3;
+  if (k < sblock->s_blocks_per_group)
+    {
+      /* Search backwards up to 7 bits to find the start of this run of
+	 free blocks.  */
+      int n;
+      for (n = 0; n < 7 && k > 0 && !test_bit (k - 1, bh); n++, k--);
+      return k;
+    }
 
-  pthread_spin_lock (&global_lock);
+  return find_next_zero_bit ((unsigned long *) bh,
+			     sblock->s_blocks_per_group, j);
+}
 
-#ifdef XXX /* Auth check to use reserved blocks  */
-  if (sblock->s_free_blocks_count <= sblock->s_r_blocks_count &&
-      (!fsuser () && (sb->u.ext2_sb.s_resuid != current->fsuid) &&
-       (sb->u.ext2_sb.s_resgid == 0 ||
-	!in_group_p (sb->u.ext2_sb.s_resgid))))
+/* Return the first bit at or after bit J of the block bitmap BH that
+   starts a run of at least LEN free bits, or the number of blocks per
+   group if there is none.  Set *LONGEST to the length of the longest
+   shorter run seen.  */
+static int
+find_free_run (char *bh, int j, int len, int *longest)
+{
+  int bpg = sblock->s_blocks_per_group;
+
+  *longest = 0;
+  j = find_next_zero_bit ((unsigned long *) bh, bpg, j);
+  while (j < bpg)
     {
-      pthread_spin_unlock (&global_lock);
-      return 0;
+      int e = j + 1;
+      while (e < bpg && e - j < len && !test_bit (e, bh))
+	e++;
+      if (e - j >= len)
+	return j;
+      if (e - j > *longest)
+	*longest = e - j;
+      j = find_next_zero_bit ((unsigned long *) bh, bpg, e);
     }
-#endif
 
-  ext2_debug ("goal=%u", goal);
+  return bpg;
+}
 
-repeat:
-  assert (bh == NULL);
-  /*
-     * First, test whether the goal block is free.
-   */
-  if (goal < sblock->s_first_data_block || goal >= sblock->s_blocks_count)
-    goal = sblock->s_first_data_block;
-  i = (goal - sblock->s_first_data_block) / sblock->s_blocks_per_group;
-  gdp = group_desc (i);
-  if (gdp->bg_free_blocks_count > 0)
+/* Try to allocate up to *COUNT consecutive blocks in block group GROUP.
+   If NEAR is true, the first one is taken as close after bit J of the
+   group as possible; otherwise the first run of at least NEED free blocks
+   is used.  Return the first block allocated and set *COUNT to the number
+   of blocks allocated, or return 0 if the group cannot satisfy the
+   request.  */
+static block_t
+group_new_blocks (int group, int j, int near, int need, block_t *count)
+{
+  struct ext2_group_desc *gdp = group_desc (group);
+  struct ext2_group_info *gi = group_info (group);
+  int bpg = sblock->s_blocks_per_group;
+  block_t base = group * bpg + sblock->s_first_data_block;
+  block_t block;
+  char *bh;
+  int k, n;
+
+  pthread_mutex_lock (&gi->lock);
+
+  if (gdp->bg_free_blocks_count < need || gi->max_free_run < need)
     {
-      j = ((goal - sblock->s_first_data_block) % sblock->s_blocks_per_group);
-#ifdef EXT2FS_DEBUG
-      if (j)
-	goal_attempts++;
-#endif
-      bh = disk_cache_block_ref (gdp->bg_block_bitmap);
+      pthread_mutex_unlock (&gi->lock);
+      return 0;
+    }
 
-      ext2_debug ("goal is at %d:%d", i, j);
+  bh = disk_cache_block_ref (gdp->bg_block_bitmap);
 
-      if (!test_bit (j, bh))
-	{
-#ifdef EXT2FS_DEBUG
-	  goal_hits++;
-	  ext2_debug ("goal bit allocated!");
-#endif
-	  goto got_block;
-	}
-      if (j)
+  if (near)
+    {
+      ext2_debug ("goal is at %d:%d", group, j);
+
+      if (j < gi->first_free_block)
+	j = gi->first_free_block;
+      if (j < bpg && test_bit (j, bh))
 	{
-	  /*
-	     * The goal was occupied; search forward for a free
-	     * block within the next 32 blocks
-	   */
-	  if ((j & 31) == 31)
-	    lmap = 0;
-	  else
-	    lmap = ((((unsigned long *) bh)[j >> 5]) >>
-		    ((j & 31) + 1));
-	  if (j < sblock->s_blocks_per_group - 32)
-	    lmap |= (((unsigned long *) bh)[(j >> 5) + 1]) <<
-	      (31 - (j & 31));
-	  else
-	    lmap |= 0xffffffff << (31 - (j & 31));
-	  if (lmap != 0xffffffffl)
-	    {
-	      k = ffz (lmap) + 1;
-	      if ((j + k) < sblock->s_blocks_per_group)
-		{
-		  j += k;
-		  goto got_block;
-		}
-	    }
+	  /* The goal was occupied; look for a free block within the next
+	     32 blocks, and failing that, in the rest of the group.  */
+	  int limit = (j + 32 < bpg ? j + 32 : bpg);
+	  k = find_next_zero_bit ((unsigned long *) bh, limit, j);
+	  j = (k < limit ? k : find_free_bit (bh, j));
 	}
+    }
+  else
+    {
+      int longest;
 
-      ext2_debug ("bit not found near goal");
-
-      /*
-       * There has been no free block found in the near vicinity
-       * of the goal: do a search forward through the block groups,
-       * searching in each group first for an entire free byte in
-       * the bitmap and then for any free bit.
-       *
-       * Search first in the remainder of the current group; then,
-       * cyclicly search through the rest of the groups.
-       */
-      p = ((char *) bh) + (j >> 3);
-      r = memscan (p, 0, (sblock->s_blocks_per_group - j + 7) >> 3);
-      k = (r - ((char *) bh)) << 3;
-      if (k < sblock->s_blocks_per_group)
+      j = gi->first_free_block;
+      if (need > 1)
 	{
-	  j = k;
-	  goto search_back;
+	  j = find_free_run (bh, j, need, &longest);
+	  if (j >= bpg)
+	    gi->max_free_run = longest;
 	}
-      k = find_next_zero_bit ((unsigned long *) bh,
-			      sblock->s_blocks_per_group,
-			      j);
-      if (k < sblock->s_blocks_per_group)
+      else
+	j = find_free_bit (bh, j);
+
+      if (j >= bpg && need == 1)
 	{
-	  j = k;
-	  goto got_block;
+	  gi->first_free_block = bpg;
+	  ext2_error ("free blocks count corrupted for block group %d", group);
 	}
-
-      disk_cache_block_deref (bh);
-      bh = NULL;
     }
 
-  ext2_debug ("bit not found in block group %d", i);
-
-  /*
-     * Now search the rest of the groups.  We assume that
-     * i and gdp correctly point to the last group visited.
-   */
-  for (k = 0; k < groups_count; k++)
+  if (j >= bpg)
     {
-      i++;
-      if (i >= groups_count)
-	i = 0;
-      gdp = group_desc (i);
-      if (gdp->bg_free_blocks_count > 0)
-	break;
-    }
-  if (k >= groups_count)
-    {
-      pthread_spin_unlock (&global_lock);
+      disk_cache_block_deref (bh);
+      pthread_mutex_unlock (&gi->lock);
       return 0;
     }
-  assert (bh == NULL);
-  bh = disk_cache_block_ref (gdp->bg_block_bitmap);
-  r = memscan (bh, 0, sblock->s_blocks_per_group >> 3);
-  j = (r - bh) << 3;
-  if (j < sblock->s_blocks_per_group)
-    goto search_back;
-  else
-    j = find_first_zero_bit ((unsigned long *) bh,
-			     sblock->s_blocks_per_group);
-  if (j >= sblock->s_blocks_per_group)
+
+  block = base + j;
+  if (block >= sblock->s_blocks_count)
     {
+      ext2_error ("block >= blocks count - block_group = %d, block=%u",
+		  group, block);
       disk_cache_block_deref (bh);
-      bh = NULL;
-      ext2_error ("free blocks count corrupted for block group %d", i);
-      pthread_spin_unlock (&global_lock);
+      pthread_mutex_unlock (&gi->lock);
       return 0;
     }
 
-search_back:
-  assert (bh != NULL);
-  /*
-     * We have succeeded in finding a free byte in the block
-     * bitmap.  Now search backwards up to 7 bits to find the
-     * start of this group of free blocks.
-   */
-  for (k = 0; k < 7 && j > 0 && !test_bit (j - 1, bh); k++, j--);
-
-got_block:
-  assert (bh != NULL);
-
-  ext2_debug ("using block group %d (%d)", i, gdp->bg_free_blocks_count);
+  /* Take as much of the run of free blocks starting at J as wanted.  */
+  for (n = 0;
+       n < *count && j + n < bpg && block + n < sblock->s_blocks_count;
+       n++)
+    {
+      block_t b = block + n;
 
-  tmp = j + i * sblock->s_blocks_per_group + sblock->s_first_data_block;
+      if (b == gdp->bg_block_bitmap ||
+	  b == gdp->bg_inode_bitmap ||
+	  in_range (b, gdp->bg_inode_table, itb_per_group))
+	ext2_panic ("allocating block in system zone; block = %u", b);
 
-  if (tmp == gdp->bg_block_bitmap ||
-      tmp == gdp->bg_inode_bitmap ||
-      in_range (tmp, gdp->bg_inode_table, itb_per_group))
-    ext2_panic ("allocating block in system zone; block = %u", tmp);
+      if (set_bit (j + n, bh))
+	{
+	  if (n == 0)
+	    ext2_warning ("bit already set for block %d", j);
+	  break;
+	}
 
-  if (set_bit (j, bh))
-    {
-      ext2_warning ("bit already set for block %d", j);
-      disk_cache_block_deref (bh);
-      bh = NULL;
-      goto repeat;
+      /* Since due to bletcherousness block-modified bits are never turned
+	 off when writing disk-pager pages, make sure they are here, in
+	 case this block is being allocated to a file (see pager.c).  */
+      if (modified_global_blocks)
+	{
+	  pthread_spin_lock (&modified_global_blocks_lock);
+	  clear_bit (b, modified_global_blocks);
+	  pthread_spin_unlock (&modified_global_blocks_lock);
+	}
     }
 
-  /* Since due to bletcherousness block-modified bits are never turned off
-     when writing disk-pager pages, make sure they are here, in case this
-     block is being allocated to a file (see pager.c).  */
-  if (modified_global_blocks)
+  if (n > 0)
     {
-      pthread_spin_lock (&modified_global_blocks_lock);
-      clear_bit (tmp, modified_global_blocks);
-      pthread_spin_unlock (&modified_global_blocks_lock);
+      record_global_poke (bh);
+
+      if (j <= gi->first_free_block)
+	gi->first_free_block = j + n;
+
+      gdp->bg_free_blocks_count -= n;
+      disk_cache_block_ref_ptr (gdp);
+      record_global_poke (gdp);
     }
+  else
+    disk_cache_block_deref (bh);
 
-  ext2_debug ("found bit %d", j);
+  pthread_mutex_unlock (&gi->lock);
 
-  /*
-     * Do block preallocation now if required.
-   */
-#ifdef EXT2_PREALLOCATE
-  if (prealloc_goal)
-    {
-      *prealloc_count = 0;
-      *prealloc_block = tmp + 1;
-      for (k = 1;
-	   k < prealloc_goal && (j + k) < sblock->s_blocks_per_group; k++)
-	{
-	  if (set_bit (j + k, bh))
-	    break;
-	  (*prealloc_count)++;
+  if (n == 0)
+    return 0;
 
-	  /* (See comment before the clear_bit above) */
-	  if (modified_global_blocks)
-	    {
-	      pthread_spin_lock (&modified_global_blocks_lock);
-	      clear_bit (tmp + k, modified_global_blocks);
-	      pthread_spin_unlock (&modified_global_blocks_lock);
-	    }
-	}
-      gdp->bg_free_blocks_count -= *prealloc_count;
-      sblock->s_free_blocks_count -= *prealloc_count;
-      ext2_debug ("preallocated a further %u bits", *prealloc_count);
-    }
-#endif
+  ext2_debug ("allocated %d blocks at %d:%d (%d free)",
+	      n, group, j, gdp->bg_free_blocks_count);
+
+  *count = n;
+  return block;
+}
 
-  j = tmp;
+/*
+ * ext2_new_blocks uses a goal block to assist allocation.  If the goal is
+ * free, or there is a free block within 32 blocks of the goal, that block
+ * is allocated.  Otherwise a forward search is made for a free block, first
+ * in the rest of the goal's block group, then in the other groups; within
+ * each group the search first looks for an entire free byte in the block
+ * bitmap, and then for any free bit if that fails.  When more than one
+ * block is wanted, the other groups are first searched for a run of free
+ * blocks long enough to satisfy the whole request.
+ *
+ * Every block group has its own lock, so allocations in different groups
+ * proceed in parallel; GLOBAL_LOCK is only taken to update the superblock.
+ */
+block_t
+ext2_new_blocks (block_t goal, block_t *count)
+{
+  block_t wanted = *count;
+  block_t result = 0;
+  int i, j, k, pass;
+
+  assert (wanted > 0);
+
+#ifdef XXX /* Auth check to use reserved blocks  */
+  if (sblock->s_free_blocks_count <= sblock->s_r_blocks_count &&
+      (!fsuser () && (sb->u.ext2_sb.s_resuid != current->fsuid) &&
+       (sb->u.ext2_sb.s_resgid == 0 ||
+	!in_group_p (sb->u.ext2_sb.s_resgid))))
+    return 0;
+#endif
 
-  record_global_poke (bh);
-  bh = NULL;
+  ext2_debug ("goal=%u, count=%u", goal, wanted);
 
-  if (j >= sblock->s_blocks_count)
+  if (goal < sblock->s_first_data_block || goal >= sblock->s_blocks_count)
+    goal = sblock->s_first_data_block;
+  i = (goal - sblock->s_first_data_block) / sblock->s_blocks_per_group;
+  j = (goal - sblock->s_first_data_block) % sblock->s_blocks_per_group;
+
+  /* First try the rest of the goal's group.  */
+  *count = wanted;
+  result = group_new_blocks (i, j, 1, 1, count);
+  if (! result)
+    ext2_debug ("bit not found near goal");
+
+  /* Now search the other groups, ending with the goal's group itself,
+     first for a run of the whole size wanted, then for any free block.  */
+  for (pass = (wanted > 1 ? 0 : 1); !result && pass < 2; pass++)
+    for (k = 1; !result && k <= groups_count; k++)
+      {
+	int group = (i + k) % groups_count;
+
+	/* Skip groups known to be unsuitable without taking their locks.  */
+	if (group_desc (group)->bg_free_blocks_count == 0
+	    || (pass == 0 && group_info (group)->max_free_run < wanted))
+	  continue;
+
+	*count = wanted;
+	result = group_new_blocks (group, 0, 0, pass == 0 ? wanted : 1, count);
+      }
+
+  if (! result)
     {
-      ext2_error ("block >= blocks count - block_group = %d, block=%d", i, j);
-      j = 0;
-      goto sync_out;
+      *count = 0;
+      return 0;
     }
 
-  ext2_debug ("allocating block %d; goal hits %d of %d",
-	      j, goal_hits, goal_attempts);
+  pthread_spin_lock (&global_lock);
+  sblock->s_free_blocks_count -= *count;
+  sblock_dirty = 1;
+  pthread_spin_unlock (&global_lock);
 
-  gdp->bg_free_blocks_count--;
-  disk_cache_block_ref_ptr (gdp);
-  record_global_poke (gdp);
+  alloc_sync (0);
 
-  sblock->s_free_blocks_count--;
-  sblock_dirty = 1;
+  return result;
+}
+
+/* Return the number of free blocks needed to honour RESERVED reserved
+   blocks, including an estimate of the indirect blocks mapping them.  */
+static inline block_t
+reservation_need (block_t reserved)
+{
+  return reserved ? reserved + reserved / addr_per_block + 3 : 0;
+}
+
+/* Reserve COUNT free blocks for delayed allocation, or return ENOSPC if
+   there are not enough free blocks not yet reserved.  */
+error_t
+ext2_reserve_blocks (block_t count)
+{
+  error_t err = 0;
 
- sync_out:
-  assert (bh == NULL);
+  pthread_spin_lock (&global_lock);
+  if (reservation_need (delalloc_reserved_blocks + count)
+      > sblock->s_free_blocks_count)
+    err = ENOSPC;
+  else
+    delalloc_reserved_blocks += count;
   pthread_spin_unlock (&global_lock);
-  alloc_sync (0);
 
-  return j;
+  return err;
+}
+
+/* Give back COUNT blocks reserved with ext2_reserve_blocks.  */
+void
+ext2_unreserve_blocks (block_t count)
+{
+  pthread_spin_lock (&global_lock);
+  assert (delalloc_reserved_blocks >= count);
+  delalloc_reserved_blocks -= count;
+  pthread_spin_unlock (&global_lock);
+}
+
+/* Return the number of free blocks not reserved for delayed allocation.  */
+block_t
+ext2_unreserved_free_blocks (void)
+{
+  block_t free, need;
+
+  pthread_spin_lock (&global_lock);
+  free = sblock->s_free_blocks_count;
+  need = reservation_need (delalloc_reserved_blocks);
+  pthread_spin_unlock (&global_lock);
+
+  return free > need ? free - need : 0;
 }
 
 unsigned long
@@ -398,8 +495,6 @@ ext2_count_free_blocks ()
   struct ext2_group_desc *gdp;
   int i;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -407,14 +502,17 @@ ext2_count_free_blocks ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_mutex_lock (&group_info (i)->lock);
       desc_count += gdp->bg_free_blocks_count;
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
       x = count_free (bh, block_size);
       disk_cache_block_deref (bh);
       printf ("group %d: stored = %d, counted = %lu",
 	      i, gdp->bg_free_blocks_count, x);
+      pthread_mutex_unlock (&group_info (i)->lock);
       bitmap_count += x;
     }
+  pthread_spin_lock (&global_lock);
   printf ("ext2_count_free_blocks: stored = %u, computed = %lu, %lu",
 	  sblock->s_free_blocks_count, desc_count, bitmap_count);
   pthread_spin_unlock (&global_lock);
@@ -440,8 +538,6 @@ ext2_check_blocks_bitmap ()
   struct ext2_group_desc *gdp;
   int i, j;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -470,6 +566,7 @@ ext2_check_blocks_bitmap ()
 	}
 
       gdp = group_desc (i);
+      pthread_mutex_lock (&group_info (i)->lock);
       desc_count += gdp->bg_free_blocks_count;
       bh = disk_cache_block_ref (gdp->bg_block_bitmap);
 
@@ -502,8 +599,10 @@ ext2_check_blocks_bitmap ()
 	ext2_error ("wrong free blocks count for group %d,"
 		    " stored = %d, counted = %lu",
 		    i, gdp->bg_free_blocks_count, x);
+      pthread_mutex_unlock (&group_info (i)->lock);
       bitmap_count += x;
     }
+  pthread_spin_lock (&global_lock);
   if (sblock->s_free_blocks_count != bitmap_count)
     ext2_error ("wrong free blocks count in super block,"
 		" stored = %lu, counted = %lu",
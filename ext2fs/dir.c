@@ -54,6 +54,14 @@ enum slot_status
      entry. */
   EXTEND,
 
+  /* For an indexed directory, this means that the leaf block where
+     the entry belongs is full and has to be split.  */
+  SPLIT,
+
+  /* This means that the directory is a full single block, and will be
+     given a hash tree index to hold the entry.  */
+  INDEX,
+
   /* For removal and rename, this means that this is the location
      of the entry found.  */
   HERE_TIS,
@@ -86,6 +94,14 @@ struct dirstat
   /* For stat COMPRESS, this is the number of bytes needed to be copied
      in order to undertake the compression. */
   size_t nbytes;
+
+  /* True if the directory's hash tree index was used for the lookup,
+     and is to be kept up to date.  */
+  int indexed;
+
+  /* For stat SPLIT, the leaf block to split and the hash of the name.  */
+  struct htree_path path;
+  uint32_t hash;
 };
 
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -102,6 +118,11 @@ dirscanblock (vm_address_t blockoff, struct node *dp, int idx,
 	      const char *name, size_t namelen, enum lookup_type type,
 	      struct dirstat *ds, ino_t *inum);
 
+static error_t
+dirscanindex (vm_address_t buf, struct node *dp, const char *name,
+	      size_t namelen, enum lookup_type type, struct dirstat *ds,
+	      ino_t *inum);
+
 
 #if 0				/* XXX unused for now */
 static const unsigned char ext2_file_type[EXT2_FT_MAX] =
@@ -174,6 +195,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
       ds->type = LOOKUP;
       ds->mapbuf = 0;
       ds->mapextent = 0;
+      ds->indexed = 0;
     }
   if (buf)
     {
@@ -190,8 +212,9 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
     return errno;
 
   buf = 0;
-  /* We allow extra space in case we have to do an EXTEND. */
-  buflen = round_page (dp->dn_stat.st_size + DIRBLKSIZ);
+  /* We allow extra space in case we have to do an EXTEND, or grow the
+     hash tree index. */
+  buflen = round_page (dp->dn_stat.st_size + HTREE_MAX_GROW * DIRBLKSIZ);
   err = vm_map (mach_task_self (),
 		&buf, buflen, 0, 1, memobj, 0, 0, prot, prot, 0);
   mach_port_deallocate (mach_task_self (), memobj);
@@ -202,6 +225,27 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 
   diskfs_set_node_atime (dp);
 
+  /* Use the hash tree index if there is one; if it turns out to be
+     unusable, fall back to scanning all of the directory.  "." and ".."
+     are only in the first block, and not in the index.  */
+  if (htree_indexed (dp))
+    {
+      if (namelen > 2 || name[0] != '.' || (namelen == 2 && name[1] != '.'))
+	{
+	  err = dirscanindex (buf, dp, name, namelen, type, ds, &inum);
+	  if (!err || err == ENOENT)
+	    goto scanned;
+	  if (err != EIO)
+	    {
+	      munmap ((caddr_t) buf, buflen);
+	      return err;
+	    }
+	}
+      else if (ds)
+	/* Changing "." or ".." leaves the index alone.  */
+	ds->indexed = 1;
+    }
+
   /* Start the lookup at DP->dn->dir_idx.  */
   idx = dp->dn->dir_idx;
   if (idx * DIRBLKSIZ > dp->dn_stat.st_size)
@@ -237,6 +281,7 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
 	}
     }
 
+ scanned:
   diskfs_set_node_atime (dp);
   if (diskfs_synchronous)
     diskfs_node_update (dp, 1);
@@ -325,6 +370,13 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
       ds->type = CREATE;
       ds->stat = EXTEND;
       ds->idx = dp->dn_stat.st_size / DIRBLKSIZ;
+
+      /* Index the directory instead, if we may.  */
+      if (htree_indexable (dp, buf))
+	{
+	  ds->stat = INDEX;
+	  ds->indexed = 1;
+	}
     }
 
   /* Return to the user; if we can't, release the reference
@@ -373,6 +425,63 @@ diskfs_lookup_hard (struct node *dp, const char *name, enum lookup_type type,
   return err ? : inum ? 0 : ENOENT;
 }
 
+/* Look up NAME (of length NAMELEN) in indexed directory DP, whose
+   contents are mapped at BUF, by scanning only the leaf blocks its hash
+   tree index leads to.  Args TYPE, DS, and INUM are as for dirscanblock.
+   Return EIO if the index is unusable.  */
+static error_t
+dirscanindex (vm_address_t buf, struct node *dp, const char *name,
+	      size_t namelen, enum lookup_type type, struct dirstat *ds,
+	      ino_t *inum)
+{
+  struct htree_path path, next;
+  uint32_t hash;
+  int idx;
+  error_t err;
+
+  err = htree_probe (dp, buf, name, namelen, &path, &hash);
+  if (err)
+    return err;
+
+  if (ds)
+    ds->indexed = 1;
+
+  /* Names with the same hash may spill over into the following leaf
+     blocks.  */
+  next = path;
+  do
+    {
+      idx = next.frames[next.levels - 1].at->block;
+      err = dirscanblock (buf + idx * DIRBLKSIZ, dp, idx, name, namelen,
+			  type, ds, inum);
+      if (err != ENOENT)
+	{
+	  if (!err)
+	    dp->dn->dir_idx = idx;
+	  return err;
+	}
+    }
+  while (htree_next_leaf (dp, buf, &next, hash));
+
+  if (ds && (type == CREATE || type == RENAME) && ds->stat == LOOKING)
+    {
+      if (htree_full (&path))
+	/* The index can't grow any more; have the directory extended,
+	   which drops the index.  */
+	ds->indexed = 0;
+      else
+	{
+	  /* Split the leaf block the new name belongs in.  */
+	  ds->type = CREATE;
+	  ds->stat = SPLIT;
+	  ds->path = path;
+	  ds->hash = hash;
+	}
+    }
+
+  return ENOENT;
+}
+
 /* Scan block at address BLKADDR (of node DP; block index IDX), for
    name NAME of length NAMELEN.  Args TYPE, DS are as for
    diskfs_lookup.  If found, set *INUM to the inode number, else
@@ -627,6 +736,26 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
       new->rec_len = DIRBLKSIZ;
       break;
 
+    case SPLIT:
+      err = htree_add (dp, ds->mapbuf, &ds->path, ds->hash, needed, cred,
+		       &new);
+      if (err)
+	{
+	  munmap ((caddr_t) ds->mapbuf, ds->mapextent);
+	  return err;
+	}
+      break;
+
+    case INDEX:
+      err = htree_make_index (dp, ds->mapbuf, name, namelen, needed, cred,
+			      &new);
+      if (err)
+	{
+	  munmap ((caddr_t) ds->mapbuf, ds->mapextent);
+	  return err;
+	}
+      break;
+
     default:
       new = 0;
       assert (! "impossible: bogus status field in dirstat");
@@ -652,13 +781,21 @@ diskfs_direnter_hard (struct node *dp, const char *name, struct node *np,
   new->name_len = namelen;
   memcpy (new->name, name, namelen);
 
-  /* Mark the directory inode has having been written.  */
-  dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
+  /* Mark the directory inode has having been written, which makes an
+     index we haven't kept up to date invalid.  */
+  if (! ds->indexed)
+    dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
   dp->dn_set_mtime = 1;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
-  if (ds->stat != EXTEND)
+  if (ds->stat == SPLIT || ds->stat == INDEX)
+    {
+      /* Entries have moved between blocks, so forget the counts.  */
+      free (dp->dn->dirents);
+      dp->dn->dirents = 0;
+    }
+  else if (ds->stat != EXTEND)
     {
       /* If we are keeping count of this block, then keep the count up
 	 to date. */
@@ -720,7 +857,8 @@ diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
     }
 
   dp->dn_set_mtime = 1;
-  dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
+  if (! ds->indexed)
+    dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -751,7 +889,8 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np, struct dirstat *ds)
 
   ds->entry->inode = np->cache_id;
   dp->dn_set_mtime = 1;
-  dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
+  if (! ds->indexed)
+    dp->dn->info.i_flags &= ~EXT2_BTREE_FL;
 
   munmap ((caddr_t) ds->mapbuf, ds->mapextent);
 
@@ -198,6 +198,7 @@ struct ext2_group_desc
 #define EXT2_ECOMPR_FL			0x00000800 /* Compression error */
 /* End compression flags --- maybe not all used */
 #define EXT2_BTREE_FL			0x00001000 /* btree format dir */
+#define EXT2_INDEX_FL			EXT2_BTREE_FL /* hash-indexed directory */
 #define EXT2_RESERVED_FL		0x80000000 /* reserved for ext2 lib */
 
 #define EXT2_FL_USER_VISIBLE		0x00001FFF /* User visible flags */
@@ -418,9 +419,36 @@ struct ext2_super_block {
 	__u8	s_prealloc_blocks;	/* Nr of blocks to try to preallocate*/
 	__u8	s_prealloc_dir_blocks;	/* Nr to preallocate for dirs */
 	__u16	s_padding1;
-	__u32	s_reserved[204];	/* Padding to the end of the block */
+	/*
+	 * Journaling support valid if EXT3_FEATURE_COMPAT_HAS_JOURNAL set.
+	 */
+	__u8	s_journal_uuid[16];	/* uuid of journal superblock */
+	__u32	s_journal_inum;		/* inode number of journal file */
+	__u32	s_journal_dev;		/* device number of journal file */
+	__u32	s_last_orphan;		/* start of list of inodes to delete */
+	__u32	s_hash_seed[4];		/* HTREE hash seed */
+	__u8	s_def_hash_version;	/* Default hash version to use */
+	__u8	s_reserved_char_pad;
+	__u16	s_reserved_word_pad;
+	__u32	s_default_mount_opts;
+	__u32	s_first_meta_bg;	/* First metablock block group */
+	__u32	s_mkfs_time;		/* When the filesystem was created */
+	__u32	s_jnl_blocks[17];	/* Backup of the journal inode */
+	__u32	s_blocks_count_hi;	/* Blocks count high 32 bits */
+	__u32	s_r_blocks_count_hi;	/* Reserved blocks count high 32 bits*/
+	__u32	s_free_blocks_hi;	/* Free blocks count high 32 bits */
+	__u16	s_min_extra_isize;	/* All inodes have at least # bytes */
+	__u16	s_want_extra_isize;	/* New inodes should reserve # bytes */
+	__u32	s_flags;		/* Miscellaneous flags */
+	__u32	s_reserved[167];	/* Padding to the end of the block */
 };
 
+/*
+ * Miscellaneous superblock flags (s_flags)
+ */
+#define EXT2_FLAGS_SIGNED_HASH		0x0001	/* Signed dirhash in use */
+#define EXT2_FLAGS_UNSIGNED_HASH	0x0002	/* Unsigned dirhash in use */
+
 #ifdef __KERNEL__
 #define EXT2_SB(sb)	(&((sb)->u.ext2_sb))
 #else
@@ -462,6 +490,7 @@ struct ext2_super_block {
 	( EXT2_SB(sb)->s_feature_incompat & (mask) )
 
 #define EXT2_FEATURE_COMPAT_DIR_PREALLOC	0x0001
+#define EXT2_FEATURE_COMPAT_DIR_INDEX		0x0020
 
 #define EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER	0x0001
 #define EXT2_FEATURE_RO_COMPAT_LARGE_FILE	0x0002
@@ -470,7 +499,7 @@ struct ext2_super_block {
 #define EXT2_FEATURE_INCOMPAT_COMPRESSION	0x0001
 #define EXT2_FEATURE_INCOMPAT_FILETYPE		0x0002
 
-#define EXT2_FEATURE_COMPAT_SUPP	0
+#define EXT2_FEATURE_COMPAT_SUPP	EXT2_FEATURE_COMPAT_DIR_INDEX
 #define EXT2_FEATURE_INCOMPAT_SUPP	EXT2_FEATURE_INCOMPAT_FILETYPE
 #define EXT2_FEATURE_RO_COMPAT_SUPP	(EXT2_FEATURE_RO_COMPAT_SPARSE_SUPER| \
 					 EXT2_FEATURE_RO_COMPAT_LARGE_FILE| \
@@ -533,6 +562,44 @@ struct ext2_dir_entry_2 {
 #define EXT2_DIR_REC_LEN(name_len)	(((name_len) + 8 + EXT2_DIR_ROUND) & \
 					 ~EXT2_DIR_ROUND)
 
+/*
+ * Hash tree directory indexing (EXT2_INDEX_FL).  The first block of an
+ * indexed directory holds "." and "..", whose rec_len covers the rest
+ * of the block, followed by the root of the index.  Interior index
+ * blocks look like a single empty directory entry covering the whole
+ * block.  Either way, the index is invisible to a linear scan.
+ */
+#define DX_HASH_LEGACY		0
+#define DX_HASH_HALF_MD4	1
+#define DX_HASH_TEA		2
+#define DX_HASH_LEGACY_UNSIGNED	3
+#define DX_HASH_HALF_MD4_UNSIGNED	4
+#define DX_HASH_TEA_UNSIGNED	5
+
+/* The deepest index supported: the root plus one level of nodes.  */
+#define EXT2_HTREE_LEVELS	2
+
+struct ext2_dx_root_info {
+	__u32	reserved_zero;
+	__u8	hash_version;
+	__u8	info_length;		/* 8 */
+	__u8	indirect_levels;
+	__u8	unused_flags;
+};
+
+/* The first entry of every index block overlays this header; its
+   hash is implicitly zero.  */
+struct ext2_dx_countlimit {
+	__u16	limit;
+	__u16	count;
+};
+
+struct ext2_dx_entry {
+	__u32	hash;			/* Lowest hash in the block, low bit
+					   set if it continues the previous */
+	__u32	block;			/* Logical block in the directory */
+};
+
 #ifdef __KERNEL__
 /*
  * Function prototypes
@@ -60,6 +60,11 @@ char *diskfs_disk_name;
 int ext2_debug_flag;
 #endif
 
+#define OPT_DELAYED_ALLOCATION		700
+#define OPT_NO_DELAYED_ALLOCATION	701
+#define OPT_DISK_CACHE_SIZE		702
+#define OPT_DISK_CACHE_MAX_SIZE		703
+
 /* Ext2fs-specific options.  */
 static const struct argp_option
 options[] =
@@ -71,6 +76,15 @@ options[] =
   },
   {"sblock", 'S', "BLOCKNO", 0,
    "Use alternate superblock location (1kb blocks)"},
+  {"delayed-allocation", OPT_DELAYED_ALLOCATION, 0, 0,
+   "Choose the disk blocks of file data only when it is written out"},
+  {"no-delayed-allocation", OPT_NO_DELAYED_ALLOCATION, 0, 0,
+   "Allocate disk blocks as soon as file data becomes writable (default)"},
+  {"disk-cache-size", OPT_DISK_CACHE_SIZE, "BLOCKS", 0,
+   "Cache at most BLOCKS metadata blocks in memory"},
+  {"disk-cache-max-size", OPT_DISK_CACHE_MAX_SIZE, "BLOCKS", 0,
+   "Allow the disk cache to be grown to BLOCKS blocks at run time"
+   " (default: its initial size)"},
   {0}
 };
 
@@ -84,6 +98,9 @@ parse_opt (int key, char *arg, struct argp_state *state)
   {
     int debug_flag;
     unsigned int sb_block;
+    int delayed_allocation;
+    int disk_cache_size;
+    int disk_cache_max_size;
   } *values = state->hook;
 
   switch (key)
@@ -99,6 +116,30 @@ parse_opt (int key, char *arg, struct argp_state *state)
 	  return EINVAL;
 	}
       break;
+    case OPT_DELAYED_ALLOCATION:
+      values->delayed_allocation = 1;
+      break;
+    case OPT_NO_DELAYED_ALLOCATION:
+      values->delayed_allocation = 0;
+      break;
+    case OPT_DISK_CACHE_SIZE:
+      values->disk_cache_size = strtol (arg, &arg, 0);
+      if (!arg || *arg != '\0'
+	  || values->disk_cache_size < DISK_CACHE_MIN_BLOCKS)
+	{
+	  argp_error (state, "invalid number for --disk-cache-size");
+	  return EINVAL;
+	}
+      break;
+    case OPT_DISK_CACHE_MAX_SIZE:
+      values->disk_cache_max_size = strtol (arg, &arg, 0);
+      if (!arg || *arg != '\0'
+	  || values->disk_cache_max_size < DISK_CACHE_MIN_BLOCKS)
+	{
+	  argp_error (state, "invalid number for --disk-cache-max-size");
+	  return EINVAL;
+	}
+      break;
 
     case ARGP_KEY_INIT:
       state->child_inputs[0] = state->input;
@@ -108,6 +149,7 @@ parse_opt (int key, char *arg, struct argp_state *state)
       state->hook = values;
       memset (values, 0, sizeof *values);
       values->sb_block = SBLOCK_BLOCK;
+      values->delayed_allocation = -1;
       break;
 
     case ARGP_KEY_SUCCESS:
@@ -122,6 +164,38 @@ parse_opt (int key, char *arg, struct argp_state *state)
 #endif
 	}
 
+      if (values->delayed_allocation >= 0)
+	ext2_delayed_allocation = values->delayed_allocation;
+
+      if (values->disk_cache_max_size)
+	{
+	  if (! disk_cache)
+	    disk_cache_max_blocks = values->disk_cache_max_size;
+	  else if (values->disk_cache_max_size != disk_cache_max_blocks)
+	    {
+	      argp_error (state, "--disk-cache-max-size can only be set"
+			  " at startup");
+	      return EINVAL;
+	    }
+	}
+
+      if (values->disk_cache_size)
+	{
+	  if (disk_cache)
+	    {
+	      /* The disk cache is already set up, resize it.  */
+	      error_t err = disk_cache_set_size (values->disk_cache_size);
+	      if (err)
+		{
+		  argp_error (state, "cannot resize the disk cache to %d blocks",
+			      values->disk_cache_size);
+		  return err;
+		}
+	    }
+	  else
+	    disk_cache_blocks = values->disk_cache_size;
+	}
+
       break;
 
     default:
@@ -143,12 +217,36 @@ diskfs_append_args (char **argz, size_t *argz_len)
   if (!err && ext2_debug_flag)
     err = argz_add (argz, argz_len, "--debug");
 #endif
+  if (!err && ext2_delayed_allocation)
+    err = argz_add (argz, argz_len, "--delayed-allocation");
+  if (!err && disk_cache_blocks != DISK_CACHE_BLOCKS)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--disk-cache-size=%d", disk_cache_blocks);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && disk_cache_max_blocks != disk_cache_blocks)
+    {
+      char buf[40];
+      snprintf (buf, sizeof buf, "--disk-cache-max-size=%d",
+		disk_cache_max_blocks);
+      err = argz_add (argz, argz_len, buf);
+    }
   if (! err)
     err = store_parsed_append_args (store_parsed, argz, argz_len);
 
   return err;
 }
 
+/* Override the standard diskfs routine so we can add our own statistics.  */
+void
+diskfs_print_stats (FILE *stream)
+{
+  diskfs_print_std_stats (stream);
+  if (disk_cache)
+    disk_cache_print_stats (stream);
+}
+
 /* Add our startup arguments to the standard diskfs set.  */
 static const struct argp_child startup_children[] =
   {{&diskfs_store_startup_argp}, {0}};
@@ -185,8 +283,6 @@ main (int argc, char **argv)
 
   map_hypermetadata ();
 
-  inode_init ();
-
   /* Set diskfs_root_node to the root inode. */
   err = diskfs_cached_lookup (EXT2_ROOT_INO, &diskfs_root_node);
   if (err)
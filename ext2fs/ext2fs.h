@@ -25,6 +25,7 @@
 #include <hurd/iohelp.h>
 #include <hurd/store.h>
 #include <hurd/diskfs.h>
+#include <hurd/diskfs-pager.h>
 #include <hurd/ihash.h>
 #include <assert.h>
 #include <pthread.h>
@@ -153,18 +154,52 @@ clear_bit (unsigned num, char *bitmap)
 /* ---------------------------------------------------------------- */
 
 /* ext2fs specific per-file data.  */
+/* A run of COUNT blocks of a file starting at block BLOCK, which are
+   stored in consecutive disk blocks starting at DISK_BLOCK, or are all
+   unallocated if DISK_BLOCK is 0.  */
+struct block_run
+{
+  block_t block;
+  block_t disk_block;
+  block_t count;
+};
+
+/* The number of block runs cached per node.  */
+#define BLOCK_RUN_CACHE_SIZE 4
+
 struct disknode
 {
   /* For a directory, this array holds the number of directory entries in
      each DIRBLKSIZE piece of the directory. */
   int *dirents;
 
-  /* Links on hash list. */
-  struct node *hnext, **hprevp;
-
   /* Lock to lock while fiddling with this inode's block allocation info.  */
   pthread_rwlock_t alloc_lock;
 
+  /* Recently looked up runs of the block mapping, see ext2_getblk_run.
+     Runs with a COUNT of 0 are unused.  BLOCK_RUNS_LOCK protects them
+     against concurrent lookups; changing the block mapping requires
+     ALLOC_LOCK to be held for writing.  */
+  pthread_spinlock_t block_runs_lock;
+  struct block_run block_runs[BLOCK_RUN_CACHE_SIZE];
+  int block_runs_next;
+
+  /* The number of blocks to preallocate when the preallocation window
+     of a regular file runs out; grows while the file is written
+     sequentially, see ext2_alloc_block.  0 means the default.  */
+  block_t prealloc_window;
+
+  /* Blocks of the file that have space reserved for them by delayed
+     allocation, but no disk blocks yet, as sorted runs with a DISK_BLOCK
+     of 0; see ext2_reserve_block.  DELALLOC_BLOCKS is the total number
+     of such blocks.  All of these are protected by ALLOC_LOCK.  */
+  struct block_run *delalloc_runs;
+  int delalloc_nruns, delalloc_runs_alloced;
+  block_t delalloc_blocks;
+
+  /* True while reserved blocks are being given disk blocks.  */
+  int delalloc_allocating;
+
   /* Where changes to our indirect blocks are added.  */
   struct pokel indir_pokel;
 
@@ -192,14 +227,19 @@ struct user_pager_info
     } type;
   struct node *node;
   vm_prot_t max_prot;
+
+  /* Sequential read ahead state of a FILE_DATA pager.  */
+  struct diskfs_readahead readahead;
 };
 
 /* ---------------------------------------------------------------- */
 /* pager.c */
 
+/* The default number of blocks in the disk cache.  */
 #define DISK_CACHE_BLOCKS	65536
 
-#include <hurd/diskfs-pager.h>
+/* The disk cache can't be shrunk below this many blocks.  */
+#define DISK_CACHE_MIN_BLOCKS	256
 
 /* Set up the disk pager.  */
 void create_disk_pager (void);
@@ -214,6 +254,10 @@ void allow_pager_softrefs (struct node *node);
 
 /* Invalidate any pager data associated with NODE.  */
 void flush_node_pager (struct node *node);
+
+/* If true, the disk blocks of regular files are only chosen when their
+   pages are written out, and just reserved when they become writable.  */
+int ext2_delayed_allocation;
 
 /* ---------------------------------------------------------------- */
 
@@ -222,15 +266,23 @@ extern struct store *store;
 /* What the user specified.  */
 extern struct store_parsed *store_parsed;
 
-/* Mapped image of cached blocks of the disk.  */
+/* Mapped image of cached blocks of the disk.  DISK_CACHE_SIZE is the size
+   of the mapping, which has room for disk_cache_max_blocks blocks, of which
+   the first disk_cache_blocks are in use.  The cache can be resized at run
+   time up to disk_cache_max_blocks, which is set by --disk-cache-max-size
+   and fixed when the cache is created, as address space for that many
+   blocks is reserved then.  */
 extern void *disk_cache;
 extern store_offset_t disk_cache_size;
 extern int disk_cache_blocks;
+extern int disk_cache_max_blocks;
 
 #define DC_INCORE	0x01	/* Not in core.  */
 #define DC_UNTOUCHED	0x02	/* Not touched by disk_pager_read_paged
 				   or disk_cache_block_ref.  */
 #define DC_FIXED	0x04	/* Must not be re-associated.  */
+#define DC_RECENT	0x08	/* Referenced since the clock hand last
+				   passed.  */
 
 /* Flags that forbid re-association of page.  DC_UNTOUCHED is included
    because this flag is used only when page is already to be
@@ -269,6 +321,13 @@ void disk_cache_block_ref_ptr (void *ptr);
 void disk_cache_block_deref (void *ptr);
 int disk_cache_block_is_ref (block_t block);
 
+/* Make the disk cache use BLOCKS blocks.  Return EINVAL if BLOCKS is out
+   of range.  */
+error_t disk_cache_set_size (int blocks);
+
+/* Print the statistics of the disk cache to STREAM.  */
+void disk_cache_print_stats (FILE *stream);
+
 /* Our in-core copy of the super-block (pointer into the disk_cache).  */
 struct ext2_super_block *sblock;
 /* True if sblock has been modified.  */
@@ -386,6 +445,30 @@ bptr_offs (void *ptr)
 #define group_desc(num)	(&group_desc_image[num])
 struct ext2_group_desc *group_desc_image;
 
+/* In-core allocation state of a block group.  */
+struct ext2_group_info
+{
+  /* Lock to lock while changing the group's block or inode bitmap or its
+     descriptor.  This is a mutex rather than a spin lock because the
+     bitmaps may have to be read from disk while it is held.  */
+  pthread_mutex_t lock;
+
+  /* No block before this bit of the block bitmap is free.  */
+  unsigned int first_free_block;
+
+  /* No inode before this bit of the inode bitmap is free.  */
+  unsigned int first_free_inode;
+
+  /* No run of free blocks in the group is longer than this.  It is
+     lowered whenever a search through the whole group fails to find a
+     long enough run, and reset when blocks of the group are freed.  */
+  unsigned int max_free_run;
+} __attribute__ ((aligned (64)));
+
+/* The allocation state of block group NUM.  */
+#define group_info(num) (&group_info_image[num])
+struct ext2_group_info *group_info_image;
+
 #define inode_group_num(inum) (((inum) - 1) / sblock->s_inodes_per_group)
 
 extern struct ext2_inode *dino (ino_t inum);
@@ -423,13 +506,13 @@ void write_all_disknodes ();
 /* Lookup node INUM (which must have a reference already) and return it
    without allocating any new references. */
 struct node *ifind (ino_t inum);
-
-void inode_init (void);
 
 /* ---------------------------------------------------------------- */
 
-/* What to lock if changing global data data (e.g., the superblock or block
-   group descriptors or bitmaps).  */
+/* What to lock if changing global data (e.g., the free counts in the
+   superblock).  The bitmaps and descriptor of a block group are protected
+   by the group's own lock instead, see struct ext2_group_info; if both are
+   needed, the group lock must be taken first.  */
 pthread_spinlock_t global_lock;
 
 /* Where to record such changes.  */
@@ -541,11 +624,134 @@ void ext2_discard_prealloc (struct node *node);
    otherwise EINVAL is returned.  */
 error_t ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block);
 
-block_t ext2_new_block (block_t goal,
-			block_t prealloc_goal,
-			block_t *prealloc_count, block_t *prealloc_block);
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE, or
+   0 if there is none, and in COUNT the number of blocks starting at BLOCK
+   that are stored in consecutive disk blocks (or are all unallocated).
+   NODE's alloc_lock must be held.  The result is cached in NODE until
+   the block mapping changes.  */
+error_t ext2_getblk_run (struct node *node, block_t block,
+			 block_t *disk_block, block_t *count);
+
+/* Forget the block runs cached for NODE.  This must be called whenever
+   NODE's block mapping changes.  */
+void ext2_flush_block_runs (struct node *node);
+
+/* Reserve space for BLOCK of NODE, which has no disk block, so that one
+   can be allocated for it when it is written out.  NODE's alloc_lock must
+   be held for writing.  */
+error_t ext2_reserve_block (struct node *node, block_t block);
+
+/* Return true if any of the COUNT blocks of NODE starting at BLOCK only
+   has space reserved for it.  NODE's alloc_lock must be held.  */
+int ext2_delalloc_pending (struct node *node, block_t block, block_t count);
+
+/* Allocate disk blocks for the reserved blocks of NODE in all the runs of
+   reserved blocks that overlap the COUNT blocks starting at BLOCK, each run
+   as one extent if possible.  NODE's alloc_lock must be held for
+   writing.  */
+error_t ext2_delalloc_allocate (struct node *node, block_t block,
+				block_t count);
+
+/* Drop the reservations for the blocks of NODE from BLOCK on.  NODE's
+   alloc_lock must be held for writing.  */
+void ext2_delalloc_release (struct node *node, block_t block);
+
+/* ---------------------------------------------------------------- */
+/* balloc.c */
+
+/* The most blocks ext2_alloc_block preallocates for a file at a time.  */
+#define EXT2_MAX_PREALLOC_BLOCKS 256
+
+/* Allocate up to *COUNT consecutive blocks, the first one as close to
+   block GOAL as possible, and return the first one, or 0 if none could
+   be had.  *COUNT is set to the number of blocks actually allocated,
+   which may be less than asked for.  */
+block_t ext2_new_blocks (block_t goal, block_t *count);
 
 void ext2_free_blocks (block_t block, unsigned long count);
+
+/* The number of free blocks promised to delayed allocations.  Protected
+   by GLOBAL_LOCK.  */
+block_t delalloc_reserved_blocks;
+
+/* Reserve COUNT free blocks for delayed allocation, or return ENOSPC if
+   there are not enough free blocks not yet reserved.  */
+error_t ext2_reserve_blocks (block_t count);
+
+/* Give back COUNT blocks reserved with ext2_reserve_blocks.  */
+void ext2_unreserve_blocks (block_t count);
+
+/* Return the number of free blocks not reserved for delayed allocation.  */
+block_t ext2_unreserved_free_blocks (void);
+
+/* Set up the in-core allocation state of the block groups, see struct
+   ext2_group_info.  */
+void ext2_init_group_info (void);
+
+/* ---------------------------------------------------------------- */
+/* htree.c */
+
+/* The path from the root of a directory's hash tree index down to a
+   leaf block.  All the pointers are into a mapping of the directory.  */
+struct htree_path
+{
+  /* The number of index blocks on the path.  */
+  int levels;
+
+  /* The hash function the index uses.  */
+  int hash_version;
+
+  struct htree_frame
+  {
+    /* The entries of the index block.  The first one is overlaid by
+       a struct ext2_dx_countlimit.  */
+    struct ext2_dx_entry *entries;
+
+    /* The entry that was followed.  */
+    struct ext2_dx_entry *at;
+  } frames[EXT2_HTREE_LEVELS];
+};
+
+/* The largest number of blocks adding an entry to an indexed directory
+   appends to it.  */
+#define HTREE_MAX_GROW 3
+
+/* Return true if directory DP has a hash tree index we can use.  */
+int htree_indexed (struct node *dp);
+
+/* Return true if directory DP, whose contents are mapped at BUF, should
+   get a hash tree index now that it needs to grow past one block.  */
+int htree_indexable (struct node *dp, vm_address_t buf);
+
+/* Find the leaf block of indexed directory DP, whose contents are mapped
+   at BUF, that NAME of length NAMELEN belongs in.  Fill in PATH, and the
+   hash of the name in *HASH.  Return EIO if the index is corrupt.  */
+error_t htree_probe (struct node *dp, vm_address_t buf, const char *name,
+		     size_t namelen, struct htree_path *path, uint32_t *hash);
+
+/* Advance PATH, as filled in by htree_probe for a name with hash HASH,
+   to the next leaf block if that might also hold names with HASH.
+   Return false if there is no such block.  */
+int htree_next_leaf (struct node *dp, vm_address_t buf,
+		     struct htree_path *path, uint32_t hash);
+
+/* Return true if no more leaf blocks can be added under PATH.  */
+int htree_full (struct htree_path *path);
+
+/* Make room for a new entry of NEEDED bytes for a name with hash HASH
+   in indexed directory DP, whose contents are mapped at BUF with room
+   for HTREE_MAX_GROW more blocks, by splitting the full leaf block PATH
+   leads to.  Set *NEW to the slot to use, with its rec_len filled in.  */
+error_t htree_add (struct node *dp, vm_address_t buf,
+		   struct htree_path *path, uint32_t hash, size_t needed,
+		   struct protid *cred, struct ext2_dir_entry_2 **new);
+
+/* Convert the full one-block directory DP, mapped at BUF as for
+   htree_add, to an indexed directory and make room for a new entry of
+   NEEDED bytes for NAME of length NAMELEN.  Set *NEW as for htree_add.  */
+error_t htree_make_index (struct node *dp, vm_address_t buf,
+			  const char *name, size_t namelen, size_t needed,
+			  struct protid *cred, struct ext2_dir_entry_2 **new);
 
 /* ---------------------------------------------------------------- */
 
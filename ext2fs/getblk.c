@@ -41,8 +41,8 @@
 /*
  * ext2_discard_prealloc and ext2_alloc_block are atomic wrt. the
  * superblock in the same manner as are ext2_free_blocks and
- * ext2_new_block.  We just wait on the super rather than locking it
- * here, since ext2_new_block will do the necessary locking and we
+ * ext2_new_blocks.  We just wait on the super rather than locking it
+ * here, since ext2_new_blocks will do the necessary locking and we
  * can't block until then.
  */
 void
@@ -60,6 +60,24 @@ ext2_discard_prealloc (struct node *node)
 #endif
 }
 
+/* Allocate up to *COUNT consecutive blocks for NODE as close to block GOAL
+   as possible, like ext2_new_blocks, but don't touch the free blocks
+   promised to delayed allocations unless those are being allocated.  */
+static block_t
+new_blocks (struct node *node, block_t goal, block_t *count)
+{
+  if (! node->dn->delalloc_allocating && delalloc_reserved_blocks)
+    {
+      block_t avail = ext2_unreserved_free_blocks ();
+      if (avail == 0)
+	return 0;
+      if (*count > avail)
+	*count = avail;
+    }
+
+  return ext2_new_blocks (goal, count);
+}
+
 /* Allocate a new block for the file NODE, as close to block GOAL as
    possible, and return it, or 0 if none could be had.  If ZERO is true, then
    zero the block (and add it to NODE's list of modified indirect blocks).  */
@@ -70,6 +88,7 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
   static unsigned long alloc_hits = 0, alloc_attempts = 0;
 #endif
   block_t result;
+  block_t count = 1;
 
 #ifdef EXT2_PREALLOCATE
   if (node->dn->info.i_prealloc_count &&
@@ -85,21 +104,45 @@ ext2_alloc_block (struct node *node, block_t goal, int zero)
     {
       ext2_debug ("preallocation miss (%lu/%lu)",
 		  alloc_hits, ++alloc_attempts);
+
+      if (S_ISREG (node->dn_stat.st_mode))
+	{
+	  block_t window =
+	    sblock->s_prealloc_blocks ?: EXT2_DEFAULT_PREALLOC_BLOCKS;
+
+	  /* If the last preallocation window was used up and the file is
+	     still being extended right after it, the file is being written
+	     sequentially: preallocate twice as much this time, so a large
+	     file gets large extents even with other files being written
+	     at the same time.  */
+	  if (node->dn->prealloc_window
+	      && node->dn->info.i_prealloc_count == 0
+	      && (goal == node->dn->info.i_prealloc_block
+		  || goal + 1 == node->dn->info.i_prealloc_block))
+	    {
+	      window = node->dn->prealloc_window * 2;
+	      if (window > EXT2_MAX_PREALLOC_BLOCKS)
+		window = EXT2_MAX_PREALLOC_BLOCKS;
+	    }
+	  node->dn->prealloc_window = window;
+	  count += window;
+	}
+      else if (S_ISDIR (node->dn_stat.st_mode)
+	       && EXT2_HAS_COMPAT_FEATURE(sblock,
+					  EXT2_FEATURE_COMPAT_DIR_PREALLOC))
+	count += sblock->s_prealloc_dir_blocks;
+
       ext2_discard_prealloc (node);
-      result = ext2_new_block
-	(goal,
-	 S_ISREG (node->dn_stat.st_mode)
-	 ? (sblock->s_prealloc_blocks ?: EXT2_DEFAULT_PREALLOC_BLOCKS)
-	 : (S_ISDIR (node->dn_stat.st_mode)
-	    && EXT2_HAS_COMPAT_FEATURE(sblock,
-				       EXT2_FEATURE_COMPAT_DIR_PREALLOC))
-	 ? sblock->s_prealloc_dir_blocks
-	 : 0,
-	 &node->dn->info.i_prealloc_count,
-	 &node->dn->info.i_prealloc_block);
+      result = new_blocks (node, goal, &count);
+      if (result)
+	{
+	  node->dn->info.i_prealloc_block = result + 1;
+	  node->dn->info.i_prealloc_count = count - 1;
+	  ext2_debug ("preallocated a further %u blocks", count - 1);
+	}
     }
 #else
-  result = ext2_new_block (goal, 0, 0);
+  result = new_blocks (node, goal, &count);
 #endif
 
   if (result && zero)
@@ -163,6 +206,7 @@ inode_getblk (struct node *node, int nr, int create, int zero,
     return ENOSPC;
 
   node->dn->info.i_data[nr] = *result;
+  ext2_flush_block_runs (node);
 
   node->dn->info.i_next_alloc_block = new_block;
   node->dn->info.i_next_alloc_goal = *result;
@@ -221,6 +265,7 @@ block_getblk (struct node *node, block_t block, int nr, int create, int zero,
     }
 
   bh[nr] = *result;
+  ext2_flush_block_runs (node);
 
   if (diskfs_synchronous || node->dn->info.i_osync)
     sync_global_ptr (bh, 1);
@@ -312,3 +357,345 @@ ext2_getblk (struct node *node, block_t block, int create, block_t *disk_block)
 
   return err;
 }
+
+/* Forget the block runs cached for NODE.  */
+void
+ext2_flush_block_runs (struct node *node)
+{
+  int i;
+
+  pthread_spin_lock (&node->dn->block_runs_lock);
+  for (i = 0; i < BLOCK_RUN_CACHE_SIZE; i++)
+    node->dn->block_runs[i].count = 0;
+  pthread_spin_unlock (&node->dn->block_runs_lock);
+}
+
+/* Look up BLOCK in the block runs cached for NODE.  */
+static int
+lookup_block_run (struct node *node, block_t block,
+		  block_t *disk_block, block_t *count)
+{
+  int i, found = 0;
+
+  pthread_spin_lock (&node->dn->block_runs_lock);
+  for (i = 0; i < BLOCK_RUN_CACHE_SIZE; i++)
+    {
+      struct block_run *run = &node->dn->block_runs[i];
+      block_t offs = block - run->block;
+
+      if (block >= run->block && offs < run->count)
+	{
+	  *disk_block = run->disk_block ? run->disk_block + offs : 0;
+	  *count = run->count - offs;
+	  found = 1;
+	  break;
+	}
+    }
+  pthread_spin_unlock (&node->dn->block_runs_lock);
+
+  return found;
+}
+
+/* Find the run starting at entry IDX of the block map MAP, which has
+   LEN entries.  */
+static void
+scan_block_map (block_t *map, block_t idx, block_t len,
+		block_t *disk_block, block_t *count)
+{
+  block_t first = map[idx], n = 1;
+
+  if (first)
+    while (idx + n < len && map[idx + n] == first + n)
+      n++;
+  else
+    while (idx + n < len && map[idx + n] == 0)
+      n++;
+
+  *disk_block = first;
+  *count = n;
+}
+
+/* Returns in DISK_BLOCK the disk block corresponding to BLOCK in NODE, or
+   0 if there is none, and in COUNT the number of blocks starting at BLOCK
+   that are stored in consecutive disk blocks (or are all unallocated).
+   Runs never cross the boundary of an indirect block.  */
+error_t
+ext2_getblk_run (struct node *node, block_t block,
+		 block_t *disk_block, block_t *count)
+{
+  block_t addr_per_block = EXT2_ADDR_PER_BLOCK (sblock);
+  block_t span, rel, indir;
+  int level;
+
+  if (lookup_block_run (node, block, disk_block, count))
+    return 0;
+
+  if (block < EXT2_NDIR_BLOCKS)
+    scan_block_map (node->dn->info.i_data, block, EXT2_NDIR_BLOCKS,
+		    disk_block, count);
+  else
+    {
+      /* Find the indirection level of BLOCK, the number of blocks SPAN
+	 the tree at that level maps, and the offset REL of BLOCK in it.  */
+      rel = block - EXT2_NDIR_BLOCKS;
+      span = addr_per_block;
+      for (level = 1; rel >= span; level++)
+	{
+	  if (level == 3)
+	    {
+	      ext2_warning ("block > big: %u", block);
+	      return EIO;
+	    }
+	  rel -= span;
+	  span *= addr_per_block;
+	}
+
+      indir = node->dn->info.i_data[EXT2_IND_BLOCK + level - 1];
+      for (;;)
+	{
+	  block_t *bh, idx;
+
+	  if (! indir)
+	    /* The rest of this subtree is unallocated.  */
+	    {
+	      *disk_block = 0;
+	      *count = span - rel;
+	      break;
+	    }
+
+	  span /= addr_per_block;
+	  idx = rel / span;
+	  rel %= span;
+
+	  bh = (block_t *) disk_cache_block_ref (indir);
+	  if (span == 1)
+	    {
+	      scan_block_map (bh, idx, addr_per_block, disk_block, count);
+	      disk_cache_block_deref (bh);
+	      break;
+	    }
+	  indir = bh[idx];
+	  disk_cache_block_deref (bh);
+	}
+    }
+
+  pthread_spin_lock (&node->dn->block_runs_lock);
+  node->dn->block_runs[node->dn->block_runs_next] =
+    (struct block_run) { block, *disk_block, *count };
+  node->dn->block_runs_next =
+    (node->dn->block_runs_next + 1) % BLOCK_RUN_CACHE_SIZE;
+  pthread_spin_unlock (&node->dn->block_runs_lock);
+
+  return 0;
+}
+
+/* Return the index of the first run of reserved blocks of NODE that ends
+   after BLOCK.  */
+static int
+find_reserved_run (struct disknode *dn, block_t block)
+{
+  int lo = 0, hi = dn->delalloc_nruns;
+
+  while (lo < hi)
+    {
+      int mid = (lo + hi) / 2;
+      struct block_run *run = &dn->delalloc_runs[mid];
+
+      if (run->block + run->count <= block)
+	lo = mid + 1;
+      else
+	hi = mid;
+    }
+
+  return lo;
+}
+
+/* Reserve space for BLOCK of NODE, which has no disk block, so that one
+   can be allocated for it when it is written out.  */
+error_t
+ext2_reserve_block (struct node *node, block_t block)
+{
+  struct disknode *dn = node->dn;
+  struct block_run *runs = dn->delalloc_runs;
+  int n = dn->delalloc_nruns;
+  int i = find_reserved_run (dn, block);
+  int left, right;
+  error_t err;
+
+  if (i < n && runs[i].block <= block)
+    /* Already reserved.  */
+    return 0;
+
+  left = (i > 0 && runs[i - 1].block + runs[i - 1].count == block);
+  right = (i < n && runs[i].block == block + 1);
+
+  if (!left && !right && n == dn->delalloc_runs_alloced)
+    {
+      int alloced = n ? 2 * n : 4;
+      runs = realloc (runs, alloced * sizeof *runs);
+      if (! runs)
+	return ENOMEM;
+      dn->delalloc_runs = runs;
+      dn->delalloc_runs_alloced = alloced;
+    }
+
+  err = ext2_reserve_blocks (1);
+  if (err)
+    return err;
+
+  if (left && right)
+    /* BLOCK joins two runs.  */
+    {
+      runs[i - 1].count += 1 + runs[i].count;
+      memmove (&runs[i], &runs[i + 1], (n - i - 1) * sizeof *runs);
+      dn->delalloc_nruns--;
+    }
+  else if (left)
+    runs[i - 1].count++;
+  else if (right)
+    {
+      runs[i].block--;
+      runs[i].count++;
+    }
+  else
+    {
+      memmove (&runs[i + 1], &runs[i], (n - i) * sizeof *runs);
+      runs[i].block = block;
+      runs[i].disk_block = 0;
+      runs[i].count = 1;
+      dn->delalloc_nruns++;
+    }
+  dn->delalloc_blocks++;
+
+  return 0;
+}
+
+/* Return true if any of the COUNT blocks of NODE starting at BLOCK only
+   has space reserved for it.  */
+int
+ext2_delalloc_pending (struct node *node, block_t block, block_t count)
+{
+  struct disknode *dn = node->dn;
+  int i;
+
+  if (dn->delalloc_nruns == 0)
+    return 0;
+
+  i = find_reserved_run (dn, block);
+  return i < dn->delalloc_nruns && dn->delalloc_runs[i].block < block + count;
+}
+
+/* Allocate disk blocks for the COUNT reserved blocks of NODE starting at
+   BLOCK, as one extent if possible.  Return the number of blocks that
+   got disk blocks in *DONE.  */
+static error_t
+allocate_reserved_run (struct node *node, block_t block, block_t count,
+		       block_t *done)
+{
+  error_t err = 0;
+  block_t goal, first, disk_block;
+  block_t want = count + count / addr_per_block + 1;
+
+  /* Continue right after the preceding block of the file if it has a
+     disk block.  */
+  if (block > 0 && ext2_getblk (node, block - 1, 0, &disk_block) == 0)
+    goal = disk_block + 1;
+  else
+    goal = (node->dn->info.i_block_group * EXT2_BLOCKS_PER_GROUP (sblock)
+	    + sblock->s_first_data_block);
+
+  node->dn->delalloc_allocating = 1;
+
+  /* Make the extent the preallocation window of NODE and arrange for
+     ext2_getblk to start using it at BLOCK, so that the blocks of the run
+     and the indirect blocks mapping them come out of it in order.  */
+  ext2_discard_prealloc (node);
+  first = ext2_new_blocks (goal, &want);
+  if (first)
+    {
+      node->dn->info.i_prealloc_block = first;
+      node->dn->info.i_prealloc_count = want;
+      node->dn->info.i_next_alloc_block = block;
+      node->dn->info.i_next_alloc_goal = first;
+    }
+
+  for (*done = 0; *done < count; (*done)++)
+    {
+      err = ext2_getblk (node, block + *done, 1, &disk_block);
+      if (err)
+	break;
+    }
+
+  node->dn->delalloc_allocating = 0;
+
+  return err;
+}
+
+/* Allocate disk blocks for the reserved blocks of NODE in all the runs of
+   reserved blocks that overlap the COUNT blocks starting at BLOCK.  The
+   whole runs are allocated, since they are most likely pages about to be
+   written out as well, and so get one extent each.  */
+error_t
+ext2_delalloc_allocate (struct node *node, block_t block, block_t count)
+{
+  struct disknode *dn = node->dn;
+  error_t err = 0;
+  int i;
+
+  while (!err
+	 && (i = find_reserved_run (dn, block)) < dn->delalloc_nruns
+	 && dn->delalloc_runs[i].block < block + count)
+    {
+      struct block_run run = dn->delalloc_runs[i];
+      block_t done;
+
+      memmove (&dn->delalloc_runs[i], &dn->delalloc_runs[i + 1],
+	       (dn->delalloc_nruns - i - 1) * sizeof run);
+      dn->delalloc_nruns--;
+
+      err = allocate_reserved_run (node, run.block, run.count, &done);
+
+      if (done < run.count)
+	/* Keep the reservation for the rest of the run.  */
+	{
+	  memmove (&dn->delalloc_runs[i + 1], &dn->delalloc_runs[i],
+		   (dn->delalloc_nruns - i) * sizeof run);
+	  dn->delalloc_runs[i].block = run.block + done;
+	  dn->delalloc_runs[i].disk_block = 0;
+	  dn->delalloc_runs[i].count = run.count - done;
+	  dn->delalloc_nruns++;
+	}
+
+      dn->delalloc_blocks -= done;
+      ext2_unreserve_blocks (done);
+    }
+
+  return err;
+}
+
+/* Drop the reservations for the blocks of NODE from BLOCK on.  */
+void
+ext2_delalloc_release (struct node *node, block_t block)
+{
+  struct disknode *dn = node->dn;
+  block_t released = 0;
+  int i, j;
+
+  i = find_reserved_run (dn, block);
+  if (i < dn->delalloc_nruns && dn->delalloc_runs[i].block < block)
+    {
+      struct block_run *run = &dn->delalloc_runs[i];
+      released += run->block + run->count - block;
+      run->count = block - run->block;
+      i++;
+    }
+  for (j = i; j < dn->delalloc_nruns; j++)
+    released += dn->delalloc_runs[j].count;
+  dn->delalloc_nruns = i;
+
+  if (released)
+    {
+      dn->delalloc_blocks -= released;
+      ext2_unreserve_blocks (released);
+    }
+}
@@ -0,0 +1,751 @@
+/* Hash tree directory indexes
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+/* This implements the `dir_index' directory format of Linux's ext3
+   and ext4: a directory block holding "." and ".." is followed by up
+   to two levels of index blocks that map the hash of a name to the
+   leaf block that holds it.  Leaf blocks are ordinary directory
+   blocks, so a linear scan of an indexed directory still works.  */
+
+#include "ext2fs.h"
+
+#include <string.h>
+#include <stdlib.h>
+
+/* The number of index entries that fit in the root block, whose root
+   info is INFO_LENGTH bytes long, and in an interior index block.  */
+#define ROOT_LIMIT(info_length) \
+  ((block_size - EXT2_DIR_REC_LEN (1) - EXT2_DIR_REC_LEN (2) \
+    - (info_length)) / sizeof (struct ext2_dx_entry))
+#define NODE_LIMIT \
+  ((block_size - EXT2_DIR_REC_LEN (0)) / sizeof (struct ext2_dx_entry))
+
+#define COUNTLIMIT(entries) ((struct ext2_dx_countlimit *) (entries))
+
+/* Hash functions.  These must give exactly the same results as the
+   ones in Linux and e2fsprogs.  */
+
+/* The original hash of the htree patches.  */
+static uint32_t
+dx_hack_hash (const char *name, size_t len, int unsigned_char)
+{
+  uint32_t hash, hash0 = 0x12a3fe2d, hash1 = 0x37abe8f9;
+  int c;
+
+  while (len--)
+    {
+      c = unsigned_char ? (int) *(const unsigned char *) name
+			: (int) *(const signed char *) name;
+      name++;
+      hash = hash1 + (hash0 ^ (c * 7152373));
+      if (hash & 0x80000000)
+	hash -= 0x7fffffff;
+      hash1 = hash0;
+      hash0 = hash;
+    }
+  return hash0 << 1;
+}
+
+/* Fill the NUM words at BUF from the LEN bytes of NAME, padding with
+   a function of the length.  */
+static void
+str2hashbuf (const char *name, size_t len, uint32_t *buf, int num,
+	     int unsigned_char)
+{
+  uint32_t pad, val;
+  int i, c;
+
+  pad = (uint32_t) len | ((uint32_t) len << 8);
+  pad |= pad << 16;
+
+  val = pad;
+  if (len > num * 4)
+    len = num * 4;
+  for (i = 0; i < len; i++)
+    {
+      c = unsigned_char ? (int) ((const unsigned char *) name)[i]
+			: (int) ((const signed char *) name)[i];
+      val = c + (val << 8);
+      if ((i % 4) == 3)
+	{
+	  *buf++ = val;
+	  val = pad;
+	  num--;
+	}
+    }
+  if (--num >= 0)
+    *buf++ = val;
+  while (--num >= 0)
+    *buf++ = pad;
+}
+
+#define F(x, y, z) ((z) ^ ((x) & ((y) ^ (z))))
+#define G(x, y, z) (((x) & (y)) + (((x) ^ (y)) & (z)))
+#define H(x, y, z) ((x) ^ (y) ^ (z))
+#define ROUND(f, a, b, c, d, x, s) \
+  (a += f (b, c, d) + (x), a = (a << (s)) | (a >> (32 - (s))))
+#define K1 0
+#define K2 013240474631UL
+#define K3 015666365641UL
+
+/* The basic cut-down MD4 transform.  */
+static void
+half_md4_transform (uint32_t buf[4], const uint32_t in[8])
+{
+  uint32_t a = buf[0], b = buf[1], c = buf[2], d = buf[3];
+
+  /* Round 1 */
+  ROUND (F, a, b, c, d, in[0] + K1,  3);
+  ROUND (F, d, a, b, c, in[1] + K1,  7);
+  ROUND (F, c, d, a, b, in[2] + K1, 11);
+  ROUND (F, b, c, d, a, in[3] + K1, 19);
+  ROUND (F, a, b, c, d, in[4] + K1,  3);
+  ROUND (F, d, a, b, c, in[5] + K1,  7);
+  ROUND (F, c, d, a, b, in[6] + K1, 11);
+  ROUND (F, b, c, d, a, in[7] + K1, 19);
+
+  /* Round 2 */
+  ROUND (G, a, b, c, d, in[1] + K2,  3);
+  ROUND (G, d, a, b, c, in[3] + K2,  5);
+  ROUND (G, c, d, a, b, in[5] + K2,  9);
+  ROUND (G, b, c, d, a, in[7] + K2, 13);
+  ROUND (G, a, b, c, d, in[0] + K2,  3);
+  ROUND (G, d, a, b, c, in[2] + K2,  5);
+  ROUND (G, c, d, a, b, in[4] + K2,  9);
+  ROUND (G, b, c, d, a, in[6] + K2, 13);
+
+  /* Round 3 */
+  ROUND (H, a, b, c, d, in[3] + K3,  3);
+  ROUND (H, d, a, b, c, in[7] + K3,  9);
+  ROUND (H, c, d, a, b, in[2] + K3, 11);
+  ROUND (H, b, c, d, a, in[6] + K3, 15);
+  ROUND (H, a, b, c, d, in[1] + K3,  3);
+  ROUND (H, d, a, b, c, in[5] + K3,  9);
+  ROUND (H, c, d, a, b, in[0] + K3, 11);
+  ROUND (H, b, c, d, a, in[4] + K3, 15);
+
+  buf[0] += a;
+  buf[1] += b;
+  buf[2] += c;
+  buf[3] += d;
+}
+
+/* The Tiny Encryption Algorithm.  */
+static void
+tea_transform (uint32_t buf[4], const uint32_t in[4])
+{
+  uint32_t sum = 0;
+  uint32_t b0 = buf[0], b1 = buf[1];
+  uint32_t a = in[0], b = in[1], c = in[2], d = in[3];
+  int n = 16;
+
+  do
+    {
+      sum += 0x9e3779b9;
+      b0 += ((b1 << 4) + a) ^ (b1 + sum) ^ ((b1 >> 5) + b);
+      b1 += ((b0 << 4) + c) ^ (b0 + sum) ^ ((b0 >> 5) + d);
+    }
+  while (--n);
+
+  buf[0] += b0;
+  buf[1] += b1;
+}
+
+/* Return the hash of the LEN bytes of NAME, computed with hash function
+   VERSION (one of the DX_HASH_* values).  The low bit of the result is
+   always clear.  */
+static uint32_t
+dirhash (const char *name, size_t len, int version)
+{
+  uint32_t buf[4], in[8], hash;
+  int unsigned_char = version >= DX_HASH_LEGACY_UNSIGNED;
+  int i;
+
+  buf[0] = 0x67452301;
+  buf[1] = 0xefcdab89;
+  buf[2] = 0x98badcfe;
+  buf[3] = 0x10325476;
+
+  for (i = 0; i < 4; i++)
+    if (sblock->s_hash_seed[i])
+      break;
+  if (i < 4)
+    memcpy (buf, sblock->s_hash_seed, sizeof buf);
+
+  switch (version)
+    {
+    case DX_HASH_HALF_MD4:
+    case DX_HASH_HALF_MD4_UNSIGNED:
+      for (; len > 0; len -= len < 32 ? len : 32, name += 32)
+	{
+	  str2hashbuf (name, len, in, 8, unsigned_char);
+	  half_md4_transform (buf, in);
+	}
+      hash = buf[1];
+      break;
+
+    case DX_HASH_TEA:
+    case DX_HASH_TEA_UNSIGNED:
+      for (; len > 0; len -= len < 16 ? len : 16, name += 16)
+	{
+	  str2hashbuf (name, len, in, 4, unsigned_char);
+	  tea_transform (buf, in);
+	}
+      hash = buf[0];
+      break;
+
+    default:
+      hash = dx_hack_hash (name, len, unsigned_char);
+      break;
+    }
+
+  hash &= ~1;
+  if (hash == (0x7fffffffU << 1))
+    hash = (0x7fffffffU - 1) << 1;
+  return hash;
+}
+
+/* Return the hash function used by a directory whose root info says
+   it uses VERSION.  */
+static int
+hash_version (int version)
+{
+  if (version <= DX_HASH_TEA
+      && (sblock->s_flags & EXT2_FLAGS_UNSIGNED_HASH))
+    version += DX_HASH_LEGACY_UNSIGNED;
+  return version;
+}
+
+/* Return the root info of the indexed directory whose first block is
+   at BUF.  */
+static inline struct ext2_dx_root_info *
+root_info (vm_address_t buf)
+{
+  return (struct ext2_dx_root_info *) (buf + EXT2_DIR_REC_LEN (1)
+				       + EXT2_DIR_REC_LEN (2));
+}
+
+int
+htree_indexed (struct node *dp)
+{
+  return (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX)
+	  && (dp->dn->info.i_flags & EXT2_INDEX_FL));
+}
+
+int
+htree_indexable (struct node *dp, vm_address_t buf)
+{
+  struct ext2_dir_entry_2 *dot = (struct ext2_dir_entry_2 *) buf;
+  struct ext2_dir_entry_2 *dotdot =
+    (struct ext2_dir_entry_2 *) (buf + EXT2_DIR_REC_LEN (1));
+
+  return (EXT2_HAS_COMPAT_FEATURE (sblock, EXT2_FEATURE_COMPAT_DIR_INDEX)
+	  && !(dp->dn->info.i_flags & EXT2_INDEX_FL)
+	  && dp->dn_stat.st_size == block_size
+	  && dot->rec_len == EXT2_DIR_REC_LEN (1)
+	  && dot->name_len == 1 && dot->name[0] == '.'
+	  && dotdot->rec_len >= EXT2_DIR_REC_LEN (2)
+	  && dotdot->name_len == 2
+	  && dotdot->name[0] == '.' && dotdot->name[1] == '.');
+}
+
+error_t
+htree_probe (struct node *dp, vm_address_t buf, const char *name,
+	     size_t namelen, struct htree_path *path, uint32_t *hash)
+{
+  struct ext2_dir_entry_2 *dot = (struct ext2_dir_entry_2 *) buf;
+  struct ext2_dir_entry_2 *dotdot =
+    (struct ext2_dir_entry_2 *) (buf + EXT2_DIR_REC_LEN (1));
+  struct ext2_dx_root_info *info = root_info (buf);
+  struct ext2_dx_entry *entries, *p, *q, *m;
+  block_t nblocks = dp->dn_stat.st_size / block_size;
+  size_t limit;
+  int level;
+
+  if (nblocks < 2
+      || dot->rec_len != EXT2_DIR_REC_LEN (1)
+      || dotdot->rec_len != block_size - EXT2_DIR_REC_LEN (1)
+      || info->reserved_zero != 0
+      || info->hash_version > DX_HASH_TEA
+      || info->info_length < sizeof *info
+      || (info->unused_flags & 1)
+      || info->indirect_levels >= EXT2_HTREE_LEVELS)
+    goto bad;
+
+  path->levels = info->indirect_levels + 1;
+  path->hash_version = hash_version (info->hash_version);
+  *hash = dirhash (name, namelen, path->hash_version);
+
+  entries = (struct ext2_dx_entry *) ((void *) info + info->info_length);
+  limit = ROOT_LIMIT (info->info_length);
+
+  for (level = 0; ; level++)
+    {
+      struct ext2_dx_countlimit *cl = COUNTLIMIT (entries);
+
+      if (cl->limit != limit || cl->count == 0 || cl->count > cl->limit)
+	goto bad;
+
+      /* Find the last entry whose hash is not above ours.  The first
+	 entry stands for everything below the second.  */
+      p = entries + 1;
+      q = entries + cl->count - 1;
+      while (p <= q)
+	{
+	  m = p + (q - p) / 2;
+	  if (m->hash > *hash)
+	    q = m - 1;
+	  else
+	    p = m + 1;
+	}
+
+      path->frames[level].entries = entries;
+      path->frames[level].at = p - 1;
+
+      if (p[-1].block == 0 || p[-1].block >= nblocks)
+	goto bad;
+      if (level + 1 == path->levels)
+	return 0;
+
+      entries = (struct ext2_dx_entry *) (buf + p[-1].block * block_size
+					  + EXT2_DIR_REC_LEN (0));
+      limit = NODE_LIMIT;
+    }
+
+ bad:
+  ext2_warning ("bad hash tree index in directory: inode: %Ld",
+		dp->cache_id);
+  return EIO;
+}
+
+int
+htree_next_leaf (struct node *dp, vm_address_t buf, struct htree_path *path,
+		 uint32_t hash)
+{
+  struct htree_frame *frame = &path->frames[path->levels - 1];
+  block_t nblocks = dp->dn_stat.st_size / block_size;
+
+  /* Find the deepest index block that has an entry after the one we
+     followed.  */
+  while (++frame->at >= frame->entries + COUNTLIMIT (frame->entries)->count)
+    {
+      if (frame == path->frames)
+	return 0;
+      frame--;
+    }
+
+  /* The next leaf can only hold entries with our hash if its lowest
+     hash is ours, possibly flagged as a continuation.  */
+  if ((frame->at->hash & ~1) != hash)
+    return 0;
+
+  for (; frame < &path->frames[path->levels - 1]; frame++)
+    {
+      struct ext2_dx_entry *entries;
+
+      if (frame->at->block == 0 || frame->at->block >= nblocks)
+	return 0;
+      entries = (struct ext2_dx_entry *) (buf + frame->at->block * block_size
+					  + EXT2_DIR_REC_LEN (0));
+      if (COUNTLIMIT (entries)->limit != NODE_LIMIT
+	  || COUNTLIMIT (entries)->count == 0)
+	return 0;
+      frame[1].entries = frame[1].at = entries;
+    }
+
+  return frame->at->block != 0 && frame->at->block < nblocks;
+}
+
+int
+htree_full (struct htree_path *path)
+{
+  int level;
+
+  for (level = 0; level < path->levels; level++)
+    {
+      struct ext2_dx_countlimit *cl =
+	COUNTLIMIT (path->frames[level].entries);
+      if (cl->count < cl->limit)
+	return 0;
+    }
+
+  /* A full root can still be pushed down a level.  */
+  return path->levels == EXT2_HTREE_LEVELS;
+}
+
+/* Append a new, empty block to directory DP, whose contents are mapped
+   at BUF, and return its index in *BLOCK.  */
+static error_t
+new_block (struct node *dp, vm_address_t buf, struct protid *cred,
+	   block_t *block)
+{
+  off_t size = dp->dn_stat.st_size;
+  struct ext2_dir_entry_2 *de;
+  error_t err;
+
+  while (size + block_size > dp->allocsize)
+    {
+      err = diskfs_grow (dp, size + block_size, cred);
+      if (err)
+	return err;
+    }
+
+  dp->dn_stat.st_size = size + block_size;
+  dp->dn_set_ctime = 1;
+
+  de = (struct ext2_dir_entry_2 *) (buf + size);
+  de->inode = 0;
+  de->rec_len = block_size;
+  de->name_len = 0;
+  de->file_type = 0;
+
+  *block = size / block_size;
+  return 0;
+}
+
+/* Insert an entry for BLOCK, whose lowest hash is HASH, after the
+   entry followed in index block FRAME.  */
+static void
+insert_entry (struct htree_frame *frame, uint32_t hash, block_t block)
+{
+  struct ext2_dx_countlimit *cl = COUNTLIMIT (frame->entries);
+  struct ext2_dx_entry *new = frame->at + 1;
+
+  assert (cl->count < cl->limit);
+  memmove (new + 1, new,
+	   (frame->entries + cl->count - new) * sizeof *new);
+  new->hash = hash;
+  new->block = block;
+  cl->count++;
+}
+
+/* Return a free slot of at least NEEDED bytes in the directory block
+   at BLOCK, with its rec_len set, or null if there is none.  */
+static struct ext2_dir_entry_2 *
+find_room (vm_address_t block, size_t needed)
+{
+  struct ext2_dir_entry_2 *de, *new;
+  vm_address_t off;
+  size_t used;
+
+  for (off = block; off < block + block_size; off += de->rec_len)
+    {
+      de = (struct ext2_dir_entry_2 *) off;
+      if (de->inode == 0 && de->rec_len >= needed)
+	return de;
+      used = EXT2_DIR_REC_LEN (de->name_len);
+      if (de->inode && de->rec_len - used >= needed)
+	{
+	  new = (struct ext2_dir_entry_2 *) (off + used);
+	  new->rec_len = de->rec_len - used;
+	  de->rec_len = used;
+	  return new;
+	}
+    }
+  return 0;
+}
+
+/* Where an entry of a leaf block is, and what its hash is.  */
+struct dx_map
+{
+  uint32_t hash;
+  uint16_t offs;
+  uint16_t size;
+};
+
+static int
+dx_map_cmp (const void *a, const void *b)
+{
+  const struct dx_map *ma = a, *mb = b;
+
+  if (ma->hash != mb->hash)
+    return ma->hash < mb->hash ? -1 : 1;
+  return (int) ma->offs - (int) mb->offs;
+}
+
+/* Scan the leaf block at BLOCK and fill MAP with its live entries,
+   hashed with hash function VERSION.  Return the number of entries,
+   or -1 if the block is corrupt.  */
+static int
+map_leaf (vm_address_t block, int version, struct dx_map *map)
+{
+  struct ext2_dir_entry_2 *de;
+  size_t off;
+  int count = 0;
+
+  for (off = 0; off < block_size; off += de->rec_len)
+    {
+      de = (struct ext2_dir_entry_2 *) (block + off);
+      if (de->rec_len == 0
+	  || de->rec_len % EXT2_DIR_PAD
+	  || off + de->rec_len > block_size
+	  || EXT2_DIR_REC_LEN (de->name_len) > de->rec_len)
+	return -1;
+      if (de->inode)
+	{
+	  map[count].hash = dirhash (de->name, de->name_len, version);
+	  map[count].offs = off;
+	  map[count].size = EXT2_DIR_REC_LEN (de->name_len);
+	  count++;
+	}
+    }
+  return count;
+}
+
+/* Write the COUNT entries described by MAP, which are in the block
+   copy FROM, tightly packed into the directory block at TO.  */
+static void
+pack_entries (const char *from, struct dx_map *map, int count,
+	      vm_address_t to)
+{
+  struct ext2_dir_entry_2 *de = (struct ext2_dir_entry_2 *) to;
+  size_t off = 0;
+  int i;
+
+  if (count == 0)
+    {
+      de->inode = 0;
+      de->rec_len = block_size;
+      de->name_len = 0;
+      de->file_type = 0;
+      return;
+    }
+
+  for (i = 0; i < count; i++)
+    {
+      de = (struct ext2_dir_entry_2 *) (to + off);
+      memcpy (de, from + map[i].offs, map[i].size);
+      de->rec_len = map[i].size;
+      off += map[i].size;
+    }
+  de->rec_len += block_size - off;
+}
+
+/* Split the leaf block that FRAME of an index with hash function
+   VERSION points to, moving the upper half of its entries by hash to a
+   new block, and return in *NEW a slot of NEEDED bytes for an entry
+   whose hash is HASH.  DP and BUF are as for new_block.  */
+static error_t
+split_leaf (struct node *dp, vm_address_t buf, struct htree_frame *frame,
+	    int version, uint32_t hash, size_t needed, struct protid *cred,
+	    struct ext2_dir_entry_2 **new)
+{
+  vm_address_t leaf = buf + frame->at->block * block_size, leaf2;
+  struct dx_map *map;
+  char *copy;
+  block_t block2;
+  uint32_t hash2;
+  size_t size;
+  int count, split, continued;
+  error_t err;
+
+  map = malloc (block_size / EXT2_DIR_REC_LEN (1) * sizeof *map);
+  copy = malloc (block_size);
+  if (!map || !copy)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  count = map_leaf (leaf, version, map);
+  if (count <= 0)
+    {
+      ext2_warning ("bad directory entry: inode: %Ld offset: %Ld",
+		    dp->cache_id,
+		    (long long) frame->at->block * block_size);
+      err = EIO;
+      goto out;
+    }
+
+  err = new_block (dp, buf, cred, &block2);
+  if (err)
+    goto out;
+  leaf2 = buf + block2 * block_size;
+
+  /* Move the upper half of the entries by size, but always leave at
+     least one entry behind.  */
+  qsort (map, count, sizeof *map, dx_map_cmp);
+  for (split = count, size = 0; split > 1; split--)
+    {
+      if (size + map[split - 1].size / 2 > block_size / 2)
+	break;
+      size += map[split - 1].size;
+    }
+  if (split == count)
+    split--;
+
+  hash2 = map[split].hash;
+  continued = split > 0 && hash2 == map[split - 1].hash;
+
+  memcpy (copy, (void *) leaf, block_size);
+  pack_entries (copy, map + split, count - split, leaf2);
+  pack_entries (copy, map, split, leaf);
+
+  insert_entry (frame, hash2 + continued, block2);
+
+  *new = find_room (hash >= hash2 ? leaf2 : leaf, needed);
+  if (! *new)
+    {
+      ext2_warning ("no room after splitting directory block: inode: %Ld",
+		    dp->cache_id);
+      err = ENOSPC;
+    }
+
+ out:
+  free (map);
+  free (copy);
+  return err;
+}
+
+error_t
+htree_add (struct node *dp, vm_address_t buf, struct htree_path *path,
+	   uint32_t hash, size_t needed, struct protid *cred,
+	   struct ext2_dir_entry_2 **new)
+{
+  struct htree_frame *frame = &path->frames[path->levels - 1];
+  struct ext2_dx_countlimit *cl = COUNTLIMIT (frame->entries);
+  struct ext2_dx_entry *entries;
+  block_t block;
+  error_t err;
+
+  if (cl->count == cl->limit)
+    {
+      err = new_block (dp, buf, cred, &block);
+      if (err)
+	return err;
+      entries = (struct ext2_dx_entry *) (buf + block * block_size
+					  + EXT2_DIR_REC_LEN (0));
+
+      if (path->levels == 1)
+	{
+	  /* Push all the root's entries down into a new index block,
+	     which has room for a few more.  */
+	  memcpy (entries, frame->entries, cl->count * sizeof *entries);
+	  COUNTLIMIT (entries)->limit = NODE_LIMIT;
+
+	  cl->count = 1;
+	  frame->entries[0].block = block;
+	  root_info (buf)->indirect_levels = 1;
+
+	  path->frames[1].entries = entries;
+	  path->frames[1].at = entries + (frame->at - frame->entries);
+	  frame->at = frame->entries;
+	  path->levels = 2;
+	  frame = &path->frames[1];
+	}
+      else
+	{
+	  /* Split the full index block in two, and add the new half to
+	     the root; htree_full made sure the root has room.  */
+	  unsigned count1 = cl->count / 2;
+	  unsigned count2 = cl->count - count1;
+	  uint32_t hash2 = frame->entries[count1].hash;
+
+	  memcpy (entries, frame->entries + count1, count2 * sizeof *entries);
+	  COUNTLIMIT (entries)->limit = NODE_LIMIT;
+	  COUNTLIMIT (entries)->count = count2;
+	  cl->count = count1;
+
+	  insert_entry (&path->frames[0], hash2, block);
+
+	  if (frame->at >= frame->entries + count1)
+	    {
+	      frame->at = entries + (frame->at - frame->entries - count1);
+	      frame->entries = entries;
+	    }
+	}
+    }
+
+  return split_leaf (dp, buf, frame, path->hash_version, hash, needed,
+		     cred, new);
+}
+
+error_t
+htree_make_index (struct node *dp, vm_address_t buf, const char *name,
+		  size_t namelen, size_t needed, struct protid *cred,
+		  struct ext2_dir_entry_2 **new)
+{
+  struct ext2_dir_entry_2 *dotdot =
+    (struct ext2_dir_entry_2 *) (buf + EXT2_DIR_REC_LEN (1));
+  struct ext2_dx_root_info *info = root_info (buf);
+  struct htree_path path;
+  struct dx_map *map;
+  char *copy;
+  block_t block;
+  vm_address_t leaf;
+  uint32_t hash;
+  size_t off;
+  int count;
+  error_t err;
+
+  map = malloc (block_size / EXT2_DIR_REC_LEN (1) * sizeof *map);
+  copy = malloc (block_size);
+  if (!map || !copy)
+    {
+      err = ENOMEM;
+      goto out;
+    }
+
+  /* Note everything after ".." before the root info overwrites it.  */
+  memcpy (copy, (void *) buf, block_size);
+  count = map_leaf (buf, DX_HASH_LEGACY, map);
+  if (count < 0)
+    {
+      err = EIO;
+      goto out;
+    }
+  off = EXT2_DIR_REC_LEN (1) + dotdot->rec_len;
+  while (count > 0 && map[0].offs < off)
+    memmove (map, map + 1, --count * sizeof *map);
+
+  err = new_block (dp, buf, cred, &block);
+  if (err)
+    goto out;
+  leaf = buf + block * block_size;
+  pack_entries (copy, map, count, leaf);
+
+  /* Turn the first block into the root of an index with one leaf.  */
+  dotdot->rec_len = block_size - EXT2_DIR_REC_LEN (1);
+  memset (info, 0, sizeof *info);
+  info->hash_version = (sblock->s_def_hash_version <= DX_HASH_TEA
+			? sblock->s_def_hash_version : DX_HASH_HALF_MD4);
+  info->info_length = sizeof *info;
+
+  path.levels = 1;
+  path.hash_version = hash_version (info->hash_version);
+  path.frames[0].entries = (struct ext2_dx_entry *) (info + 1);
+  path.frames[0].at = path.frames[0].entries;
+  COUNTLIMIT (path.frames[0].entries)->limit = ROOT_LIMIT (sizeof *info);
+  COUNTLIMIT (path.frames[0].entries)->count = 1;
+  path.frames[0].entries[0].block = block;
+
+  dp->dn->info.i_flags |= EXT2_INDEX_FL;
+
+  hash = dirhash (name, namelen, path.hash_version);
+  *new = find_room (leaf, needed);
+  if (! *new)
+    err = split_leaf (dp, buf, &path.frames[0], path.hash_version, hash,
+		      needed, cred, new);
+
+ out:
+  free (map);
+  free (copy);
+  return err;
+}
@@ -156,6 +156,7 @@ get_hypermetadata (void)
     }
 
   allocate_mod_map ();
+  ext2_init_group_info ();
 
   /* A handy source of page-aligned zeros.  */
   if (zeroblock == 0)
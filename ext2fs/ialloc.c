@@ -56,18 +56,17 @@ diskfs_free_node (struct node *np, mode_t old_mode)
   unsigned long block_group;
   unsigned long bit;
   struct ext2_group_desc *gdp;
+  struct ext2_group_info *gi;
+  int freed = 0;
   ino_t inum = np->cache_id;
 
   assert (!diskfs_readonly);
 
   ext2_debug ("freeing inode %u", inum);
 
-  pthread_spin_lock (&global_lock);
-
   if (inum < EXT2_FIRST_INO (sblock) || inum > sblock->s_inodes_count)
     {
       ext2_error ("reserved inode or nonexistent inode: %Ld", inum);
-      pthread_spin_unlock (&global_lock);
       return;
     }
 
@@ -75,6 +74,8 @@ diskfs_free_node (struct node *np, mode_t old_mode)
   bit = (inum - 1) % sblock->s_inodes_per_group;
 
   gdp = group_desc (block_group);
+  gi = group_info (block_group);
+  pthread_mutex_lock (&gi->lock);
   bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
 
   if (!clear_bit (bit, bh))
@@ -90,10 +91,16 @@ diskfs_free_node (struct node *np, mode_t old_mode)
       disk_cache_block_ref_ptr (gdp);
       record_global_poke (gdp);
 
-      sblock->s_free_inodes_count++;
+      if (bit < gi->first_free_inode)
+	gi->first_free_inode = bit;
+      freed = 1;
     }
 
   disk_cache_block_deref (bh);
+  pthread_mutex_unlock (&gi->lock);
+
+  pthread_spin_lock (&global_lock);
+  sblock->s_free_inodes_count += freed;
   sblock_dirty = 1;
   pthread_spin_unlock (&global_lock);
   alloc_sync(0);
@@ -119,9 +126,10 @@ ext2_alloc_inode (ino_t dir_inum, mode_t mode)
   ino_t inum;
   struct ext2_group_desc *gdp;
   struct ext2_group_desc *tmp;
+  struct ext2_group_info *gi;
 
-  pthread_spin_lock (&global_lock);
-
+  /* The group is chosen by looking at the descriptors without locking
+     them; the choice is checked again once the group is locked.  */
 repeat:
   assert (bh == NULL);
   gdp = NULL;
@@ -213,14 +221,21 @@ repeat:
     }
 
   if (!gdp)
+    return 0;
+
+  gi = group_info (i);
+  pthread_mutex_lock (&gi->lock);
+  if (gdp->bg_free_inodes_count == 0)
     {
-      pthread_spin_unlock (&global_lock);
-      return 0;
+      /* Somebody else took the last free inode of the group meanwhile.  */
+      pthread_mutex_unlock (&gi->lock);
+      goto repeat;
     }
 
   bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
   if ((inum =
-       find_first_zero_bit ((unsigned long *) bh, sblock->s_inodes_per_group))
+       find_next_zero_bit ((unsigned long *) bh, sblock->s_inodes_per_group,
+			   gi->first_free_inode))
       < sblock->s_inodes_per_group)
     {
       if (set_bit (inum, bh))
@@ -228,22 +243,21 @@ repeat:
 	  ext2_warning ("bit already set for inode %d", inum);
 	  disk_cache_block_deref (bh);
 	  bh = NULL;
+	  pthread_mutex_unlock (&gi->lock);
 	  goto repeat;
 	}
       record_global_poke (bh);
       bh = NULL;
+      gi->first_free_inode = inum + 1;
     }
   else
     {
       disk_cache_block_deref (bh);
       bh = NULL;
-      if (gdp->bg_free_inodes_count != 0)
-	{
-	  ext2_error ("free inodes count corrupted in group %d", i);
-	  inum = 0;
-	  goto sync_out;
-	}
-      goto repeat;
+      ext2_error ("free inodes count corrupted in group %d", i);
+      pthread_mutex_unlock (&gi->lock);
+      inum = 0;
+      goto sync_out;
     }
 
   inum += i * sblock->s_inodes_per_group + 1;
@@ -251,6 +265,7 @@ repeat:
     {
       ext2_error ("reserved inode or inode > inodes count - "
 		  "block_group = %d,inode=%d", i, inum);
+      pthread_mutex_unlock (&gi->lock);
       inum = 0;
       goto sync_out;
     }
@@ -260,13 +275,15 @@ repeat:
     gdp->bg_used_dirs_count++;
   disk_cache_block_ref_ptr (gdp);
   record_global_poke (gdp);
+  pthread_mutex_unlock (&gi->lock);
 
+  pthread_spin_lock (&global_lock);
   sblock->s_free_inodes_count--;
   sblock_dirty = 1;
+  pthread_spin_unlock (&global_lock);
 
  sync_out:
   assert (bh == NULL);
-  pthread_spin_unlock (&global_lock);
   alloc_sync (0);
 
   /* Make sure the coming read_node won't complain about bad
@@ -321,6 +338,7 @@ diskfs_alloc_node (struct node *dir, mode_t mode, struct node **node)
 	np->dn->info.i_data[block] = 0;
 	np->dn_set_ctime = 1;
       }
+  ext2_flush_block_runs (np);
   if (np->dn->info_i_translator != 0)
     {
       np->dn->info_i_translator = 0;
@@ -366,8 +384,6 @@ ext2_count_free_inodes ()
   struct ext2_group_desc *gdp;
   int i;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -375,14 +391,17 @@ ext2_count_free_inodes ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_mutex_lock (&group_info (i)->lock);
       desc_count += gdp->bg_free_inodes_count;
       bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
       x = count_free (bh, sblock->s_inodes_per_group / 8);
       disk_cache_block_deref (bh);
       ext2_debug ("group %d: stored = %d, counted = %lu",
 		  i, gdp->bg_free_inodes_count, x);
+      pthread_mutex_unlock (&group_info (i)->lock);
       bitmap_count += x;
     }
+  pthread_spin_lock (&global_lock);
   ext2_debug ("stored = %u, computed = %lu, %lu",
 	      sblock->s_free_inodes_count, desc_count, bitmap_count);
   pthread_spin_unlock (&global_lock);
@@ -401,8 +420,6 @@ ext2_check_inodes_bitmap ()
   struct ext2_group_desc *gdp;
   unsigned long desc_count, bitmap_count, x;
 
-  pthread_spin_lock (&global_lock);
-
   desc_count = 0;
   bitmap_count = 0;
   gdp = NULL;
@@ -410,6 +427,7 @@ ext2_check_inodes_bitmap ()
     {
       void *bh;
       gdp = group_desc (i);
+      pthread_mutex_lock (&group_info (i)->lock);
       desc_count += gdp->bg_free_inodes_count;
       bh = disk_cache_block_ref (gdp->bg_inode_bitmap);
       x = count_free (bh, sblock->s_inodes_per_group / 8);
@@ -418,8 +436,10 @@ ext2_check_inodes_bitmap ()
 	ext2_error ("wrong free inodes count in group %d, "
 		    "stored = %d, counted = %lu",
 		    i, gdp->bg_free_inodes_count, x);
+      pthread_mutex_unlock (&group_info (i)->lock);
       bitmap_count += x;
     }
+  pthread_spin_lock (&global_lock);
   if (sblock->s_free_inodes_count != bitmap_count)
     ext2_error ("wrong free inodes count in super block, "
 		"stored = %lu, counted = %lu",
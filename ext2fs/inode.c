@@ -39,29 +39,26 @@
 #define UF_IMMUTABLE 0
 #endif
 
-#define	INOHSZ	8192
-#if	((INOHSZ&(INOHSZ-1)) == 0)
-#define	INOHASH(ino)	((ino)&(INOHSZ-1))
-#else
-#define	INOHASH(ino)	(((unsigned)(ino))%INOHSZ)
-#endif
-
-static struct node *nodehash[INOHSZ];
-static size_t nodehash_nr_items;
-
 static error_t read_node (struct node *np);
 
 pthread_spinlock_t generation_lock = PTHREAD_SPINLOCK_INITIALIZER;
 
-/* Initialize the inode hash table. */
-void
-inode_init ()
+/* Set up the locks of a disknode, which stay set up while it is in the
+   disknode cache.  */
+static error_t
+construct_disknode (void *hook, void *buffer)
 {
-  int n;
-  for (n = 0; n < INOHSZ; n++)
-    nodehash[n] = 0;
+  struct disknode *dn = buffer;
+
+  pthread_rwlock_init (&dn->alloc_lock, NULL);
+  pthread_spin_init (&dn->block_runs_lock, PTHREAD_PROCESS_PRIVATE);
+  return 0;
 }
 
+static struct hurd_slab_space disknode_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct disknode, construct_disknode,
+				 NULL, NULL);
+
 /* Fetch inode INUM, set *NPP to the node structure;
    gain one user reference and lock the node.  */
 error_t
@@ -72,19 +69,15 @@ diskfs_cached_lookup (ino_t inum, struct node **npp)
   struct disknode *dn;
 
   pthread_spin_lock (&diskfs_node_refcnt_lock);
-  for (np = nodehash[INOHASH(inum)]; np; np = np->dn->hnext)
-    if (np->cache_id == inum)
-      {
-	np->references++;
-	pthread_spin_unlock (&diskfs_node_refcnt_lock);
-	pthread_mutex_lock (&np->lock);
-	*npp = np;
-	return 0;
-      }
+  np = diskfs_node_cache_lookup (inum);
+  if (np)
+    {
+      *npp = np;
+      return 0;
+    }
 
   /* Format specific data for the new node.  */
-  dn = malloc (sizeof (struct disknode));
-  if (! dn)
+  if (hurd_slab_alloc (&disknode_space, (void **) &dn))
     {
       pthread_spin_unlock (&diskfs_node_refcnt_lock);
       return ENOMEM;
@@ -92,22 +85,38 @@ diskfs_cached_lookup (ino_t inum, struct node **npp)
   dn->dirents = 0;
   dn->dir_idx = 0;
   dn->pager = 0;
-  pthread_rwlock_init (&dn->alloc_lock, NULL);
+  memset (dn->block_runs, 0, sizeof dn->block_runs);
+  dn->block_runs_next = 0;
+  dn->prealloc_window = 0;
+  dn->delalloc_runs = 0;
+  dn->delalloc_nruns = dn->delalloc_runs_alloced = 0;
+  dn->delalloc_blocks = 0;
+  dn->delalloc_allocating = 0;
   pokel_init (&dn->indir_pokel, diskfs_disk_pager, disk_cache);
 
   /* Create the new node.  */
   np = diskfs_make_node (dn);
+  if (! np)
+    {
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      pokel_finalize (&dn->indir_pokel);
+      hurd_slab_dealloc (&disknode_space, dn);
+      return ENOMEM;
+    }
   np->cache_id = inum;
 
-  pthread_mutex_lock (&np->lock);
+  /* Put NP in the inode cache.  */
+  err = diskfs_node_cache_add (np);
+  if (err)
+    {
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      pokel_finalize (&dn->indir_pokel);
+      hurd_slab_dealloc (&disknode_space, dn);
+      diskfs_destroy_node (np);
+      return err;
+    }
 
-  /* Put NP in NODEHASH.  */
-  dn->hnext = nodehash[INOHASH(inum)];
-  if (dn->hnext)
-    dn->hnext->dn->hprevp = &dn->hnext;
-  dn->hprevp = &nodehash[INOHASH(inum)];
-  nodehash[INOHASH(inum)] = np;
-  nodehash_nr_items += 1;
+  pthread_mutex_lock (&np->lock);
 
   pthread_spin_unlock (&diskfs_node_refcnt_lock);
 
@@ -141,38 +150,42 @@ ifind (ino_t inum)
   struct node *np;
 
   pthread_spin_lock (&diskfs_node_refcnt_lock);
-  for (np = nodehash[INOHASH(inum)]; np; np = np->dn->hnext)
-    {
-      if (np->cache_id != inum)
-	continue;
-
-      assert (np->references);
-      pthread_spin_unlock (&diskfs_node_refcnt_lock);
-      return np;
-    }
-  assert (0);
+  np = diskfs_node_cache_find (inum);
+  assert (np && np->references);
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+  return np;
 }
 
-/* The last reference to a node has gone away; drop
-   it from the hash table and clean all state in the dn structure. */
+/* The last reference to a node has gone away; keep it in the inode
+   cache if possible, otherwise drop it from the cache and clean all
+   state in the dn structure. */
 void
 diskfs_node_norefs (struct node *np)
 {
-  *np->dn->hprevp = np->dn->hnext;
-  if (np->dn->hnext)
-    np->dn->hnext->dn->hprevp = np->dn->hprevp;
-  nodehash_nr_items -= 1;
-
   if (np->dn->dirents)
-    free (np->dn->dirents);
+    {
+      free (np->dn->dirents);
+      np->dn->dirents = 0;
+    }
   assert (!np->dn->pager);
 
   /* Move any pending writes of indirect blocks.  */
   pokel_inherit (&global_pokel, &np->dn->indir_pokel);
+
+  /* With the pager gone, no reserved block will ever be written.  */
+  ext2_delalloc_release (np, 0);
+  free (np->dn->delalloc_runs);
+  np->dn->delalloc_runs = 0;
+  np->dn->delalloc_runs_alloced = 0;
+
+  if (diskfs_node_cache_keep (np))
+    return;
+
+  diskfs_node_cache_remove (np);
   pokel_finalize (&np->dn->indir_pokel);
 
-  free (np->dn);
-  free (np);
+  hurd_slab_dealloc (&disknode_space, np->dn);
+  diskfs_destroy_node (np);
 }
 
 /* The last hard reference to a node has gone away; arrange to have
@@ -312,6 +325,7 @@ read_node (struct node *np)
     {
       memcpy (info->i_data, di->i_block,
 	      EXT2_N_BLOCKS * sizeof info->i_data[0]);
+      ext2_flush_block_runs (np);
       st->st_rdev = 0;
     }
   dn->info_i_translator = di->i_translator;
@@ -551,55 +565,7 @@ diskfs_node_reload (struct node *node)
 error_t
 diskfs_node_iterate (error_t (*fun)(struct node *))
 {
-  error_t err = 0;
-  int n;
-  size_t num_nodes;
-  struct node *node, **node_list, **p;
-
-  pthread_spin_lock (&diskfs_node_refcnt_lock);
-
-  /* We must copy everything from the hash table into another data structure
-     to avoid running into any problems with the hash-table being modified
-     during processing (normally we delegate access to hash-table with
-     diskfs_node_refcnt_lock, but we can't hold this while locking the
-     individual node locks).  */
-  num_nodes = nodehash_nr_items;
-
-  /* TODO This method doesn't scale beyond a few dozen nodes and should be
-     replaced.  */
-  node_list = malloc (num_nodes * sizeof (struct node *));
-  if (node_list == NULL)
-    {
-      pthread_spin_unlock (&diskfs_node_refcnt_lock);
-      ext2_debug ("unable to allocate temporary node table");
-      return ENOMEM;
-    }
-
-  p = node_list;
-  for (n = 0; n < INOHSZ; n++)
-    for (node = nodehash[n]; node; node = node->dn->hnext)
-      {
-	*p++ = node;
-	node->references++;
-      }
-
-  pthread_spin_unlock (&diskfs_node_refcnt_lock);
-
-  p = node_list;
-  while (num_nodes-- > 0)
-    {
-      node = *p++;
-      if (!err)
-	{
-	  pthread_mutex_lock (&node->lock);
-	  err = (*fun)(node);
-	  pthread_mutex_unlock (&node->lock);
-	}
-      diskfs_nrele (node);
-    }
-
-  free (node_list);
-  return err;
+  return diskfs_node_cache_iterate (fun);
 }
 
 /* Write all active disknodes into the ext2_inode pager. */
@@ -651,7 +617,7 @@ diskfs_set_statfs (struct statfs *st)
   st->f_type = FSTYPE_EXT2FS;
   st->f_bsize = block_size;
   st->f_blocks = sblock->s_blocks_count;
-  st->f_bfree = sblock->s_free_blocks_count;
+  st->f_bfree = ext2_unreserved_free_blocks ();
   st->f_bavail = st->f_bfree - sblock->s_r_blocks_count;
   if (st->f_bfree < sblock->s_r_blocks_count)
     st->f_bavail = 0;
@@ -693,11 +659,12 @@ diskfs_set_translator (struct node *np, const char *name, unsigned namelen,
   if (namelen && !blkno)
     {
       /* Allocate block for translator */
+      block_t count = 1;
       blkno =
-	ext2_new_block ((np->dn->info.i_block_group
-			 * EXT2_BLOCKS_PER_GROUP (sblock))
-			+ sblock->s_first_data_block,
-			0, 0, 0);
+	ext2_new_blocks ((np->dn->info.i_block_group
+			  * EXT2_BLOCKS_PER_GROUP (sblock))
+			 + sblock->s_first_data_block,
+			 &count);
       if (blkno == 0)
 	{
 	  dino_deref (di);
@@ -806,6 +773,7 @@ write_symlink (struct node *node, const char *target)
   assert (node->dn_stat.st_blocks == 0);
 
   memcpy (node->dn->info.i_data, target, len);
+  ext2_flush_block_runs (node);
   node->dn_stat.st_size = len - 1;
   node->dn_set_ctime = 1;
   node->dn_set_mtime = 1;
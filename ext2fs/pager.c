@@ -58,6 +58,8 @@ struct ext2fs_pager_stats
   unsigned long file_pagein_freed_bufs;	/* Discarded pages */
   unsigned long file_pagein_alloced_bufs; /* Allocated pages */
 
+  unsigned long file_readaheads; /* Read ahead runs offered to the kernel */
+
   unsigned long file_pageouts;
 
   unsigned long file_page_unlocks;
@@ -125,15 +127,18 @@ free_page_buf (void *buf)
 }
 
 /* Find the location on disk of page OFFSET in NODE.  Return the disk block
-   in BLOCK (if unallocated, then return 0).  If *LOCK is 0, then a reader
-   lock is acquired on NODE's ALLOC_LOCK before doing anything, and left
-   locked after the return -- even if an error is returned.  0 is returned
-   on success otherwise an error code.  */
+   in BLOCK (if unallocated, then return 0), and in COUNT the number of
+   blocks, at most up to NODE's allocsize, from OFFSET on that are in
+   consecutive disk blocks (or are unallocated as well).  If *LOCK is 0,
+   then a reader lock is acquired on NODE's ALLOC_LOCK before doing
+   anything, and left locked after the return -- even if an error is
+   returned.  0 is returned on success otherwise an error code.  */
 static error_t
 find_block (struct node *node, vm_offset_t offset,
-	    block_t *block, pthread_rwlock_t **lock)
+	    block_t *block, block_t *count, pthread_rwlock_t **lock)
 {
   error_t err;
+  block_t max;
 
   if (!*lock)
     {
@@ -144,34 +149,36 @@ find_block (struct node *node, vm_offset_t offset,
   if (offset + block_size > node->allocsize)
     return EIO;
 
-  err = ext2_getblk (node, offset >> log2_block_size, 0, block);
-  if (err == EINVAL)
-    /* Don't barf yet if the node is unallocated.  */
-    {
-      *block = 0;
-      err = 0;
-    }
+  err = ext2_getblk_run (node, offset >> log2_block_size, block, count);
+  if (err)
+    return err;
 
-  return err;
+  max = (node->allocsize - offset) >> log2_block_size;
+  if (*count > max)
+    *count = max;
+
+  return 0;
 }
 
-/* Read one page for the pager backing NODE at offset PAGE, into BUF.  This
-   may need to read several filesystem blocks to satisfy one page, and tries
-   to consolidate the i/o if possible.  */
+/* Read LENGTH bytes of pages for the pager backing NODE at offset PAGE,
+   into BUF.  This may need to read several filesystem blocks to satisfy
+   the request, and tries to consolidate the i/o if possible.  */
 static error_t
-file_pager_read_page (struct node *node, vm_offset_t page,
-		      void **buf, int *writelock)
+file_pager_read_pages (struct node *node, vm_offset_t page, vm_size_t length,
+		       void **buf, int *writelock)
 {
   error_t err;
   int offs = 0;
   int partial = 0;		/* A page truncated by the EOF.  */
   pthread_rwlock_t *lock = NULL;
-  int left = vm_page_size;
+  int left = length;
   block_t pending_blocks = 0;
   int num_pending_blocks = 0;
+  /* Whether *BUF already is a LENGTH byte buffer we must read into.  */
+  int have_buf = 0;
 
-  ext2_debug ("reading inode %llu page %lu[%u]",
-	      node->cache_id, page, vm_page_size);
+  ext2_debug ("reading inode %llu page %lu[%zu]",
+	      node->cache_id, page, length);
 
   /* Read the NUM_PENDING_BLOCKS blocks in PENDING_BLOCKS, into the buffer
      pointed to by BUF (allocating it if necessary) at offset OFFS.  OFFS in
@@ -189,7 +196,7 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	     buffer, otherwise, we try to read directly into the tail of the
 	     buffer we've already got.  */
 	  void *new_buf = *buf + offs;
-	  size_t new_len = offs == 0 ? 0 : vm_page_size - offs;
+	  size_t new_len = have_buf || offs != 0 ? length - offs : 0;
 
 	  STAT_INC (file_pagein_reads);
 
@@ -203,14 +210,14 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	    {
 	      /* The read went into a different buffer than the one we
                  passed. */
-	      if (offs == 0)
+	      if (offs == 0 && !have_buf)
 		/* First read, make the returned page be our buffer.  */
 		*buf = new_buf;
 	      else
 		/* We've already got some buffer, so copy into it.  */
 		{
 		  memcpy (*buf + offs, new_buf, new_len);
-		  free_page_buf (new_buf); /* Return NEW_BUF to our pool.  */
+		  munmap (new_buf, round_page (new_len));
 		  STAT_INC (file_pagein_freed_bufs);
 		}
 	    }
@@ -237,14 +244,31 @@ file_pager_read_page (struct node *node, vm_offset_t page,
       partial = 1;
     }
 
+  if (left > 0 && length > vm_page_size)
+    /* A single read into a freshly allocated buffer only covers the
+       first run of blocks, so get a buffer for all of it up front.  */
+    {
+      *buf = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (*buf == MAP_FAILED)
+	return ENOMEM;
+      have_buf = 1;
+      STAT_INC (file_pagein_alloced_bufs);
+    }
+
   while (left > 0)
     {
-      block_t block;
+      block_t block, count;
+      size_t amount;
 
-      err = find_block (node, page, &block, &lock);
+      err = find_block (node, page, &block, &count, &lock);
       if (err)
 	break;
 
+      /* Take the whole run of blocks at once.  */
+      if (count > left >> log2_block_size)
+	count = left >> log2_block_size;
+      amount = count << log2_block_size;
+
       if (block != pending_blocks + num_pending_blocks)
 	{
 	  err = do_pending_reads ();
@@ -254,10 +278,10 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 	}
 
       if (block == 0)
-	/* Reading unallocated block, just make a zero-filled one.  */
+	/* Reading unallocated blocks, just make zero-filled ones.  */
 	{
 	  *writelock = 1;
-	  if (offs == 0)
+	  if (offs == 0 && !have_buf)
 	    /* No page allocated to read into yet.  */
 	    {
 	      *buf = get_page_buf ();
@@ -265,14 +289,14 @@ file_pager_read_page (struct node *node, vm_offset_t page,
 		break;
 	      STAT_INC (file_pagein_alloced_bufs);
 	    }
-	  memset (*buf + offs, 0, block_size);
-	  offs += block_size;
+	  memset (*buf + offs, 0, amount);
+	  offs += amount;
 	}
       else
-	num_pending_blocks++;
+	num_pending_blocks += count;
 
-      page += block_size;
-      left -= block_size;
+      page += amount;
+      left -= amount;
     }
 
   if (!err && num_pending_blocks > 0)
@@ -284,9 +308,12 @@ file_pager_read_page (struct node *node, vm_offset_t page,
   if (lock)
     pthread_rwlock_unlock (lock);
 
+  if (err && have_buf)
+    munmap (*buf, length);
+
   return err;
 }
-
+
 struct pending_blocks
 {
   /* The block number of the first of the blocks.  */
@@ -353,10 +380,10 @@ pending_blocks_skip (struct pending_blocks *pb)
   return err;
 }
 
-/* Add the disk block BLOCK to the list of destination disk blocks pending in
-   PB.  */
+/* Add the COUNT consecutive disk blocks starting at BLOCK to the list of
+   destination disk blocks pending in PB.  */
 static error_t
-pending_blocks_add (struct pending_blocks *pb, block_t block)
+pending_blocks_add (struct pending_blocks *pb, block_t block, block_t count)
 {
   if (block != pb->block + pb->num)
     {
@@ -365,7 +392,7 @@ pending_blocks_add (struct pending_blocks *pb, block_t block)
 	return err;
       pb->block = block;
     }
-  pb->num++;
+  pb->num += count;
   return 0;
 }
 
@@ -378,8 +405,9 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
   error_t err = 0;
   struct pending_blocks pb;
   pthread_rwlock_t *lock = &node->dn->alloc_lock;
-  block_t block;
+  block_t block, count;
   int left = vm_page_size;
+  block_t page_blocks = vm_page_size >> log2_block_size;
 
   pending_blocks_init (&pb, buf);
 
@@ -388,6 +416,29 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
      diskfs_grow and diskfs_truncate.  */
   pthread_rwlock_rdlock (&node->dn->alloc_lock);
 
+  if (ext2_delalloc_pending (node, offset >> log2_block_size, page_blocks))
+    /* Some blocks of the page only have space reserved for them, so
+       allocate them now.  This needs the lock for writing.  */
+    {
+      pthread_rwlock_unlock (&node->dn->alloc_lock);
+      pthread_rwlock_wrlock (&node->dn->alloc_lock);
+
+      err = diskfs_catch_exception ();
+      if (!err)
+	{
+	  err = ext2_delalloc_allocate (node, offset >> log2_block_size,
+					page_blocks);
+	  diskfs_end_catch_exception ();
+	}
+      if (err)
+	{
+	  pthread_rwlock_unlock (&node->dn->alloc_lock);
+	  ext2_warning ("inode=%Ld, page=0x%zx: %s",
+			node->cache_id, offset, strerror (err));
+	  return err;
+	}
+    }
+
   if (offset >= node->allocsize)
     left = 0;
   else if (offset + left > node->allocsize)
@@ -399,13 +450,15 @@ file_pager_write_page (struct node *node, vm_offset_t offset, void *buf)
 
   while (left > 0)
     {
-      err = find_block (node, offset, &block, &lock);
+      err = find_block (node, offset, &block, &count, &lock);
       if (err)
 	break;
       assert (block);
-      pending_blocks_add (&pb, block);
-      offset += block_size;
-      left -= block_size;
+      if (count > left >> log2_block_size)
+	count = left >> log2_block_size;
+      pending_blocks_add (&pb, block, count);
+      offset += count << log2_block_size;
+      left -= count << log2_block_size;
     }
 
   if (!err)
@@ -502,7 +555,7 @@ disk_pager_write_page (vm_offset_t page, void *buf)
 	     paging interface.  XXXX */
 	  if (test_bit (block, modified_global_blocks))
 	    /* This block may have been modified, so write it out.  */
-	    err = pending_blocks_add (&pb, block);
+	    err = pending_blocks_add (&pb, block, 1);
 	  else
 	    /* Otherwise just skip it.  */
 	    err = pending_blocks_skip (&pb);
@@ -534,9 +587,62 @@ disk_pager_notify_evict (vm_offset_t page)
 
   pthread_mutex_lock (&disk_cache_lock);
   disk_cache_info[index].flags &= ~DC_INCORE;
+  pthread_cond_broadcast (&disk_cache_released);
   pthread_mutex_unlock (&disk_cache_lock);
 }
 
+/* Read LENGTH bytes of pages at offset PAGE for the file pager PAGER into
+   BUF.  If this continues a sequential run, the following pages are read
+   in the same go, and offered to the kernel.  */
+static error_t
+file_pager_read (struct user_pager_info *pager, vm_offset_t page,
+		 vm_size_t length, void **buf, int *writelock)
+{
+  error_t err;
+  struct node *node = pager->node;
+  struct pager *p;
+  vm_offset_t start;
+  vm_size_t len;
+
+  diskfs_readahead_update (&pager->readahead, page, length, &start, &len);
+  if (len > 0 && start < node->allocsize)
+    {
+      if (start + len > round_page (node->allocsize))
+	len = round_page (node->allocsize) - start;
+
+      err = file_pager_read_pages (node, page, length + len, buf, writelock);
+      if (! err && ! *writelock)
+	{
+	  pthread_spin_lock (&node_to_page_lock);
+	  p = node->dn->pager;
+	  if (p)
+	    ports_port_ref (p);
+	  pthread_spin_unlock (&node_to_page_lock);
+
+	  if (p)
+	    {
+	      STAT_INC (file_readaheads);
+	      diskfs_readahead_offered (len);
+	      pager_offer_pages (p, 0, 0, start, len,
+				 (vm_address_t) *buf + length);
+	      ports_port_deref (p);
+	    }
+	  else
+	    munmap (*buf + length, len);
+	  return 0;
+	}
+
+      /* There was an error, or there are holes, which we leave to the
+	 ordinary pagein path that knows how to provide them read-only.
+	 Just read what we were asked for.  */
+      if (! err)
+	munmap (*buf, length + len);
+      pager->readahead.next = start;
+    }
+
+  return file_pager_read_pages (node, page, length, buf, writelock);
+}
+
 /* Satisfy a pager read request for either the disk pager or file pager
    PAGER, to the page at offset PAGE into BUF.  WRITELOCK should be set if
    the pager should make the page writeable.  */
@@ -547,7 +653,25 @@ pager_read_page (struct user_pager_info *pager, vm_offset_t page,
   if (pager->type == DISK)
     return disk_pager_read_page (page, (void **)buf, writelock);
   else
-    return file_pager_read_page (pager->node, page, (void **)buf, writelock);
+    return file_pager_read (pager, page, vm_page_size,
+			    (void **)buf, writelock);
+}
+
+/* Satisfy a multi-page pager read request for the file pager PAGER, of
+   LENGTH bytes at offset START into BUF.  The disk pager reads its pages
+   one at a time, and so do requests reaching past the last page of the
+   file, so that the pages beyond it get an error as a single page
+   request would.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t start,
+		  vm_size_t length, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == DISK)
+    return EOPNOTSUPP;
+  else if (start + length > round_page (pager->node->allocsize))
+    return EOPNOTSUPP;
+  else
+    return file_pager_read (pager, start, length, (void **)buf, writelock);
 }
 
 /* Satisfy a pager write request for either the disk pager or file pager
@@ -570,9 +694,30 @@ pager_notify_evict (struct user_pager_info *pager, vm_offset_t page)
 }
 
 
+/* Make sure block BLOCK of NODE has a disk block to be written to: either
+   allocate one now, or, with delayed allocation, just reserve space for
+   one, to be allocated by file_pager_write_page.  NODE's alloc_lock must
+   be held for writing.  */
+static error_t
+prepare_block (struct node *node, block_t block)
+{
+  block_t disk_block;
+
+  if (ext2_delayed_allocation && S_ISREG (node->dn_stat.st_mode))
+    {
+      block_t count;
+      error_t err = ext2_getblk_run (node, block, &disk_block, &count);
+      if (err || disk_block)
+	return err;
+      return ext2_reserve_block (node, block);
+    }
+
+  return ext2_getblk (node, block, 1, &disk_block);
+}
+
 /* Make page PAGE writable, at least up to ALLOCSIZE.  This function and
    diskfs_grow are the only places that blocks are actually added to the
-   file.  */
+   file, or, with delayed allocation, reserved for it.  */
 error_t
 pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 {
@@ -597,8 +742,7 @@ pager_unlock_page (struct user_pager_info *pager, vm_offset_t page)
 
 	  while (left > 0)
 	    {
-	      block_t disk_block;
-	      err = ext2_getblk (node, block++, 1, &disk_block);
+	      err = prepare_block (node, block++);
 	      if (err)
 		break;
 	      left -= block_size;
@@ -698,10 +842,7 @@ diskfs_grow (struct node *node, off_t size, struct protid *cred)
 
 	      err = diskfs_catch_exception ();
 	      while (!err && end_block < writable_end)
-		{
-		  block_t disk_block;
-		  err = ext2_getblk (node, end_block++, 1, &disk_block);
-		}
+		err = prepare_block (node, end_block++);
 	      diskfs_end_catch_exception ();
 
 	      if (! err)
@@ -828,20 +969,42 @@ pager_dropweak (struct user_pager_info *p __attribute__ ((unused)))
 /* Cached blocks from disk.  */
 void *disk_cache;
 
-/* DISK_CACHE size in bytes and blocks.  */
+/* DISK_CACHE size in bytes, and the number of blocks in use and there is
+   room for.  */
 store_offset_t disk_cache_size;
 int disk_cache_blocks;
+int disk_cache_max_blocks;
 
 /* block num --> pointer to in-memory block */
 hurd_ihash_t disk_cache_bptr;
 /* Cached blocks' info.  */
 struct disk_cache_info *disk_cache_info;
-/* Hint index for which cache block to reuse next.  */
-int disk_cache_hint;
+/* Clock hands: where to look for a cache block to reuse next, and for
+   in-core blocks to return to the kernel when there are none.  */
+int disk_cache_hand;
+int disk_cache_return_hand;
+/* The number of blocks with DC_FIXED set, at the start of the cache.  */
+int disk_cache_fixed_blocks;
 /* Lock for these structures.  */
 pthread_mutex_t disk_cache_lock;
 /* Fired when a re-association is done.  */
 pthread_cond_t disk_cache_reassociation;
+/* Fired when the last reference to a cached block is released.  */
+pthread_cond_t disk_cache_released;
+
+/* Statistics of the disk cache, protected by DISK_CACHE_LOCK.  */
+static struct
+{
+  unsigned long hits;		/* Blocks found in the cache.  */
+  unsigned long misses;		/* Blocks not found.  */
+  unsigned long reassociations;	/* Cache blocks reused for other blocks.  */
+  unsigned long failed_reassociations;
+  unsigned long returns;	/* In-core blocks returned to the kernel.  */
+  unsigned long starvations;	/* Times no block could be returned.  */
+} disk_cache_stats;
+
+/* The most blocks disk_cache_return_unused returns at once.  */
+#define DISK_CACHE_RETURN_BATCH(blocks) ((blocks) / 16 ?: 1)
 
 /* Finish mapping initialization. */
 static void
@@ -853,18 +1016,19 @@ disk_cache_init (void)
 
   pthread_mutex_init (&disk_cache_lock, NULL);
   pthread_cond_init (&disk_cache_reassociation, NULL);
+  pthread_cond_init (&disk_cache_released, NULL);
 
   /* Allocate space for block num -> in-memory pointer mapping.  */
   if (hurd_ihash_create (&disk_cache_bptr, HURD_IHASH_NO_LOCP))
     ext2_panic ("Can't allocate memory for disk_pager_bptr");
 
   /* Allocate space for disk cache blocks' info.  */
-  disk_cache_info = malloc ((sizeof *disk_cache_info) * disk_cache_blocks);
+  disk_cache_info = malloc ((sizeof *disk_cache_info) * disk_cache_max_blocks);
   if (!disk_cache_info)
     ext2_panic ("Cannot allocate space for disk cache info");
 
   /* Initialize disk_cache_info.  */
-  for (int i = 0; i < disk_cache_blocks; i++)
+  for (int i = 0; i < disk_cache_max_blocks; i++)
     {
       disk_cache_info[i].block = DC_NO_BLOCK;
       disk_cache_info[i].flags = 0;
@@ -875,7 +1039,8 @@ disk_cache_init (void)
 	= DC_NO_BLOCK ^ DISK_CACHE_LAST_READ_XOR;
 #endif
     }
-  disk_cache_hint = 0;
+  disk_cache_hand = 0;
+  disk_cache_return_hand = 0;
 
   /* Map the superblock and the block group descriptors.  */
   block_t fixed_first = boffs_block (SBLOCK_OFFS);
@@ -890,64 +1055,114 @@ disk_cache_init (void)
       assert (disk_cache_info[i-fixed_first].block == i);
       disk_cache_info[i-fixed_first].flags |= DC_FIXED;
     }
+  disk_cache_fixed_blocks = fixed_last - fixed_first + 1;
 }
 
+/* Return the COUNT cache blocks starting at INDEX to the kernel, waiting
+   for any modifications to be written back.  */
+static void
+disk_cache_return (int index, int count)
+{
+  pager_return_some (diskfs_disk_pager, index << log2_block_size,
+		     count << log2_block_size, 1);
+}
+
+/* Called when no cache block can be reused.  Return a batch of in-core
+   cache blocks that are not referenced to the kernel, so that they can be
+   reused once the kernel has evicted them.  The blocks are chosen with
+   the clock algorithm: blocks referenced since the return hand last
+   passed them get another chance.  If every block is referenced, wait
+   until one is released.  */
 static void
 disk_cache_return_unused (void)
 {
-  int index;
+  int index, batch, steps, blocks;
+  int pending_begin = -1, pending_end = -1;
 
   /* XXX: Touch all pages.  It seems that sometimes GNU Mach "forgets"
      to notify us about evicted pages.  Disk cache must be
      unlocked.  */
-  for (vm_offset_t i = 0; i < disk_cache_size; i += vm_page_size)
-    *(volatile char *)(disk_cache + i);
+  for (index = 0; index < disk_cache_blocks; index++)
+    if (disk_cache_info[index].block != DC_NO_BLOCK)
+      *(volatile char *)(disk_cache + (index << log2_block_size));
 
   /* Release some references to cached blocks.  */
   pokel_sync (&global_pokel, 1);
 
   /* Return unused pages that are in core.  */
-  int pending_begin = -1, pending_end = -1;
   pthread_mutex_lock (&disk_cache_lock);
-  for (index = 0; index < disk_cache_blocks; index++)
-    if (! (disk_cache_info[index].flags & (DC_DONT_REUSE & ~DC_INCORE))
-	&& ! disk_cache_info[index].ref_count)
-      {
-	ext2_debug ("return %u -> %d",
-		    disk_cache_info[index].block, index);
-	if (index != pending_end)
-	  {
-	    /* Return previous region, if there is such, ... */
-	    if (pending_end >= 0)
-	      {
-		pthread_mutex_unlock (&disk_cache_lock);
-		pager_return_some (diskfs_disk_pager,
-				   pending_begin * vm_page_size,
-				   (pending_end - pending_begin)
-				   * vm_page_size, 1);
-		pthread_mutex_lock (&disk_cache_lock);
-	      }
-	    /* ... and start new region.  */
-	    pending_begin = index;
-	  }
-	pending_end = index + 1;
-      }
+  blocks = disk_cache_blocks;
+  batch = 0;
+  index = disk_cache_return_hand;
+  for (steps = 0;
+       steps < 2 * blocks && batch < DISK_CACHE_RETURN_BATCH (blocks);
+       steps++)
+    {
+      struct disk_cache_info *info = &disk_cache_info[index];
+
+      if (! (info->flags & (DC_DONT_REUSE & ~DC_INCORE))
+	  && ! info->ref_count
+	  && info->block != DC_NO_BLOCK)
+	{
+	  if (info->flags & DC_RECENT)
+	    /* Give it a second chance.  */
+	    info->flags &= ~DC_RECENT;
+	  else
+	    {
+	      ext2_debug ("return %u -> %d", info->block, index);
+	      if (index != pending_end)
+		{
+		  /* Return previous region, if there is such, ... */
+		  if (pending_end >= 0)
+		    {
+		      pthread_mutex_unlock (&disk_cache_lock);
+		      disk_cache_return (pending_begin,
+					 pending_end - pending_begin);
+		      pthread_mutex_lock (&disk_cache_lock);
+		    }
+		  /* ... and start new region.  */
+		  pending_begin = index;
+		}
+	      pending_end = index + 1;
+	      batch++;
+	    }
+	}
+
+      if (++index >= blocks)
+	{
+	  index = 0;
+	  /* Regions don't wrap around.  */
+	  if (pending_end >= 0)
+	    {
+	      pthread_mutex_unlock (&disk_cache_lock);
+	      disk_cache_return (pending_begin, pending_end - pending_begin);
+	      pthread_mutex_lock (&disk_cache_lock);
+	      pending_end = -1;
+	    }
+	}
+    }
+  if (index < disk_cache_blocks)
+    disk_cache_return_hand = index;
+  disk_cache_stats.returns += batch;
+
+  if (batch == 0)
+    {
+      struct timespec timeout;
+
+      disk_cache_stats.starvations++;
+      /* Wait for a block to be released, but not too long, as blocks
+	 referenced by pokels are only released when those are synced.  */
+      clock_gettime (CLOCK_REALTIME, &timeout);
+      timeout.tv_sec++;
+      pthread_cond_timedwait (&disk_cache_released, &disk_cache_lock,
+			      &timeout);
+    }
 
   pthread_mutex_unlock (&disk_cache_lock);
 
   /* Return last region, if there is such.   */
   if (pending_end >= 0)
-    pager_return_some (diskfs_disk_pager,
-		       pending_begin * vm_page_size,
-		       (pending_end - pending_begin) * vm_page_size,
-		       1);
-  else
-    {
-      printf ("ext2fs: disk cache is starving\n");
-
-      /* Give it some time.  This should happen rarely.  */
-      sleep (1);
-    }
+    disk_cache_return (pending_begin, pending_end - pending_begin);
 }
 
 /* Map block and return pointer to it.  */
@@ -988,6 +1203,8 @@ retry_ref:
       assert (disk_cache_info[index].ref_count + 1
 	      > disk_cache_info[index].ref_count);
       disk_cache_info[index].ref_count++;
+      disk_cache_info[index].flags |= DC_RECENT;
+      disk_cache_stats.hits++;
 
       ext2_debug ("cached %u -> %d (ref_count = %hu, flags = %#hx, ptr = %p)",
 		  disk_cache_info[index].block, index,
@@ -999,31 +1216,39 @@ retry_ref:
       return bptr;
     }
 
-  /* Search for a block that is not in core and is not referenced.  */
-  index = disk_cache_hint;
-  while ((disk_cache_info[index].flags & DC_DONT_REUSE)
-	 || (disk_cache_info[index].ref_count))
-    {
-      ext2_debug ("reject %u -> %d (ref_count = %hu, flags = %#hx)",
-		  disk_cache_info[index].block, index,
-		  disk_cache_info[index].ref_count,
-		  disk_cache_info[index].flags);
+  disk_cache_stats.misses++;
 
-      /* Just move to next block.  */
-      index++;
-      if (index >= disk_cache_blocks)
-	index -= disk_cache_blocks;
+  /* Search for a block that is not in core and is not referenced, with
+     the clock algorithm: blocks used since the hand last passed them are
+     skipped once.  Only if there is none like that, give up.  */
+  {
+    int steps, blocks = disk_cache_blocks;
 
-      /* If we return to where we started, than there is no suitable
-	 block. */
-      if (index == disk_cache_hint)
-	break;
-    }
+    index = disk_cache_hand;
+    for (steps = 0; steps < 2 * blocks; steps++)
+      {
+	struct disk_cache_info *info = &disk_cache_info[index];
+
+	if (! (info->flags & DC_DONT_REUSE) && ! info->ref_count)
+	  {
+	    if (! (info->flags & DC_RECENT))
+	      break;
+	    info->flags &= ~DC_RECENT;
+	  }
 
-  /* The next place in the disk cache becomes the current hint.  */
-  disk_cache_hint = index + 1;
-  if (disk_cache_hint >= disk_cache_blocks)
-    disk_cache_hint -= disk_cache_blocks;
+	ext2_debug ("reject %u -> %d (ref_count = %hu, flags = %#hx)",
+		    info->block, index, info->ref_count, info->flags);
+
+	/* Just move to next block.  */
+	if (++index >= blocks)
+	  index = 0;
+      }
+
+    /* The next place in the disk cache becomes the current hand.  */
+    disk_cache_hand = index + 1;
+    if (disk_cache_hand >= blocks)
+      disk_cache_hand = 0;
+  }
 
   /* Is suitable place found?  */
   if ((disk_cache_info[index].flags & DC_DONT_REUSE)
@@ -1088,8 +1313,11 @@ retry_ref:
 
   /* Re-associate.  */
   if (disk_cache_info[index].block != DC_NO_BLOCK)
-    /* Remove old association.  */
-    hurd_ihash_remove (disk_cache_bptr, disk_cache_info[index].block);
+    {
+      /* Remove old association.  */
+      hurd_ihash_remove (disk_cache_bptr, disk_cache_info[index].block);
+      disk_cache_stats.reassociations++;
+    }
   /* New association.  */
   if (hurd_ihash_add (disk_cache_bptr, block, bptr))
     ext2_panic ("Couldn't hurd_ihash_add new disk block");
@@ -1097,6 +1325,7 @@ retry_ref:
   disk_cache_info[index].block = block;
   assert (! disk_cache_info[index].ref_count);
   disk_cache_info[index].ref_count = 1;
+  disk_cache_info[index].flags |= DC_RECENT;
 
   /* All data structures are set up.  */
   pthread_mutex_unlock (&disk_cache_lock);
@@ -1114,6 +1343,7 @@ retry_ref:
       disk_cache_info[index].block = DC_NO_BLOCK;
       disk_cache_info[index].flags &=~ DC_UNTOUCHED;
       disk_cache_info[index].ref_count = 0;
+      disk_cache_stats.failed_reassociations++;
       pthread_mutex_unlock (&disk_cache_lock);
 
       /* Prepare next time association of this page to succeed.  */
@@ -1171,6 +1401,8 @@ disk_cache_block_deref (void *ptr)
   assert (! (disk_cache_info[index].flags & DC_UNTOUCHED));
   assert (disk_cache_info[index].ref_count >= 1);
   disk_cache_info[index].ref_count--;
+  if (disk_cache_info[index].ref_count == 0)
+    pthread_cond_broadcast (&disk_cache_released);
   pthread_mutex_unlock (&disk_cache_lock);
 }
 
@@ -1192,6 +1424,90 @@ disk_cache_block_is_ref (block_t block)
   return ref;
 }
 
+/* Make the disk cache use BLOCKS blocks.  */
+error_t
+disk_cache_set_size (int blocks)
+{
+  int old, index, pending;
+  struct timespec timeout;
+
+  if (blocks < DISK_CACHE_MIN_BLOCKS || blocks > disk_cache_max_blocks)
+    return EINVAL;
+
+  pthread_mutex_lock (&disk_cache_lock);
+  if (blocks <= disk_cache_fixed_blocks)
+    {
+      pthread_mutex_unlock (&disk_cache_lock);
+      return EINVAL;
+    }
+  old = disk_cache_blocks;
+  disk_cache_blocks = blocks;
+  if (disk_cache_hand >= blocks)
+    disk_cache_hand = 0;
+  if (disk_cache_return_hand >= blocks)
+    disk_cache_return_hand = 0;
+  pthread_mutex_unlock (&disk_cache_lock);
+
+  if (blocks >= old)
+    /* The new blocks are free for use right away.  */
+    return 0;
+
+  /* Get the blocks no longer in the cache out of the kernel, writing back
+     any changes, and then forget what they were associated with.  A slot
+     is only free once the kernel has told us it evicted its page, so wait
+     a little for those notifications.  Blocks that are still referenced
+     or in core after that stay associated until a later resize; until
+     then, they are found as before, but never reused.  */
+  disk_cache_return (blocks, old - blocks);
+
+  clock_gettime (CLOCK_REALTIME, &timeout);
+  timeout.tv_sec++;
+
+  pthread_mutex_lock (&disk_cache_lock);
+  do
+    {
+      pending = 0;
+      for (index = blocks; index < old; index++)
+	{
+	  struct disk_cache_info *info = &disk_cache_info[index];
+
+	  if (info->block == DC_NO_BLOCK || info->ref_count
+	      || (info->flags & (DC_UNTOUCHED | DC_FIXED)))
+	    continue;
+
+	  if (info->flags & DC_INCORE)
+	    pending++;
+	  else
+	    {
+	      hurd_ihash_remove (disk_cache_bptr, info->block);
+	      info->block = DC_NO_BLOCK;
+	      info->flags &= ~DC_RECENT;
+	    }
+	}
+    }
+  while (pending
+	 && pthread_cond_timedwait (&disk_cache_released, &disk_cache_lock,
+				    &timeout) != ETIMEDOUT);
+  pthread_mutex_unlock (&disk_cache_lock);
+
+  return 0;
+}
+
+/* Print the statistics of the disk cache to STREAM.  */
+void
+disk_cache_print_stats (FILE *stream)
+{
+  pthread_mutex_lock (&disk_cache_lock);
+  fprintf (stream, "disk cache: %d blocks (%d max), %lu hits, %lu misses,"
+	   " %lu reassociations, %lu failed, %lu returned, %lu starved\n",
+	   disk_cache_blocks, disk_cache_max_blocks,
+	   disk_cache_stats.hits, disk_cache_stats.misses,
+	   disk_cache_stats.reassociations,
+	   disk_cache_stats.failed_reassociations,
+	   disk_cache_stats.returns, disk_cache_stats.starvations);
+  pthread_mutex_unlock (&disk_cache_lock);
+}
+
 /* Create the disk pager, and the file pager.  */
 void
 create_disk_pager (void)
@@ -1207,8 +1523,11 @@ create_disk_pager (void)
   upi->type = DISK;
   disk_pager_bucket = ports_create_bucket ();
   get_hypermetadata ();
-  disk_cache_blocks = DISK_CACHE_BLOCKS;
-  disk_cache_size = disk_cache_blocks << log2_block_size;
+  if (! disk_cache_blocks)
+    disk_cache_blocks = DISK_CACHE_BLOCKS;
+  if (disk_cache_max_blocks < disk_cache_blocks)
+    disk_cache_max_blocks = disk_cache_blocks;
+  disk_cache_size = (store_offset_t) disk_cache_max_blocks << log2_block_size;
   diskfs_start_disk_pager (upi, disk_pager_bucket, MAY_CACHE, 1,
 			   disk_cache_size, &disk_cache);
   disk_cache_init ();
@@ -1256,6 +1575,7 @@ diskfs_get_filemap (struct node *node, vm_prot_t prot)
 	  upi->type = FILE_DATA;
 	  upi->node = node;
 	  upi->max_prot = prot;
+	  diskfs_readahead_init (&upi->readahead);
 	  diskfs_nref_light (node);
 	  node->dn->pager =
 	    pager_create (upi, file_pager_bucket, MAY_CACHE,
@@ -1294,6 +1614,9 @@ drop_pager_softrefs (struct node *node)
     ports_port_ref (pager);
   pthread_spin_unlock (&node_to_page_lock);
 
+  /* Windows left by io_read and io_write on the file.  */
+  if (pager)
+    pager_memcpy_release (pager);
   if (MAY_CACHE && pager)
     {
       pager_sync (pager, 0);
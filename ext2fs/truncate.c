@@ -239,6 +239,7 @@ force_delayed_copies (struct node *node, off_t length)
     {
       mach_port_t obj;
 
+      pager_memcpy_release (pager);
       pager_change_attributes (pager, MAY_CACHE, MEMORY_OBJECT_COPY_NONE, 1);
       obj = diskfs_get_filemap (node, VM_PROT_READ);
       if (obj != MACH_PORT_NULL)
@@ -291,7 +292,7 @@ diskfs_truncate (struct node *node, off_t length)
   if (length >= node->dn_stat.st_size)
     return 0;
 
-  if (! node->dn_stat.st_blocks)
+  if (! node->dn_stat.st_blocks && ! node->dn->delalloc_blocks)
     /* There aren't really any blocks allocated, so just frob the size.  This
        is true for fast symlinks, and also apparently for some device nodes
        in linux.  */
@@ -350,6 +351,10 @@ diskfs_truncate (struct node *node, off_t length)
       trunc_triple_indirect (node, end, bptrs + EXT2_TIND_BLOCK, offs, &fbr);
 
       free_block_run_finish (&fbr);
+      ext2_flush_block_runs (node);
+
+      /* The pages past the new end won't be written out anymore.  */
+      ext2_delalloc_release (node, end);
 
       node->allocsize = round_block (length);
 
@@ -36,9 +36,6 @@ struct disknode
 {
   cluster_t start_cluster;
 
-  /* Links on hash list.  */
-  struct node *hnext, **hprevp;
-
   /* The inode as returned by virtual inode management routines.  */
   inode_t inode;
 
@@ -114,6 +111,7 @@ void allow_pager_softrefs (struct node *);
 void create_fat_pager (void);
 
 void flush_node_pager (struct node *node);
+void release_node_pager_windows (struct node *node);
 
 void write_all_disknodes ();
 
@@ -37,27 +37,8 @@
 #define UF_IMMUTABLE 0
 #endif
 
-#define INOHSZ  512
-#if     ((INOHSZ&(INOHSZ-1)) == 0)
-#define INOHASH(ino)    ((ino)&(INOHSZ-1))
-#else
-#define INOHASH(ino)    (((unsigned)(ino))%INOHSZ)
-#endif
-
-static struct node *nodehash[INOHSZ];
-static size_t nodehash_nr_items;
-
 static error_t read_node (struct node *np, vm_address_t buf);
 
-/* Initialize the inode hash table.  */
-void
-inode_init ()
-{
-  int n;
-  for (n = 0; n < INOHSZ; n++)
-    nodehash[n] = 0;
-}
-
 /* Fetch inode INUM, set *NPP to the node structure; gain one user
    reference and lock the node.  */
 error_t
@@ -68,15 +49,12 @@ diskfs_cached_lookup (ino64_t inum, struct node **npp)
   struct disknode *dn;
 
   pthread_spin_lock (&diskfs_node_refcnt_lock);
-  for (np = nodehash[INOHASH(inum)]; np; np = np->dn->hnext)
-    if (np->cache_id == inum)
-      {
-        np->references++;
-        pthread_spin_unlock (&diskfs_node_refcnt_lock);
-        pthread_mutex_lock (&np->lock);
-        *npp = np;
-        return 0;
-      }
+  np = diskfs_node_cache_lookup (inum);
+  if (np)
+    {
+      *npp = np;
+      return 0;
+    }
 
   /* Format specific data for the new node.  */
   dn = malloc (sizeof (struct disknode));
@@ -99,15 +77,17 @@ diskfs_cached_lookup (ino64_t inum, struct node **npp)
   np->cache_id = inum;
   np->dn->inode = vi_lookup(inum);
 
+  /* Put NP in the inode cache.  */
+  err = diskfs_node_cache_add (np);
+  if (err)
+    {
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      free (dn);
+      diskfs_destroy_node (np);
+      return err;
+    }
+
   pthread_mutex_lock (&np->lock);
-  
-  /* Put NP in NODEHASH.  */
-  dn->hnext = nodehash[INOHASH(inum)];
-  if (dn->hnext)
-    dn->hnext->dn->hprevp = &dn->hnext;
-  dn->hprevp = &nodehash[INOHASH(inum)];
-  nodehash[INOHASH(inum)] = np;
-  nodehash_nr_items += 1;
 
   pthread_spin_unlock (&diskfs_node_refcnt_lock);
   
@@ -134,15 +114,12 @@ diskfs_cached_lookup_in_dirbuf (int inum, struct node **npp, vm_address_t buf)
   struct disknode *dn;
 
   pthread_spin_lock (&diskfs_node_refcnt_lock);
-  for (np = nodehash[INOHASH(inum)]; np; np = np->dn->hnext)
-    if (np->cache_id == inum)
-      {
-        np->references++;
-        pthread_spin_unlock (&diskfs_node_refcnt_lock);
-        pthread_mutex_lock (&np->lock);
-        *npp = np;
-        return 0;
-      }
+  np = diskfs_node_cache_lookup (inum);
+  if (np)
+    {
+      *npp = np;
+      return 0;
+    }
 
   /* Format specific data for the new node.  */
   dn = malloc (sizeof (struct disknode));
@@ -165,15 +142,17 @@ diskfs_cached_lookup_in_dirbuf (int inum, struct node **npp, vm_address_t buf)
   np->cache_id = inum;
   np->dn->inode = vi_lookup(inum);
 
+  /* Put NP in the inode cache.  */
+  err = diskfs_node_cache_add (np);
+  if (err)
+    {
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      free (dn);
+      diskfs_destroy_node (np);
+      return err;
+    }
+
   pthread_mutex_lock (&np->lock);
-  
-  /* Put NP in NODEHASH.  */
-  dn->hnext = nodehash[INOHASH(inum)];
-  if (dn->hnext)
-    dn->hnext->dn->hprevp = &dn->hnext;
-  dn->hprevp = &nodehash[INOHASH(inum)];
-  nodehash[INOHASH(inum)] = np;
-  nodehash_nr_items += 1;
 
   pthread_spin_unlock (&diskfs_node_refcnt_lock);
   
@@ -197,29 +176,21 @@ ifind (ino_t inum)
   struct node *np;
 
   pthread_spin_lock (&diskfs_node_refcnt_lock);
-  for (np = nodehash[INOHASH(inum)]; np; np = np->dn->hnext)
-    {
-      if (np->cache_id != inum)
-        continue;
-
-      assert (np->references);
-      pthread_spin_unlock (&diskfs_node_refcnt_lock);
-      return np;
-    }
-  assert (0);
+  np = diskfs_node_cache_find (inum);
+  assert (np && np->references);
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+  return np;
 }
 
-/* The last reference to a node has gone away; drop it from the hash
-   table and clean all state in the dn structure.  */
+/* The last reference to a node has gone away; drop it from the inode
+   cache and clean all state in the dn structure.  Nodes are not kept
+   in the cache, as they hold a reference to their directory.  */
 void
 diskfs_node_norefs (struct node *np)
 {
   struct cluster_chain *last = np->dn->first;
 
-  *np->dn->hprevp = np->dn->hnext;
-  if (np->dn->hnext)
-    np->dn->hnext->dn->hprevp = np->dn->hprevp;
-  nodehash_nr_items -= 1;
+  diskfs_node_cache_remove (np);
 
   while (last)
     {
@@ -243,7 +214,7 @@ diskfs_node_norefs (struct node *np)
   assert (!np->dn->pager);
 
   free (np->dn);
-  free (np);
+  diskfs_destroy_node (np);
 }
 
 /* The last hard reference to a node has gone away; arrange to have
@@ -549,46 +520,7 @@ diskfs_node_reload (struct node *node)
 error_t
 diskfs_node_iterate (error_t (*fun)(struct node *))
 {
-  error_t err = 0;
-  int n;
-  size_t num_nodes;
-  struct node *node, **node_list, **p;
-
-  pthread_spin_lock (&diskfs_node_refcnt_lock);
-
-  /* We must copy everything from the hash table into another data structure
-     to avoid running into any problems with the hash-table being modified
-     during processing (normally we delegate access to hash-table with
-     diskfs_node_refcnt_lock, but we can't hold this while locking the
-     individual node locks).  */
-
-  num_nodes = nodehash_nr_items;
-
-  node_list = alloca (num_nodes * sizeof (struct node *));
-  p = node_list;
-  for (n = 0; n < INOHSZ; n++)
-    for (node = nodehash[n]; node; node = node->dn->hnext)
-      {
-        *p++ = node;
-        node->references++;
-      }
-
-  pthread_spin_unlock (&diskfs_node_refcnt_lock);
-
-  p = node_list;
-  while (num_nodes-- > 0)
-    {
-      node = *p++;
-      if (!err)
-        {
-          pthread_mutex_lock (&node->lock);
-          err = (*fun)(node);
-          pthread_mutex_unlock (&node->lock);
-        }
-      diskfs_nrele (node);
-    }
-
-  return err;
+  return diskfs_node_cache_iterate (fun);
 }
 
 /* Write all active disknodes into the ext2_inode pager. */
@@ -704,6 +636,8 @@ diskfs_truncate (struct node *node, loff_t length)
       diskfs_file_update (node, 1);
     }
 
+  release_node_pager_windows (node);
+
   pthread_rwlock_wrlock (&node->dn->alloc_lock);
 
   /* Update the size on disk; if we crash, we'll loose.  */
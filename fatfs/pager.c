@@ -304,6 +304,98 @@ file_pager_read_huge_page (struct node *node, vm_offset_t page,
   return err;
 }
 
+/* Read LENGTH bytes of pages for the pager backing NODE at offset PAGE,
+   into BUF.  Runs of clusters which are consecutive on disk are read
+   with a single store_read.  */
+static error_t
+file_pager_read_pages (struct node *node, vm_offset_t page, vm_size_t length,
+		       void **buf, int *writelock)
+{
+  error_t err = 0;
+  pthread_rwlock_t *lock = NULL;
+  vm_size_t left = length, offs = 0;
+  /* The granularity in which we look up clusters.  */
+  vm_size_t step = (bytes_per_cluster < vm_page_size
+		    ? bytes_per_cluster : vm_page_size);
+  store_offset_t pending_block = 0;
+  size_t pending_len = 0;
+  void *new_buf;
+  size_t new_len;
+
+  *writelock = 0;
+
+  if (page >= node->allocsize)
+    return EIO;
+
+  if (page + left > node->allocsize)
+    left = node->allocsize - page;
+
+  *buf = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (*buf == MAP_FAILED)
+    return ENOMEM;
+
+  while (left > 0 && !err)
+    {
+      cluster_t cluster;
+      store_offset_t block;
+
+      err = find_cluster (node, page, &cluster, &lock);
+      if (err)
+	break;
+
+      block = FAT_FIRST_CLUSTER_BLOCK (cluster)
+	+ ((page % bytes_per_cluster) >> store->log2_block_size);
+
+      if (pending_len > 0
+	  && block != pending_block + (pending_len >> store->log2_block_size))
+	{
+	  /* Read the pending run into the tail of our buffer.  */
+	  new_buf = *buf + offs;
+	  new_len = length - offs;
+	  err = store_read (store, pending_block, pending_len,
+			    &new_buf, &new_len);
+	  if (!err && new_len != pending_len)
+	    err = EIO;
+	  if (!err && new_buf != *buf + offs)
+	    {
+	      memcpy (*buf + offs, new_buf, new_len);
+	      munmap (new_buf, round_page (new_len));
+	    }
+	  offs += pending_len;
+	  pending_len = 0;
+	}
+
+      if (pending_len == 0)
+	pending_block = block;
+      pending_len += step;
+
+      page += step;
+      left -= step;
+    }
+
+  if (!err && pending_len > 0)
+    {
+      new_buf = *buf + offs;
+      new_len = length - offs;
+      err = store_read (store, pending_block, pending_len, &new_buf, &new_len);
+      if (!err && new_len != pending_len)
+	err = EIO;
+      if (!err && new_buf != *buf + offs)
+	{
+	  memcpy (*buf + offs, new_buf, new_len);
+	  munmap (new_buf, round_page (new_len));
+	}
+    }
+
+  if (lock)
+    pthread_rwlock_unlock (lock);
+
+  if (err)
+    munmap (*buf, length);
+
+  return err;
+}
+
 struct pending_clusters
   {
     /* The cluster number of the first of the clusters.  */
@@ -565,6 +657,26 @@ pager_read_page (struct user_pager_info *pager, vm_offset_t page,
     }
 }
 
+/* Satisfy a multi-page pager read request for the file pager PAGER, of
+   LENGTH bytes at offset START into BUF.  The FAT pager and the fixed
+   root directory of FAT12/16 read their pages one at a time, and so do
+   requests reaching past the last page of the file, so that the pages
+   beyond it get an error as a single page request would.  */
+error_t
+pager_read_pages (struct user_pager_info *pager, vm_offset_t start,
+		  vm_size_t length, vm_address_t *buf, int *writelock)
+{
+  if (pager->type == FAT
+      || (pager->node == diskfs_root_node
+	  && (fat_type == FAT12 || fat_type == FAT16)))
+    return EOPNOTSUPP;
+  else if (start + length > round_page (pager->node->allocsize))
+    return EOPNOTSUPP;
+  else
+    return file_pager_read_pages (pager->node, start, length,
+				  (void **)buf, writelock);
+}
+
 /* Satisfy a pager write request for either the disk pager or file pager
    PAGER, from the page at offset PAGE from BUF.  */
 error_t
@@ -708,6 +820,26 @@ flush_node_pager (struct node *node)
     }
 }
 
+/* Unmap the windows pager_memcpy keeps for NODE's pager, so that they
+   don't outlive a truncation.  */
+void
+release_node_pager_windows (struct node *node)
+{
+  struct pager *pager;
+
+  pthread_spin_lock (&node_to_page_lock);
+  pager = node->dn->pager;
+  if (pager)
+    ports_port_ref (pager);
+  pthread_spin_unlock (&node_to_page_lock);
+
+  if (pager)
+    {
+      pager_memcpy_release (pager);
+      ports_port_deref (pager);
+    }
+}
+
 /* Return in *OFFSET and *SIZE the minimum valid address the pager
    will accept and the size of the object.  */
 inline error_t
@@ -853,6 +985,9 @@ drop_pager_softrefs (struct node *node)
     ports_port_ref (pager);
   pthread_spin_unlock (&node_to_page_lock);
 
+  /* Also drops the windows release_node_pager_windows would.  */
+  if (pager)
+    pager_memcpy_release (pager);
   if (MAY_CACHE && pager)
     pager_change_attributes (pager, 0, MEMORY_OBJECT_COPY_DELAY, 0);
   if (pager)
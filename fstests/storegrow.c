@@ -0,0 +1,96 @@
+/* Test that a file store can be used past its old size after growing.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This program is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   This program is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+/* Open a file store on a scratch file of OLD_CHUNKS chunks, grow it to
+   NEW_CHUNKS with store_set_size, and write and read back every chunk,
+   including the ones past the old size.  */
+
+#include <errno.h>
+#include <error.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <hurd/store.h>
+
+#define CHUNK_SIZE 512
+#define OLD_CHUNKS 4
+#define NEW_CHUNKS 64
+
+int
+main (int argc, char **argv)
+{
+  char name[] = "/tmp/storegrowXXXXXX";
+  struct store *store;
+  char chunk[CHUNK_SIZE];
+  error_t err;
+  int fd, n;
+
+  fd = mkstemp (name);
+  if (fd < 0)
+    error (1, errno, "mkstemp");
+  if (ftruncate (fd, OLD_CHUNKS * CHUNK_SIZE) < 0)
+    error (1, errno, "ftruncate");
+
+  /* The run index of the store is made for the old size.  */
+  err = store_file_open (name, 0, &store);
+  if (err)
+    error (1, err, "store_file_open: %s", name);
+
+  err = store_set_size (store, NEW_CHUNKS * CHUNK_SIZE);
+  if (err)
+    error (1, err, "store_set_size");
+
+  for (n = 0; n < NEW_CHUNKS; n++)
+    {
+      store_offset_t addr = (n * CHUNK_SIZE) >> store->log2_block_size;
+      size_t amount;
+
+      memset (chunk, n, sizeof chunk);
+      err = store_write (store, addr, chunk, sizeof chunk, &amount);
+      if (err)
+	error (1, err, "store_write: chunk %d", n);
+      if (amount != sizeof chunk)
+	error (1, 0, "store_write: chunk %d: short write", n);
+    }
+
+  for (n = 0; n < NEW_CHUNKS; n++)
+    {
+      store_offset_t addr = (n * CHUNK_SIZE) >> store->log2_block_size;
+      void *buf = chunk;
+      size_t len = sizeof chunk, i;
+
+      err = store_read (store, addr, sizeof chunk, &buf, &len);
+      if (err)
+	error (1, err, "store_read: chunk %d", n);
+      if (len != sizeof chunk)
+	error (1, 0, "store_read: chunk %d: short read", n);
+      for (i = 0; i < len; i++)
+	if (((unsigned char *) buf)[i] != (unsigned char) n)
+	  error (1, 0, "store_read: chunk %d: bad data", n);
+      if (buf != chunk)
+	munmap (buf, len);
+    }
+
+  store_free (store);
+  close (fd);
+  unlink (name);
+
+  puts ("ok");
+  return 0;
+}
@@ -68,7 +68,7 @@ ftpfs_create_node (struct ftpfs_dir_entry *e, const char *rmt_path,
   if (err)
     {
       free (nn);
-      free (new);
+      netfs_destroy_node (new);
       return err;
     }
 
@@ -107,7 +107,7 @@ netfs_node_norefs (struct node *node)
     ccache_free (nn->contents);
 
   free (nn);
-  free (node);
+  netfs_destroy_node (node);
 
   /* Caller expects us to leave this locked... */
   pthread_spin_lock (&netfs_node_refcnt_lock);
@@ -35,7 +35,7 @@ netfs_node_norefs (struct node *node)
        freed by another party.  */
     node->nn->name->node = 0;
   free (node->nn);
-  free (node);
+  netfs_destroy_node (node);
 }
 
 /* Attempt to create a file named NAME in DIR for USER with MODE.  Set *NODE
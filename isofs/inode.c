@@ -31,13 +31,6 @@
    record for symlinks and zero length files, and file_start otherwise.
    Only for hard links to zero length files we get extra inodes.  */
 
-#define	INOHSZ	512
-#if	((INOHSZ&(INOHSZ-1)) == 0)
-#define	INOHASH(ino)	((ino>>8)&(INOHSZ-1))
-#else
-#define	INOHASH(ino)	(((unsigned)(ino>>8))%INOHSZ)
-#endif
-
 struct node_cache
 {
   struct dirrect *dr;		/* somewhere in disk_image */
@@ -52,6 +45,44 @@ static int node_cache_size = 0;
 static int node_cache_alloced = 0;
 struct node_cache *node_cache = 0;
 
+static hurd_ihash_key_t
+node_cache_hash (const void *key)
+{
+  return hurd_ihash_hash32 (key, sizeof (off_t), 0);
+}
+
+static int
+node_cache_compare (const void *a, const void *b)
+{
+  return *(const off_t *) a == *(const off_t *) b;
+}
+
+/* Index of NODE_CACHE by identifier.  The keys point to the ID member
+   of the entries, the values are the indices of the entries plus one.
+   diskfs_node_refcnt_lock protects it along with NODE_CACHE.  */
+static struct hurd_ihash node_cache_index
+  = HURD_IHASH_INITIALIZER_GKI (HURD_IHASH_NO_LOCP,
+				node_cache_hash, node_cache_compare);
+
+/* Return the index of the entry of NODE_CACHE with identifier ID, or
+   -1 if there is none.  */
+static int
+node_cache_slot (off_t id)
+{
+  void *value = hurd_ihash_find (&node_cache_index, (hurd_ihash_key_t) &id);
+  return value ? (uintptr_t) value - 1 : -1;
+}
+
+/* Add entry I of NODE_CACHE to the index.  */
+static void
+node_cache_index_add (int i)
+{
+  error_t err = hurd_ihash_add (&node_cache_index,
+				(hurd_ihash_key_t) &node_cache[i].id,
+				(void *) (uintptr_t) (i + 1));
+  assert_perror (err);
+}
+
 /* Forward */
 static error_t read_disknode (struct node *,
 			      struct dirrect *, struct rrip_lookup *);
@@ -64,18 +95,16 @@ static error_t read_disknode (struct node *,
 void
 inode_cache_find (off_t id, struct node **npp)
 {
-  int i;
+  int i = node_cache_slot (id);
 
-  for (i = 0; i < node_cache_size; i++)
-    if (node_cache[i].id == id
-	&& node_cache[i].np)
-      {
-	*npp = node_cache[i].np;
-	(*npp)->references++;
-	pthread_spin_unlock (&diskfs_node_refcnt_lock);
-	pthread_mutex_lock (&(*npp)->lock);
-	return;
-      }
+  if (i >= 0 && node_cache[i].np)
+    {
+      *npp = node_cache[i].np;
+      (*npp)->references++;
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      pthread_mutex_lock (&(*npp)->lock);
+      return;
+    }
   *npp = 0;
 }
 
@@ -107,14 +136,15 @@ cache_inode (struct node *np, struct dirrect *record,
     id = (off_t) ((void *) record - (void *) disk_image);
 
   /* First see if there's already an entry. */
-  for (i = 0; i < node_cache_size; i++)
-    if (node_cache[i].id == id)
-      break;
+  i = node_cache_slot (id);
 
-  if (i == node_cache_size)
+  if (i < 0)
     {
+      i = node_cache_size;
       if (node_cache_size >= node_cache_alloced)
 	{
+	  struct node_cache *old = node_cache;
+
 	  if (!node_cache_alloced)
 	    {
 	      /* Initialize */
@@ -129,8 +159,26 @@ cache_inode (struct node *np, struct dirrect *record,
 				    * node_cache_alloced);
 	    }
 	  assert (node_cache);
+
+	  if (node_cache != old)
+	    {
+	      /* The keys of the index point into the old array.  */
+	      error_t err;
+	      int j;
+
+	      hurd_ihash_destroy (&node_cache_index);
+	      hurd_ihash_init (&node_cache_index, HURD_IHASH_NO_LOCP);
+	      hurd_ihash_set_gki (&node_cache_index,
+				  node_cache_hash, node_cache_compare);
+	      err = hurd_ihash_reserve (&node_cache_index, node_cache_alloced);
+	      assert_perror (err);
+	      for (j = 0; j < node_cache_size; j++)
+		node_cache_index_add (j);
+	    }
 	}
       node_cache_size++;
+      node_cache[i].id = id;
+      node_cache_index_add (i);
     }
 
   c = &node_cache[i];
@@ -513,7 +561,7 @@ diskfs_node_norefs (struct node *np)
 
   assert (!np->dn->fileinfo);
   free (np->dn);
-  free (np);
+  diskfs_destroy_node (np);
 }
 
 /* The last hard reference to a node has gone away; arrange to have
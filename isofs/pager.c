@@ -80,6 +80,61 @@ pager_read_page (struct user_pager_info *upi,
   return 0;
 }
 
+/* Implement the pager_read_pages callback from the pager library.  File
+   data is contiguous on the medium, so any run of pages can be read with
+   a single store_read.  */
+error_t
+pager_read_pages (struct user_pager_info *upi,
+		  vm_offset_t start,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *writelock)
+{
+  error_t err;
+  daddr_t addr;
+  struct node *np = upi->np;
+  size_t read = 0;
+  size_t amount = length;
+  void *data, *new_buf;
+
+  if (upi->type != FILE_DATA || start >= np->dn_stat.st_size)
+    return EOPNOTSUPP;
+
+  /* This is a read-only medium */
+  *writelock = 1;
+
+  addr = np->dn->file_start + (start >> store->log2_block_size);
+  if (start + length > np->dn_stat.st_size)
+    amount = round_page (np->dn_stat.st_size - start);
+
+  data = mmap (0, length, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (data == MAP_FAILED)
+    return ENOMEM;
+
+  new_buf = data;
+  read = length;
+  err = store_read (store, addr, amount, &new_buf, &read);
+  if (!err && read != amount)
+    err = EIO;
+  if (err)
+    {
+      munmap (data, length);
+      return err;
+    }
+  if (new_buf != data)
+    {
+      memcpy (data, new_buf, read);
+      munmap (new_buf, round_page (read));
+    }
+  *buf = (vm_address_t) data;
+
+  if (amount > np->dn_stat.st_size - start)
+    memset ((void *) *buf + (np->dn_stat.st_size - start), 0,
+	    amount - (np->dn_stat.st_size - start));
+
+  return 0;
+}
+
 /* This function should never be called.  */
 error_t
 pager_write_page (struct user_pager_info *pager,
@@ -226,6 +281,8 @@ drop_pager_softrefs (struct node *np)
 
   if (upi)
     {
+      /* Windows left by io_read on the file.  */
+      pager_memcpy_release (upi->p);
       pager_change_attributes (upi->p, 0, MEMORY_OBJECT_COPY_DELAY, 0);
       ports_port_deref (upi->p);
     }
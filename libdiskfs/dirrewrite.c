@@ -37,7 +37,7 @@ error_t diskfs_dirrewrite (struct node *dp,
 {
   error_t err;
 
-  diskfs_purge_lookup_cache (dp, oldnp);
+  diskfs_purge_lookup_cache_name (dp, name);
 
   err = diskfs_dirrewrite_hard (dp, np, ds);
   if (err)
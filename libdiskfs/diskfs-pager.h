@@ -41,6 +41,36 @@ extern void diskfs_start_disk_pager (struct user_pager_info *info,
 
 extern struct pager *diskfs_disk_pager;
 
+/* Sequential read ahead state for a file pager.  Since libpager
+   serializes the requests to each pager, no locking is done.  */
+struct diskfs_readahead
+  {
+    vm_offset_t next;		/* Where we expect the next pagein.  */
+    vm_size_t window;		/* Current read ahead size in bytes.  */
+  };
+
+/* The minimum and maximum read ahead windows, in pages.  A maximum of
+   zero disables read ahead.  */
+extern int diskfs_readahead_min, diskfs_readahead_max;
+
+/* Initialize the read ahead state RA of a new file pager.  */
+extern void diskfs_readahead_init (struct diskfs_readahead *ra);
+
+/* Note that PAGE, LENGTH bytes long, was paged in by the pager with read
+   ahead state RA.  If this continues a sequential access pattern, the
+   read ahead window grows and the range the pager should read ahead and
+   offer to the kernel (using pager_offer_pages) is returned in *START and
+   *LENGTH; otherwise, *LENGTH is zero.  If the pager does not read
+   everything it is asked to, it should set RA->next to the offset of the
+   first page it did not read ahead.  */
+extern void diskfs_readahead_update (struct diskfs_readahead *ra,
+				     vm_offset_t page, vm_size_t length,
+				     vm_offset_t *start, vm_size_t *ra_length);
+
+/* Note that LENGTH bytes read ahead were offered to the kernel, for the
+   statistics.  */
+extern void diskfs_readahead_offered (vm_size_t length);
+
 struct disk_image_user
   {
     jmp_buf env;
@@ -22,10 +22,13 @@
 
 #include <assert.h>
 #include <unistd.h>
+#include <stdio.h>
 #include <pthread.h>
 #include <hurd/ports.h>
 #include <hurd/fshelp.h>
 #include <hurd/iohelp.h>
+#include <hurd/slab.h>
+#include <hurd/ihash.h>
 #include <idvec.h>
 #include <features.h>
 #include <refcount.h>
@@ -119,6 +122,11 @@ struct node
 
   ino64_t cache_id;
 
+  /* Used by the node cache, see diskfs_node_cache_add.  */
+  hurd_ihash_locp_t cache_locp;
+  struct node *cache_lru_next, *cache_lru_prev;
+  int cache_flags;
+
   int author_tracks_uid;
 };
 
@@ -686,6 +694,13 @@ diskfs_notice_filechange (struct node *np, enum file_changed_type type,
    The new node will have one hard reference and no light references.  */
 struct node *diskfs_make_node (struct disknode *dn);
 
+/* Free the node structure NP, made by diskfs_make_node, once it has no
+   references; this is normally done by diskfs_node_norefs.  Node
+   structures are cached, so this is much cheaper than making them
+   with malloc.  Nodes made by diskfs_make_node_alloc are released
+   with free as before.  */
+void diskfs_destroy_node (struct node *np);
+
 /* Create a new node structure.  Also allocate SIZE bytes for the
    disknode.  The address of the disknode can be obtained using
    diskfs_node_disknode.  The new node will have one hard reference
@@ -949,12 +964,68 @@ void diskfs_enter_lookup_cache (struct node *dir, struct node *np,
    directory DP. */
 void diskfs_purge_lookup_cache (struct node *dp, struct node *np);
 
+/* Purge the entry for NAME inside directory DP from the cache.  This is
+   much cheaper than diskfs_purge_lookup_cache.  */
+void diskfs_purge_lookup_cache_name (struct node *dp, const char *name);
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
    a newly allocated reference. */
 struct node *diskfs_check_lookup_cache (struct node *dir, const char *name);
 
+/* Make the lookup cache hold about SIZE entries, dropping its current
+   contents.  A SIZE of zero disables the cache.  */
+error_t diskfs_set_name_cache_size (size_t size);
+
+/* Return the number of entries the lookup cache can hold.  */
+size_t diskfs_get_name_cache_size (void);
+
+/* Libdiskfs provides a cache of nodes indexed by their cache id, which
+   filesystems can use to implement diskfs_cached_lookup and
+   diskfs_node_iterate.  The cache can also keep nodes whose last
+   reference went away in memory, so that they need not be read from
+   disk again when they are looked up soon after.  All these functions
+   must be called with diskfs_node_refcnt_lock held, unless noted
+   otherwise.  */
+
+/* Return the node in the cache with cache id ID, or null, without
+   adding a reference.  */
+struct node *diskfs_node_cache_find (ino64_t id);
+
+/* Look up the node with cache id ID in the cache.  If it is there, add
+   a hard reference to it, release diskfs_node_refcnt_lock, lock the
+   node and return it.  Otherwise return null, with
+   diskfs_node_refcnt_lock still held.  */
+struct node *diskfs_node_cache_lookup (ino64_t id);
+
+/* Add NP, whose cache_id must be set, to the cache.  */
+error_t diskfs_node_cache_add (struct node *np);
+
+/* Remove NP from the cache, if it is there.  */
+void diskfs_node_cache_remove (struct node *np);
+
+/* Call this from diskfs_node_norefs once the state that should not
+   outlive the last reference has been released.  If NP can be kept in
+   memory, unlock it and return nonzero, and NP must not be freed.
+   Otherwise return zero; NP should then be removed from the cache and
+   freed as usual.  Keeping NP may drop the least recently used nodes
+   kept, by calling diskfs_node_norefs for them with the node unlocked.
+   Nodes without links are never kept.  */
+int diskfs_node_cache_keep (struct node *np);
+
+/* Call FUN for each node in the cache which is in use, as described for
+   diskfs_node_iterate.  diskfs_node_refcnt_lock must not be held.  */
+error_t diskfs_node_cache_iterate (error_t (*fun)(struct node *));
+
+/* Make the node cache keep up to SIZE nodes which are not in use.  A
+   SIZE of zero disables keeping them.  diskfs_node_refcnt_lock must not
+   be held.  */
+error_t diskfs_set_node_cache_size (size_t size);
+
+/* Return the number of unused nodes the node cache can keep.  */
+size_t diskfs_get_node_cache_size (void);
+
 /* Rename directory node FNP (whose parent is FDP, and which has name
    FROMNAME in that directory) to have name TONAME inside directory
    TDP.  None of these nodes are locked, and none should be locked
@@ -1062,6 +1133,15 @@ extern const struct argp diskfs_store_startup_argp;
    must already have a sane value).  */
 error_t diskfs_append_std_options (char **argz, size_t *argz_len);
 
+/* Print statistics about the filesystem to STREAM.  This is called when
+   the --print-stats runtime option is given.  The default definition of
+   this routine simply calls diskfs_print_std_stats; filesystems keeping
+   statistics of their own may override it to add those.  */
+void diskfs_print_stats (FILE *stream);
+
+/* Print the statistics kept by the diskfs library to STREAM.  */
+void diskfs_print_std_stats (FILE *stream);
+
 /* Demultiplex incoming messages on ports created by libdiskfs.  */
 int diskfs_demuxer (mach_msg_header_t *, mach_msg_header_t *);
 
@@ -22,224 +22,209 @@
 #include "priv.h"
 #include <assert.h>
 #include <string.h>
-
+
 /* The name cache is implemented using a hash table.
 
    We use buckets of a fixed size.  We approximate the
    least-frequently used cache algorithm by counting the number of
-   lookups using saturating arithmetic in the two lowest bits of the
-   pointer to the name.  Using this strategy we achieve a constant
-   worst-case lookup and insertion time.  */
+   lookups using saturating arithmetic in a small counter kept with
+   each entry.  Using this strategy we achieve a constant worst-case
+   lookup and insertion time.
+
+   The buckets are divided among CACHE_SHARDS shards, each protected by
+   its own lock, by the low bits of the hash, so that lookups in
+   different buckets rarely contend.  The table can be resized with
+   diskfs_set_name_cache_size, which takes all the shard locks.  */
 
-/* Number of buckets.  Must be a power of two. */
-#define CACHE_SIZE	256
+/* Number of shards.  Must be a power of two, and no larger than the
+   number of buckets.  */
+#define CACHE_SHARDS	64
 
 /* Entries per bucket.  */
 #define BUCKET_SIZE	4
 
-/* A mask for fast binary modulo.  */
-#define CACHE_MASK	(CACHE_SIZE - 1)
+/* Names shorter than this are stored in the entry itself; longer ones
+   are allocated separately.  */
+#define NAME_INLINE	40
 
-/* Cache bucket with BUCKET_SIZE entries.
-
-   The layout of the bucket is chosen so that it will be straight
-   forward to use vector operations in the future.  */
-struct cache_bucket
+/* An entry of the cache.  */
+struct cache_entry
 {
-  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  If
-     NULL, the entry is unused.  */
-  unsigned long name[BUCKET_SIZE];
+  /* Name of the node NODE_CACHE_ID in the directory DIR_CACHE_ID.  It
+     points to INLINE_NAME if the name fits there.  If NULL, the entry
+     is unused.  */
+  char *name;
 
   /* The key.  */
-  unsigned long key[BUCKET_SIZE];
+  unsigned long key;
 
   /* Used to indentify nodes to the fs dependent code.  */
-  ino64_t dir_cache_id[BUCKET_SIZE];
+  ino64_t dir_cache_id;
 
   /* 0 for NODE_CACHE_ID means a `negative' entry -- recording that
      there's definitely no node with this name.  */
-  ino64_t node_cache_id[BUCKET_SIZE];
-};
-
-/* The cache.  */
-static struct cache_bucket name_cache[CACHE_SIZE];
+  ino64_t node_cache_id;
 
-/* Protected by this lock.  */
-static pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER;
-
-/* Given VALUE, return the char pointer.  */
-static inline char *
-charp (unsigned long value)
-{
-  return (char *) (value & ~3L);
-}
-
-/* Given VALUE, return the approximation of use frequency.  */
-static inline unsigned long
-frequ (unsigned long value)
-{
-  return value & 3;
-}
-
-/* Add an entry in the Ith slot of the given bucket.  If there is a
-   value there, remove it first.  */
-static inline void
-add_entry (struct cache_bucket *b, int i,
-	   const char *name, unsigned long key,
-	   ino64_t dir_cache_id, ino64_t node_cache_id)
-{
-  if (b->name[i])
-    free (charp (b->name[i]));
+  /* The length of NAME.  */
+  unsigned short name_len;
 
-  b->name[i] = (unsigned long) strdup (name);
-  assert ((b->name[i] & 3) == 0);
-  if (b->name[i] == 0)
-    return;
+  /* Approximation of the use frequency, from 0 to 3.  */
+  unsigned short frequ;
 
-  b->key[i] = key;
-  b->dir_cache_id[i] = dir_cache_id;
-  b->node_cache_id[i] = node_cache_id;
-}
+  char inline_name[NAME_INLINE];
+};
 
-/* Remove the entry in the Ith slot of the given bucket.  */
-static inline void
-remove_entry (struct cache_bucket *b, int i)
+/* Cache bucket with BUCKET_SIZE entries.  */
+struct cache_bucket
 {
-  if (b->name[i])
-    free (charp (b->name[i]));
-  b->name[i] = 0;
-}
+  struct cache_entry entry[BUCKET_SIZE];
+};
 
-/* Check if the entry in the Ith slot of the given bucket is
-   valid.  */
-static inline int
-valid_entry (struct cache_bucket *b, int i)
+/* A shard of the cache.  It is aligned so that shards don't share
+   cache lines.  */
+struct cache_shard
 {
-  return b->name[i] != 0;
-}
-
-/* This is the Murmur3 hash algorithm.  */
+  pthread_mutex_t lock;
 
-#define FORCE_INLINE inline __attribute__((always_inline))
+  /* If there is no best candidate to replace, pick any.  We
+     approximate any by picking the slot depicted by REPLACE, and
+     increment REPLACE then.  */
+  int replace;
 
-inline uint32_t rotl32 ( uint32_t x, int8_t r )
-{
-  return (x << r) | (x >> (32 - r));
-}
+  /* Statistics.  */
+  unsigned long hits, negative_hits, misses, evictions;
+} __attribute__ ((aligned (64)));
 
-#define ROTL32(x,y)     rotl32(x,y)
+static struct cache_shard shards[CACHE_SHARDS];
 
-/* Block read - if your platform needs to do endian-swapping or can
-   only handle aligned reads, do the conversion here.  */
+/* The cache.  It has CACHE_BUCKETS buckets, a power of two, or is NULL
+   if the cache is disabled.  Both are protected by all the shard locks
+   together, so holding any one of them is enough to read them.  */
+static struct cache_bucket *name_cache;
+static size_t cache_buckets;
 
-FORCE_INLINE uint32_t getblock32 ( const uint32_t * p, int i )
-{
-  return p[i];
-}
-
-/* Finalization mix - force all bits of a hash block to avalanche.  */
+static pthread_once_t cache_once = PTHREAD_ONCE_INIT;
 
-FORCE_INLINE uint32_t fmix32 ( uint32_t h )
+/* Return the number of buckets a cache of SIZE entries should have.  */
+static size_t
+buckets_for (size_t size)
 {
-  h ^= h >> 16;
-  h *= 0x85ebca6b;
-  h ^= h >> 13;
-  h *= 0xc2b2ae35;
-  h ^= h >> 16;
+  size_t buckets;
+
+  if (size == 0)
+    return 0;
 
-  return h;
+  for (buckets = CACHE_SHARDS; buckets * BUCKET_SIZE < size; buckets *= 2)
+    ;
+  return buckets;
 }
 
-/* The Murmur3 hash function.  */
-void MurmurHash3_x86_32 ( const void * key, int len,
-                          uint32_t seed, void * out )
+static void
+cache_init (void)
 {
-  const uint8_t * data = (const uint8_t*)key;
-  const int nblocks = len / 4;
-
-  uint32_t h1 = seed;
-
-  const uint32_t c1 = 0xcc9e2d51;
-  const uint32_t c2 = 0x1b873593;
-
-  /* body */
-
-  const uint32_t * blocks = (const uint32_t *)(data + nblocks*4);
-
-  for(int i = -nblocks; i; i++)
-  {
-    uint32_t k1 = getblock32(blocks,i);
-
-    k1 *= c1;
-    k1 = ROTL32(k1,15);
-    k1 *= c2;
-
-    h1 ^= k1;
-    h1 = ROTL32(h1,13);
-    h1 = h1*5+0xe6546b64;
-  }
+  int i;
 
-  /* tail */
+  for (i = 0; i < CACHE_SHARDS; i++)
+    pthread_mutex_init (&shards[i].lock, NULL);
 
-  const uint8_t * tail = (const uint8_t*)(data + nblocks*4);
+  cache_buckets = buckets_for (DEFAULT_NAME_CACHE_SIZE);
+  name_cache = calloc (cache_buckets, sizeof *name_cache);
+  if (! name_cache)
+    cache_buckets = 0;
+}
 
-  uint32_t k1 = 0;
+/* Return the shard responsible for KEY, locked.  */
+static inline struct cache_shard *
+lock_shard (unsigned long key)
+{
+  struct cache_shard *shard = &shards[key & (CACHE_SHARDS - 1)];
 
-  switch(len & 3)
-  {
-  case 3: k1 ^= tail[2] << 16;
-  case 2: k1 ^= tail[1] << 8;
-  case 1: k1 ^= tail[0];
-          k1 *= c1; k1 = ROTL32(k1,15); k1 *= c2; h1 ^= k1;
-  };
+  pthread_once (&cache_once, cache_init);
+  pthread_mutex_lock (&shard->lock);
+  return shard;
+}
 
-  /* finalization */
+/* Add an entry in E.  If there is a value there, remove it first.  */
+static inline void
+add_entry (struct cache_entry *e,
+	   const char *name, size_t name_len, unsigned long key,
+	   ino64_t dir_cache_id, ino64_t node_cache_id)
+{
+  if (e->name && e->name != e->inline_name)
+    free (e->name);
 
-  h1 ^= len;
+  if (name_len < NAME_INLINE)
+    {
+      memcpy (e->inline_name, name, name_len + 1);
+      e->name = e->inline_name;
+    }
+  else
+    {
+      e->name = strdup (name);
+      if (e->name == NULL)
+	return;
+    }
 
-  h1 = fmix32(h1);
+  e->name_len = name_len;
+  e->frequ = 0;
+  e->key = key;
+  e->dir_cache_id = dir_cache_id;
+  e->node_cache_id = node_cache_id;
+}
 
-  *(uint32_t*)out = h1;
+/* Remove the entry E.  */
+static inline void
+remove_entry (struct cache_entry *e)
+{
+  if (e->name && e->name != e->inline_name)
+    free (e->name);
+  e->name = NULL;
 }
-
-/* If there is no best candidate to replace, pick any.  We approximate
-   any by picking the slot depicted by REPLACE, and increment REPLACE
-   then.  */
-static int replace;
-
-/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache.  If it is found,
-   return 1 and set BUCKET and INDEX to the item.  Otherwise, return 0
-   and set BUCKET and INDEX to the slot where the item should be
-   inserted.  */
+
+/* Check if the entry E is valid.  */
 static inline int
-lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
-	struct cache_bucket **bucket, int *index)
+valid_entry (struct cache_entry *e)
+{
+  return e->name != NULL;
+}
+
+/* Lookup (DIR_CACHE_ID, NAME, KEY) in the cache, whose shard SHARD
+   must be locked.  If it is found, return it.  Otherwise, return NULL
+   and set *SLOT to the entry the item should replace.  */
+static inline struct cache_entry *
+lookup (struct cache_shard *shard, ino64_t dir_cache_id,
+	const char *name, size_t name_len, unsigned long key,
+	struct cache_entry **slot)
 {
-  struct cache_bucket *b = *bucket = &name_cache[key & CACHE_MASK];
+  struct cache_bucket *b = &name_cache[key & (cache_buckets - 1)];
   unsigned long best = 3;
   int i;
 
   for (i = 0; i < BUCKET_SIZE; i++)
     {
-      unsigned long f = frequ (b->name[i]);
+      struct cache_entry *e = &b->entry[i];
 
-      if (valid_entry (b, i)
-	  && b->key[i] == key
-	  && b->dir_cache_id[i] == dir_cache_id
-	  && strcmp (charp (b->name[i]), name) == 0)
+      if (valid_entry (e)
+	  && e->key == key
+	  && e->dir_cache_id == dir_cache_id
+	  && e->name_len == name_len
+	  && memcmp (e->name, name, name_len) == 0)
 	{
-	  if (f < 3)
-	    b->name[i] += 1;
-
-	  *index = i;
-	  return 1;
+	  if (e->frequ < 3)
+	    e->frequ++;
+	  return e;
 	}
 
       /* Keep track of the replacement candidate.  */
-      if (f < best)
+      if (! valid_entry (e))
+	{
+	  best = 0;
+	  *slot = e;
+	}
+      else if (e->frequ < best)
 	{
-	  best = f;
-	  *index = i;
+	  best = e->frequ;
+	  *slot = e;
 	}
     }
 
@@ -247,64 +232,96 @@ lookup (ino64_t dir_cache_id, const char *name, unsigned long key,
      any entry.  */
   if (best == 3)
     {
-      *index = replace;
-      replace = (replace + 1) & (BUCKET_SIZE - 1);
+      *slot = &b->entry[shard->replace];
+      shard->replace = (shard->replace + 1) & (BUCKET_SIZE - 1);
     }
 
-  return 0;
+  return NULL;
 }
 
 /* Hash the directory cache_id and the name.  */
 static inline unsigned long
-hash (ino64_t dir_cache_id, const char *name)
+hash (ino64_t dir_cache_id, const char *name, size_t name_len)
 {
-  unsigned long h;
-  MurmurHash3_x86_32 (&dir_cache_id, sizeof dir_cache_id, 0, &h);
-  MurmurHash3_x86_32 (name, strlen (name), h, &h);
-  return h;
+  uint32_t h = hurd_ihash_hash32 (&dir_cache_id, sizeof dir_cache_id, 0);
+  return hurd_ihash_hash32 (name, name_len, h);
 }
-
+
 /* Node NP has just been found in DIR with NAME.  If NP is null, that
    means that this name has been confirmed as absent in the directory. */
 void
 diskfs_enter_lookup_cache (struct node *dir, struct node *np, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t name_len = strlen (name);
+  unsigned long key = hash (dir->cache_id, name, name_len);
   ino64_t value = np ? np->cache_id : 0;
-  struct cache_bucket *bucket;
-  int i = 0, found;
+  struct cache_shard *shard = lock_shard (key);
+  struct cache_entry *e, *slot;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (! found)
-    add_entry (bucket, i, name, key, dir->cache_id, value);
-  else
-    if (bucket->node_cache_id[i] != value)
-      bucket->node_cache_id[i] = value;
+  if (name_cache)
+    {
+      e = lookup (shard, dir->cache_id, name, name_len, key, &slot);
+      if (! e)
+	{
+	  if (valid_entry (slot))
+	    shard->evictions++;
+	  add_entry (slot, name, name_len, key, dir->cache_id, value);
+	}
+      else if (e->node_cache_id != value)
+	e->node_cache_id = value;
+    }
 
-  pthread_mutex_unlock (&cache_lock);
+  pthread_mutex_unlock (&shard->lock);
 }
-
+
 /* Purge all references in the cache to NP as a node inside
    directory DP. */
 void
 diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 {
-  int i;
-  struct cache_bucket *b;
+  int i, s;
+  size_t b;
 
-  pthread_mutex_lock (&cache_lock);
+  pthread_once (&cache_once, cache_init);
 
-  for (b = &name_cache[0]; b < &name_cache[CACHE_SIZE]; b++)
-    for (i = 0; i < BUCKET_SIZE; i++)
-      if (valid_entry (b, i)
-	  && b->dir_cache_id[i] == dp->cache_id
-	  && b->node_cache_id[i] == np->cache_id)
-	remove_entry (b, i);
+  for (s = 0; s < CACHE_SHARDS; s++)
+    {
+      pthread_mutex_lock (&shards[s].lock);
+
+      /* The buckets of shard S are the ones whose low bits are S.  */
+      for (b = s; b < cache_buckets; b += CACHE_SHARDS)
+	for (i = 0; i < BUCKET_SIZE; i++)
+	  {
+	    struct cache_entry *e = &name_cache[b].entry[i];
+	    if (valid_entry (e)
+		&& e->dir_cache_id == dp->cache_id
+		&& e->node_cache_id == np->cache_id)
+	      remove_entry (e);
+	  }
+
+      pthread_mutex_unlock (&shards[s].lock);
+    }
+}
 
-  pthread_mutex_unlock (&cache_lock);
+/* Purge the entry for NAME inside directory DP from the cache.  */
+void
+diskfs_purge_lookup_cache_name (struct node *dp, const char *name)
+{
+  size_t name_len = strlen (name);
+  unsigned long key = hash (dp->cache_id, name, name_len);
+  struct cache_shard *shard = lock_shard (key);
+  struct cache_entry *e, *slot;
+
+  if (name_cache)
+    {
+      e = lookup (shard, dp->cache_id, name, name_len, key, &slot);
+      if (e)
+	remove_entry (e);
+    }
+
+  pthread_mutex_unlock (&shard->lock);
 }
-
+
 /* Scan the cache looking for NAME inside DIR.  If we don't know
    anything entry at all, then return 0.  If the entry is confirmed to
    not exist, then return -1.  Otherwise, return NP for the entry, with
@@ -312,21 +329,28 @@ diskfs_purge_lookup_cache (struct node *dp, struct node *np)
 struct node *
 diskfs_check_lookup_cache (struct node *dir, const char *name)
 {
-  unsigned long key = hash (dir->cache_id, name);
+  size_t name_len = strlen (name);
+  unsigned long key = hash (dir->cache_id, name, name_len);
   int lookup_parent = name[0] == '.' && name[1] == '.' && name[2] == '\0';
-  struct cache_bucket *bucket;
-  int i, found;
+  struct cache_shard *shard;
+  struct cache_entry *e, *slot;
 
   if (lookup_parent && dir == diskfs_root_node)
     /* This is outside our file system, return cache miss.  */
     return NULL;
 
-  pthread_mutex_lock (&cache_lock);
-  found = lookup (dir->cache_id, name, key, &bucket, &i);
-  if (found)
+  shard = lock_shard (key);
+  e = name_cache ? lookup (shard, dir->cache_id, name, name_len, key, &slot)
+		 : NULL;
+  if (e)
     {
-      ino64_t id = bucket->node_cache_id[i];
-      pthread_mutex_unlock (&cache_lock);
+      ino64_t id = e->node_cache_id;
+
+      if (id == 0)
+	shard->negative_hits++;
+      else
+	shard->hits++;
+      pthread_mutex_unlock (&shard->lock);
 
       if (id == 0)
 	/* A negative cache entry.  */
@@ -349,21 +373,25 @@ diskfs_check_lookup_cache (struct node *dir, const char *name)
 	      err = diskfs_cached_lookup (id, &np);
 	      pthread_mutex_lock (&dir->lock);
 
+	      if (err)
+		return 0;
+
 	      /* In the window where DP was unlocked, we might
 		 have lost.  So check the cache again, and see
 		 if it's still there; if so, then we win. */
-	      pthread_mutex_lock (&cache_lock);
-	      found = lookup (dir->cache_id, name, key, &bucket, &i);
-	      if (! found
-		  || ! bucket->node_cache_id[i] != id)
+	      shard = lock_shard (key);
+	      e = (name_cache
+		   ? lookup (shard, dir->cache_id, name, name_len, key, &slot)
+		   : NULL);
+	      if (! e || e->node_cache_id != id)
 		{
-		  pthread_mutex_unlock (&cache_lock);
+		  pthread_mutex_unlock (&shard->lock);
 
 		  /* Lose */
 		  diskfs_nput (np);
 		  return 0;
 		}
-	      pthread_mutex_unlock (&cache_lock);
+	      pthread_mutex_unlock (&shard->lock);
 	    }
 	  else
 	    err = diskfs_cached_lookup (id, &np);
@@ -371,6 +399,91 @@ diskfs_check_lookup_cache (struct node *dir, const char *name)
 	}
     }
 
-  pthread_mutex_unlock (&cache_lock);
+  if (name_cache)
+    shard->misses++;
+  pthread_mutex_unlock (&shard->lock);
   return 0;
 }
+
+error_t
+diskfs_set_name_cache_size (size_t size)
+{
+  size_t buckets = buckets_for (size);
+  struct cache_bucket *new = NULL, *old;
+  size_t old_buckets, b;
+  int i;
+
+  if (buckets)
+    {
+      new = calloc (buckets, sizeof *new);
+      if (! new)
+	return ENOMEM;
+    }
+
+  pthread_once (&cache_once, cache_init);
+
+  for (i = 0; i < CACHE_SHARDS; i++)
+    pthread_mutex_lock (&shards[i].lock);
+
+  old = name_cache;
+  old_buckets = cache_buckets;
+  name_cache = new;
+  cache_buckets = buckets;
+
+  for (i = CACHE_SHARDS - 1; i >= 0; i--)
+    pthread_mutex_unlock (&shards[i].lock);
+
+  for (b = 0; b < old_buckets; b++)
+    for (i = 0; i < BUCKET_SIZE; i++)
+      remove_entry (&old[b].entry[i]);
+  free (old);
+
+  return 0;
+}
+
+size_t
+diskfs_get_name_cache_size (void)
+{
+  size_t size;
+
+  pthread_once (&cache_once, cache_init);
+  pthread_mutex_lock (&shards[0].lock);
+  size = cache_buckets * BUCKET_SIZE;
+  pthread_mutex_unlock (&shards[0].lock);
+  return size;
+}
+
+void
+_diskfs_name_cache_get_stats (unsigned long *hits,
+			      unsigned long *negative_hits,
+			      unsigned long *misses,
+			      unsigned long *evictions)
+{
+  int i;
+
+  pthread_once (&cache_once, cache_init);
+
+  *hits = *negative_hits = *misses = *evictions = 0;
+  for (i = 0; i < CACHE_SHARDS; i++)
+    {
+      pthread_mutex_lock (&shards[i].lock);
+      *hits += shards[i].hits;
+      *negative_hits += shards[i].negative_hits;
+      *misses += shards[i].misses;
+      *evictions += shards[i].evictions;
+      pthread_mutex_unlock (&shards[i].lock);
+    }
+}
+
+/* Print the name cache statistics to STREAM.  */
+void
+_diskfs_name_cache_print_stats (FILE *stream)
+{
+  unsigned long hits, negative_hits, misses, evictions;
+
+  _diskfs_name_cache_get_stats (&hits, &negative_hits, &misses, &evictions);
+  fprintf (stream, "name cache: %zu entries, %lu hits, %lu negative hits,"
+	   " %lu misses, %lu evictions\n",
+	   diskfs_get_name_cache_size (), hits, negative_hits, misses,
+	   evictions);
+}
@@ -0,0 +1,273 @@
+/* Cache of nodes indexed by their cache id
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#include "priv.h"
+#include <stddef.h>
+
+/* Values of NP->cache_flags.  */
+#define NODE_CACHE_KEPT		0x1	/* On the list of unused nodes.  */
+#define NODE_CACHE_EVICTING	0x2	/* Being dropped for good.  */
+
+static hurd_ihash_key_t
+node_cache_hash (const void *key)
+{
+  return hurd_ihash_hash32 (key, sizeof (ino64_t), 0);
+}
+
+static int
+node_cache_compare (const void *a, const void *b)
+{
+  return *(const ino64_t *) a == *(const ino64_t *) b;
+}
+
+/* All nodes in the cache, keyed by a pointer to their cache id.  This
+   and everything below is protected by diskfs_node_refcnt_lock, which
+   also protects the reference counts deciding whether a node can stay
+   in the table.  */
+static struct hurd_ihash node_cache
+  = HURD_IHASH_INITIALIZER_GKI (offsetof (struct node, cache_locp),
+				node_cache_hash, node_cache_compare);
+
+/* The nodes without references kept in memory, most recently used
+   first, and their number.  */
+static struct node *lru_head, *lru_tail;
+static size_t lru_count;
+
+/* The number of nodes without references to keep.  */
+static size_t node_cache_max = DEFAULT_NODE_CACHE_SIZE;
+
+static struct
+{
+  unsigned long hits;		/* Lookups finding a node in use.  */
+  unsigned long revivals;	/* Lookups finding a kept node.  */
+  unsigned long misses;		/* Lookups finding nothing.  */
+  unsigned long evictions;	/* Kept nodes dropped for good.  */
+} node_cache_stats;
+
+static void
+lru_remove (struct node *np)
+{
+  if (np->cache_lru_prev)
+    np->cache_lru_prev->cache_lru_next = np->cache_lru_next;
+  else
+    lru_head = np->cache_lru_next;
+  if (np->cache_lru_next)
+    np->cache_lru_next->cache_lru_prev = np->cache_lru_prev;
+  else
+    lru_tail = np->cache_lru_prev;
+  np->cache_lru_next = np->cache_lru_prev = 0;
+  np->cache_flags &= ~NODE_CACHE_KEPT;
+  lru_count--;
+}
+
+/* Drop kept nodes until no more than MAX are left.  */
+static void
+trim (size_t max)
+{
+  while (lru_count > max)
+    {
+      struct node *victim = lru_tail;
+
+      lru_remove (victim);
+      diskfs_node_cache_remove (victim);
+      victim->cache_flags |= NODE_CACHE_EVICTING;
+      node_cache_stats.evictions++;
+      diskfs_node_norefs (victim);
+    }
+}
+
+struct node *
+diskfs_node_cache_find (ino64_t id)
+{
+  return hurd_ihash_find (&node_cache, (hurd_ihash_key_t) &id);
+}
+
+struct node *
+diskfs_node_cache_lookup (ino64_t id)
+{
+  struct node *np = hurd_ihash_find (&node_cache, (hurd_ihash_key_t) &id);
+
+  if (! np)
+    {
+      node_cache_stats.misses++;
+      return 0;
+    }
+
+  if (np->cache_flags & NODE_CACHE_KEPT)
+    {
+      lru_remove (np);
+      node_cache_stats.revivals++;
+    }
+  else
+    node_cache_stats.hits++;
+
+  np->references++;
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+  pthread_mutex_lock (&np->lock);
+  return np;
+}
+
+error_t
+diskfs_node_cache_add (struct node *np)
+{
+  np->cache_lru_next = np->cache_lru_prev = 0;
+  np->cache_flags = 0;
+  return hurd_ihash_add (&node_cache, (hurd_ihash_key_t) &np->cache_id, np);
+}
+
+void
+diskfs_node_cache_remove (struct node *np)
+{
+  if (np->cache_locp)
+    {
+      hurd_ihash_locp_remove (&node_cache, np->cache_locp);
+      np->cache_locp = 0;
+    }
+}
+
+int
+diskfs_node_cache_keep (struct node *np)
+{
+  if (node_cache_max == 0
+      || ! np->cache_locp
+      || (np->cache_flags & NODE_CACHE_EVICTING)
+      || np->dn_stat.st_nlink == 0)
+    return 0;
+
+  /* diskfs_drop_node has released these, but the node is not going
+     away, so make sure nothing refers to them anymore.  */
+  np->transbox.active = MACH_PORT_NULL;
+  np->dirmod_reqs = 0;
+  np->filemod_reqs = 0;
+  pthread_mutex_unlock (&np->lock);
+
+  np->cache_flags |= NODE_CACHE_KEPT;
+  np->cache_lru_prev = 0;
+  np->cache_lru_next = lru_head;
+  if (lru_head)
+    lru_head->cache_lru_prev = np;
+  else
+    lru_tail = np;
+  lru_head = np;
+  lru_count++;
+
+  trim (node_cache_max);
+  return 1;
+}
+
+error_t
+diskfs_node_cache_iterate (error_t (*fun)(struct node *))
+{
+  error_t err = 0;
+  size_t num_nodes;
+  struct node **node_list, **p;
+
+  pthread_spin_lock (&diskfs_node_refcnt_lock);
+
+  /* We must copy everything from the table into another data structure
+     to avoid running into any problems with the table being modified
+     during processing (normally we delegate access to the table with
+     diskfs_node_refcnt_lock, but we can't hold this while locking the
+     individual node locks).  Kept nodes have nothing to do.  */
+  num_nodes = node_cache.nr_items - lru_count;
+
+  node_list = malloc (num_nodes * sizeof (struct node *));
+  if (node_list == NULL)
+    {
+      pthread_spin_unlock (&diskfs_node_refcnt_lock);
+      return ENOMEM;
+    }
+
+  p = node_list;
+  HURD_IHASH_ITERATE (&node_cache, value)
+    {
+      struct node *node = value;
+
+      if (node->cache_flags & NODE_CACHE_KEPT)
+	continue;
+      *p++ = node;
+      node->references++;
+    }
+
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+
+  p = node_list;
+  while (num_nodes-- > 0)
+    {
+      struct node *node = *p++;
+      if (!err)
+	{
+	  pthread_mutex_lock (&node->lock);
+	  err = (*fun)(node);
+	  pthread_mutex_unlock (&node->lock);
+	}
+      diskfs_nrele (node);
+    }
+
+  free (node_list);
+  return err;
+}
+
+error_t
+diskfs_set_node_cache_size (size_t size)
+{
+  pthread_spin_lock (&diskfs_node_refcnt_lock);
+  node_cache_max = size;
+  trim (size);
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+  return 0;
+}
+
+size_t
+diskfs_get_node_cache_size (void)
+{
+  return node_cache_max;
+}
+
+/* Drop all kept nodes, for example because their contents may not
+   match the disk anymore.  */
+void
+_diskfs_node_cache_flush (void)
+{
+  pthread_spin_lock (&diskfs_node_refcnt_lock);
+  trim (0);
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+}
+
+/* Print the statistics of the node cache to STREAM.  */
+void
+_diskfs_node_cache_print_stats (FILE *stream)
+{
+  size_t nodes, kept;
+  typeof (node_cache_stats) stats;
+
+  pthread_spin_lock (&diskfs_node_refcnt_lock);
+  nodes = node_cache.nr_items;
+  kept = lru_count;
+  stats = node_cache_stats;
+  pthread_spin_unlock (&diskfs_node_refcnt_lock);
+
+  if (nodes == 0 && stats.hits + stats.revivals + stats.misses == 0)
+    return;
+
+  fprintf (stream, "node cache: %zu nodes, %zu of %zu unused kept,"
+	   " %lu hits, %lu revivals, %lu misses, %lu evictions\n",
+	   nodes, kept, node_cache_max, stats.hits, stats.revivals,
+	   stats.misses, stats.evictions);
+}
@@ -17,8 +17,27 @@
 
 #include "priv.h"
 #include <fcntl.h>
+#include <sys/file.h>
 
 
+/* Set up the synchronization objects of a node, which stay set up while
+   it is in the node cache.  */
+static error_t
+construct_node (void *hook, void *buffer)
+{
+  struct node *np = buffer;
+
+  pthread_mutex_init (&np->lock, NULL);
+  fshelp_transbox_init (&np->transbox, &np->lock, np);
+  iohelp_initialize_conch (&np->conch, &np->lock);
+  fshelp_lock_init (&np->userlock);
+  return 0;
+}
+
+/* The cache of node structures made by diskfs_make_node.  */
+struct hurd_slab_space _diskfs_node_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct node, construct_node, NULL, NULL);
+
 static struct node *
 init_node (struct node *np, struct disknode *dn)
 {
@@ -28,7 +47,6 @@ init_node (struct node *np, struct disknode *dn)
   np->dn_set_mtime = 0;
   np->dn_stat_dirty = 0;
 
-  pthread_mutex_init (&np->lock, NULL);
   np->references = 1;
   np->light_references = 0;
   np->owner = 0;
@@ -39,9 +57,9 @@ init_node (struct node *np, struct disknode *dn)
   np->filemod_reqs = 0;
   np->filemod_tick = 0;
 
-  fshelp_transbox_init (&np->transbox, &np->lock, np);
-  iohelp_initialize_conch (&np->conch, &np->lock);
-  fshelp_lock_init (&np->userlock);
+  np->cache_locp = 0;
+  np->cache_lru_next = np->cache_lru_prev = 0;
+  np->cache_flags = 0;
 
   return np;
 }
@@ -51,11 +69,21 @@ init_node (struct node *np, struct disknode *dn)
 struct node *
 diskfs_make_node (struct disknode *dn)
 {
-  struct node *np = malloc (sizeof (struct node));
+  struct node *np;
 
-  if (np == 0)
+  if (hurd_slab_alloc (&_diskfs_node_space, (void **) &np))
     return 0;
 
+  /* The node may have been used before, so reset the state of what
+     the constructor set up.  */
+  np->transbox.active = MACH_PORT_NULL;
+  np->transbox.flags = 0;
+  np->conch.holder = 0;
+  np->conch.holder_shared_page = 0;
+  np->userlock.type = LOCK_UN;
+  np->userlock.waiting = 0;
+  np->userlock.shcount = 0;
+
   return init_node (np, dn);
 }
 
@@ -71,5 +99,17 @@ diskfs_make_node_alloc (size_t size)
   if (np == NULL)
     return NULL;
 
+  construct_node (NULL, np);
   return init_node (np, diskfs_node_disknode (np));
 }
+
+/* Free the node structure NP, made by diskfs_make_node.  */
+void
+diskfs_destroy_node (struct node *np)
+{
+  /* Nodes are usually released with their lock held.  Leave it
+     unlocked for the next user; the constructor only runs once.  */
+  pthread_mutex_trylock (&np->lock);
+  pthread_mutex_unlock (&np->lock);
+  hurd_slab_dealloc (&_diskfs_node_space, np);
+}
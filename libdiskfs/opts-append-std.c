@@ -22,8 +22,10 @@
 
 #include <stdio.h>
 #include <argz.h>
+#include <hurd/pager.h>
 
 #include "priv.h"
+#include "diskfs-pager.h"
 
 error_t
 diskfs_append_std_options (char **argz, size_t *argz_len)
@@ -44,6 +46,65 @@ diskfs_append_std_options (char **argz, size_t *argz_len)
     err = argz_add (argz, argz_len, "--no-atime");
   if (!err && _diskfs_no_inherit_dir_group)
     err = argz_add (argz, argz_len, "--no-inherit-dir-group");
+  if (!err && pager_get_worker_count () != PAGER_DEFAULT_WORKER_COUNT)
+    {
+      char buf[80];
+      sprintf (buf, "--pager-workers=%d", pager_get_worker_count ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_readahead_min != DEFAULT_READAHEAD_MIN)
+    {
+      char buf[80];
+      sprintf (buf, "--readahead-min=%d", diskfs_readahead_min);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_readahead_max != DEFAULT_READAHEAD_MAX)
+    {
+      char buf[80];
+      sprintf (buf, "--readahead-max=%d", diskfs_readahead_max);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_get_name_cache_size () != DEFAULT_NAME_CACHE_SIZE)
+    {
+      char buf[80];
+      sprintf (buf, "--name-cache-size=%zu", diskfs_get_name_cache_size ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_get_name_cache_size () > 0)
+    {
+      /* Let fsysopts show how well the name cache does.  */
+      unsigned long hits, negative_hits, misses, evictions;
+      char buf[80];
+
+      _diskfs_name_cache_get_stats (&hits, &negative_hits, &misses,
+				    &evictions);
+      sprintf (buf, "--name-cache-stats=%lu,%lu,%lu,%lu",
+	       hits, negative_hits, misses, evictions);
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (!err && diskfs_get_node_cache_size () != DEFAULT_NODE_CACHE_SIZE)
+    {
+      char buf[80];
+      sprintf (buf, "--node-cache-size=%zu", diskfs_get_node_cache_size ());
+      err = argz_add (argz, argz_len, buf);
+    }
+  if (! err)
+    {
+      unsigned int min, max;
+      char buf[80];
+
+      ports_get_thread_limits (&min, &max);
+      if (min > 1)
+	{
+	  sprintf (buf, "--min-threads=%u", min);
+	  err = argz_add (argz, argz_len, buf);
+	}
+      if (!err && max)
+	{
+	  sprintf (buf, "--max-threads=%u", max);
+	  err = argz_add (argz, argz_len, buf);
+	}
+    }
 
   if (! err)
     {
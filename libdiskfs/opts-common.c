@@ -55,5 +55,27 @@ const struct argp_option diskfs_common_options[] =
    "Create new nodes with gid of parent dir (default)"},
   {"grpid",    0,   0, OPTION_ALIAS | OPTION_HIDDEN},
   {"bsdgroups", 0,   0, OPTION_ALIAS | OPTION_HIDDEN},
+  {"pager-workers", OPT_PAGER_WORKERS, "NUM", 0,
+   "Use NUM threads to service paging requests, so that paging for"
+   " different files can proceed in parallel (the default is 1)"},
+  {"readahead-min", OPT_READAHEAD_MIN, "PAGES", 0,
+   "Start reading ahead PAGES pages once sequential access to a file is"
+   " detected (the default is " DEFAULT_READAHEAD_MIN_STRING ")"},
+  {"readahead-max", OPT_READAHEAD_MAX, "PAGES", 0,
+   "Let the read ahead window grow up to PAGES pages; 0 disables read ahead"
+   " (the default is " DEFAULT_READAHEAD_MAX_STRING ")"},
+  {"name-cache-size", OPT_NAME_CACHE_SIZE, "ENTRIES", 0,
+   "Cache up to about ENTRIES directory lookups; 0 disables the cache"
+   " (the default is " DEFAULT_NAME_CACHE_SIZE_STRING ")"},
+  /* Reported by fsys_get_options, ignored when given back.  */
+  {"name-cache-stats", OPT_NAME_CACHE_STATS, "COUNTS", OPTION_HIDDEN},
+  {"node-cache-size", OPT_NODE_CACHE_SIZE, "NODES", 0,
+   "Keep up to NODES nodes in memory after they are last used; 0 disables"
+   " this (the default is " DEFAULT_NODE_CACHE_SIZE_STRING ")"},
+  {"min-threads", OPT_MIN_THREADS, "NUM", 0,
+   "Keep at least NUM threads ready to handle requests (the default is 1)"},
+  {"max-threads", OPT_MAX_THREADS, "NUM", 0,
+   "Handle at most NUM requests at once and queue the others; 0 means"
+   " no limit (the default is 0)"},
   {0, 0}
 };
@@ -19,21 +19,26 @@
    Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
 
 #include <argp.h>
+#include <hurd/pager.h>
 
 #include "priv.h"
+#include "diskfs-pager.h"
 
 static const struct argp_option
 std_runtime_options[] =
 {
   {"update", 'u',  0, 0, "Flush any meta-data cached in core"},
   {"remount", 0, 0, OPTION_HIDDEN | OPTION_ALIAS}, /* deprecated */
+  {"print-stats", OPT_PRINT_STATS, 0, 0,
+   "Print cache and i/o statistics to the error output"},
   {0, 0}
 };
 
 struct parse_hook
 {
   int readonly, sync, sync_interval, remount, nosuid, noexec, noatime,
-    noinheritdirgroup;
+    noinheritdirgroup, pager_workers, readahead_min, readahead_max,
+    name_cache_size, node_cache_size, min_threads, max_threads, print_stats;
 };
 
 /* Implement the options in H, and free H.  */
@@ -83,6 +88,34 @@ set_opts (struct parse_hook *h)
   if (h->noinheritdirgroup != -1)
     _diskfs_no_inherit_dir_group = h->noinheritdirgroup;
 
+  if (h->pager_workers != -1 && !err)
+    err = pager_set_worker_count (h->pager_workers);
+
+  if (h->readahead_min != -1)
+    diskfs_readahead_min = h->readahead_min;
+  if (h->readahead_max != -1)
+    diskfs_readahead_max = h->readahead_max;
+
+  if (h->name_cache_size != -1 && !err)
+    err = diskfs_set_name_cache_size (h->name_cache_size);
+  if (h->node_cache_size != -1 && !err)
+    err = diskfs_set_node_cache_size (h->node_cache_size);
+
+  if ((h->min_threads != -1 || h->max_threads != -1) && !err)
+    {
+      unsigned int min, max;
+
+      ports_get_thread_limits (&min, &max);
+      if (h->min_threads != -1)
+	min = h->min_threads;
+      if (h->max_threads != -1)
+	max = h->max_threads;
+      err = ports_set_thread_limits (min, max);
+    }
+
+  if (h->print_stats)
+    diskfs_print_stats (stderr);
+
   free (h);
 
   return err;
@@ -107,6 +140,43 @@ parse_opt (int opt, char *arg, struct argp_state *state)
     case OPT_NO_INHERIT_DIR_GROUP: h->noinheritdirgroup = 1; break;
     case OPT_INHERIT_DIR_GROUP: h->noinheritdirgroup = 0; break;
     case 'n': h->sync_interval = 0; h->sync = 0; break;
+    case OPT_PAGER_WORKERS:
+      h->pager_workers = atoi (arg);
+      if (h->pager_workers < 1)
+	return EINVAL;
+      break;
+    case OPT_READAHEAD_MIN:
+      h->readahead_min = atoi (arg);
+      if (h->readahead_min < 1)
+	return EINVAL;
+      break;
+    case OPT_READAHEAD_MAX:
+      h->readahead_max = atoi (arg);
+      if (h->readahead_max < 0)
+	return EINVAL;
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      h->name_cache_size = atoi (arg);
+      if (h->name_cache_size < 0)
+	return EINVAL;
+      break;
+    case OPT_NODE_CACHE_SIZE:
+      h->node_cache_size = atoi (arg);
+      if (h->node_cache_size < 0)
+	return EINVAL;
+      break;
+    case OPT_MIN_THREADS:
+      h->min_threads = atoi (arg);
+      if (h->min_threads < 0)
+	return EINVAL;
+      break;
+    case OPT_MAX_THREADS:
+      h->max_threads = atoi (arg);
+      if (h->max_threads < 0)
+	return EINVAL;
+      break;
+    case OPT_PRINT_STATS: h->print_stats = 1; break;
+    case OPT_NAME_CACHE_STATS: break;
     case 's':
       if (arg)
 	{
@@ -130,6 +200,10 @@ parse_opt (int opt, char *arg, struct argp_state *state)
 	  h->sync_interval = -1;
 	  h->remount = 0;
 	  h->nosuid = h->noexec = h->noatime = h->noinheritdirgroup = -1;
+	  h->pager_workers = h->readahead_min = h->readahead_max = -1;
+	  h->name_cache_size = h->node_cache_size = -1;
+	  h->min_threads = h->max_threads = -1;
+	  h->print_stats = 0;
 
 	  /* We know that we have one child, with which we share our hook.  */
 	  state->child_inputs[0] = h;
@@ -25,7 +25,9 @@
 #include <argp.h>
 #include <hurd/store.h>
 #include <hurd/paths.h>
+#include <hurd/pager.h>
 #include "priv.h"
+#include "diskfs-pager.h"
 
 const char *diskfs_boot_command_line;
 char **_diskfs_boot_command;
@@ -98,6 +100,44 @@ parse_startup_opt (int opt, char *arg, struct argp_state *state)
       diskfs_synchronous = 0;
       diskfs_default_sync_interval = 0;
       break;
+    case OPT_PAGER_WORKERS:
+      if (pager_set_worker_count (atoi (arg)))
+	argp_error (state, "%s: Invalid number of pager workers", arg);
+      break;
+    case OPT_READAHEAD_MIN:
+      diskfs_readahead_min = atoi (arg);
+      if (diskfs_readahead_min < 1)
+	argp_error (state, "%s: Invalid read ahead size", arg);
+      break;
+    case OPT_READAHEAD_MAX:
+      diskfs_readahead_max = atoi (arg);
+      if (diskfs_readahead_max < 0)
+	argp_error (state, "%s: Invalid read ahead size", arg);
+      break;
+    case OPT_NAME_CACHE_SIZE:
+      if (atoi (arg) < 0 || diskfs_set_name_cache_size (atoi (arg)))
+	argp_error (state, "%s: Invalid name cache size", arg);
+      break;
+    case OPT_NAME_CACHE_STATS:
+      break;
+    case OPT_NODE_CACHE_SIZE:
+      if (atoi (arg) < 0 || diskfs_set_node_cache_size (atoi (arg)))
+	argp_error (state, "%s: Invalid node cache size", arg);
+      break;
+    case OPT_MIN_THREADS:
+    case OPT_MAX_THREADS:
+      {
+	unsigned int min, max;
+
+	ports_get_thread_limits (&min, &max);
+	if (opt == OPT_MIN_THREADS)
+	  min = atoi (arg);
+	else
+	  max = atoi (arg);
+	if (atoi (arg) < 0 || ports_set_thread_limits (min, max))
+	  argp_error (state, "%s: Invalid number of threads", arg);
+      }
+      break;
 
       /* Boot options */
     case OPT_DEVICE_MASTER_PORT:
@@ -18,16 +18,21 @@
 #include "priv.h"
 #include <sys/file.h>
 
+/* The cache of peropen structures.  */
+struct hurd_slab_space _diskfs_peropen_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct peropen, NULL, NULL, NULL);
+
 /* Create and return a new peropen structure on node NP with open
    flags FLAGS.  */
 error_t
 diskfs_make_peropen (struct node *np, int flags, struct peropen *context,
 		     struct peropen **ppo)
 {
-  struct peropen *po = *ppo = malloc (sizeof (struct peropen));
+  struct peropen *po;
 
-  if (! po)
+  if (hurd_slab_alloc (&_diskfs_peropen_space, (void **) ppo))
     return ENOMEM;
+  po = *ppo;
 
   po->filepointer = 0;
   po->lock_status = LOCK_UN;
@@ -42,7 +47,10 @@ diskfs_make_peropen (struct node *np, int flags, struct peropen *context,
 	{
 	  po->path = strdup (context->path);
 	  if (! po->path)
-	    return ENOMEM;
+	    {
+	      hurd_slab_dealloc (&_diskfs_peropen_space, po);
+	      return ENOMEM;
+	    }
 	}
 
       po->root_parent = context->root_parent;
@@ -45,5 +45,5 @@ diskfs_release_peropen (struct peropen *po)
     diskfs_nrele (po->np);
 
   free (po->path);
-  free (po);
+  hurd_slab_dealloc (&_diskfs_peropen_space, po);
 }
@@ -61,13 +61,68 @@ extern const struct argp_option diskfs_common_options[];
 #define OPT_ATIME	602	/* --atime */
 #define OPT_NO_INHERIT_DIR_GROUP	603	/* --no-inherit-dir-group */
 #define OPT_INHERIT_DIR_GROUP		604	/* --inherit-dir-group */
+#define OPT_PAGER_WORKERS		605	/* --pager-workers */
+#define OPT_READAHEAD_MIN		606	/* --readahead-min */
+#define OPT_READAHEAD_MAX		607	/* --readahead-max */
+#define OPT_PRINT_STATS			608	/* --print-stats */
+#define OPT_NAME_CACHE_SIZE		609	/* --name-cache-size */
+#define OPT_MIN_THREADS			610	/* --min-threads */
+#define OPT_MAX_THREADS			611	/* --max-threads */
+#define OPT_NODE_CACHE_SIZE		612	/* --node-cache-size */
+#define OPT_NAME_CACHE_STATS		613	/* --name-cache-stats */
 
 /* Common value for diskfs_common_options and diskfs_default_sync_interval. */
 #define DEFAULT_SYNC_INTERVAL 30
 #define DEFAULT_SYNC_INTERVAL_STRING STRINGIFY(DEFAULT_SYNC_INTERVAL)
+
+/* Common values for diskfs_common_options and diskfs_readahead_min
+   and diskfs_readahead_max.  */
+#define DEFAULT_READAHEAD_MIN 4
+#define DEFAULT_READAHEAD_MIN_STRING STRINGIFY(DEFAULT_READAHEAD_MIN)
+#define DEFAULT_READAHEAD_MAX 32
+#define DEFAULT_READAHEAD_MAX_STRING STRINGIFY(DEFAULT_READAHEAD_MAX)
+
+/* Common value for diskfs_common_options and the name cache.  */
+#define DEFAULT_NAME_CACHE_SIZE 8192
+#define DEFAULT_NAME_CACHE_SIZE_STRING STRINGIFY(DEFAULT_NAME_CACHE_SIZE)
+
+/* Common value for diskfs_common_options and the node cache.  */
+#define DEFAULT_NODE_CACHE_SIZE 1024
+#define DEFAULT_NODE_CACHE_SIZE_STRING STRINGIFY(DEFAULT_NODE_CACHE_SIZE)
+
 #define STRINGIFY(x) STRINGIFY_1(x)
 #define STRINGIFY_1(x) #x
 
+/* Print the read ahead statistics to STREAM.  */
+void _diskfs_readahead_print_stats (FILE *stream);
+
+/* Print the name cache statistics to STREAM.  */
+void _diskfs_name_cache_print_stats (FILE *stream);
+
+/* Return the name cache statistics in *HITS, *NEGATIVE_HITS, *MISSES
+   and *EVICTIONS.  */
+void _diskfs_name_cache_get_stats (unsigned long *hits,
+				   unsigned long *negative_hits,
+				   unsigned long *misses,
+				   unsigned long *evictions);
+
+/* Print the node cache statistics to STREAM.  */
+void _diskfs_node_cache_print_stats (FILE *stream);
+
+/* Drop the unused nodes kept by the node cache.  */
+void _diskfs_node_cache_flush (void);
+
+/* Print the statistics of the request threads to STREAM.  */
+void _diskfs_threads_print_stats (FILE *stream);
+
+/* Print the statistics of the node, peropen and protid caches to
+   STREAM.  */
+void _diskfs_objects_print_stats (FILE *stream);
+
+/* The caches of node and peropen structures.  */
+extern struct hurd_slab_space _diskfs_node_space;
+extern struct hurd_slab_space _diskfs_peropen_space;
+
 /* Diskfs thinks the disk is dirty if this is set. */
 extern int _diskfs_diskdirty;
 
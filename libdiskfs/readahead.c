@@ -0,0 +1,91 @@
+/* Sequential read ahead for file pagers
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#include <stdio.h>
+#include "priv.h"
+#include "diskfs-pager.h"
+
+int diskfs_readahead_min = DEFAULT_READAHEAD_MIN;
+int diskfs_readahead_max = DEFAULT_READAHEAD_MAX;
+
+static struct
+{
+  pthread_spinlock_t lock;
+  unsigned long hits;		/* Pageins continuing a sequential run.  */
+  unsigned long misses;		/* Other pageins.  */
+  unsigned long pages;		/* Pages offered to the kernel.  */
+} readahead_stats = { .lock = PTHREAD_SPINLOCK_INITIALIZER };
+
+void
+diskfs_readahead_init (struct diskfs_readahead *ra)
+{
+  ra->next = 0;
+  ra->window = 0;
+}
+
+void
+diskfs_readahead_update (struct diskfs_readahead *ra,
+			 vm_offset_t page, vm_size_t length,
+			 vm_offset_t *start, vm_size_t *ra_length)
+{
+  vm_size_t min = diskfs_readahead_min * vm_page_size;
+  vm_size_t max = diskfs_readahead_max * vm_page_size;
+  int hit = (page == ra->next);
+
+  if (! hit)
+    /* Random access; don't read ahead until we see a sequential run.  */
+    ra->window = 0;
+  else if (ra->window == 0)
+    ra->window = min;
+  else
+    ra->window *= 2;
+
+  if (ra->window > max)
+    ra->window = max;
+
+  *start = page + length;
+  *ra_length = ra->window;
+  ra->next = *start + ra->window;
+
+  pthread_spin_lock (&readahead_stats.lock);
+  if (hit)
+    readahead_stats.hits++;
+  else
+    readahead_stats.misses++;
+  pthread_spin_unlock (&readahead_stats.lock);
+}
+
+void
+diskfs_readahead_offered (vm_size_t length)
+{
+  pthread_spin_lock (&readahead_stats.lock);
+  readahead_stats.pages += length / vm_page_size;
+  pthread_spin_unlock (&readahead_stats.lock);
+}
+
+/* Print the read ahead statistics to STREAM.  */
+void
+_diskfs_readahead_print_stats (FILE *stream)
+{
+  pthread_spin_lock (&readahead_stats.lock);
+  fprintf (stream, "readahead: %lu hits, %lu misses, %lu pages\n",
+	   readahead_stats.hits, readahead_stats.misses,
+	   readahead_stats.pages);
+  pthread_spin_unlock (&readahead_stats.lock);
+}
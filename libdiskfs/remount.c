@@ -37,6 +37,9 @@ diskfs_remount ()
   if (err)
     return err;
 
+  /* Unused nodes are not reloaded, so just forget them.  */
+  _diskfs_node_cache_flush ();
+
   err = diskfs_reload_global_state ();
   if (!err)
     err = diskfs_node_iterate (diskfs_node_reload);
@@ -0,0 +1,74 @@
+/* Print filesystem statistics
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#include <stdio.h>
+#include "priv.h"
+
+void
+diskfs_print_std_stats (FILE *stream)
+{
+  _diskfs_readahead_print_stats (stream);
+  _diskfs_name_cache_print_stats (stream);
+  _diskfs_node_cache_print_stats (stream);
+  _diskfs_threads_print_stats (stream);
+  _diskfs_objects_print_stats (stream);
+}
+
+/* Print the statistics of the request threads to STREAM.  */
+void
+_diskfs_threads_print_stats (FILE *stream)
+{
+  struct ports_thread_stats stats;
+
+  ports_get_thread_stats (&stats);
+  fprintf (stream, "threads: %u now, %u peak, %lu created, %lu exited,"
+	   " %lu failed, %lu throttled, %llu ms idle\n",
+	   stats.threads, stats.peak_threads, stats.created, stats.exited,
+	   stats.failed, stats.throttled, stats.idle_msecs);
+}
+
+static void
+print_slab_stats (FILE *stream, const char *name,
+		  struct hurd_slab_space *space)
+{
+  struct hurd_slab_stats stats;
+
+  hurd_slab_get_stats (space, &stats);
+  fprintf (stream, "%s: %lu allocated, %lu freed, %lu misses,"
+	   " %lu slabs, %lu of %lu objects free\n",
+	   name, stats.allocs, stats.frees, stats.misses,
+	   stats.slabs, stats.free, stats.objects);
+}
+
+/* Print the statistics of the node, peropen and protid caches to
+   STREAM.  */
+void
+_diskfs_objects_print_stats (FILE *stream)
+{
+  print_slab_stats (stream, "nodes", &_diskfs_node_space);
+  print_slab_stats (stream, "peropens", &_diskfs_peropen_space);
+  if (diskfs_protid_class && diskfs_protid_class->obj_space)
+    print_slab_stats (stream, "protids", diskfs_protid_class->obj_space);
+}
+
+void __attribute__ ((weak))
+diskfs_print_stats (FILE *stream)
+{
+  diskfs_print_std_stats (stream);
+}
@@ -0,0 +1,483 @@
+/* slab.c - Object cache functions.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or modify
+   it under the terms of the GNU General Public License as published by
+   the Free Software Foundation; either version 2, or (at your option)
+   any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+   GNU General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; see the file COPYING.  If not, write to
+   the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <errno.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <assert.h>
+#include <sys/mman.h>
+
+#include "slab.h"
+
+/* A slab is a naturally aligned block of SLAB_SIZE bytes starting with
+   this header, followed by the objects.  Each object is followed by
+   the link of the free list, so that free objects keep their
+   constructed state.  */
+struct hurd_slab
+{
+  struct hurd_slab *next, **prevp;
+  void *free_list;
+  unsigned int in_use;
+};
+
+/* A magazine of free objects a thread keeps for a space.  */
+struct hurd_slab_magazine
+{
+  hurd_slab_space_t space;
+  unsigned int rounds;
+  unsigned long allocs, frees;
+  void *objects[HURD_SLAB_MAGAZINE_SIZE];
+};
+
+/* Slabs hold at least that many objects.  */
+#define MIN_OBJECTS_PER_SLAB 8
+
+/* Keep at most that many slabs without allocated objects, or an eighth
+   of all slabs if that is more, so that bursts of allocations do not
+   make and release slabs over and over.  hurd_slab_reap releases them
+   all.  */
+#define MAX_EMPTY_SLABS 2
+
+#define ROUND_UP(x, align) (((x) + (align) - 1) & ~((align) - 1))
+
+#define LINK(space, obj) (*(void **) ((char *) (obj) + (space)->link_offset))
+
+#define SLAB_OF(space, obj) \
+  ((struct hurd_slab *) ((uintptr_t) (obj) & ~((space)->slab_size - 1)))
+
+
+static void
+slab_list_insert (struct hurd_slab **list, struct hurd_slab *slab)
+{
+  slab->next = *list;
+  slab->prevp = list;
+  if (*list)
+    (*list)->prevp = &slab->next;
+  *list = slab;
+}
+
+static void
+slab_list_remove (struct hurd_slab *slab)
+{
+  *slab->prevp = slab->next;
+  if (slab->next)
+    slab->next->prevp = slab->prevp;
+}
+
+/* Return the memory of SLAB, which has no allocated objects, to the
+   system.  */
+static void
+slab_release (hurd_slab_space_t space, struct hurd_slab *slab)
+{
+  assert (slab->in_use == 0);
+  slab_list_remove (slab);
+  space->nr_empty--;
+
+  if (space->destructor)
+    for (unsigned int i = 0; i < space->objects_per_slab; i++)
+      (*space->destructor) (space->hook, (char *) slab + space->first_offset
+			    + i * space->stride);
+
+  munmap (slab, space->slab_size);
+  space->stats.slabs--;
+  space->stats.objects -= space->objects_per_slab;
+  space->stats.free -= space->objects_per_slab;
+}
+
+/* Allocate a new slab for SPACE and put it on the list of empty
+   slabs.  */
+static error_t
+slab_grow (hurd_slab_space_t space)
+{
+  struct hurd_slab *slab;
+  void *mem;
+  unsigned int i;
+  error_t err = 0;
+
+  /* Get SLAB_SIZE bytes aligned to SLAB_SIZE.  */
+  mem = mmap (NULL, 2 * space->slab_size, PROT_READ | PROT_WRITE,
+	      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mem == MAP_FAILED)
+    return ENOMEM;
+  slab = (struct hurd_slab *) ROUND_UP ((uintptr_t) mem, space->slab_size);
+  if ((char *) slab > (char *) mem)
+    munmap (mem, (char *) slab - (char *) mem);
+  munmap ((char *) slab + space->slab_size,
+	  (char *) mem + space->slab_size - (char *) slab);
+
+  slab->free_list = NULL;
+  slab->in_use = 0;
+  for (i = space->objects_per_slab; i > 0; i--)
+    {
+      void *obj = (char *) slab + space->first_offset
+		  + (i - 1) * space->stride;
+
+      if (space->constructor)
+	{
+	  err = (*space->constructor) (space->hook, obj);
+	  if (err)
+	    break;
+	}
+      LINK (space, obj) = slab->free_list;
+      slab->free_list = obj;
+    }
+
+  if (err)
+    {
+      /* Destroy the objects constructed so far.  */
+      if (space->destructor)
+	for (void *obj = slab->free_list; obj; obj = LINK (space, obj))
+	  (*space->destructor) (space->hook, obj);
+      munmap (slab, space->slab_size);
+      return err;
+    }
+
+  slab_list_insert (&space->empty, slab);
+  space->nr_empty++;
+  space->stats.slabs++;
+  space->stats.objects += space->objects_per_slab;
+  space->stats.free += space->objects_per_slab;
+  return 0;
+}
+
+/* Take a free object from the slabs of SPACE, making a new slab if
+   needed.  SPACE must be locked.  */
+static error_t
+slab_get (hurd_slab_space_t space, void **buffer)
+{
+  struct hurd_slab *slab = space->partial;
+  void *obj;
+
+  if (! slab)
+    {
+      if (! space->empty)
+	{
+	  error_t err = slab_grow (space);
+	  if (err)
+	    return err;
+	}
+      slab = space->empty;
+      slab_list_remove (slab);
+      space->nr_empty--;
+      slab_list_insert (&space->partial, slab);
+    }
+
+  obj = slab->free_list;
+  slab->free_list = LINK (space, obj);
+  slab->in_use++;
+  space->stats.free--;
+
+  if (! slab->free_list)
+    {
+      slab_list_remove (slab);
+      slab_list_insert (&space->full, slab);
+    }
+
+  *buffer = obj;
+  return 0;
+}
+
+/* Give back the object BUFFER to its slab.  SPACE must be locked.  */
+static void
+slab_put (hurd_slab_space_t space, void *buffer)
+{
+  struct hurd_slab *slab = SLAB_OF (space, buffer);
+
+  assert (slab->in_use > 0);
+  if (! slab->free_list)
+    {
+      /* The slab was full.  */
+      slab_list_remove (slab);
+      slab_list_insert (&space->partial, slab);
+    }
+
+  LINK (space, buffer) = slab->free_list;
+  slab->free_list = buffer;
+  slab->in_use--;
+  space->stats.free++;
+
+  if (slab->in_use == 0)
+    {
+      slab_list_remove (slab);
+      slab_list_insert (&space->empty, slab);
+      space->nr_empty++;
+      if (space->nr_empty > MAX_EMPTY_SLABS
+	  && space->nr_empty > space->stats.slabs / 8)
+	slab_release (space, slab);
+    }
+}
+
+/* Account for the operations done from MAGAZINE without the lock.
+   SPACE must be locked.  */
+static void
+magazine_fold_stats (hurd_slab_space_t space,
+		     struct hurd_slab_magazine *magazine)
+{
+  space->stats.allocs += magazine->allocs;
+  space->stats.frees += magazine->frees;
+  magazine->allocs = magazine->frees = 0;
+}
+
+/* Called when a thread exits to give back the objects in its
+   magazine.  */
+static void
+magazine_release (void *arg)
+{
+  struct hurd_slab_magazine *magazine = arg;
+  hurd_slab_space_t space = magazine->space;
+
+  pthread_mutex_lock (&space->lock);
+  while (magazine->rounds > 0)
+    slab_put (space, magazine->objects[--magazine->rounds]);
+  magazine_fold_stats (space, magazine);
+  pthread_mutex_unlock (&space->lock);
+
+  free (magazine);
+}
+
+/* Return the magazine of the calling thread for SPACE, or null if none
+   can be made.  */
+static struct hurd_slab_magazine *
+magazine_get (hurd_slab_space_t space)
+{
+  struct hurd_slab_magazine *magazine = pthread_getspecific (space->key);
+
+  if (! magazine)
+    {
+      magazine = malloc (sizeof *magazine);
+      if (! magazine)
+	return NULL;
+      magazine->space = space;
+      magazine->rounds = 0;
+      magazine->allocs = magazine->frees = 0;
+      if (pthread_setspecific (space->key, magazine))
+	{
+	  free (magazine);
+	  return NULL;
+	}
+    }
+  return magazine;
+}
+
+/* Compute the layout of the slabs of SPACE and set up the per-thread
+   magazines.  */
+static error_t
+space_setup (hurd_slab_space_t space)
+{
+  error_t err;
+
+  pthread_mutex_lock (&space->lock);
+  if (space->initialized)
+    {
+      pthread_mutex_unlock (&space->lock);
+      return 0;
+    }
+
+  if (space->alignment < __alignof__ (void *))
+    space->alignment = __alignof__ (void *);
+  space->link_offset = ROUND_UP (space->size, __alignof__ (void *));
+  space->stride = ROUND_UP (space->link_offset + sizeof (void *),
+			    space->alignment);
+  space->first_offset = ROUND_UP (sizeof (struct hurd_slab), space->alignment);
+
+  space->slab_size = getpagesize ();
+  while ((space->slab_size - space->first_offset) / space->stride
+	 < MIN_OBJECTS_PER_SLAB)
+    space->slab_size *= 2;
+  space->objects_per_slab = ((space->slab_size - space->first_offset)
+			     / space->stride);
+  space->stats.size = space->size;
+
+  err = pthread_key_create (&space->key, magazine_release);
+  if (! err)
+    __atomic_store_n (&space->initialized, 1, __ATOMIC_RELEASE);
+  pthread_mutex_unlock (&space->lock);
+  return err;
+}
+
+
+error_t
+hurd_slab_init (hurd_slab_space_t space, size_t size, size_t alignment,
+		hurd_slab_constructor_t constructor,
+		hurd_slab_destructor_t destructor,
+		void *hook)
+{
+  if (alignment & (alignment - 1))
+    return EINVAL;
+
+  memset (space, 0, sizeof *space);
+  space->size = size;
+  space->alignment = alignment;
+  space->constructor = constructor;
+  space->destructor = destructor;
+  space->hook = hook;
+  return pthread_mutex_init (&space->lock, NULL);
+}
+
+error_t
+hurd_slab_create (size_t size, size_t alignment,
+		  hurd_slab_constructor_t constructor,
+		  hurd_slab_destructor_t destructor,
+		  void *hook, hurd_slab_space_t *space)
+{
+  error_t err;
+
+  *space = malloc (sizeof **space);
+  if (! *space)
+    return ENOMEM;
+
+  err = hurd_slab_init (*space, size, alignment, constructor, destructor,
+			hook);
+  if (err)
+    {
+      free (*space);
+      *space = NULL;
+    }
+  return err;
+}
+
+error_t
+hurd_slab_destroy (hurd_slab_space_t space)
+{
+  if (! space->initialized)
+    return 0;
+
+  /* Give back the objects of our own magazine.  */
+  struct hurd_slab_magazine *magazine = pthread_getspecific (space->key);
+  if (magazine)
+    {
+      pthread_setspecific (space->key, NULL);
+      magazine_release (magazine);
+    }
+
+  pthread_mutex_lock (&space->lock);
+  if (space->partial || space->full)
+    {
+      pthread_mutex_unlock (&space->lock);
+      return EBUSY;
+    }
+  while (space->empty)
+    slab_release (space, space->empty);
+  pthread_mutex_unlock (&space->lock);
+
+  pthread_key_delete (space->key);
+  space->initialized = 0;
+  return 0;
+}
+
+error_t
+hurd_slab_free (hurd_slab_space_t space)
+{
+  error_t err = hurd_slab_destroy (space);
+  if (! err)
+    free (space);
+  return err;
+}
+
+error_t
+hurd_slab_alloc (hurd_slab_space_t space, void **buffer)
+{
+  struct hurd_slab_magazine *magazine;
+  error_t err;
+
+  if (! __atomic_load_n (&space->initialized, __ATOMIC_ACQUIRE))
+    {
+      err = space_setup (space);
+      if (err)
+	return err;
+    }
+
+  magazine = magazine_get (space);
+  if (magazine && magazine->rounds > 0)
+    {
+      *buffer = magazine->objects[--magazine->rounds];
+      magazine->allocs++;
+      return 0;
+    }
+
+  pthread_mutex_lock (&space->lock);
+  space->stats.misses++;
+  err = slab_get (space, buffer);
+  if (! err)
+    {
+      space->stats.allocs++;
+      if (magazine)
+	{
+	  /* Refill half of the magazine, so that the next allocations
+	     and deallocations can both be done without the lock.  */
+	  while (magazine->rounds < HURD_SLAB_MAGAZINE_SIZE / 2
+		 && ! slab_get (space, &magazine->objects[magazine->rounds]))
+	    magazine->rounds++;
+	  magazine_fold_stats (space, magazine);
+	}
+    }
+  pthread_mutex_unlock (&space->lock);
+
+  return err;
+}
+
+void
+hurd_slab_dealloc (hurd_slab_space_t space, void *buffer)
+{
+  struct hurd_slab_magazine *magazine = magazine_get (space);
+
+  if (magazine && magazine->rounds < HURD_SLAB_MAGAZINE_SIZE)
+    {
+      magazine->objects[magazine->rounds++] = buffer;
+      magazine->frees++;
+      return;
+    }
+
+  pthread_mutex_lock (&space->lock);
+  space->stats.misses++;
+  space->stats.frees++;
+  slab_put (space, buffer);
+  if (magazine)
+    {
+      /* Flush half of the magazine.  */
+      while (magazine->rounds > HURD_SLAB_MAGAZINE_SIZE / 2)
+	slab_put (space, magazine->objects[--magazine->rounds]);
+      magazine_fold_stats (space, magazine);
+    }
+  pthread_mutex_unlock (&space->lock);
+}
+
+void
+hurd_slab_reap (hurd_slab_space_t space)
+{
+  pthread_mutex_lock (&space->lock);
+  while (space->empty)
+    slab_release (space, space->empty);
+  pthread_mutex_unlock (&space->lock);
+}
+
+void
+hurd_slab_get_stats (hurd_slab_space_t space, struct hurd_slab_stats *stats)
+{
+  pthread_mutex_lock (&space->lock);
+  *stats = space->stats;
+  stats->size = space->size;
+  pthread_mutex_unlock (&space->lock);
+}
@@ -0,0 +1,143 @@
+/* slab.h - Object cache interface.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+#ifndef _HURD_SLAB_H
+#define _HURD_SLAB_H	1
+
+#include <errno.h>
+#include <stddef.h>
+#include <pthread.h>
+
+/* A slab space is a cache of objects of one size.  Objects are carved
+   out of page-sized (or larger) slabs, so allocating them needs no
+   malloc, and each thread keeps a small magazine of free objects, so
+   that most allocations and deallocations do not even take a lock.
+
+   If a constructor is given, objects are constructed once, when their
+   slab is made, and destroyed with the destructor when the slab is
+   released.  Objects handed back to the space must be in their
+   constructed state again, for example with any mutex unlocked, so
+   that expensive initializations need not be repeated for every
+   allocation.  */
+
+/* The type of the constructor, which is called with the hook of the
+   space and the object to construct.  If it fails, the allocation
+   that made the slab fails.  */
+typedef error_t (*hurd_slab_constructor_t) (void *hook, void *buffer);
+
+/* The type of the destructor, which is called with the hook of the
+   space and the object to destroy.  */
+typedef void (*hurd_slab_destructor_t) (void *hook, void *buffer);
+
+/* The number of free objects a thread keeps for each space.  */
+#define HURD_SLAB_MAGAZINE_SIZE	32
+
+/* Usage statistics of a slab space.  The allocation and deallocation
+   counts of a thread are only added up when it takes the lock of the
+   space, so they may lag behind a bit.  */
+struct hurd_slab_stats
+{
+  size_t size;			/* Size of the objects.  */
+  unsigned long allocs;		/* Objects allocated.  */
+  unsigned long frees;		/* Objects deallocated.  */
+  unsigned long misses;		/* Magazine refills and flushes.  */
+  unsigned long slabs;		/* Slabs in use.  */
+  unsigned long objects;	/* Objects in those slabs.  */
+  unsigned long free;		/* Free objects not in any magazine.  */
+};
+
+struct hurd_slab;
+
+struct hurd_slab_space
+{
+  /* The parameters of the space.  */
+  size_t size;
+  size_t alignment;
+  hurd_slab_constructor_t constructor;
+  hurd_slab_destructor_t destructor;
+  void *hook;
+
+  /* Set up when the first object is allocated.  */
+  int initialized;
+  size_t stride;		/* Distance between objects.  */
+  size_t link_offset;		/* Free list link, after the object.  */
+  size_t first_offset;		/* Offset of the first object.  */
+  size_t slab_size;
+  unsigned int objects_per_slab;
+  pthread_key_t key;		/* Per-thread magazines.  */
+
+  /* Protects everything below.  */
+  pthread_mutex_t lock;
+
+  /* Slabs with both allocated and free objects, slabs without free
+     objects, and slabs without allocated objects.  */
+  struct hurd_slab *partial;
+  struct hurd_slab *full;
+  struct hurd_slab *empty;
+  unsigned int nr_empty;
+
+  struct hurd_slab_stats stats;
+};
+typedef struct hurd_slab_space *hurd_slab_space_t;
+
+/* The static initializer for a struct hurd_slab_space holding objects
+   of type TYPE.  */
+#define HURD_SLAB_SPACE_INITIALIZER(TYPE, CTOR, DTOR, HOOK)	\
+  { .size = sizeof (TYPE), .alignment = __alignof__ (TYPE),	\
+    .constructor = (CTOR), .destructor = (DTOR), .hook = (HOOK),	\
+    .lock = PTHREAD_MUTEX_INITIALIZER }
+
+/* Initialize the slab space SPACE for objects of SIZE bytes, aligned
+   to ALIGNMENT (a power of two, or zero for the natural alignment).
+   CONSTRUCTOR and DESTRUCTOR may be null.  HOOK is passed to them.  */
+error_t hurd_slab_init (hurd_slab_space_t space, size_t size,
+			size_t alignment,
+			hurd_slab_constructor_t constructor,
+			hurd_slab_destructor_t destructor,
+			void *hook);
+
+/* Like hurd_slab_init, but allocate the space and return it in
+   *SPACE.  */
+error_t hurd_slab_create (size_t size, size_t alignment,
+			  hurd_slab_constructor_t constructor,
+			  hurd_slab_destructor_t destructor,
+			  void *hook, hurd_slab_space_t *space);
+
+/* Destroy the slab space SPACE, which must have been initialized with
+   hurd_slab_init.  Return EBUSY if any objects are still allocated,
+   including ones in the magazines of other threads.  */
+error_t hurd_slab_destroy (hurd_slab_space_t space);
+
+/* Destroy and free the slab space SPACE made with hurd_slab_create.  */
+error_t hurd_slab_free (hurd_slab_space_t space);
+
+/* Allocate an object from SPACE and return it in *BUFFER.  */
+error_t hurd_slab_alloc (hurd_slab_space_t space, void **buffer);
+
+/* Give back the object BUFFER, allocated from SPACE.  */
+void hurd_slab_dealloc (hurd_slab_space_t space, void *buffer);
+
+/* Release the slabs of SPACE that have no objects allocated.  */
+void hurd_slab_reap (hurd_slab_space_t space);
+
+/* Fill in *STATS with the usage statistics of SPACE.  */
+void hurd_slab_get_stats (hurd_slab_space_t space,
+			  struct hurd_slab_stats *stats);
+
+#endif /* _HURD_SLAB_H */
@@ -1,5 +1,5 @@
 /* ihash.c - Integer-keyed hash table functions.
-   Copyright (C) 1993-1997, 2001, 2003, 2004, 2006
+   Copyright (C) 1993-1997, 2001, 2003, 2004, 2006, 2014
      Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
    Revised by Miles Bader <miles@gnu.org>.
@@ -42,12 +42,34 @@ index_empty (hurd_ihash_t ht, unsigned int idx)
 }
 
 
+/* Return the hash value of KEY in the hash table HT.  */
+static inline hurd_ihash_key_t
+hash (hurd_ihash_t ht, hurd_ihash_key_t key)
+{
+  if (ht->fct_hash)
+    return ht->fct_hash ((const void *) key);
+  return key;
+}
+
+
+/* Return 1 if the keys KEY1 and KEY2 are equal in the hash table HT.  */
+static inline int
+compare (hurd_ihash_t ht, hurd_ihash_key_t key1, hurd_ihash_key_t key2)
+{
+  if (key1 == key2)
+    return 1;
+  if (ht->fct_cmp)
+    return ht->fct_cmp ((const void *) key1, (const void *) key2);
+  return 0;
+}
+
+
 /* Return 1 if the index IDX in the hash table HT is occupied by the
    element with the key KEY.  */
 static inline int
 index_valid (hurd_ihash_t ht, unsigned int idx, hurd_ihash_key_t key)
 {
-  return !index_empty (ht, idx) && ht->items[idx].key == key;
+  return !index_empty (ht, idx) && compare (ht, ht->items[idx].key, key);
 }
 
 
@@ -61,9 +83,9 @@ find_index (hurd_ihash_t ht, hurd_ihash_key_t key)
   unsigned int up_idx;
   unsigned int mask = ht->size - 1;
 
-  idx = key & mask;
+  idx = hash (ht, key) & mask;
 
-  if (ht->items[idx].value == _HURD_IHASH_EMPTY || ht->items[idx].key == key)
+  if (ht->items[idx].value == _HURD_IHASH_EMPTY || index_valid (ht, idx, key))
     return idx;
 
   up_idx = idx;
@@ -72,7 +94,7 @@ find_index (hurd_ihash_t ht, hurd_ihash_key_t key)
     {
       up_idx = (up_idx + 1) & mask;
       if (ht->items[up_idx].value == _HURD_IHASH_EMPTY
-	  || ht->items[up_idx].key == key)
+	  || index_valid (ht, up_idx, key))
 	return up_idx;
     }
   while (up_idx != idx);
@@ -107,6 +129,8 @@ hurd_ihash_init (hurd_ihash_t ht, intptr_t locp_offs)
   ht->locp_offset = locp_offs;
   ht->max_load = HURD_IHASH_MAX_LOAD_DEFAULT;
   ht->cleanup = 0;
+  ht->fct_hash = 0;
+  ht->fct_cmp = 0;
 }
 
 
@@ -186,6 +210,18 @@ hurd_ihash_set_max_load (hurd_ihash_t ht, unsigned int max_load)
   ht->max_load = max_load;
 }
 
+
+/* Make the hash table HT use generalized keys, hashed with FCT_HASH
+   and compared with FCT_CMP.  */
+void
+hurd_ihash_set_gki (hurd_ihash_t ht, hurd_ihash_fct_hash_t fct_hash,
+		    hurd_ihash_fct_cmp_t fct_cmp)
+{
+  assert (ht->nr_items == 0);
+  ht->fct_hash = fct_hash;
+  ht->fct_cmp = fct_cmp;
+}
+
 
 /* Helper function for hurd_ihash_add.  Return 1 if the item was
    added, and 0 if it could not be added because no empty slot was
@@ -200,10 +236,10 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
   unsigned int first_free;
   unsigned int mask = ht->size - 1;
 
-  idx = key & mask;
+  idx = hash (ht, key) & mask;
   first_free = idx;
 
-  if (ht->items[idx].value != _HURD_IHASH_EMPTY && ht->items[idx].key != key)
+  if (ht->items[idx].value != _HURD_IHASH_EMPTY && !index_valid (ht, idx, key))
     {
       unsigned int up_idx = idx;
 
@@ -211,7 +247,7 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
 	{
         up_idx = (up_idx + 1) & mask;
 	  if (ht->items[up_idx].value == _HURD_IHASH_EMPTY
-	      || ht->items[up_idx].key == key)
+	      || index_valid (ht, up_idx, key))
 	    {
 	      idx = up_idx;
 	      break;
@@ -245,35 +281,20 @@ add_one (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t value)
   return 0;
 }
 
-  
-/* Add ITEM to the hash table HT under the key KEY.  If there already
-   is an item under this key, call the cleanup function (if any) for
-   it before overriding the value.  If a memory allocation error
-   occurs, ENOMEM is returned, otherwise 0.  */
-error_t
-hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
+
+/* Reorganize the hash table HT to have SIZE slots, which must be a
+   power of two large enough to hold all elements.  If a memory
+   allocation error occurs, ENOMEM is returned and HT is unchanged,
+   otherwise 0.  */
+static error_t
+resize (hurd_ihash_t ht, size_t size)
 {
   struct hurd_ihash old_ht = *ht;
   int was_added;
   unsigned int i;
 
-  if (ht->size)
-    {
-      /* Only fill the hash table up to its maximum load factor.  */
-      if (hurd_ihash_get_load (ht) <= ht->max_load)
-	if (add_one (ht, key, item))
-	  return 0;
-    }
-
-  /* The hash table is too small, and we have to increase it.  */
-  ht->nr_items = 0;
-  if (ht->size == 0)
-      ht->size = HURD_IHASH_MIN_SIZE;
-  else
-      ht->size <<= 1;
-
   /* calloc() will initialize all values to _HURD_IHASH_EMPTY implicitly.  */
-  ht->items = calloc (ht->size, sizeof (struct _hurd_ihash_item));
+  ht->items = calloc (size, sizeof (struct _hurd_ihash_item));
 
   if (ht->items == NULL)
     {
@@ -281,6 +302,9 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
       return ENOMEM;
     }
 
+  ht->size = size;
+  ht->nr_items = 0;
+
   /* We have to rehash the old entries.  */
   for (i = 0; i < old_ht.size; i++)
     if (!index_empty (&old_ht, i))
@@ -289,17 +313,64 @@ hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
 	assert (was_added);
       }
 
+  if (old_ht.size > 0)
+    free (old_ht.items);
+
+  return 0;
+}
+
+  
+/* Add ITEM to the hash table HT under the key KEY.  If there already
+   is an item under this key, call the cleanup function (if any) for
+   it before overriding the value.  If a memory allocation error
+   occurs, ENOMEM is returned, otherwise 0.  */
+error_t
+hurd_ihash_add (hurd_ihash_t ht, hurd_ihash_key_t key, hurd_ihash_value_t item)
+{
+  error_t err;
+  int was_added;
+
+  if (ht->size)
+    {
+      /* Only fill the hash table up to its maximum load factor.  */
+      if (hurd_ihash_get_load (ht) <= ht->max_load)
+	if (add_one (ht, key, item))
+	  return 0;
+    }
+
+  /* The hash table is too small, and we have to increase it.  */
+  err = resize (ht, ht->size ? ht->size << 1 : HURD_IHASH_MIN_SIZE);
+  if (err)
+    return err;
+
   /* Finally add the new element!  */
   was_added = add_one (ht, key, item);
   assert (was_added);
 
-  if (old_ht.size > 0)
-    free (old_ht.items);
-
   return 0;
 }
 
 
+/* Make sure the hash table HT can hold at least NR_ITEMS elements
+   without being reorganized.  If a memory allocation error occurs,
+   ENOMEM is returned, otherwise 0.  */
+error_t
+hurd_ihash_reserve (hurd_ihash_t ht, size_t nr_items)
+{
+  size_t size = ht->size ? ht->size : HURD_IHASH_MIN_SIZE;
+
+  /* hurd_ihash_add enlarges the table once the load factor exceeds
+     MAX_LOAD, so leave room for one more element than that.  */
+  while ((nr_items + 1) * 128 > (size_t) ht->max_load * size)
+    size <<= 1;
+
+  if (size == ht->size)
+    return 0;
+
+  return resize (ht, size);
+}
+
+
 /* Find and return the item in the hash table HT with key KEY, or NULL
    if it doesn't exist.  */
 hurd_ihash_value_t
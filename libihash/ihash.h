@@ -1,5 +1,5 @@
 /* ihash.h - Integer keyed hash table interface.
-   Copyright (C) 1995, 2003, 2004 Free Software Foundation, Inc.
+   Copyright (C) 1995, 2003, 2004, 2014 Free Software Foundation, Inc.
    Written by Miles Bader <miles@gnu.org>.
    Revised by Marcus Brinkmann <marcus@gnu.org>.
 
@@ -41,7 +41,9 @@ typedef void *hurd_ihash_value_t;
 #define _HURD_IHASH_EMPTY	((hurd_ihash_value_t) 0)
 #define _HURD_IHASH_DELETED	((hurd_ihash_value_t) -1)
 
-/* The type of integer we want to use for the keys.  */
+/* The type of integer we want to use for the keys.  If the hash table
+   uses generalized keys (see hurd_ihash_set_gki), this is a pointer
+   to the real key, cast to an integer.  */
 typedef uintptr_t hurd_ihash_key_t;
 
 /* The type of a location pointer, which is a pointer to the hash
@@ -53,6 +55,14 @@ typedef hurd_ihash_value_t *hurd_ihash_locp_t;
    removed from the hash table.  */
 typedef void (*hurd_ihash_cleanup_t) (hurd_ihash_value_t value, void *arg);
 
+/* The type of the hash function for generalized keys.  It is called
+   with the key and must return its hash value.  */
+typedef hurd_ihash_key_t (*hurd_ihash_fct_hash_t) (const void *key);
+
+/* The type of the comparison function for generalized keys.  It is
+   called with two keys and must return non-zero if they are equal.  */
+typedef int (*hurd_ihash_fct_cmp_t) (const void *a, const void *b);
+
 
 struct _hurd_ihash_item
 {
@@ -87,6 +97,12 @@ struct hurd_ihash
      second argument.  This does not happen if CLEANUP is NULL.  */
   hurd_ihash_cleanup_t cleanup;
   void *cleanup_data;
+
+  /* If FCT_HASH is not NULL, the keys are generalized keys: pointers
+     to the real keys, which are hashed using FCT_HASH and compared
+     using FCT_CMP.  Otherwise the keys are used as they are.  */
+  hurd_ihash_fct_hash_t fct_hash;
+  hurd_ihash_fct_cmp_t fct_cmp;
 };
 typedef struct hurd_ihash *hurd_ihash_t;
 
@@ -110,6 +126,14 @@ typedef struct hurd_ihash *hurd_ihash_t;
     .max_load = HURD_IHASH_MAX_LOAD_DEFAULT,				\
     .locp_offset = (locp_offs)}
 
+/* The static initializer for a struct hurd_ihash with generalized
+   keys.  */
+#define HURD_IHASH_INITIALIZER_GKI(locp_offs, f_hash, f_cmp)		\
+  { .nr_items = 0, .size = 0, .cleanup = (hurd_ihash_cleanup_t) 0,	\
+    .max_load = HURD_IHASH_MAX_LOAD_DEFAULT,				\
+    .locp_offset = (locp_offs),						\
+    .fct_hash = (f_hash), .fct_cmp = (f_cmp)}
+
 /* Initialize the hash table at address HT.  If LOCP_OFFSET is not
    HURD_IHASH_NO_LOCP, then this is an offset (in bytes) from the
    address of a hash value where a location pointer can be found.  The
@@ -159,6 +183,26 @@ void hurd_ihash_set_cleanup (hurd_ihash_t ht, hurd_ihash_cleanup_t cleanup,
    added to the hash table.  */
 void hurd_ihash_set_max_load (hurd_ihash_t ht, unsigned int max_load);
 
+/* Make the hash table HT use generalized keys.  Keys passed to and
+   stored by HT are then pointers to the real keys, which must stay
+   valid while they are in the table, for example because they are
+   part of the value.  FCT_HASH is used to hash them and FCT_CMP to
+   compare them.  This must be done before adding any elements.  */
+void hurd_ihash_set_gki (hurd_ihash_t ht, hurd_ihash_fct_hash_t fct_hash,
+			 hurd_ihash_fct_cmp_t fct_cmp);
+
+/* Hash LEN bytes at KEY with the Murmur3 hash function, using SEED as
+   the initial value.  This is meant to be used to build hash
+   functions for generalized keys, for example for strings or 64-bit
+   integers.  */
+uint32_t hurd_ihash_hash32 (const void *key, size_t len, uint32_t seed);
+
+/* Make sure the hash table HT can hold at least NR_ITEMS elements
+   without being reorganized.  Call this before adding many elements
+   at once, so that the table is only enlarged once.  If a memory
+   allocation error occurs, ENOMEM is returned, otherwise 0.  */
+error_t hurd_ihash_reserve (hurd_ihash_t ht, size_t nr_items);
+
 
 /* Get the current load factor of HT in binary percent, where 128b%
    corresponds to 100%.  The reason we do this is that it is so
@@ -0,0 +1,98 @@
+/* murmur3.c - The Murmur3 hash function.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with the GNU Hurd; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA.  */
+
+/* This is MurmurHash3_x86_32, written by Austin Appleby, who placed
+   it in the public domain.  */
+
+#if HAVE_CONFIG_H
+#include <config.h>
+#endif
+
+#include <stdint.h>
+#include <string.h>
+
+#include "ihash.h"
+
+static inline uint32_t
+rotl32 (uint32_t x, int8_t r)
+{
+  return (x << r) | (x >> (32 - r));
+}
+
+/* Finalization mix - force all bits of a hash block to avalanche.  */
+static inline uint32_t
+fmix32 (uint32_t h)
+{
+  h ^= h >> 16;
+  h *= 0x85ebca6b;
+  h ^= h >> 13;
+  h *= 0xc2b2ae35;
+  h ^= h >> 16;
+
+  return h;
+}
+
+/* Hash LEN bytes at KEY, using SEED as the initial value.  */
+uint32_t
+hurd_ihash_hash32 (const void *key, size_t len, uint32_t seed)
+{
+  const uint8_t *data = key;
+  const size_t nblocks = len / 4;
+  const uint32_t c1 = 0xcc9e2d51;
+  const uint32_t c2 = 0x1b873593;
+  uint32_t h1 = seed;
+  uint32_t k1;
+  size_t i;
+
+  /* Body.  Use memcpy, as KEY need not be aligned.  */
+  for (i = 0; i < nblocks; i++)
+    {
+      memcpy (&k1, data + i * 4, sizeof k1);
+
+      k1 *= c1;
+      k1 = rotl32 (k1, 15);
+      k1 *= c2;
+
+      h1 ^= k1;
+      h1 = rotl32 (h1, 13);
+      h1 = h1 * 5 + 0xe6546b64;
+    }
+
+  /* Tail.  */
+  data += nblocks * 4;
+  k1 = 0;
+  switch (len & 3)
+    {
+    case 3:
+      k1 ^= data[2] << 16;
+    case 2:
+      k1 ^= data[1] << 8;
+    case 1:
+      k1 ^= data[0];
+      k1 *= c1;
+      k1 = rotl32 (k1, 15);
+      k1 *= c2;
+      h1 ^= k1;
+    }
+
+  /* Finalization.  */
+  h1 ^= (uint32_t) len;
+
+  return fmix32 (h1);
+}
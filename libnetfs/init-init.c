@@ -38,6 +38,7 @@ void
 netfs_init ()
 {
   netfs_protid_class = ports_create_class (netfs_release_protid, 0);
+  ports_class_cache_objects (netfs_protid_class, sizeof (struct protid));
   netfs_control_class = ports_create_class (0, 0);
   netfs_port_bucket = ports_create_bucket ();
   netfs_auth_server_port = getauth ();
@@ -20,30 +20,53 @@
 
 #include "netfs.h"
 #include <hurd/fshelp.h>
+#include <sys/file.h>
+
+/* Set up the synchronization objects of a node, which stay set up while
+   it is in the node cache.  */
+static error_t
+construct_node (void *hook, void *buffer)
+{
+  struct node *np = buffer;
+
+  pthread_mutex_init (&np->lock, NULL);
+  fshelp_transbox_init (&np->transbox, &np->lock, np);
+  fshelp_lock_init (&np->userlock);
+  return 0;
+}
+
+/* The cache of node structures made by netfs_make_node.  */
+static struct hurd_slab_space node_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct node, construct_node, NULL, NULL);
 
 static struct node *
 init_node (struct node *np, struct netnode *nn)
 {
   np->nn = nn;
 
-  pthread_mutex_init (&np->lock, NULL);
   np->references = 1;
   np->sockaddr = MACH_PORT_NULL;
   np->owner = 0;
 
-  fshelp_transbox_init (&np->transbox, &np->lock, np);
-  fshelp_lock_init (&np->userlock);
-  
   return np;
 }
 
 struct node *
 netfs_make_node (struct netnode *nn)
 {
-  struct node *np = malloc (sizeof (struct node));
-  if (! np)
+  struct node *np;
+
+  if (hurd_slab_alloc (&node_space, (void **) &np))
     return NULL;
 
+  /* The node may have been used before, so reset the state of what
+     the constructor set up.  */
+  np->transbox.active = MACH_PORT_NULL;
+  np->transbox.flags = 0;
+  np->userlock.type = LOCK_UN;
+  np->userlock.waiting = 0;
+  np->userlock.shcount = 0;
+
   return init_node (np, nn);
 }
 
@@ -55,5 +78,16 @@ netfs_make_node_alloc (size_t size)
   if (np == NULL)
     return NULL;
 
+  construct_node (NULL, np);
   return init_node (np, netfs_node_netnode (np));
 }
+
+void
+netfs_destroy_node (struct node *np)
+{
+  /* Nodes are usually released with their lock held.  Leave it
+     unlocked for the next user; the constructor only runs once.  */
+  pthread_mutex_trylock (&np->lock);
+  pthread_mutex_unlock (&np->lock);
+  hurd_slab_dealloc (&node_space, np);
+}
@@ -19,14 +19,19 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
 #include "netfs.h"
+#include "priv.h"
 #include <sys/file.h>
 
+/* The cache of peropen structures.  */
+struct hurd_slab_space _netfs_peropen_space
+  = HURD_SLAB_SPACE_INITIALIZER (struct peropen, NULL, NULL, NULL);
+
 struct peropen *
 netfs_make_peropen (struct node *np, int flags, struct peropen *context)
 {
-  struct peropen *po = malloc (sizeof (struct peropen));
+  struct peropen *po;
 
-  if (!po)
+  if (hurd_slab_alloc (&_netfs_peropen_space, (void **) &po))
     return NULL;
 
   po->filepointer = 0;
@@ -42,7 +47,7 @@ netfs_make_peropen (struct node *np, int flags, struct peropen *context)
 	{
 	  po->path = strdup (context->path);
 	  if (! po->path) {
-	    free(po);
+	    hurd_slab_dealloc (&_netfs_peropen_space, po);
 	    return NULL;
 	  }
 	}
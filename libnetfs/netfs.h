@@ -22,6 +22,7 @@
 #include <hurd/ports.h>
 #include <hurd/fshelp.h>
 #include <hurd/iohelp.h>
+#include <hurd/slab.h>
 #include <assert.h>
 #include <pthread.h>
 
@@ -372,6 +373,13 @@ extern int netfs_maxsymlinks;
    If an error occurs, NULL is returned.  */
 struct node *netfs_make_node (struct netnode *);
 
+/* Free the node structure NP, made by netfs_make_node, once it has no
+   references; this is normally done by netfs_node_norefs.  Node
+   structures are cached, so this is much cheaper than making them
+   with malloc.  Nodes made by netfs_make_node_alloc are released with
+   free as before.  */
+void netfs_destroy_node (struct node *np);
+
 /* Create a new node structure.  Also allocate SIZE bytes for the
    netnode.  The address of the netnode can be obtained using
    netfs_node_netnode.  The new node will have one hard reference and
@@ -25,6 +25,9 @@
 
 #include "netfs.h"
 
+/* The cache of peropen structures.  */
+extern struct hurd_slab_space _netfs_peropen_space;
+
 static inline struct protid * __attribute__ ((unused))
 begin_using_protid_port (file_t port)
 {
@@ -20,6 +20,7 @@
 
 #include <sys/file.h>
 #include "netfs.h"
+#include "priv.h"
 
 void
 netfs_release_peropen (struct peropen *po)
@@ -47,6 +48,6 @@ netfs_release_peropen (struct peropen *po)
       netfs_nput (po->np);
 
       free (po->path);
-      free (po);
+      hurd_slab_dealloc (&_netfs_peropen_space, po);
     }
 }
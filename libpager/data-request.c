@@ -20,6 +20,76 @@
 #include <stdio.h>
 #include <string.h>
 
+/* What to do with each page of a (possibly multi-page) request.  */
+enum page_action
+{
+  PAGE_SKIP,			/* Nothing; someone else supplies it.  */
+  PAGE_READ,			/* Read it from the backing store.  */
+  PAGE_ERROR,			/* Return an error for it.  */
+};
+
+/* Read the NPAGES pages starting at OFFSET, all of which the caller
+   has decided to read, and supply them to the kernel.  Try to do it
+   with a single pager_read_pages call, and fall back to reading the
+   pages one at a time.  */
+static void
+supply_pages (struct pager *p, vm_offset_t offset, int npages)
+{
+  error_t err;
+  vm_size_t length = npages * __vm_page_size;
+  vm_address_t page;
+  int write_lock;
+
+  if (npages > 1)
+    {
+      err = pager_read_pages (p->upi, offset, length, &page, &write_lock);
+      if (err != EOPNOTSUPP)
+	{
+	  if (err)
+	    {
+	      memory_object_data_error (p->memobjcntl, offset, length, EIO);
+	      pthread_mutex_lock (&p->interlock);
+	      _pager_mark_object_error (p, offset, length, EIO);
+	      pthread_mutex_unlock (&p->interlock);
+	    }
+	  else
+	    {
+	      memory_object_data_supply (p->memobjcntl, offset, page, length,
+					 1, (write_lock
+					     ? VM_PROT_WRITE : VM_PROT_NONE),
+					 p->notify_on_evict ? 1 : 0,
+					 MACH_PORT_NULL);
+	      pthread_mutex_lock (&p->interlock);
+	      _pager_mark_object_error (p, offset, length, 0);
+	      pthread_mutex_unlock (&p->interlock);
+	    }
+	  return;
+	}
+    }
+
+  for (; npages > 0; npages--, offset += __vm_page_size)
+    {
+      err = pager_read_page (p->upi, offset, &page, &write_lock);
+      if (err)
+	{
+	  memory_object_data_error (p->memobjcntl, offset, __vm_page_size,
+				    EIO);
+	  pthread_mutex_lock (&p->interlock);
+	  _pager_mark_object_error (p, offset, __vm_page_size, EIO);
+	  pthread_mutex_unlock (&p->interlock);
+	  continue;
+	}
+
+      memory_object_data_supply (p->memobjcntl, offset, page, __vm_page_size,
+				 1, write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
+				 p->notify_on_evict ? 1 : 0,
+				 MACH_PORT_NULL);
+      pthread_mutex_lock (&p->interlock);
+      _pager_mark_object_error (p, offset, __vm_page_size, 0);
+      pthread_mutex_unlock (&p->interlock);
+    }
+}
+
 /* Implement pagein callback as described in <mach/memory_object.defs>. */
 kern_return_t
 _pager_S_memory_object_data_request (struct pager *p,
@@ -29,10 +99,9 @@ _pager_S_memory_object_data_request (struct pager *p,
 					  vm_prot_t access)
 {
   short *pm_entry;
-  int doread, doerror;
   error_t err;
-  vm_address_t page;
-  int write_lock;
+  int npages, i, run;
+  char *actions;
 
   if (!p
       || p->port.class != _pager_class)
@@ -41,13 +110,13 @@ _pager_S_memory_object_data_request (struct pager *p,
   /* Acquire the right to meddle with the pagemap */
   pthread_mutex_lock (&p->interlock);
 
-  /* sanity checks -- we don't do multi-page requests yet.  */
+  /* sanity checks */
   if (control != p->memobjcntl)
     {
       printf ("incg data request: wrong control port\n");
       goto release_out;
     }
-  if (length != __vm_page_size)
+  if (length == 0 || length % __vm_page_size)
     {
       printf ("incg data request: bad length size %zd\n", length);
       goto release_out;
@@ -58,6 +127,11 @@ _pager_S_memory_object_data_request (struct pager *p,
       goto release_out;
     }
 
+  npages = length / __vm_page_size;
+  actions = malloc (npages);
+  if (actions == NULL)
+    goto release_out;		/* The kernel will ask again.  */
+
   _pager_block_termination (p);	/* prevent termination until
 				   mark_object_error is done */
 
@@ -71,63 +145,71 @@ _pager_S_memory_object_data_request (struct pager *p,
   if (err)
     goto allow_release_out;	/* Can't do much about the actual error.  */
 
-  /* If someone is paging this out right now, the disk contents are
-     unreliable, so we have to wait.  It is too expensive (right now) to
-     find the data and return it, and then interrupt the write, so we just
-     mark the page and have the writing thread do m_o_data_supply when it
-     gets around to it.  */
   pm_entry = &p->pagemap[offset / __vm_page_size];
-  if (*pm_entry & PM_PAGINGOUT)
-    {
-      doread = 0;
-      *pm_entry |= PM_PAGEINWAIT;
-    }
-  else
-    doread = 1;
-
-  if (*pm_entry & PM_INVALID)
-    doerror = 1;
-  else
-    doerror = 0;
-
-  *pm_entry |= PM_INCORE;
-
-  if (PM_NEXTERROR (*pm_entry) != PAGE_NOERR && (access & VM_PROT_WRITE))
+  for (i = 0; i < npages; i++, pm_entry++)
     {
-      memory_object_data_error (control, offset, length,
-				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
-      _pager_mark_object_error (p, offset, length,
-				_pager_page_errors[PM_NEXTERROR (*pm_entry)]);
-      *pm_entry = SET_PM_NEXTERROR (*pm_entry, PAGE_NOERR);
-      doread = 0;
+      vm_offset_t page = offset + i * __vm_page_size;
+
+      /* If someone is paging this out right now, the disk contents are
+	 unreliable, so we have to wait.  It is too expensive (right now) to
+	 find the data and return it, and then interrupt the write, so we
+	 just mark the page and have the writing thread do m_o_data_supply
+	 when it gets around to it.  */
+      if (*pm_entry & PM_PAGINGOUT)
+	{
+	  actions[i] = PAGE_SKIP;
+	  *pm_entry |= PM_PAGEINWAIT;
+	}
+      else if (*pm_entry & PM_INVALID)
+	actions[i] = PAGE_ERROR;
+      else
+	actions[i] = PAGE_READ;
+
+      *pm_entry |= PM_INCORE;
+
+      if (PM_NEXTERROR (*pm_entry) != PAGE_NOERR && (access & VM_PROT_WRITE))
+	{
+	  memory_object_data_error (control, page, __vm_page_size,
+				    _pager_page_errors[PM_NEXTERROR (*pm_entry)]);
+	  _pager_mark_object_error (p, page, __vm_page_size,
+				    _pager_page_errors[PM_NEXTERROR (*pm_entry)]);
+	  *pm_entry = SET_PM_NEXTERROR (*pm_entry, PAGE_NOERR);
+	  actions[i] = PAGE_SKIP;
+	}
     }
 
   /* Let someone else in.  */
   pthread_mutex_unlock (&p->interlock);
 
-  if (!doread)
-    goto allow_term_out;
-  if (doerror)
-    goto error_read;
-
-  err = pager_read_page (p->upi, offset, &page, &write_lock);
-  if (err)
-    goto error_read;
-
-  memory_object_data_supply (p->memobjcntl, offset, page, length, 1,
-			     write_lock ? VM_PROT_WRITE : VM_PROT_NONE,
-			     p->notify_on_evict ? 1 : 0,
-			     MACH_PORT_NULL);
-  pthread_mutex_lock (&p->interlock);
-  _pager_mark_object_error (p, offset, length, 0);
-  _pager_allow_termination (p);
-  pthread_mutex_unlock (&p->interlock);
-  return 0;
+  /* Hand each run of consecutive pages to be read to the user in one
+     go, so that it can consolidate the backing store i/o.  */
+  for (i = 0; i < npages; i += run)
+    {
+      vm_offset_t page = offset + i * __vm_page_size;
+
+      for (run = 1; i + run < npages && actions[i + run] == actions[i]; run++)
+	;
+
+      switch (actions[i])
+	{
+	case PAGE_READ:
+	  supply_pages (p, page, run);
+	  break;
+
+	case PAGE_ERROR:
+	  memory_object_data_error (p->memobjcntl, page,
+				    run * __vm_page_size, EIO);
+	  pthread_mutex_lock (&p->interlock);
+	  _pager_mark_object_error (p, page, run * __vm_page_size, EIO);
+	  pthread_mutex_unlock (&p->interlock);
+	  break;
+
+	default:
+	  break;
+	}
+    }
 
- error_read:
-  memory_object_data_error (p->memobjcntl, offset, length, EIO);
-  _pager_mark_object_error (p, offset, length, EIO);
- allow_term_out:
+  free (actions);
   pthread_mutex_lock (&p->interlock);
   _pager_allow_termination (p);
   pthread_mutex_unlock (&p->interlock);
@@ -135,6 +217,7 @@ _pager_S_memory_object_data_request (struct pager *p,
 
  allow_release_out:
   _pager_allow_termination (p);
+  free (actions);
  release_out:
   pthread_mutex_unlock (&p->interlock);
   return 0;
@@ -38,9 +38,11 @@
   unique identifier representing O.  If another thread now dequeues a
   second request to O, it enqueues it to the first workers queue.
 
-  At least one worker thread is necessary.
+  At least one worker thread is necessary.  The number of workers can
+  be changed at any time using pager_set_worker_count; surplus workers
+  retire once they have finished the requests delegated to them.
 */
-#define WORKER_COUNT 1
+#define MAX_WORKER_COUNT	64
 
 /* An request contains the message received from the port set.  */
 struct request
@@ -63,6 +65,7 @@ struct worker
   struct requests *requests;	/* our pagers request queue */
   struct queue queue;	/* other workers may delegate requests to us */
   unsigned long tag;	/* tag of the object we are working on */
+  int running;		/* whether a thread is running this worker */
 };
 
 /* This is the queue for incoming requests.  A single thread receives
@@ -75,9 +78,21 @@ struct requests
   int asleep;
   pthread_cond_t wakeup;
   pthread_mutex_t lock;
-  struct worker workers[WORKER_COUNT];
+  int worker_count;	/* number of workers that should be running */
+  int workers_used;	/* all running workers are below this index */
+  struct requests *next;	/* next in ALL_REQUESTS */
+  struct worker workers[MAX_WORKER_COUNT];
 };
 
+/* The number of workers each worker pool should be running.  */
+static int worker_count = PAGER_DEFAULT_WORKER_COUNT;
+
+/* All the worker pools started by pager_start_workers.  */
+static struct requests *all_requests;
+
+/* Protects WORKER_COUNT and ALL_REQUESTS.  */
+static pthread_mutex_t all_requests_lock = PTHREAD_MUTEX_INITIALIZER;
+
 /* Demultiplex a single message directed at a pager port; INP is the
    message received; fill OUTP with the reply.  */
 static int
@@ -185,15 +200,28 @@ worker_func (void *arg)
       self->tag = 0;
 
     get_request_locked:
-      /* ... get a request from the global queue instead.  */
-      while ((r = queue_dequeue (&requests->queue)) == NULL)
+      /* ... get a request from the global queue instead.  But first,
+	 see whether we are no longer wanted.  Nobody can delegate
+	 requests to us now that our tag is cleared.  */
+      while (self - requests->workers >= requests->worker_count
+	     || (r = queue_dequeue (&requests->queue)) == NULL)
 	{
+	  if (self - requests->workers >= requests->worker_count)
+	    {
+	      self->running = 0;
+	      /* We might have consumed a wakeup meant for a request.  */
+	      if (requests->queue.head != NULL && requests->asleep > 0)
+		pthread_cond_signal (&requests->wakeup);
+	      pthread_mutex_unlock (&requests->lock);
+	      return NULL;
+	    }
+
 	  requests->asleep += 1;
 	  pthread_cond_wait (&requests->wakeup, &requests->lock);
 	  requests->asleep -= 1;
 	}
 
-      for (i = 0; i < WORKER_COUNT; i++)
+      for (i = 0; i < requests->workers_used; i++)
 	if (requests->workers[i].tag
 	    == (unsigned long) request_inp (r)->msgh_local_port)
 	  {
@@ -296,6 +324,48 @@ service_paging_requests (void *arg)
   return NULL;
 }
 
+/* Start a thread for worker I of REQUESTS, unless there already is
+   one.  REQUESTS->lock must be held.  */
+static error_t
+start_worker (struct requests *requests, int i)
+{
+  error_t err;
+  pthread_t t;
+  struct worker *w = &requests->workers[i];
+
+  if (w->running)
+    return 0;
+
+  w->running = 1;
+  err = pthread_create (&t, NULL, &worker_func, w);
+  if (err)
+    {
+      w->running = 0;
+      return err;
+    }
+  pthread_detach (t);
+
+  if (i >= requests->workers_used)
+    requests->workers_used = i + 1;
+  return 0;
+}
+
+/* Make REQUESTS run COUNT workers.  REQUESTS->lock must be held.  */
+static error_t
+set_worker_count (struct requests *requests, int count)
+{
+  error_t err = 0;
+  int i;
+
+  requests->worker_count = count;
+  for (i = 0; !err && i < count; i++)
+    err = start_worker (requests, i);
+
+  /* Let the surplus workers notice that they should retire.  */
+  pthread_cond_broadcast (&requests->wakeup);
+  return err;
+}
+
 /* Start the worker threads libpager uses to service requests.  */
 error_t
 pager_start_workers (struct port_bucket *pager_bucket)
@@ -311,27 +381,73 @@ pager_start_workers (struct port_bucket *pager_bucket)
 
   requests->bucket = pager_bucket;
   requests->asleep = 0;
+  requests->worker_count = 0;
+  requests->workers_used = 0;
   queue_init (&requests->queue);
   pthread_cond_init (&requests->wakeup, NULL);
   pthread_mutex_init (&requests->lock, NULL);
 
+  for (i = 0; i < MAX_WORKER_COUNT; i++)
+    {
+      requests->workers[i].requests = requests;
+      requests->workers[i].tag = 0;
+      requests->workers[i].running = 0;
+      queue_init (&requests->workers[i].queue);
+    }
+
   /* Make a thread to service paging requests.  */
   err = pthread_create (&t, NULL, service_paging_requests, requests);
   if (err)
     return err;
   pthread_detach (t);
 
-  for (i = 0; i < WORKER_COUNT; i++)
+  pthread_mutex_lock (&all_requests_lock);
+  pthread_mutex_lock (&requests->lock);
+  err = set_worker_count (requests, worker_count);
+  pthread_mutex_unlock (&requests->lock);
+  requests->next = all_requests;
+  all_requests = requests;
+  pthread_mutex_unlock (&all_requests_lock);
+
+  return err;
+}
+
+/* Make all worker pools use COUNT worker threads.  */
+error_t
+pager_set_worker_count (int count)
+{
+  error_t err = 0;
+  struct requests *requests;
+
+  if (count < 1 || count > MAX_WORKER_COUNT)
+    return EINVAL;
+
+  pthread_mutex_lock (&all_requests_lock);
+  worker_count = count;
+  for (requests = all_requests; requests; requests = requests->next)
     {
-      requests->workers[i].requests = requests;
-      requests->workers[i].tag = 0;
-      queue_init (&requests->workers[i].queue);
+      error_t e;
 
-      err = pthread_create (&t, NULL, &worker_func, &requests->workers[i]);
-      if (err)
-	return err;
-      pthread_detach (t);
+      pthread_mutex_lock (&requests->lock);
+      e = set_worker_count (requests, count);
+      pthread_mutex_unlock (&requests->lock);
+      if (e && !err)
+	err = e;
     }
+  pthread_mutex_unlock (&all_requests_lock);
 
   return err;
 }
+
+/* Return the number of worker threads worker pools use.  */
+int
+pager_get_worker_count (void)
+{
+  int count;
+
+  pthread_mutex_lock (&all_requests_lock);
+  count = worker_count;
+  pthread_mutex_unlock (&all_requests_lock);
+
+  return count;
+}
@@ -20,6 +20,7 @@
 
 
 #include "priv.h"
+#include <assert.h>
 
 void
 pager_offer_page (struct pager *p,
@@ -49,3 +50,51 @@ pager_offer_page (struct pager *p,
 
   pthread_mutex_unlock (&p->interlock);
 }
+
+void
+pager_offer_pages (struct pager *p,
+		   int precious,
+		   int writelock,
+		   vm_offset_t start,
+		   vm_size_t length,
+		   vm_address_t buf)
+{
+  vm_offset_t offset, run = start;
+
+  assert (start % vm_page_size == 0);
+  assert (length % vm_page_size == 0);
+
+  pthread_mutex_lock (&p->interlock);
+
+  if (p->pager_state != NORMAL || _pager_pagemap_resize (p, start + length))
+    {
+      pthread_mutex_unlock (&p->interlock);
+      munmap ((void *) buf, length);
+      return;
+    }
+
+  /* Supply each run of pages the kernel cannot have, and throw away
+     the data for the others.  */
+  for (offset = start; offset <= start + length; offset += vm_page_size)
+    {
+      short *pm_entry = &p->pagemap[offset / vm_page_size];
+
+      if (offset < start + length
+	  && ! (*pm_entry & (PM_INCORE | PM_PAGINGOUT | PM_INVALID)))
+	{
+	  *pm_entry |= PM_INCORE;
+	  continue;
+	}
+
+      if (offset > run)
+	memory_object_data_supply (p->memobjcntl, run,
+				   buf + (run - start), offset - run, 1,
+				   writelock ? VM_PROT_WRITE : VM_PROT_NONE,
+				   precious, MACH_PORT_NULL);
+      if (offset < start + length)
+	munmap ((void *) buf + (offset - start), vm_page_size);
+      run = offset + vm_page_size;
+    }
+
+  pthread_mutex_unlock (&p->interlock);
+}
@@ -28,6 +28,164 @@
    vm_page_size.) */
 #define VMCOPY_BETTER_THAN_MEMCPY (8*vm_page_size)
 
+#define MEMCPY_WINDOW_DEFAULT_SIZE (32 * vm_page_size)
+
+/* The number of memcpy windows kept mapped between calls.  */
+#define WINDOW_CACHE_SIZE 16
+
+/* A memcpy window kept mapped for reuse.  */
+struct window
+{
+  struct pager *pager;		/* Null if this slot is free.  */
+  vm_offset_t offset;		/* Offset of the window in the object.  */
+  vm_address_t addr;		/* Where it is mapped, 0 while mapping.  */
+  vm_prot_t prot;		/* Protection it is mapped with.  */
+  int users;			/* Number of calls using it right now.  */
+  int dead;			/* Unmap it once there are no users.  */
+  unsigned long last_use;	/* For LRU replacement.  */
+};
+
+static struct window windows[WINDOW_CACHE_SIZE];
+static unsigned long window_clock;
+static pthread_mutex_t window_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Take window W, which must have no users, out of the cache, and copy it
+   to OLD to be unmapped by window_unmap.  WINDOW_LOCK must be held.  */
+static void
+window_detach (struct window *w, struct window *old)
+{
+  *old = *w;
+  w->pager = NULL;
+  w->dead = 0;
+}
+
+/* Unmap window W, taken out of the cache by window_detach, and drop its
+   reference to its pager.  WINDOW_LOCK must not be held, as this may run
+   the pager's clean routine.  */
+static void
+window_unmap (struct window *w)
+{
+  vm_deallocate (mach_task_self (), w->addr, MEMCPY_WINDOW_DEFAULT_SIZE);
+  ports_port_deref (w->pager);
+}
+
+/* Return a window mapping MEMOBJ of PAGER at OFFSET with at least
+   protection PROT, mapping it if necessary.  Returns NULL if there is no
+   window that can be reused.  */
+static struct window *
+window_get (struct pager *pager, memory_object_t memobj,
+	    vm_offset_t offset, vm_prot_t prot)
+{
+  struct window *w, *victim = NULL;
+  struct window old = { .pager = NULL };
+  vm_address_t addr = 0;
+  error_t err;
+
+  pthread_mutex_lock (&window_lock);
+
+  for (w = windows; w < windows + WINDOW_CACHE_SIZE; w++)
+    {
+      if (w->pager == pager && w->offset == offset && w->addr != 0
+	  && ! w->dead && (w->prot & prot) == prot)
+	{
+	  w->users++;
+	  w->last_use = ++window_clock;
+	  pthread_mutex_unlock (&window_lock);
+	  return w;
+	}
+
+      if (w->users == 0
+	  && (victim == NULL
+	      || (victim->pager != NULL
+		  && (w->pager == NULL || w->last_use < victim->last_use))))
+	victim = w;
+    }
+
+  if (victim == NULL)
+    {
+      pthread_mutex_unlock (&window_lock);
+      return NULL;
+    }
+
+  if (victim->pager != NULL)
+    window_detach (victim, &old);
+
+  /* Keep the slot to ourselves while we map it without the lock, which
+     would otherwise serialize all misses behind the kernel.  It already
+     names PAGER, so that pager_memcpy_release of PAGER meanwhile marks it
+     dead, while releases of other pagers leave it alone.  */
+  victim->pager = pager;
+  victim->offset = offset;
+  victim->addr = 0;
+  victim->prot = prot;
+  victim->dead = 0;
+  victim->users = 1;
+  pthread_mutex_unlock (&window_lock);
+
+  if (old.pager != NULL)
+    window_unmap (&old);
+
+  err = vm_map (mach_task_self (), &addr,
+		MEMCPY_WINDOW_DEFAULT_SIZE, 0, 1,
+		memobj, offset, 0, prot, prot, VM_INHERIT_NONE);
+  if (! err)
+    ports_port_ref (pager);
+
+  pthread_mutex_lock (&window_lock);
+  if (err)
+    {
+      victim->pager = NULL;
+      victim->dead = 0;
+      victim->users = 0;
+      pthread_mutex_unlock (&window_lock);
+      return NULL;
+    }
+
+  victim->addr = addr;
+  victim->last_use = ++window_clock;
+
+  pthread_mutex_unlock (&window_lock);
+  return victim;
+}
+
+/* Stop using window W.  If BAD is set, don't reuse it.  */
+static void
+window_put (struct window *w, int bad)
+{
+  struct window old = { .pager = NULL };
+
+  pthread_mutex_lock (&window_lock);
+  if (bad)
+    w->dead = 1;
+  if (--w->users == 0 && w->dead)
+    window_detach (w, &old);
+  pthread_mutex_unlock (&window_lock);
+
+  if (old.pager != NULL)
+    window_unmap (&old);
+}
+
+/* Release the windows pager_memcpy has kept mapped for PAGER.  */
+void
+pager_memcpy_release (struct pager *pager)
+{
+  struct window *w, old[WINDOW_CACHE_SIZE];
+  int i, nold = 0;
+
+  pthread_mutex_lock (&window_lock);
+  for (w = windows; w < windows + WINDOW_CACHE_SIZE; w++)
+    if (w->pager == pager)
+      {
+	w->dead = 1;
+	if (w->users == 0)
+	  window_detach (w, &old[nold++]);
+      }
+  pthread_mutex_unlock (&window_lock);
+
+  for (i = 0; i < nold; i++)
+    window_unmap (&old[i]);
+}
+
 /* Try to copy *SIZE bytes between the region OTHER points to
    and the region at OFFSET in the pager indicated by PAGER and MEMOBJ.
    If PROT is VM_PROT_READ, copying is from the pager to OTHER;
@@ -44,9 +202,12 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
   size_t n = *size;
 
 #define VMCOPY_WINDOW_DEFAULT_SIZE (32 * vm_page_size)
-#define MEMCPY_WINDOW_DEFAULT_SIZE (32 * vm_page_size)
   vm_address_t window;
   vm_size_t window_size;
+  /* Where in the window the current copy starts.  */
+  size_t window_off = 0;
+  /* The cached window in use, if any.  */
+  struct window *cached = NULL;
 
   error_t do_vm_copy (void)
     {
@@ -102,6 +263,26 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 	      size_t pageoff = offset & (vm_page_size - 1);
 	      size_t copy_count = window_size - pageoff;
 
+	      /* Use a cached window aligned to its size if we can; small
+		 reads and writes to the same region of a file then don't
+		 have to map and unmap it each time.  */
+	      if (pager != NULL)
+		{
+		  size_t winoff = offset & (MEMCPY_WINDOW_DEFAULT_SIZE - 1);
+
+		  window_size = MEMCPY_WINDOW_DEFAULT_SIZE;
+		  cached = window_get (pager, memobj, offset - winoff, prot);
+		  if (cached)
+		    {
+		      copy_count = window_size - winoff;
+		      if (copy_count > to_copy)
+			copy_count = to_copy;
+		      window = cached->addr;
+		      pageoff = winoff;
+		      goto mapped;
+		    }
+		}
+
 	      /* Map in and copy a standard-sized window, unless that is
 		 more than the total left to be copied.  */
 
@@ -118,6 +299,9 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 	      if (err)
 		return err;
 
+	    mapped:
+	      window_off = pageoff;
+
 	      /* Realign the fault preemptor for the new mapping window.  */
 	      preemptor->first = window;
 	      preemptor->last = window + window_size;
@@ -126,8 +310,14 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 		memcpy (other, (const void *) window + pageoff, copy_count);
 	      else
 		memcpy ((void *) window + pageoff, other, copy_count);
-	      
-	      vm_deallocate (mach_task_self (), window, window_size);
+
+	      if (cached)
+		{
+		  window_put (cached, 0);
+		  cached = NULL;
+		}
+	      else
+		vm_deallocate (mach_task_self (), window, window_size);
 
 	      offset += copy_count;
 	      other += copy_count;
@@ -172,10 +362,16 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
   jmp_buf buf;
   void fault (int signo, long int sigcode, struct sigcontext *scp)
     {
+      size_t copied = ((vm_address_t) sigcode > window + window_off
+		       ? sigcode - (window + window_off) : 0);
+
       assert (scp->sc_error == EKERN_MEMORY_ERROR);
-      err = pager_get_error (pager, sigcode - window + offset);
-      n -= sigcode - window;
-      vm_deallocate (mach_task_self (), window, window_size);
+      err = pager_get_error (pager, offset + copied);
+      n -= copied;
+      if (cached)
+	window_put (cached, 1);
+      else
+	vm_deallocate (mach_task_self (), window, window_size);
       longjmp (buf, 1);
     }
 
@@ -22,7 +22,8 @@
 void
 pager_shutdown (struct pager *p)
 {
-  /* Sync and flush pager */
+  /* Drop any cached pager_memcpy mappings, then sync and flush pager */
+  pager_memcpy_release (p);
   pager_sync (p, 1);
   pager_flush (p, 1);
   pthread_mutex_lock (&p->interlock);
@@ -28,6 +28,18 @@ struct user_pager_info;
 /* Start the worker threads libpager uses to service requests.  */
 error_t pager_start_workers (struct port_bucket *pager_bucket);
 
+/* The number of worker threads a worker pool uses by default.  */
+#define PAGER_DEFAULT_WORKER_COUNT 1
+
+/* Make every worker pool, including the ones started later, use COUNT
+   worker threads.  Requests to the same pager are always processed in
+   order, but requests to different pagers may be processed in parallel
+   by different workers.  Return EINVAL if COUNT is out of range.  */
+error_t pager_set_worker_count (int count);
+
+/* Return the number of worker threads each worker pool uses.  */
+int pager_get_worker_count (void);
+
 /* Create a new pager.  The pager will have a port created for it
    (using libports, in BUCKET) and will be immediately ready
    to receive requests.  U_PAGER will be provided to later calls to
@@ -107,6 +119,19 @@ pager_offer_page (struct pager *pager,
 		  vm_offset_t page,
 		  vm_address_t buf);  
 
+/* Offer LENGTH bytes of consecutive pages starting at offset START,
+   which are in BUF, to the kernel without being asked for them, for
+   example to read ahead.  Pages the kernel might already have are
+   skipped.  PRECIOUS and WRITELOCK are as for pager_offer_page.  BUF
+   is consumed, whether or not its contents are used.  */
+void
+pager_offer_pages (struct pager *pager,
+		   int precious,
+		   int writelock,
+		   vm_offset_t start,
+		   vm_size_t length,
+		   vm_address_t buf);
+
 /* Change the attributes of the memory object underlying pager PAGER.
    Arguments MAY_CACHE and COPY_STRATEGY are as for
    memory_object_change_attributes.  Wait for the kernel to report
@@ -148,6 +173,15 @@ pager_memcpy (struct pager *pager, memory_object_t memobj,
 	      vm_offset_t offset, void *other, size_t *size,
 	      vm_prot_t prot);
 
+/* pager_memcpy keeps a small number of mappings of recently used
+   pagers around to avoid mapping the object on every call.  Each holds a
+   reference on its pager and keeps the memory object mapped, so the
+   object is never terminated while they exist.  Drop the ones of PAGER
+   (windows of other pagers are left alone), which must be done before
+   the last reference to the memory object can go away.  */
+void
+pager_memcpy_release (struct pager *pager);
+
 /* The user must define this function.  For pager PAGER, read one
    page from offset PAGE.  Set *BUF to be the address of the page,
    and set *WRITE_LOCK if the page must be provided read-only.
@@ -158,6 +192,22 @@ pager_read_page (struct user_pager_info *pager,
 		 vm_address_t *buf,
 		 int *write_lock);
 
+/* The user may define this function.  For pager PAGER, read LENGTH
+   bytes (a multiple of the page size) of consecutive pages starting
+   at offset START.  Set *BUF to be the address of a buffer holding
+   them, and set *WRITE_LOCK if the pages must be provided read-only.
+   This lets the user satisfy a multi-page request from the kernel
+   with as few backing store reads as possible.  The only permissible
+   error returns are EIO, EDQUOT, and ENOSPC, and EOPNOTSUPP, which
+   makes the library fall back to calling pager_read_page for each
+   page.  The default version always returns EOPNOTSUPP.  */
+error_t
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t start,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *write_lock);
+
 /* The user must define this function.  For pager PAGER, synchronously
    write one page from BUF to offset PAGE.  In addition, mfree
    (or equivalent) BUF.  The only permissible error returns are EIO,
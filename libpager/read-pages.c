@@ -0,0 +1,32 @@
+/* Default version of pager_read_pages
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+#include "priv.h"
+
+/* Users that do not define pager_read_pages get their pages read one
+   at a time with pager_read_page.  */
+error_t __attribute__ ((weak))
+pager_read_pages (struct user_pager_info *pager,
+		  vm_offset_t start,
+		  vm_size_t length,
+		  vm_address_t *buf,
+		  int *write_lock)
+{
+  return EOPNOTSUPP;
+}
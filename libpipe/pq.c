@@ -273,6 +273,34 @@ packet_realloc (struct packet *packet, size_t new_len)
   return err;
 }
 
+/* Replace the buffer of PACKET, which should be empty, with a malloced one
+   of NEW_LEN bytes, whatever its size, so that packet_read copies from it
+   rather than giving it away.  If an error occurs, PACKET is not modified
+   and the error is returned.  */
+error_t
+packet_new_buffer (struct packet *packet, size_t new_len)
+{
+  char *new_buf = malloc (new_len);
+
+  if (! new_buf)
+    return ENOMEM;
+
+  if (packet->buf_len > 0)
+    {
+      if (packet->buf_vm_alloced)
+	munmap (packet->buf, packet->buf_len);
+      else
+	free (packet->buf);
+    }
+
+  packet->buf = new_buf;
+  packet->buf_len = new_len;
+  packet->buf_vm_alloced = 0;
+  packet->buf_start = packet->buf_end = new_buf;
+
+  return 0;
+}
+
 /* ---------------------------------------------------------------- */
 
 /* If PACKET has any ports, deallocates them.  */
@@ -349,6 +377,41 @@ packet_write (struct packet *packet,
   return 0;
 }
 
+/* Make the data of PACKET, which should be empty, the DATA_LEN bytes at
+   DATA, which must be whole pages, by a virtual copy: the pages are shared
+   copy-on-write with DATA, and are moved to the reader by packet_read, so
+   the data is never copied unless one side writes to it.  If this fails,
+   PACKET is not modified and the error is returned.  */
+error_t
+packet_write_pages (struct packet *packet, char *data, size_t data_len)
+{
+  error_t err;
+  vm_address_t copy;
+  mach_msg_type_number_t copy_len;
+
+  err = vm_read (mach_task_self (), (vm_address_t) data, data_len,
+		 &copy, &copy_len);
+  if (err)
+    return err;
+
+  /* Get rid of the old buffer.  */
+  if (packet->buf_len > 0)
+    {
+      if (packet->buf_vm_alloced)
+	munmap (packet->buf, packet->buf_len);
+      else
+	free (packet->buf);
+    }
+
+  packet->buf = (char *) copy;
+  packet->buf_len = copy_len;
+  packet->buf_vm_alloced = 1;
+  packet->buf_start = packet->buf;
+  packet->buf_end = packet->buf + data_len;
+
+  return 0;
+}
+
 /* Remove or peek up to AMOUNT bytes from the beginning of the data in PACKET, and
    puts it into *DATA, and the amount read into DATA_LEN.  If more than the
    original *DATA_LEN bytes are available, new memory is vm_allocated, and
@@ -414,11 +477,13 @@ packet_fetch (struct packet *packet,
 	  memcpy (*data, start, amount);
 	  start += amount;
 
-	  if (remove && start - buf > 2 * PACKET_SIZE_LARGE)
-	    /* Get rid of unused space at the beginning of the buffer -- we
-	       know it's vm_alloced because of the size, and this will allow
-	       the buffer to just slide through memory.  Because we wait for
-	       a relatively large amount of free space before doing this, and
+	  if (remove && packet->buf_vm_alloced
+	      && start - buf > 2 * PACKET_SIZE_LARGE)
+	    /* Get rid of unused space at the beginning of the buffer, which
+	       will allow the buffer to just slide through memory.  Its size
+	       doesn't tell whether it's vm_alloced, as stream segments are
+	       malloced whatever their size.  Because we wait for a relatively
+	       large amount of free space before doing this, and
 	       packet_write() would have gotten rid the free space if it
 	       didn't require copying much data, it's unlikely that this will
 	       happen if it would have been cheaper to just move the packet
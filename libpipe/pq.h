@@ -91,6 +91,14 @@ packet_readable (struct packet *packet)
 error_t packet_write (struct packet *packet,
 		      char *data, size_t data_len, size_t *amount);
 
+/* Make the data of PACKET, which should be empty, the DATA_LEN bytes at
+   DATA, which must be whole pages, by a virtual copy: the pages are shared
+   copy-on-write with DATA, and are moved to the reader by packet_read, so
+   the data is never copied unless one side writes to it.  If this fails,
+   PACKET is not modified and the error is returned.  */
+error_t packet_write_pages (struct packet *packet,
+			    char *data, size_t data_len);
+
 /* Removes up to AMOUNT bytes from the beginning of the data in PACKET, and
    puts it into *DATA, and the amount read into DATA_LEN.  If more than the
    original *DATA_LEN bytes are available, new memory is vm_allocated, and
@@ -147,6 +155,12 @@ int packet_extend (struct packet *packet, size_t new_len);
    returned.  */
 error_t packet_realloc (struct packet *packet, size_t new_len);
 
+/* Replace the buffer of PACKET, which should be empty, with a malloced one
+   of NEW_LEN bytes, whatever its size, so that packet_read copies from it
+   rather than giving it away.  If an error occurs, PACKET is not modified
+   and the error is returned.  */
+error_t packet_new_buffer (struct packet *packet, size_t new_len);
+
 extern int packet_fit (struct packet *packet, size_t amount);
 
 extern error_t packet_ensure (struct packet *packet, size_t amount);
@@ -25,10 +25,27 @@
 
 /* See the definition of struct pipe_class in "pipe.h" for an explanation.  */
 
-/* This should be in some system header...  XXX  */
-static inline int page_aligned (vm_offset_t num)
+/* Stream data is copied into segments of this size, packets with malloced
+   buffers which are used over and over: a read that empties one puts it
+   on the free list of the packet queue, with its buffer, for a later
+   write to take.  Together the queue and the free list make a ring
+   buffer, which grows only as far as the pipe fills.  This is the default
+   write limit, so that a reader usually finds what small writes have
+   queued in one segment, as a read returns data from one packet only.  */
+#define SEGMENT_SIZE	(16 * 1024)
+
+/* Runs of whole pages at least this long are written by reference, in a
+   packet of their own, rather than copied into segments.  */
+#define PAGES_MIN	PACKET_SIZE_LARGE
+
+/* Returns how many more bytes the stream packet PACKET can take.  */
+static inline size_t
+segment_room (struct packet *packet)
 {
-  return trunc_page (num) == num;
+  if (packet->buf_vm_alloced)
+    /* Pages written by reference, or buffers left over from before.  */
+    return 0;
+  return packet->buf + packet->buf_len - packet->buf_end;
 }
 
 static error_t 
@@ -36,20 +53,68 @@ stream_write (struct pq *pq, void *source,
 	      char *data, size_t data_len, size_t *amount)
 {
   struct packet *packet = pq_tail (pq, PACKET_TYPE_DATA, source);
+  size_t left = data_len;
+  error_t err = 0;
 
-  if (packet_readable (packet) > 0
-      && data_len > PACKET_SIZE_LARGE
-      && (! page_aligned (data - packet->buf_end)
-	  || ! packet_ensure_efficiently (packet, data_len)))
-    /* Put a large page-aligned transfer in its own packet, if it's
-       page-aligned `differently' than the end of the current packet, or if
-       the current packet can't be extended in place.  */
-    packet = pq_queue (pq, PACKET_TYPE_DATA, source);
-
-  if (!packet)
-    return ENOBUFS;
-  else
-    return packet_write (packet, data, data_len, amount);
+  while (left > 0 && !err)
+    {
+      /* The bytes before the next page boundary of DATA, which start a
+	 run of whole pages if there is one.  */
+      size_t head = round_page (data) - (vm_address_t) data;
+      int pages = (head == 0 && left >= PAGES_MIN);
+      size_t len;
+
+      if (packet && packet_readable (packet) > 0
+	  && (pages || segment_room (packet) == 0))
+	/* Pages written by reference get a packet of their own.  */
+	packet = pq_queue (pq, PACKET_TYPE_DATA, source);
+      if (! packet)
+	{
+	  err = ENOBUFS;
+	  break;
+	}
+
+      if (pages)
+	{
+	  len = trunc_page (left);
+	  if (! packet_write_pages (packet, data, len))
+	    {
+	      data += len;
+	      left -= len;
+	      continue;
+	    }
+	  /* Copy them instead.  */
+	}
+
+      if (packet_readable (packet) == 0
+	  && (packet->buf_vm_alloced || packet->buf_len < SEGMENT_SIZE))
+	/* Make PACKET a segment.  */
+	{
+	  err = packet_new_buffer (packet, SEGMENT_SIZE);
+	  if (err)
+	    break;
+	}
+
+      len = segment_room (packet);
+      if (len > left)
+	len = left;
+      if (head > 0 && head < len && left - head >= PAGES_MIN)
+	/* Leave the pages that follow to go by reference.  */
+	len = head;
+
+      memcpy (packet->buf_end, data, len);
+      packet->buf_end += len;
+      data += len;
+      left -= len;
+    }
+
+  if (err && left == data_len)
+    return err;
+
+  /* Return what we could write, as a short write.  */
+  if (amount)
+    *amount = data_len - left;
+  return 0;
 }
 
 static error_t 
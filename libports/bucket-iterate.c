@@ -35,11 +35,11 @@ _ports_bucket_class_iterate (struct hurd_ihash *ht,
   size_t i, n, nr_items;
   error_t err;
 
-  pthread_rwlock_rdlock (&_ports_htable_lock);
+  _ports_htable_rdlock ();
 
   if (ht->nr_items == 0)
     {
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_rdunlock ();
       return 0;
     }
 
@@ -47,7 +47,7 @@ _ports_bucket_class_iterate (struct hurd_ihash *ht,
   p = malloc (nr_items * sizeof *p);
   if (p == NULL)
     {
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_rdunlock ();
       return ENOMEM;
     }
 
@@ -63,7 +63,7 @@ _ports_bucket_class_iterate (struct hurd_ihash *ht,
 	  n++;
 	}
     }
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_rdunlock ();
 
   if (n != 0 && n != nr_items)
     {
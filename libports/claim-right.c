@@ -34,10 +34,10 @@ ports_claim_right (void *portstruct)
   if (ret == MACH_PORT_NULL)
     return ret;
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
   err = mach_port_move_member (mach_task_self (), ret, MACH_PORT_NULL);
   assert_perror (err);
   pthread_mutex_lock (&_ports_lock);
@@ -0,0 +1,71 @@
+/* Allocate the port structures of a class from an object cache.
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 675 Mass Ave, Cambridge, MA 02139, USA. */
+
+#include "ports.h"
+#include <assert.h>
+
+error_t
+ports_class_cache_objects (struct port_class *class, size_t size)
+{
+  error_t err;
+
+  assert (! class->obj_space);
+
+  if (size < sizeof (struct port_info))
+    size = sizeof (struct port_info);
+
+  err = hurd_slab_create (size, 0, NULL, NULL, NULL, &class->obj_space);
+  if (! err)
+    class->obj_size = size;
+  return err;
+}
+
+/* Allocate a port structure of SIZE bytes for a port in CLASS, and
+   initialize its flags.  Return null if out of memory.  */
+struct port_info *
+_ports_alloc_port_info (struct port_class *class, size_t size)
+{
+  struct port_info *pi;
+
+  if (class->obj_space && size == class->obj_size)
+    {
+      if (hurd_slab_alloc (class->obj_space, (void **) &pi))
+	return NULL;
+      pi->flags = PORT_CACHED;
+    }
+  else
+    {
+      pi = malloc (size);
+      if (! pi)
+	return NULL;
+      pi->flags = 0;
+    }
+
+  return pi;
+}
+
+/* Free the port structure PI.  */
+void
+_ports_free_port_info (struct port_info *pi)
+{
+  if (pi->flags & PORT_CACHED)
+    hurd_slab_dealloc (pi->class->obj_space, pi);
+  else
+    free (pi);
+}
@@ -31,7 +31,7 @@ _ports_complete_deallocate (struct port_info *pi)
     {
       struct references result;
 
-      pthread_rwlock_wrlock (&_ports_htable_lock);
+      _ports_htable_wrlock ();
       refcounts_references (&pi->refcounts, &result);
       if (result.hard > 0 || result.weak > 0)
         {
@@ -39,13 +39,13 @@ _ports_complete_deallocate (struct port_info *pi)
              It's fine, we didn't touch anything yet. */
           /* XXX: This really shouldn't happen.  */
           assert (! "reacquired reference w/o send rights");
-          pthread_rwlock_unlock (&_ports_htable_lock);
+          _ports_htable_wrunlock ();
           return;
         }
 
       hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
       hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_wrunlock ();
 
       mach_port_mod_refs (mach_task_self (), pi->port_right,
 			  MACH_PORT_RIGHT_RECEIVE, -1);
@@ -62,5 +62,5 @@ _ports_complete_deallocate (struct port_info *pi)
   if (pi->class->clean_routine)
     (*pi->class->clean_routine)(pi);
   
-  free (pi);
+  _ports_free_port_info (pi);
 }
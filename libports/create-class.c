@@ -41,6 +41,8 @@ ports_create_class (void (*clean_routine)(void *),
   cl->rpcs = 0;
   cl->count = 0;
   cl->uninhibitable_rpcs = ports_default_uninhibitable_rpcs;
+  cl->obj_space = NULL;
+  cl->obj_size = 0;
 
   return cl;
 }
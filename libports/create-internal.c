@@ -44,7 +44,7 @@ _ports_create_port_internal (struct port_class *class,
   if (size < sizeof (struct port_info))
     size = sizeof (struct port_info);
 
-  pi = malloc (size);
+  pi = _ports_alloc_port_info (class, size);
   if (! pi)
     {
       err = mach_port_mod_refs (mach_task_self (), port,
@@ -57,7 +57,6 @@ _ports_create_port_internal (struct port_class *class,
   refcounts_init (&pi->refcounts, 1, 0);
   pi->cancel_threshold = 0;
   pi->mscount = 0;
-  pi->flags = 0;
   pi->port_right = port;
   pi->current_rpcs = 0;
   pi->bucket = bucket;
@@ -80,21 +79,21 @@ _ports_create_port_internal (struct port_class *class,
       goto loop;
     }
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   err = hurd_ihash_add (&_ports_htable, port, pi);
   if (err)
     {
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_wrunlock ();
       goto lose;
     }
   err = hurd_ihash_add (&bucket->htable, port, pi);
   if (err)
     {
       hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_wrunlock ();
       goto lose;
     }
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
 
   bucket->count++;
   class->count++;
@@ -124,7 +123,7 @@ _ports_create_port_internal (struct port_class *class,
   e = mach_port_mod_refs (mach_task_self (), port,
 			  MACH_PORT_RIGHT_RECEIVE, -1);
   assert_perror (e);
-  free (pi);
+  _ports_free_port_info (pi);
 
   return err;
 }
@@ -43,7 +43,7 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
   if (size < sizeof (struct port_info))
     size = sizeof (struct port_info);
   
-  pi = malloc (size);
+  pi = _ports_alloc_port_info (class, size);
   if (! pi)
     return ENOMEM;
   
@@ -51,7 +51,8 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
   refcounts_init (&pi->refcounts, 1 + !!stat.mps_srights, 0);
   pi->cancel_threshold = 0;
   pi->mscount = stat.mps_mscount;
-  pi->flags = stat.mps_srights ? PORT_HAS_SENDRIGHTS : 0;
+  if (stat.mps_srights)
+    pi->flags |= PORT_HAS_SENDRIGHTS;
   pi->port_right = port;
   pi->current_rpcs = 0;
   pi->bucket = bucket;
@@ -74,21 +75,21 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
       goto loop;
     }
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   err = hurd_ihash_add (&_ports_htable, port, pi);
   if (err)
     {
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_wrunlock ();
       goto lose;
     }
   err = hurd_ihash_add (&bucket->htable, port, pi);
   if (err)
     {
       hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_wrunlock ();
       goto lose;
     }
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
 
   bucket->count++;
   class->count++;
@@ -119,7 +120,7 @@ ports_import_port (struct port_class *class, struct port_bucket *bucket,
   err = EINTR;
  lose:
   pthread_mutex_unlock (&_ports_lock);
-  free (pi);
+  _ports_free_port_info (pi);
 
   return err;
 }
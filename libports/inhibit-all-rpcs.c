@@ -36,7 +36,7 @@ ports_inhibit_all_rpcs ()
       struct port_bucket *bucket;
       int this_one = 0;
 
-      pthread_rwlock_rdlock (&_ports_htable_lock);
+      _ports_htable_rdlock ();
       HURD_IHASH_ITERATE (&_ports_htable, portstruct)
 	{
 	  struct rpc_info *rpc;
@@ -52,7 +52,7 @@ ports_inhibit_all_rpcs ()
 		hurd_thread_cancel (rpc->thread);
 	    }
 	}
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_rdunlock ();
 
       while (_ports_total_rpcs > this_one)
 	{
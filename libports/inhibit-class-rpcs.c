@@ -36,7 +36,7 @@ ports_inhibit_class_rpcs (struct port_class *class)
       struct rpc_info *rpc;
       int this_one = 0;
 
-      pthread_rwlock_rdlock (&_ports_htable_lock);
+      _ports_htable_rdlock ();
       HURD_IHASH_ITERATE (&_ports_htable, portstruct)
 	{
 	  struct rpc_info *rpc;
@@ -53,7 +53,7 @@ ports_inhibit_class_rpcs (struct port_class *class)
 		hurd_thread_cancel (rpc->thread);
 	    }
 	}
-      pthread_rwlock_unlock (&_ports_htable_lock);
+      _ports_htable_rdunlock ();
 
       while (class->rpcs > this_one)
 	{
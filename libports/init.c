@@ -26,7 +26,29 @@ pthread_cond_t _ports_block = PTHREAD_COND_INITIALIZER;
 
 struct hurd_ihash _ports_htable =
   HURD_IHASH_INITIALIZER (offsetof (struct port_info, ports_htable_entry));
-pthread_rwlock_t _ports_htable_lock = PTHREAD_RWLOCK_INITIALIZER;
+struct _ports_htable_lock _ports_htable_locks[_PORTS_HTABLE_LOCKS] =
+  { [0 ... _PORTS_HTABLE_LOCKS - 1] = { PTHREAD_RWLOCK_INITIALIZER } };
+
+/* Lock the hash tables for writing.  Take the reader locks in
+   ascending order to avoid deadlocks between writers.  */
+void
+_ports_htable_wrlock (void)
+{
+  int i;
+
+  for (i = 0; i < _PORTS_HTABLE_LOCKS; i++)
+    pthread_rwlock_wrlock (&_ports_htable_locks[i].lock);
+}
+
+/* Release a lock taken by _ports_htable_wrlock.  */
+void
+_ports_htable_wrunlock (void)
+{
+  int i;
+
+  for (i = _PORTS_HTABLE_LOCKS - 1; i >= 0; i--)
+    pthread_rwlock_unlock (&_ports_htable_locks[i].lock);
+}
 
 int _ports_total_rpcs;
 int _ports_flags;
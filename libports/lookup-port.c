@@ -28,7 +28,7 @@ ports_lookup_port (struct port_bucket *bucket,
 {
   struct port_info *pi;
 
-  pthread_rwlock_rdlock (&_ports_htable_lock);
+  _ports_htable_rdlock ();
 
   pi = hurd_ihash_find (&_ports_htable, port);
   if (pi
@@ -39,7 +39,7 @@ ports_lookup_port (struct port_bucket *bucket,
   if (pi)
     refcounts_unsafe_ref (&pi->refcounts, NULL);
 
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_rdunlock ();
 
   return pi;
 }
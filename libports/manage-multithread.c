@@ -1,5 +1,5 @@
 /*
-   Copyright (C) 1995, 1996, 1997 Free Software Foundation, Inc.
+   Copyright (C) 1995, 1996, 1997, 2014 Free Software Foundation, Inc.
    Written by Michael I. Bushnell.
 
    This file is part of the GNU Hurd.
@@ -30,6 +30,99 @@
 
 #define THREAD_PRI 2
 
+/* The limits set by ports_set_thread_limits.  */
+static unsigned int min_threads;
+static unsigned int max_threads;
+
+/* The statistics returned by ports_get_thread_stats.  The fields are
+   updated atomically.  */
+static struct ports_thread_stats thread_stats;
+
+error_t
+ports_set_thread_limits (unsigned int min, unsigned int max)
+{
+  if (max && max < min)
+    return EINVAL;
+
+  __atomic_store_n (&min_threads, min, __ATOMIC_RELAXED);
+  __atomic_store_n (&max_threads, max, __ATOMIC_RELAXED);
+  return 0;
+}
+
+void
+ports_get_thread_limits (unsigned int *min, unsigned int *max)
+{
+  *min = __atomic_load_n (&min_threads, __ATOMIC_RELAXED);
+  *max = __atomic_load_n (&max_threads, __ATOMIC_RELAXED);
+}
+
+void
+ports_get_thread_stats (struct ports_thread_stats *stats)
+{
+#define GET(field) \
+  stats->field = __atomic_load_n (&thread_stats.field, __ATOMIC_RELAXED)
+  GET (threads);
+  GET (peak_threads);
+  GET (created);
+  GET (exited);
+  GET (failed);
+  GET (throttled);
+  GET (idle_msecs);
+#undef GET
+}
+
+/* Account for a new thread in *TOTALTHREADS, unless that would exceed
+   the maximum.  Return nonzero if the thread may be created.  */
+static int
+reserve_thread (unsigned int *totalthreads)
+{
+  unsigned int max = __atomic_load_n (&max_threads, __ATOMIC_RELAXED);
+  unsigned int total = __atomic_load_n (totalthreads, __ATOMIC_RELAXED);
+
+  do
+    if (max && total >= max)
+      {
+	__atomic_add_fetch (&thread_stats.throttled, 1, __ATOMIC_RELAXED);
+	return 0;
+      }
+  while (! __atomic_compare_exchange_n (totalthreads, &total, total + 1, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/* Remove an idle thread from *TOTALTHREADS, unless that would leave
+   fewer threads than the minimum.  Return nonzero if the thread may
+   exit.  */
+static int
+release_thread (unsigned int *totalthreads)
+{
+  unsigned int min = __atomic_load_n (&min_threads, __ATOMIC_RELAXED);
+  unsigned int total = __atomic_load_n (totalthreads, __ATOMIC_RELAXED);
+
+  do
+    if (total <= min)
+      return 0;
+  while (! __atomic_compare_exchange_n (totalthreads, &total, total - 1, 0,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED));
+  return 1;
+}
+
+/* Account for a thread that was just created.  */
+static void
+thread_created (void)
+{
+  unsigned int threads, peak;
+
+  __atomic_add_fetch (&thread_stats.created, 1, __ATOMIC_RELAXED);
+  threads = __atomic_add_fetch (&thread_stats.threads, 1, __ATOMIC_RELAXED);
+  peak = __atomic_load_n (&thread_stats.peak_threads, __ATOMIC_RELAXED);
+  while (threads > peak
+	 && ! __atomic_compare_exchange_n (&thread_stats.peak_threads, &peak,
+					   threads, 0, __ATOMIC_RELAXED,
+					   __ATOMIC_RELAXED))
+    ;
+}
+
 /* XXX To reduce starvation, the priority of new threads is initially
    depressed. This helps already existing threads complete their job and be
    recycled to handle new messages. The duration of this depression is made
@@ -114,6 +207,38 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
   pthread_attr_init (&attr);
   pthread_attr_setstacksize (&attr, STACK_SIZE);
 
+  /* Create a thread listening for requests, if the limits allow it.  */
+  void
+  spawn_thread (void)
+    {
+      pthread_t pthread_id;
+      error_t err;
+
+      if (! reserve_thread (&totalthreads))
+	/* The message stays queued until a thread is done.  */
+	return;
+
+      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+
+      err = pthread_create (&pthread_id, &attr, thread_function, NULL);
+      if (!err)
+	{
+	  pthread_detach (pthread_id);
+	  thread_created ();
+	}
+      else
+	{
+	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_add_fetch (&thread_stats.failed, 1, __ATOMIC_RELAXED);
+	  /* There is not much we can do at this point.  The code
+	     and design of the Hurd servers just don't handle
+	     thread creation failure.  */
+	  errno = err;
+	  perror ("pthread_create");
+	}
+    }
+
   int
   internal_demuxer (mach_msg_header_t *inp,
 		    mach_msg_header_t *outheadp)
@@ -134,28 +259,8 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 
       if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
 	/* No thread would be listening for requests, spawn one. */
-	{
-	  pthread_t pthread_id;
-	  error_t err;
-
-	  __atomic_add_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	  __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
+	spawn_thread ();
 
-	  err = pthread_create (&pthread_id, &attr, thread_function, NULL);
-	  if (!err)
-	    pthread_detach (pthread_id);
-	  else
-	    {
-	      __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
-	      __atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
-	      /* There is not much we can do at this point.  The code
-		 and design of the Hurd servers just don't handle
-		 thread creation failure.  */
-	      errno = err;
-	      perror ("pthread_create");
-	    }
-	}
-      
       /* Fill in default response. */
       outp->Head.msgh_bits 
 	= MACH_MSGH_BITS(MACH_MSGH_BITS_REMOTE(inp->msgh_bits), 0);
@@ -251,6 +356,8 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 				       timeout);
       while (err != MACH_RCV_TIMED_OUT);
 
+      __atomic_add_fetch (&thread_stats.idle_msecs, timeout, __ATOMIC_RELAXED);
+
       if (master)
 	{
 	  if (__atomic_load_n (&totalthreads, __ATOMIC_RELAXED) != 1)
@@ -258,13 +365,16 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
 	}
       else
 	{
-	  if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0)
+	  if (__atomic_sub_fetch (&nreqthreads, 1, __ATOMIC_RELAXED) == 0
+	      || ! release_thread (&totalthreads))
 	    {
-	      /* No other thread is listening for requests, continue. */
+	      /* No other thread is listening for requests, or we are
+		 needed to keep the minimum number of threads, continue. */
 	      __atomic_add_fetch (&nreqthreads, 1, __ATOMIC_RELAXED);
 	      goto startover;
 	    }
-	  __atomic_sub_fetch (&totalthreads, 1, __ATOMIC_RELAXED);
+	  __atomic_add_fetch (&thread_stats.exited, 1, __ATOMIC_RELAXED);
+	  __atomic_sub_fetch (&thread_stats.threads, 1, __ATOMIC_RELAXED);
 	}
       _ports_thread_offline (&bucket->threadpool, &thread);
       return NULL;
@@ -276,5 +386,18 @@ ports_manage_port_operations_multithread (struct port_bucket *bucket,
      master thread from going away.  */
   global_timeout = 0;
 
+  /* Start the minimum number of threads right away, so that they are
+     ready when the first requests come in.  */
+  __atomic_add_fetch (&thread_stats.threads, 1, __ATOMIC_RELAXED);
+  while (__atomic_load_n (&totalthreads, __ATOMIC_RELAXED)
+	 < __atomic_load_n (&min_threads, __ATOMIC_RELAXED))
+    {
+      unsigned int before = __atomic_load_n (&totalthreads,
+					     __ATOMIC_RELAXED);
+      spawn_thread ();
+      if (__atomic_load_n (&totalthreads, __ATOMIC_RELAXED) == before)
+	break;
+    }
+
   thread_function ((void *) 1);
 }
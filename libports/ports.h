@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <hurd.h>
 #include <hurd/ihash.h>
+#include <hurd/slab.h>
 #include <mach/notify.h>
 #include <pthread.h>
 #include <refcount.h>
@@ -62,6 +63,7 @@ typedef struct port_info *port_info_t;
 
 /* FLAGS above are the following: */
 #define PORT_HAS_SENDRIGHTS	0x0001 /* send rights extant */
+#define PORT_CACHED		0x0002 /* allocated from the class's cache */
 #define PORT_INHIBITED		PORTS_INHIBITED
 #define PORT_BLOCKED		PORTS_BLOCKED
 #define PORT_INHIBIT_WAIT	PORTS_INHIBIT_WAIT
@@ -70,7 +72,7 @@ struct port_bucket
 {
   mach_port_t portset;
   /* Per-bucket hash table used for fast iteration.  Access must be
-     serialized using _ports_htable_lock.  */
+     serialized using _ports_htable_wrlock and friends.  */
   struct hurd_ihash htable;
   int rpcs;
   int flags;
@@ -92,6 +94,10 @@ struct port_class
   void (*clean_routine) (void *);
   void (*dropweak_routine) (void *);
   struct ports_msg_id_range *uninhibitable_rpcs;
+  /* If not null, port structures of OBJ_SIZE bytes are allocated from
+     this object cache.  */
+  struct hurd_slab_space *obj_space;
+  size_t obj_size;
 };
 /* FLAGS are the following: */
 #define PORT_CLASS_INHIBITED	PORTS_INHIBITED
@@ -169,6 +175,13 @@ struct port_bucket *ports_create_bucket (void);
 struct port_class *ports_create_class (void (*clean_routine)(void *),
 				       void (*dropweak_routine)(void *));
 
+/* Allocate the port structures of CLASS that are SIZE bytes large from
+   an object cache instead of with malloc.  This is worthwhile for
+   classes whose ports are made and destroyed often, and whose ports are
+   (mostly) of one size.  Call this at most once for each class, before
+   making any ports in it.  */
+error_t ports_class_cache_objects (struct port_class *class, size_t size);
+
 /* Create and return in RESULT a new port in CLASS and BUCKET; SIZE bytes
    will be allocated to hold the port structure and whatever private data the
    user desires.  */
@@ -373,13 +386,50 @@ void ports_manage_port_operations_one_thread(struct port_bucket *bucket,
    LOCAL_TIMEOUT is non-zero, then individual threads will die off if
    they handle no incoming messages for LOCAL_TIMEOUT milliseconds.
    HOOK (if not null) will be called in each new thread immediately
-   after it is created. */
+   after it is created.  The number of threads is kept within the
+   limits set by ports_set_thread_limits.  */
 void ports_manage_port_operations_multithread (struct port_bucket *bucket,
 					       ports_demuxer_type demuxer,
 					       int thread_timeout,
 					       int global_timeout,
 					       void (*hook)(void));
 
+/* Make ports_manage_port_operations_multithread keep at least
+   MIN_THREADS threads, including the calling thread, per bucket, even
+   if they are idle, and never create more than MAX_THREADS threads per
+   bucket.  If all threads are busy when a message arrives, it stays
+   queued on the port until one of them is done; this also makes
+   senders block once the queue of the port is full.  A MAX_THREADS of
+   0 means no limit, which is the default.  Beware that a limit may
+   deadlock a server whose RPCs wait for other RPCs to the same server.
+   Return EINVAL if MAX_THREADS is nonzero and less than MIN_THREADS.
+   The limits apply to threads created after this call.  */
+error_t ports_set_thread_limits (unsigned int min_threads,
+				 unsigned int max_threads);
+
+/* Return the limits set by ports_set_thread_limits.  */
+void ports_get_thread_limits (unsigned int *min_threads,
+			      unsigned int *max_threads);
+
+/* Statistics on the threads of ports_manage_port_operations_multithread,
+   summed over all buckets.  */
+struct ports_thread_stats
+{
+  unsigned int threads;		/* Number of threads now.  */
+  unsigned int peak_threads;	/* Maximum number of threads so far.  */
+  unsigned long created;	/* Threads created.  */
+  unsigned long exited;		/* Threads that exited after being idle.  */
+  unsigned long failed;		/* Failures to create a thread.  */
+  unsigned long throttled;	/* Messages that had to wait because the
+				   maximum number of threads was reached.  */
+  unsigned long long idle_msecs; /* Time threads spent waiting for
+				    messages in vain, in milliseconds.
+				    Only whole thread timeouts count.  */
+};
+
+/* Fill in STATS with the current thread statistics.  */
+void ports_get_thread_stats (struct ports_thread_stats *stats);
+
 /* Interrupt any pending RPC on PORT.  Wait for all pending RPC's to
    finish, and then block any new RPC's starting on that port. */
 error_t ports_inhibit_port_rpcs (void *port);
@@ -471,8 +521,59 @@ extern pthread_cond_t _ports_block;
    momentarily to check whether someone else reacquired a reference
    through the hash table.  */
 extern struct hurd_ihash _ports_htable;
-/* Access to all hash tables is protected by this lock.  */
-extern pthread_rwlock_t _ports_htable_lock;
+
+/* Access to all hash tables is protected by a lock which is split into
+   _PORTS_HTABLE_LOCKS reader-writer locks, each on its own cache line.
+   A reader only takes the one selected by its thread, so concurrent
+   lookups don't contend on a single lock word.  A writer takes all of
+   them.  Use the functions below to manipulate it.  */
+#define _PORTS_HTABLE_LOCKS	16
+struct _ports_htable_lock
+{
+  pthread_rwlock_t lock;
+} __attribute__ ((aligned (64)));
+extern struct _ports_htable_lock _ports_htable_locks[_PORTS_HTABLE_LOCKS];
+
+/* Lock the hash tables for reading.  */
+void _ports_htable_rdlock (void);
+
+/* Release a lock taken by _ports_htable_rdlock.  This must be called
+   by the same thread.  */
+void _ports_htable_rdunlock (void);
+
+/* Lock the hash tables for writing.  */
+void _ports_htable_wrlock (void);
+
+/* Release a lock taken by _ports_htable_wrlock.  */
+void _ports_htable_wrunlock (void);
+
+/* Return the lock _ports_htable_rdlock takes for the calling thread.  */
+pthread_rwlock_t *_ports_htable_reader_lock (void);
+
+#if defined(__USE_EXTERN_INLINES) || defined(PORTS_DEFINE_EI)
+
+/* Return the reader lock used by the calling thread.  Thread ids are
+   small consecutive integers, so they spread evenly over the locks.  */
+PORTS_EI pthread_rwlock_t *
+_ports_htable_reader_lock (void)
+{
+  return &_ports_htable_locks[(uintptr_t) pthread_self ()
+			      % _PORTS_HTABLE_LOCKS].lock;
+}
+
+PORTS_EI void
+_ports_htable_rdlock (void)
+{
+  pthread_rwlock_rdlock (_ports_htable_reader_lock ());
+}
+
+PORTS_EI void
+_ports_htable_rdunlock (void)
+{
+  pthread_rwlock_unlock (_ports_htable_reader_lock ());
+}
+
+#endif /* Use extern inlines.  */
 
 extern int _ports_total_rpcs;
 extern int _ports_flags;
@@ -482,5 +583,7 @@ extern int _ports_flags;
 void _ports_complete_deallocate (struct port_info *);
 error_t _ports_create_port_internal (struct port_class *, struct port_bucket *,
 				     size_t, void *, int);
+struct port_info *_ports_alloc_port_info (struct port_class *, size_t);
+void _ports_free_port_info (struct port_info *);
 
 #endif
@@ -43,10 +43,10 @@ ports_reallocate_from_external (void *portstruct, mach_port_t receive)
 			    MACH_PORT_RIGHT_RECEIVE, -1);
   assert_perror (err);
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
 
   if ((pi->flags & PORT_HAS_SENDRIGHTS) && !stat.mps_srights)
     {
@@ -63,11 +63,11 @@ ports_reallocate_from_external (void *portstruct, mach_port_t receive)
   pi->cancel_threshold = 0;
   pi->mscount = stat.mps_mscount;
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   err = hurd_ihash_add (&_ports_htable, receive, pi);
   assert_perror (err);
   err = hurd_ihash_add (&pi->bucket->htable, receive, pi);
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
   pthread_mutex_unlock (&_ports_lock);
   assert_perror (err);
 
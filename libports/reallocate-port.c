@@ -36,10 +36,10 @@ ports_reallocate_port (void *portstruct)
 			    MACH_PORT_RIGHT_RECEIVE, -1);
   assert_perror (err);
 
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   hurd_ihash_locp_remove (&_ports_htable, pi->ports_htable_entry);
   hurd_ihash_locp_remove (&pi->bucket->htable, pi->hentry);
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
 
   err = mach_port_allocate (mach_task_self (), MACH_PORT_RIGHT_RECEIVE,
 			    &pi->port_right);
@@ -51,11 +51,11 @@ ports_reallocate_port (void *portstruct)
     }
   pi->cancel_threshold = 0;
   pi->mscount = 0;
-  pthread_rwlock_wrlock (&_ports_htable_lock);
+  _ports_htable_wrlock ();
   err = hurd_ihash_add (&_ports_htable, pi->port_right, pi);
   assert_perror (err);
   err = hurd_ihash_add (&pi->bucket->htable, pi->port_right, pi);
-  pthread_rwlock_unlock (&_ports_htable_lock);
+  _ports_htable_wrunlock ();
   pthread_mutex_unlock (&_ports_lock);
   assert_perror (err);
 
@@ -10,4 +10,6 @@ DO_UNZIP (void)
 }
 
 #define UNZIP		bunzip2
+#define UNZIP_INDEX	bunzip2_index
+#define UNZIP_EXTRACT	bunzip2_extract
 #include "unzipstore.c"
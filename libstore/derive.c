@@ -19,6 +19,7 @@
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
 #include <assert.h>
+#include <stdlib.h>
 #include <sys/types.h>
 #include <mach.h>
 
@@ -34,12 +35,20 @@ _store_derive (struct store *store)
   unsigned num_runs = store->num_runs;
   size_t bsize = store->block_size;
 
+  /* RUN_OFFSETS */
+  free (store->run_offsets);
+  store->run_offsets = (num_runs > 0
+			? malloc (num_runs * sizeof (store_offset_t)) : 0);
+  store->last_run = 0;
+
   /* BLOCK & SIZE */
   store->blocks = 0;
   store->wrap_src = 0;
 
   for (i = 0; i < num_runs; i++)
     {
+      if (store->run_offsets)
+	store->run_offsets[i] = store->wrap_src;
       store->wrap_src += runs[i].length;
       if (runs[i].start >= 0)	/* Not a hole */
 	store->blocks += runs[i].length;
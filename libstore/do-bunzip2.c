@@ -19,8 +19,14 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <unistd.h>
 #include <bzlib.h>
 
+#include "unzip.h"
+
 /* I/O interface */
 extern int (*unzip_read) (char *buf, size_t maxread);
 extern void (*unzip_write) (const char *buf, size_t nwrite);
@@ -85,3 +91,306 @@ do_bunzip2 (void)
   if (result != BZ_STREAM_END)
     (*unzip_error) (NULL);
 }
+
+/* Random access.  A bzip2 stream is a header followed by blocks, each
+   compressed on its own and starting with a 48-bit magic number, and an
+   end of stream marker, none of which are byte aligned.  The blocks are
+   found by looking for the magic numbers, and each is decompressed by
+   making it into a stream of its own.  */
+
+#define BLOCK_MAGIC	0x314159265359ULL
+#define EOS_MAGIC	0x177245385090ULL
+#define MAGIC_MASK	0xffffffffffffULL
+
+/* Read the compressed input in pieces of this size.  */
+#define INPUT_SIZE	(64 * 1024)
+
+/* Output that is only counted goes to a buffer of this size.  */
+#define SCRATCH_SIZE	(64 * 1024)
+
+/* The most threads decompressing blocks at once while indexing, if there
+   are that many processors.  */
+#define INDEX_JOBS	8
+
+/* Append the low N bits of VALUE to the zeroed buffer BUF, at the bit
+   offset *POS, which is advanced.  */
+static void
+put_bits (unsigned char *buf, size_t *pos, uint64_t value, int n)
+{
+  while (n-- > 0)
+    {
+      if ((value >> n) & 1)
+	buf[*pos >> 3] |= 0x80 >> (*pos & 7);
+      ++*pos;
+    }
+}
+
+/* Decompress the block of FROM described by the input offsets of CHUNK.
+   If BUF is not null, put the output there, which must be exactly LEN
+   bytes long; otherwise, just return its length in *LEN.  If reading FROM
+   fails and READ_ERR is not null, the error is also stored there.  */
+static error_t
+decompress_block (struct store *from, const struct unzip_chunk *chunk,
+		  char *buf, size_t *len, error_t *read_err)
+{
+  store_offset_t start = chunk->in >> 3;
+  int shift = chunk->in & 7;
+  size_t nbits = chunk->in_end - chunk->in;
+  size_t in_len = ((chunk->in_end + 7) >> 3) - start + 1;
+  size_t stream_len = 4 + (nbits + 48 + 32 + 7) / 8;
+  size_t size = buf ? *len : 0, total = 0, got, pos, i;
+  unsigned char *in, *stream = 0;
+  char *scratch = 0;
+  uint32_t crc;
+  bz_stream strm;
+  error_t err = 0;
+  int result;
+
+  /* A block has at least its magic number and its CRC.  */
+  if (nbits < 80)
+    return EINVAL;
+
+  in = calloc (in_len, 1);
+  if (! in)
+    return ENOMEM;
+  for (pos = 0; ! err && pos < in_len; pos += got)
+    {
+      err = unzip_read_input (from, start + pos, in + pos, in_len - pos, &got);
+      if (err && read_err)
+	*read_err = err;
+      if (! err && got == 0)
+	break;			/* The extra byte may be past the end.  */
+    }
+  if (! err && pos < in_len - 1)
+    err = EINVAL;
+  if (! err)
+    {
+      stream = calloc (stream_len, 1);
+      scratch = malloc (SCRATCH_SIZE);
+      if (! stream || ! scratch)
+	err = ENOMEM;
+    }
+  if (err)
+    {
+      free (in);
+      free (stream);
+      free (scratch);
+      return err;
+    }
+
+  /* The header, with the largest block size, and the block moved to a
+     byte boundary.  */
+  memcpy (stream, "BZh9", 4);
+  for (i = 0; i < (nbits + 7) / 8; i++)
+    stream[4 + i] = (in[i] << shift) | (shift ? in[i + 1] >> (8 - shift) : 0);
+  if (nbits & 7)
+    stream[4 + nbits / 8] &= 0xff << (8 - (nbits & 7));
+  free (in);
+
+  /* The block's CRC follows its magic number; as the stream has only this
+     block, it is also the CRC of the stream.  */
+  crc = ((uint32_t) stream[10] << 24 | (uint32_t) stream[11] << 16
+	 | (uint32_t) stream[12] << 8 | stream[13]);
+  pos = 32 + nbits;
+  put_bits (stream, &pos, EOS_MAGIC, 48);
+  put_bits (stream, &pos, crc, 32);
+
+  memset (&strm, 0, sizeof strm);
+  if (BZ2_bzDecompressInit (&strm, 0, SMALL_MODE) != BZ_OK)
+    err = ENOMEM;
+  else
+    {
+      strm.next_in = (char *) stream;
+      strm.avail_in = stream_len;
+
+      for (;;)
+	{
+	  /* Once BUF is full, anything more is an error.  */
+	  char *out = buf && total < size ? buf + total : scratch;
+	  size_t avail = out == scratch ? SCRATCH_SIZE : size - total;
+	  size_t produced;
+
+	  strm.next_out = out;
+	  strm.avail_out = avail;
+	  result = BZ2_bzDecompress (&strm);
+	  produced = avail - strm.avail_out;
+	  if (buf && out == scratch && produced > 0)
+	    {
+	      err = EINVAL;
+	      break;
+	    }
+	  total += produced;
+
+	  if (result == BZ_STREAM_END)
+	    break;
+	  if (result == BZ_MEM_ERROR)
+	    err = ENOMEM;
+	  else if (result != BZ_OK || (produced == 0 && strm.avail_in == 0))
+	    err = EINVAL;
+	  if (err)
+	    break;
+	}
+      BZ2_bzDecompressEnd (&strm);
+    }
+
+  free (stream);
+  free (scratch);
+
+  if (! err)
+    {
+      if (buf && total != size)
+	err = EINVAL;
+      *len = total;
+    }
+  return err;
+}
+
+error_t
+bunzip2_extract (struct store *from, const struct unzip_chunk *chunk,
+		 void *buf)
+{
+  size_t len = chunk->len;
+  return decompress_block (from, chunk, buf, &len, 0);
+}
+
+/* Finding the size of the blocks of an index.  */
+struct sizing
+{
+  struct store *from;
+  struct unzip_index *index;
+  size_t next;			/* The next block to do.  */
+  error_t err;
+};
+
+/* Find the size of blocks of the struct sizing ARG until there are none
+   left.  */
+static void
+size_blocks (void *arg)
+{
+  struct sizing *sizing = arg;
+  struct unzip_index *index = sizing->index;
+
+  for (;;)
+    {
+      size_t i = __atomic_fetch_add (&sizing->next, 1, __ATOMIC_RELAXED);
+      error_t err, read_err = 0;
+
+      if (i >= index->num_chunks)
+	break;
+      err = decompress_block (sizing->from, &index->chunks[i], 0,
+			      &index->chunks[i].len, &read_err);
+      if (err)
+	{
+	  __atomic_store_n (&sizing->err, err, __ATOMIC_RELAXED);
+	  if (read_err)
+	    __atomic_store_n (&index->read_err, read_err, __ATOMIC_RELAXED);
+	  break;
+	}
+    }
+}
+
+error_t
+bunzip2_index (struct store *from, struct unzip_index *index)
+{
+  unsigned char *input;
+  uint64_t magic = 0;
+  store_offset_t pos = 0, bit = 0;
+  size_t open = 0;		/* The block being scanned, plus one.  */
+  error_t err = 0;
+  size_t got, i;
+
+  index->chunks = 0;
+  index->num_chunks = 0;
+  index->size = 0;
+  index->read_err = 0;
+
+  input = malloc (INPUT_SIZE);
+  if (! input)
+    return ENOMEM;
+
+  err = unzip_read_input (from, 0, input, 4, &got);
+  if (err)
+    index->read_err = err;
+  if (! err
+      && (got < 4 || memcmp (input, "BZh", 3) || input[3] < '1'
+	  || input[3] > '9'))
+    err = EINVAL;
+
+  /* The magic numbers of the blocks and of the end of the stream start
+     where the last 48 bits read match them.  Concatenated streams are
+     handled as one, since their headers are outside the blocks.  */
+  while (! err)
+    {
+      err = unzip_read_input (from, pos, input, INPUT_SIZE, &got);
+      if (err)
+	index->read_err = err;
+      if (err || got == 0)
+	break;
+      pos += got;
+
+      for (i = 0; i < got; i++)
+	{
+	  int b;
+	  for (b = 7; b >= 0; b--)
+	    {
+	      uint64_t m;
+
+	      magic = (magic << 1) | ((input[i] >> b) & 1);
+	      bit++;
+	      m = magic & MAGIC_MASK;
+	      if (bit < 48 || (m != BLOCK_MAGIC && m != EOS_MAGIC))
+		continue;
+
+	      if (open)
+		index->chunks[open - 1].in_end = bit - 48;
+	      open = 0;
+	      if (m == BLOCK_MAGIC)
+		{
+		  struct unzip_chunk *chunk = unzip_add_chunk (index);
+		  if (! chunk)
+		    {
+		      err = ENOMEM;
+		      break;
+		    }
+		  chunk->in = bit - 48;
+		  open = index->num_chunks;
+		}
+	    }
+	  if (err)
+	    break;
+	}
+    }
+  free (input);
+
+  if (! err && open)
+    err = EINVAL;		/* Truncated.  */
+
+  if (! err && index->num_chunks > 0)
+    {
+      struct sizing sizing = { from, index, 0, 0 };
+      long cpus = sysconf (_SC_NPROCESSORS_ONLN);
+      size_t jobs = cpus > 0 && cpus < INDEX_JOBS ? cpus : INDEX_JOBS;
+      void *args[jobs];
+
+      if (jobs > index->num_chunks)
+	jobs = index->num_chunks;
+
+      for (i = 0; i < jobs; i++)
+	args[i] = &sizing;
+      _store_run_parallel (size_blocks, args, jobs);
+      err = sizing.err;
+    }
+
+  if (err)
+    {
+      unzip_free_index (index);
+      return err;
+    }
+
+  for (i = 0; i < index->num_chunks; i++)
+    {
+      index->chunks[i].out = index->size;
+      index->size += index->chunks[i].len;
+    }
+  return 0;
+}
@@ -19,8 +19,12 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
+#include <errno.h>
+#include <stdlib.h>
 #include <zlib.h>
 
+#include "unzip.h"
+
 /* I/O interface */
 extern int (*unzip_read) (char *buf, size_t maxread);
 extern void (*unzip_write) (const char *buf, size_t nwrite);
@@ -78,3 +82,228 @@ do_gunzip (void)
   if (result != Z_STREAM_END)
     (*unzip_error) (NULL);
 }
+
+/* Random access, after the method of zran.c in the zlib distribution.  */
+
+/* Make a chunk at the end of each deflate block which ends at least this
+   many bytes of output after the start of the previous chunk.  */
+#define SPAN		(1024 * 1024)
+
+/* The most data deflate refers back to.  */
+#define WINSIZE		32768
+
+/* Read the compressed input in pieces of this size.  */
+#define INPUT_SIZE	(64 * 1024)
+
+/* Add a chunk at the bit offset IN of the input and the offset OUT of the
+   output to INDEX.  WINDOW holds the last output, which ends LEFT bytes
+   before its end, and wraps around to its start.  */
+static error_t
+add_chunk (struct unzip_index *index, store_offset_t in, store_offset_t out,
+	   const unsigned char *window, size_t left)
+{
+  struct unzip_chunk *chunk = unzip_add_chunk (index);
+
+  if (! chunk)
+    return ENOMEM;
+
+  chunk->out = out;
+  chunk->in = in;
+  chunk->dict_len = out < WINSIZE ? out : WINSIZE;
+  if (chunk->dict_len > 0)
+    {
+      unsigned char *dict = malloc (WINSIZE);
+      if (! dict)
+	return ENOMEM;
+      memcpy (dict, window + WINSIZE - left, left);
+      memcpy (dict + left, window, WINSIZE - left);
+      /* Only keep the part that was actually written.  */
+      if (chunk->dict_len < WINSIZE)
+	memmove (dict, dict + WINSIZE - chunk->dict_len, chunk->dict_len);
+      chunk->dict = dict;
+    }
+  return 0;
+}
+
+error_t
+gunzip_index (struct store *from, struct unzip_index *index)
+{
+  z_stream strm;
+  unsigned char *input, *window;
+  store_offset_t totin = 0, totout = 0, last = 0, pos = 0;
+  error_t err = 0;
+  int result;
+  size_t i;
+
+  index->chunks = 0;
+  index->num_chunks = 0;
+  index->size = 0;
+  index->read_err = 0;
+
+  input = malloc (INPUT_SIZE);
+  window = malloc (WINSIZE);
+  if (! input || ! window)
+    {
+      free (input);
+      free (window);
+      return ENOMEM;
+    }
+
+  memset (&strm, 0, sizeof strm);
+  result = inflateInit2 (&strm, 32 + MAX_WBITS);
+  if (result != Z_OK)
+    err = ENOMEM;
+  strm.avail_out = 0;
+
+  while (! err)
+    {
+      size_t got;
+
+      err = unzip_read_input (from, pos, input, INPUT_SIZE, &got);
+      if (err)
+	{
+	  index->read_err = err;
+	  break;
+	}
+      if (got == 0)
+	{
+	  err = EINVAL;		/* Truncated.  */
+	  break;
+	}
+      pos += got;
+      strm.next_in = input;
+      strm.avail_in = got;
+
+      do
+	{
+	  if (strm.avail_out == 0)
+	    {
+	      strm.next_out = window;
+	      strm.avail_out = WINSIZE;
+	    }
+
+	  /* Stop at the end of each deflate block.  */
+	  totin += strm.avail_in;
+	  totout += strm.avail_out;
+	  result = inflate (&strm, Z_BLOCK);
+	  totin -= strm.avail_in;
+	  totout -= strm.avail_out;
+
+	  if (result == Z_MEM_ERROR)
+	    err = ENOMEM;
+	  else if (result != Z_OK && result != Z_STREAM_END)
+	    err = EINVAL;
+	  if (err || result == Z_STREAM_END)
+	    break;
+
+	  /* Bit 7 of DATA_TYPE is set at the end of a block, and bit 6 after
+	     the last one.  The lower bits are the number of bits of the
+	     last input byte not used yet.  */
+	  if ((strm.data_type & 128) && ! (strm.data_type & 64)
+	      && (totout == 0 || totout - last > SPAN))
+	    {
+	      err = add_chunk (index, totin * 8 - (strm.data_type & 7),
+			       totout, window, strm.avail_out);
+	      last = totout;
+	    }
+	}
+      while (! err && strm.avail_in != 0);
+
+      if (result == Z_STREAM_END)
+	break;
+    }
+
+  inflateEnd (&strm);
+  free (input);
+  free (window);
+
+  if (! err && index->num_chunks == 0)
+    err = EINVAL;
+  if (err)
+    {
+      unzip_free_index (index);
+      return err;
+    }
+
+  for (i = 0; i + 1 < index->num_chunks; i++)
+    index->chunks[i].len = index->chunks[i + 1].out - index->chunks[i].out;
+  index->chunks[i].len = totout - index->chunks[i].out;
+  index->size = totout;
+  return 0;
+}
+
+error_t
+gunzip_extract (struct store *from, const struct unzip_chunk *chunk,
+		void *buf)
+{
+  z_stream strm;
+  unsigned char *input;
+  store_offset_t pos = chunk->in >> 3;
+  int bits = -chunk->in & 7;
+  error_t err = 0;
+  int result;
+
+  input = malloc (INPUT_SIZE);
+  if (! input)
+    return ENOMEM;
+
+  /* The chunks start in the middle of the deflate data.  */
+  memset (&strm, 0, sizeof strm);
+  result = inflateInit2 (&strm, -MAX_WBITS);
+  if (result != Z_OK)
+    {
+      free (input);
+      return ENOMEM;
+    }
+
+  if (bits)
+    {
+      size_t got;
+      err = unzip_read_input (from, pos, input, 1, &got);
+      if (! err && got == 0)
+	err = EINVAL;
+      if (! err)
+	inflatePrime (&strm, bits, input[0] >> (8 - bits));
+      pos++;
+    }
+  if (! err && chunk->dict_len > 0)
+    inflateSetDictionary (&strm, chunk->dict, chunk->dict_len);
+
+  strm.next_out = buf;
+  strm.avail_out = chunk->len;
+
+  while (! err && strm.avail_out > 0)
+    {
+      if (strm.avail_in == 0)
+	{
+	  size_t got;
+	  err = unzip_read_input (from, pos, input, INPUT_SIZE, &got);
+	  if (err)
+	    break;
+	  if (got == 0)
+	    {
+	      err = EINVAL;
+	      break;
+	    }
+	  pos += got;
+	  strm.next_in = input;
+	  strm.avail_in = got;
+	}
+
+      result = inflate (&strm, Z_NO_FLUSH);
+      if (result == Z_MEM_ERROR)
+	err = ENOMEM;
+      else if (result == Z_STREAM_END)
+	{
+	  if (strm.avail_out > 0)
+	    err = EINVAL;
+	  break;
+	}
+      else if (result != Z_OK)
+	err = EINVAL;
+    }
+
+  inflateEnd (&strm);
+  free (input);
+  return err;
+}
@@ -30,4 +30,6 @@ DO_UNZIP (void)
 }
 
 #define UNZIP		gunzip
+#define UNZIP_INDEX	gunzip_index
+#define UNZIP_EXTRACT	gunzip_extract
 #include "unzipstore.c"
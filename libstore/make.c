@@ -45,6 +45,8 @@ _store_create (const struct store_class *class,
 	  new->num_runs = 0;
 	  new->wrap_src = 0;
 	  new->wrap_dst = 0;
+	  new->run_offsets = 0;
+	  new->last_run = 0;
 	  new->flags = flags;
 	  new->end = end;
 	  new->block_size = block_size;
@@ -95,6 +97,7 @@ store_free (struct store *store)
     free (store->name);
   if (store->runs)
     free (store->runs);
+  free (store->run_offsets);
 
   free (store);
 }
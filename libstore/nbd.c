@@ -20,6 +20,7 @@
 #include "store.h"
 #include <hurd.h>
 #include <hurd/io.h>
+#include <hurd/socket.h>
 #include <errno.h>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -29,6 +30,7 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <sys/mman.h>
+#include <pthread.h>
 
 
 // Avoid dragging in the resolver when linking statically.
@@ -83,187 +85,441 @@ struct nbd_reply
 #define ntohll htonll
 
 
-static inline error_t
-read_reply (struct store *store, uint64_t handle)
+static const char url_prefix[] = "nbd://";
+
+/* The number of requests which can be outstanding at once by default.  */
+#define NBD_DEFAULT_QUEUE_DEPTH	16
+
+/* A request sent to the server, for at most NBD_IO_MAX bytes.  */
+struct nbd_chunk
+{
+  char *buf;			/* Where the data goes, for reads.  */
+  size_t len;
+  error_t err;
+  unsigned int *outstanding;	/* Count of the caller's requests in flight.  */
+};
+
+/* The state of the conversation with the server over the socket PORT,
+   shared by the clones of a store.  Up to DEPTH requests may be
+   outstanding; each is kept in SLOTS at the index it uses as handle.
+   While requests are outstanding, a reader thread receives the replies
+   and dispatches them to the threads waiting for them.  */
+struct nbd_conn
 {
-  struct nbd_reply reply;
-  char *buf = (void *) &reply;
-  mach_msg_type_number_t cc = sizeof reply;
-  error_t err = io_read (store->port, &buf, &cc, -1, cc);
+  pthread_mutex_t lock;
+  pthread_cond_t wakeup;	/* A request was completed.  */
+  int refs;			/* Stores and reader thread.  */
+
+  mach_port_t port;
+  unsigned int depth;		/* 0 until the first request.  */
+  unsigned int pending;		/* Number of used SLOTS.  */
+  unsigned int next_slot;
+  struct nbd_chunk **slots;
+
+  int reading;			/* The reader thread is running.  */
+  error_t err;			/* The conversation failed.  */
+
+  /* Requests are written while holding this lock, so that the header
+     and data of different requests do not get mixed up.  */
+  pthread_mutex_t send_lock;
+};
+
+/* Return the queue depth given in the store name NAME.  */
+static unsigned int
+nbd_queue_depth (const char *name)
+{
+  unsigned long depth;
+  char *p, *endp;
+
+  if (! name)
+    return NBD_DEFAULT_QUEUE_DEPTH;
+  if (!strncmp (name, url_prefix, sizeof url_prefix - 1))
+    name += sizeof url_prefix - 1;
+
+  /* The depth is after the block size, which is after the port.  */
+  p = strchr (name, ':');
+  p = p ? strchr (p, '/') : 0;
+  p = p ? strchr (p + 1, '/') : 0;
+  if (! p)
+    return NBD_DEFAULT_QUEUE_DEPTH;
+
+  depth = strtoul (p + 1, &endp, 0);
+  return (endp != p + 1 && depth > 0 && depth <= 0xffff
+	  ? depth : NBD_DEFAULT_QUEUE_DEPTH);
+}
+
+/* Set *CONN to a new conversation over the socket PORT, to which a send
+   right is added.  */
+static error_t
+nbd_conn_create (mach_port_t port, struct nbd_conn **conn)
+{
+  error_t err;
+
+  *conn = calloc (1, sizeof **conn);
+  if (! *conn)
+    return ENOMEM;
+
+  err = mach_port_mod_refs (mach_task_self (), port, MACH_PORT_RIGHT_SEND, 1);
   if (err)
-    return err;
-  if (buf != (void *) &reply)
     {
-      memcpy (&reply, buf, sizeof reply);
-      munmap (buf, cc);
+      free (*conn);
+      return err;
     }
-  if (cc != sizeof reply)
-    return EIO;
-  if (reply.magic != NBD_REPLY_MAGIC)
-    return EIO;
-  if (reply.handle != handle)
-    return EIO;
-  if (reply.error != 0)
-    return EIO;
+
+  pthread_mutex_init (&(*conn)->lock, NULL);
+  pthread_cond_init (&(*conn)->wakeup, NULL);
+  pthread_mutex_init (&(*conn)->send_lock, NULL);
+  (*conn)->refs = 1;
+  (*conn)->port = port;
   return 0;
 }
 
-static error_t
-nbd_write (struct store *store,
-	   store_offset_t addr, size_t index, const void *buf, size_t len,
-	   size_t *amount)
+/* Drop a reference to CONN.  */
+static void
+nbd_conn_release (struct nbd_conn *conn)
 {
-  struct nbd_request req =
-  {
-    magic: NBD_REQUEST_MAGIC,
-    type: htonl (1),		/* WRITE */
-  };
-  error_t err;
-  mach_msg_type_number_t cc;
+  int last;
 
-  addr <<= store->log2_block_size;
-  *amount = 0;
+  pthread_mutex_lock (&conn->lock);
+  last = --conn->refs == 0;
+  pthread_mutex_unlock (&conn->lock);
 
-  do
+  if (last)
     {
-      size_t chunk = len < NBD_IO_MAX ? len : NBD_IO_MAX, nwrote;
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+      mach_port_deallocate (mach_task_self (), conn->port);
+      free (conn->slots);
+      free (conn);
+    }
+}
 
-      err = io_write (store->port, (char *) &req, sizeof req, -1, &cc);
+/* Read exactly LEN bytes from the socket PORT to BUF.  */
+static error_t
+read_fully (mach_port_t port, char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      char *data = buf;
+      mach_msg_type_number_t cc = len;
+      error_t err = io_read (port, &data, &cc, -1, len);
       if (err)
 	return err;
-      if (cc != sizeof req)
-	return EIO;
-
-      nwrote = 0;
-      do
+      if (data != buf)
 	{
-	  err = io_write (store->port, (char *) buf, chunk - nwrote, -1, &cc);
-	  if (err)
-	    return err;
-	  buf += cc;
-	  nwrote += cc;
-	} while (nwrote < chunk);
+	  memcpy (buf, data, cc < len ? cc : len);
+	  munmap (data, cc);
+	}
+      if (cc == 0 || cc > len)
+	return EIO;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
 
-      err = read_reply (store, req.handle);
+/* Write exactly LEN bytes from BUF to the socket PORT.  */
+static error_t
+write_fully (mach_port_t port, const char *buf, size_t len)
+{
+  while (len > 0)
+    {
+      mach_msg_type_number_t cc;
+      error_t err = io_write (port, (char *) buf, len, -1, &cc);
       if (err)
 	return err;
+      if (cc == 0 || cc > len)
+	return EIO;
+      buf += cc;
+      len -= cc;
+    }
+  return 0;
+}
 
-      addr += chunk;
-      *amount += chunk;
-      len -= chunk;
-    } while (len > 0);
+/* Complete the request in slot I of CONN with error ERR.  CONN must be
+   locked.  */
+static void
+complete (struct nbd_conn *conn, unsigned int i, error_t err)
+{
+  struct nbd_chunk *chunk = conn->slots[i];
 
-  return 0;
+  conn->slots[i] = 0;
+  conn->pending--;
+  chunk->err = err;
+  (*chunk->outstanding)--;
+  pthread_cond_broadcast (&conn->wakeup);
+}
+
+/* Give up the conversation of CONN because of ERR, failing all the
+   outstanding requests.  CONN must be locked.  */
+static void
+fail (struct nbd_conn *conn, error_t err)
+{
+  unsigned int i;
+
+  if (! conn->err)
+    {
+      conn->err = err;
+      /* Wake up the reader thread if it is waiting for a reply that will
+	 never be dispatched, so that it drops its reference.  */
+      socket_shutdown (conn->port, SHUT_RDWR);
+    }
+  for (i = 0; i < conn->depth; i++)
+    if (conn->slots[i])
+      complete (conn, i, conn->err);
+}
+
+/* The reader thread of the conversation ARG.  */
+static void *
+reader (void *arg)
+{
+  struct nbd_conn *conn = arg;
+
+  pthread_mutex_lock (&conn->lock);
+  while (conn->pending > 0)
+    {
+      struct nbd_reply reply;
+      struct nbd_chunk *chunk = 0;
+      error_t err;
+
+      pthread_mutex_unlock (&conn->lock);
+
+      err = read_fully (conn->port, (char *) &reply, sizeof reply);
+      if (! err && reply.magic != NBD_REPLY_MAGIC)
+	err = EIO;
+      if (! err)
+	{
+	  /* The slot doesn't change while its request is outstanding.  */
+	  pthread_mutex_lock (&conn->lock);
+	  if (reply.handle < conn->depth)
+	    chunk = conn->slots[reply.handle];
+	  pthread_mutex_unlock (&conn->lock);
+	  if (! chunk)
+	    err = EIO;
+	}
+
+      /* A successful read is followed by its data.  */
+      if (! err && chunk->buf && reply.error == 0)
+	err = read_fully (conn->port, chunk->buf, chunk->len);
+
+      pthread_mutex_lock (&conn->lock);
+      if (err)
+	fail (conn, err);
+      else
+	complete (conn, reply.handle, reply.error ? EIO : 0);
+    }
+  conn->reading = 0;
+  pthread_mutex_unlock (&conn->lock);
+
+  nbd_conn_release (conn);
+  return NULL;
 }
 
+/* Send a request of TYPE for the byte offset ADDR of STORE, described
+   by CHUNK, followed by the data at DATA if it is not null.  CHUNK is
+   completed once the reply has been received.  */
 static error_t
-nbd_read (struct store *store,
-	  store_offset_t addr, size_t index, size_t amount,
-	  void **buf, size_t *len)
+send_request (struct store *store, uint32_t type, store_offset_t addr,
+	      const void *data, struct nbd_chunk *chunk)
 {
+  struct nbd_conn *conn = store->hook;
   struct nbd_request req =
   {
     magic: NBD_REQUEST_MAGIC,
-    type: htonl (0),		/* READ */
+    type: htonl (type),
+    from: htonll (addr),
+    len: htonl (chunk->len),
   };
-  error_t err;
-  size_t ofs, chunk;
-  char *databuf, *piecebuf;
-  size_t databuflen, piecelen;
-
-  /* Send a request for the largest possible piece of remaining data and
-     read the first piece of its reply into PIECEBUF, PIECELEN.  The amount
-     requested can be found in CHUNK.  */
-  inline error_t request_chunk (char **buf, size_t *len)
+  unsigned int i;
+  error_t err = 0;
+
+  pthread_mutex_lock (&conn->lock);
+  while (! conn->err && conn->pending == conn->depth)
+    pthread_cond_wait (&conn->wakeup, &conn->lock);
+  if (conn->err)
     {
-      mach_msg_type_number_t cc;
+      err = conn->err;
+      pthread_mutex_unlock (&conn->lock);
+      return err;
+    }
 
-      chunk = (amount - ofs) < NBD_IO_MAX ? (amount - ofs) : NBD_IO_MAX;
+  if (! conn->reading)
+    {
+      pthread_t thread;
 
-      req.from = htonll (addr);
-      req.len = htonl (chunk);
+      err = pthread_create (&thread, NULL, reader, conn);
+      if (err)
+	{
+	  pthread_mutex_unlock (&conn->lock);
+	  return err;
+	}
+      pthread_detach (thread);
+      conn->reading = 1;
+      conn->refs++;
+    }
 
-      /* Advance ADDR immediately, so it always points past what we've
-	 already requested.  */
-      addr += chunk;
+  for (i = conn->next_slot; conn->slots[i]; i = (i + 1) % conn->depth)
+    ;
+  conn->next_slot = (i + 1) % conn->depth;
+  conn->slots[i] = chunk;
+  conn->pending++;
+  (*chunk->outstanding)++;
+  pthread_mutex_unlock (&conn->lock);
 
-      return (io_write (store->port, (char *) &req, sizeof req, -1, &cc) ?
-	      : cc != sizeof req ? EIO
-	      : read_reply (store, req.handle) ?
-	      : io_read (store->port, buf, len, (off_t) -1, chunk));
-    }
+  req.handle = i;
 
-  addr <<= store->log2_block_size;
+  pthread_mutex_lock (&conn->send_lock);
+  err = write_fully (conn->port, (char *) &req, sizeof req);
+  if (! err && data)
+    err = write_fully (conn->port, data, chunk->len);
+  pthread_mutex_unlock (&conn->send_lock);
 
-  /* Read the first piece, which can go directly into the caller's buffer.  */
-  databuf = *buf;
-  piecelen = databuflen = *len;
-  err = request_chunk (&databuf, &piecelen);
   if (err)
-    return err;
-  if (databuflen >= amount)
     {
-      /* That got it all.  We're done.  */
-      *buf = databuf;
-      *len = piecelen;
-      return 0;
+      /* The server may have gotten part of the request, so we can't
+	 talk to it anymore.  This completes CHUNK too.  */
+      pthread_mutex_lock (&conn->lock);
+      fail (conn, err);
+      pthread_mutex_unlock (&conn->lock);
     }
 
-  /* We haven't read the entire amount yet.  */
-  ofs = 0;
-  do
-    {
-      /* Account for what we just read.  */
-      ofs += piecelen;
-      chunk -= piecelen;
-      if (ofs == amount)
-	{
-	  /* That got it all.  We're done.  */
-	  *buf = databuf;
-	  *len = ofs;
-	  return 0;
-	}
+  return 0;
+}
+
+/* Wait until OUTSTANDING, the count of the requests of a caller, drops
+   to zero.  */
+static void
+wait_requests (struct store *store, unsigned int *outstanding)
+{
+  struct nbd_conn *conn = store->hook;
+
+  pthread_mutex_lock (&conn->lock);
+  while (*outstanding > 0)
+    pthread_cond_wait (&conn->wakeup, &conn->lock);
+  pthread_mutex_unlock (&conn->lock);
+}
 
-      /* Now we'll read another piece of the data, hopefully
-	 into the latter part of the existing buffer.  */
-      piecebuf = databuf + ofs;
-      piecelen = databuflen - ofs;
+/* Prepare the conversation of STORE for requests.  */
+static error_t
+start_conn (struct store *store)
+{
+  struct nbd_conn *conn = store->hook;
+  error_t err = 0;
 
-      if (chunk > 0)
-	/* We haven't finishing reading the last chunk we requested.  */
-	err = io_read (store->port, &piecebuf, &piecelen,
-		       (off_t) -1, chunk);
+  if (! conn)
+    return EIO;
+
+  pthread_mutex_lock (&conn->lock);
+  if (conn->depth == 0)
+    {
+      unsigned int depth = nbd_queue_depth (store->name);
+
+      conn->slots = calloc (depth, sizeof *conn->slots);
+      if (conn->slots)
+	conn->depth = depth;
       else
-	/* Request the next chunk from the server.  */
-	err = request_chunk (&piecebuf, &piecelen);
+	err = ENOMEM;
+    }
+  pthread_mutex_unlock (&conn->lock);
 
-      if (!err && piecebuf != databuf + ofs)
-	{
-	  /* Now we have two discontiguous pieces of the buffer.  */
-	  size_t newbuflen = round_page (databuflen + piecelen);
-	  char *newbuf = mmap (0, newbuflen,
-			       PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-	  if (newbuf == MAP_FAILED)
-	    {
-	      err = errno;
-	      break;
-	    }
-	  memcpy (newbuf, databuf, ofs);
-	  memcpy (newbuf + ofs, piecebuf, piecelen);
-	  if (databuf != *buf)
-	    munmap (databuf, databuflen);
-	  databuf = newbuf;
-	  databuflen = newbuflen;
-	}
-    } while (! err);
+  return err;
+}
+
+/* Send requests of TYPE for AMOUNT bytes at the block address ADDR of
+   STORE, in chunks of at most NBD_IO_MAX bytes, without waiting for
+   the replies to the previous ones.  For writes, the data is at BUF,
+   for reads it goes there.  Return in *DONE how many bytes were
+   transferred before the first failure.  */
+static error_t
+transfer (struct store *store, uint32_t type, store_offset_t addr,
+	  char *buf, size_t amount, size_t *done)
+{
+  size_t nchunks = (amount + NBD_IO_MAX - 1) / NBD_IO_MAX, i;
+  struct nbd_chunk *chunks;
+  unsigned int outstanding = 0;
+  error_t err;
 
-  if (databuf != *buf)
-    munmap (databuf, databuflen);
+  *done = 0;
+  if (amount == 0)
+    return 0;
+
+  err = start_conn (store);
+  if (err)
+    return err;
+
+  chunks = malloc (nchunks * sizeof *chunks);
+  if (! chunks)
+    return ENOMEM;
+
+  addr <<= store->log2_block_size;
+
+  for (i = 0; i < nchunks; i++)
+    {
+      size_t ofs = i * NBD_IO_MAX;
+
+      chunks[i].buf = type == 0 ? buf + ofs : 0;
+      chunks[i].len = amount - ofs < NBD_IO_MAX ? amount - ofs : NBD_IO_MAX;
+      chunks[i].err = 0;
+      chunks[i].outstanding = &outstanding;
+      err = send_request (store, type, addr + ofs,
+			  type == 1 ? buf + ofs : 0, &chunks[i]);
+      if (err)
+	break;
+    }
+  nchunks = i;
+
+  wait_requests (store, &outstanding);
+
+  for (i = 0; i < nchunks && ! chunks[i].err; i++)
+    *done += chunks[i].len;
+  if (i < nchunks)
+    err = chunks[i].err;
+
+  free (chunks);
   return err;
 }
 
+static error_t
+nbd_write (struct store *store,
+	   store_offset_t addr, size_t index, const void *buf, size_t len,
+	   size_t *amount)
+{
+  return transfer (store, 1, addr, (char *) buf, len, amount); /* WRITE */
+}
+
+static error_t
+nbd_read (struct store *store,
+	  store_offset_t addr, size_t index, size_t amount,
+	  void **buf, size_t *len)
+{
+  char *data;
+  size_t done;
+  error_t err;
+
+  if (*len >= amount)
+    data = *buf;
+  else
+    {
+      data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (data == MAP_FAILED)
+	return errno;
+    }
+
+  err = transfer (store, 0, addr, data, amount, &done); /* READ */
+  if (err)
+    {
+      if (data != *buf)
+	munmap (data, amount);
+      return err;
+    }
+
+  if (data != *buf && round_page (done) < round_page (amount))
+    munmap (data + round_page (done),
+	    round_page (amount) - round_page (done));
+
+  *buf = data;
+  *len = done;
+  return 0;
+}
+
 static error_t
 nbd_set_size (struct store *store, size_t newsize)
 {
@@ -289,10 +545,10 @@ nbd_open (const char *name, int flags,
   return store_nbd_open (name, flags, store);
 }
 
-static const char url_prefix[] = "nbd://";
-
-/* Valid name syntax is [nbd://]HOSTNAME:PORT[/BLOCKSIZE].
-   If "/BLOCKSIZE" is omitted, the block size is 1.  */
+/* Valid name syntax is [nbd://]HOSTNAME:PORT[/BLOCKSIZE[/DEPTH]].
+   If "/BLOCKSIZE" is omitted, the block size is 1.  DEPTH is the number
+   of requests which may be sent before the first reply is received,
+   NBD_DEFAULT_QUEUE_DEPTH if omitted.  */
 static error_t
 nbd_validate_name (const char *name,
 		   const struct store_class *const *classes)
@@ -320,6 +576,12 @@ nbd_validate_name (const char *name,
       strtoul (p, &endp, 0);
       if (endp == 0 || endp == p)
 	return EINVAL;
+      if (*endp == '/')
+	{
+	  p = endp + 1;
+	  if (strtoul (p, &endp, 0) == 0 || endp == 0 || endp == p)
+	    return EINVAL;
+	}
       if (*endp != '\0')
 	return EINVAL;
     }
@@ -367,6 +629,13 @@ nbdopen (const char *name, int *mod_flags,
       *blocksize = strtoul (p, &endp, 0);
       if (endp == 0 || endp == p)
 	return EINVAL;
+      if (*endp == '/')
+	{
+	  /* The queue depth is only needed by nbd_queue_depth.  */
+	  p = endp + 1;
+	  if (strtoul (p, &endp, 0) == 0 || endp == 0 || endp == p)
+	    return EINVAL;
+	}
       if (*endp != '\0')
 	return EINVAL;
     }
@@ -438,6 +707,12 @@ nbdclose (struct store *store)
       mach_msg_type_number_t cc;
       (void) io_write (store->port, (char *) &req, sizeof req, -1, &cc);
 
+      if (store->hook)
+	{
+	  nbd_conn_release (store->hook);
+	  store->hook = 0;
+	}
+
       /* Close the socket.  */
       mach_port_deallocate (mach_task_self (), store->port);
       store->port = MACH_PORT_NULL;
@@ -467,11 +742,47 @@ nbd_clear_flags (struct store *store, int flags)
     ? nbdopen (store->name, &store->flags,
 	       &store->port, &store->block_size, &store->size)
     : ENOENT;
+  if (! err)
+    {
+      struct nbd_conn *conn;
+
+      if (store->hook)
+	nbd_conn_release (store->hook);
+      store->hook = 0;
+      err = nbd_conn_create (store->port, &conn);
+      if (err)
+	nbdclose (store);
+      else
+	store->hook = conn;
+    }
   if (! err)
     store->flags &= ~STORE_INACTIVE;
   return err;
 }
 
+static void
+nbd_cleanup (struct store *store)
+{
+  if (store->hook)
+    nbd_conn_release (store->hook);
+}
+
+/* Clones use the same socket, so they share the conversation.  */
+static error_t
+nbd_clone (const struct store *from, struct store *to)
+{
+  struct nbd_conn *conn = from->hook;
+
+  if (conn)
+    {
+      pthread_mutex_lock (&conn->lock);
+      conn->refs++;
+      pthread_mutex_unlock (&conn->lock);
+    }
+  to->hook = conn;
+  return 0;
+}
+
 const struct store_class store_nbd_class =
 {
   STORAGE_NETWORK, "nbd",
@@ -484,6 +795,7 @@ const struct store_class store_nbd_class =
   encode: store_std_leaf_encode,
   decode: nbd_decode,
   set_flags: nbd_set_flags, clear_flags: nbd_clear_flags,
+  cleanup: nbd_cleanup, clone: nbd_clone,
 };
 STORE_STD_CLASS (nbd);
 
@@ -494,8 +806,24 @@ _store_nbd_create (mach_port_t port, int flags, size_t block_size,
 		   const struct store_run *runs, size_t num_runs,
 		   struct store **store)
 {
-  return _store_create (&store_nbd_class,
-			port, flags, block_size, runs, num_runs, 0, store);
+  struct nbd_conn *conn;
+  error_t err;
+
+  err = nbd_conn_create (port, &conn);
+  if (err)
+    return err;
+
+  err = _store_create (&store_nbd_class,
+		       port, flags, block_size, runs, num_runs, 0, store);
+  if (err)
+    {
+      /* Our caller still owns PORT.  */
+      nbd_conn_release (conn);
+      return err;
+    }
+
+  (*store)->hook = conn;
+  return 0;
 }
 
 /* Open a new store backed by the named nbd server.  */
@@ -0,0 +1,199 @@
+/* Running store operations concurrently
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "store.h"
+
+/* The most worker threads shared by all stores.  */
+#define MAX_WORKERS 16
+
+/* Workers idle for that many seconds exit.  */
+#define WORKER_TIMEOUT 30
+
+/* The jobs of one call to _store_run_parallel.  */
+struct batch
+{
+  unsigned int pending;		/* Jobs not finished yet.  */
+  pthread_cond_t done;		/* PENDING dropped to 0.  */
+};
+
+struct job
+{
+  void (*fun) (void *arg);
+  void *arg;
+  struct batch *batch;
+  struct job *next, **prevp;	/* In QUEUE; PREVP is 0 if not.  */
+};
+
+/* Protects everything below, and the batches and jobs.  */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pool_wakeup = PTHREAD_COND_INITIALIZER;
+
+/* The jobs no thread has taken yet, oldest first.  */
+static struct job *queue, **queue_tail = &queue;
+
+static unsigned int workers;	/* Running worker threads.  */
+static unsigned int idle;	/* Those waiting for jobs.  */
+
+static void
+enqueue (struct job *job)
+{
+  job->next = 0;
+  job->prevp = queue_tail;
+  *queue_tail = job;
+  queue_tail = &job->next;
+}
+
+static void
+dequeue (struct job *job)
+{
+  *job->prevp = job->next;
+  if (job->next)
+    job->next->prevp = job->prevp;
+  else
+    queue_tail = job->prevp;
+  job->prevp = 0;
+}
+
+/* Run JOB, taken from the queue.  POOL_LOCK is held, but released while
+   the job runs.  */
+static void
+run_job (struct job *job)
+{
+  struct batch *batch = job->batch;
+
+  pthread_mutex_unlock (&pool_lock);
+  (*job->fun) (job->arg);
+  pthread_mutex_lock (&pool_lock);
+
+  if (--batch->pending == 0)
+    pthread_cond_broadcast (&batch->done);
+}
+
+static void *
+worker (void *arg)
+{
+  struct job *job;
+
+  pthread_mutex_lock (&pool_lock);
+  for (;;)
+    {
+      while (! queue)
+	{
+	  struct timespec timeout;
+	  int err;
+
+	  clock_gettime (CLOCK_REALTIME, &timeout);
+	  timeout.tv_sec += WORKER_TIMEOUT;
+
+	  idle++;
+	  err = pthread_cond_timedwait (&pool_wakeup, &pool_lock, &timeout);
+	  idle--;
+	  if (err == ETIMEDOUT && ! queue)
+	    {
+	      workers--;
+	      pthread_mutex_unlock (&pool_lock);
+	      return NULL;
+	    }
+	}
+
+      job = queue;
+      dequeue (job);
+      run_job (job);
+    }
+}
+
+/* Call FUN on each of the NUM arguments in ARGS, concurrently, and
+   return when all calls have returned.  The first call is made by the
+   calling thread, as are any others no worker thread could take, so
+   this works even if no threads can be made, and FUN may itself call
+   _store_run_parallel.  */
+void
+_store_run_parallel (void (*fun) (void *arg), void *const *args, size_t num)
+{
+  struct job jobs[num];
+  struct batch batch;
+  unsigned int queued, i;
+
+  if (num == 0)
+    return;
+  if (num == 1)
+    {
+      (*fun) (args[0]);
+      return;
+    }
+
+  batch.pending = num;
+  pthread_cond_init (&batch.done, NULL);
+
+  pthread_mutex_lock (&pool_lock);
+
+  for (i = 1; i < num; i++)
+    {
+      jobs[i].fun = fun;
+      jobs[i].arg = args[i];
+      jobs[i].batch = &batch;
+      enqueue (&jobs[i]);
+    }
+
+  /* Wake up the idle workers, and start new ones for the jobs they
+     can't take.  */
+  queued = num - 1;
+  if (idle > 0)
+    pthread_cond_broadcast (&pool_wakeup);
+  while (queued > idle && workers < MAX_WORKERS)
+    {
+      pthread_t thread;
+
+      if (pthread_create (&thread, NULL, worker, NULL))
+	break;
+      pthread_detach (thread);
+      workers++;
+      queued--;
+    }
+
+  pthread_mutex_unlock (&pool_lock);
+
+  (*fun) (args[0]);
+
+  pthread_mutex_lock (&pool_lock);
+  batch.pending--;
+  while (batch.pending > 0)
+    {
+      /* Do the jobs still queued ourselves rather than wait for the
+	 workers, which may all be busy.  */
+      for (i = 1; i < num; i++)
+	if (jobs[i].prevp)
+	  break;
+      if (i < num)
+	{
+	  dequeue (&jobs[i]);
+	  run_job (&jobs[i]);
+	}
+      else
+	pthread_cond_wait (&batch.done, &pool_lock);
+    }
+  pthread_mutex_unlock (&pool_lock);
+
+  pthread_cond_destroy (&batch.done);
+}
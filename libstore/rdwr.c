@@ -18,11 +18,51 @@
    with this program; if not, write to the Free Software Foundation, Inc.,
    59 Temple Place - Suite 330, Boston, MA 02111, USA. */
 
+#include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
 
 #include "store.h"
 
+/* Return the index of the run of STORE containing ADDR, which is less
+   than STORE->wrap_src, using STORE->run_offsets.  */
+static inline size_t
+store_search_runs (struct store *store, store_offset_t addr)
+{
+  const store_offset_t *offsets = store->run_offsets;
+  size_t num_runs = store->num_runs, lo, hi;
+  size_t i = __atomic_load_n (&store->last_run, __ATOMIC_RELAXED);
+
+  /* Sequential access stays in the last run or moves on to the next.  */
+  if (i < num_runs && offsets[i] <= addr
+      && addr - offsets[i] < store->runs[i].length)
+    return i;
+  i++;
+  if (i < num_runs && offsets[i] <= addr
+      && addr - offsets[i] < store->runs[i].length)
+    goto found;
+
+  /* Find the last run starting at or before ADDR, which skips any empty
+     runs before the one holding it.  */
+  lo = 0;
+  hi = num_runs;
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (offsets[mid] <= addr)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  i = lo;
+
+ found:
+  /* This is only a hint, so it doesn't matter which of several
+     concurrent callers wins.  */
+  __atomic_store_n (&store->last_run, i, __ATOMIC_RELAXED);
+  return i;
+}
+
 /* Returns in RUN the tail of STORE's run list, who's first run contains
    ADDR, and is not a hole, and in RUNS_END a pointer pointing at the end of
    the run list.  Returns the offset within it at which ADDR occurs.  Also
@@ -38,15 +78,28 @@ store_find_first_run (struct store *store, store_offset_t addr,
   if (addr >= wrap_src && addr < store->end)
     /* Locate the correct position within a repeating pattern of runs.  */
     {
-      *base = addr / store->wrap_dst;
+      *base = addr / wrap_src * store->wrap_dst;
       addr %= wrap_src;
     }
   else
     *base = 0;
 
-  /* XXX: this isn't going to be very efficient if RUNS is very complex...
-     But it should do dandy if it's short.  For long run lists, we could do a
-     binary search or something.  */
+  if (store->run_offsets && addr < wrap_src)
+    /* ADDR is covered by the index.  Stores that change the length of
+       their runs in place, like file stores being resized, leave
+       WRAP_SRC behind, so anything past it is found by the walk below.  */
+    {
+      size_t i = store_search_runs (store, addr);
+      if (addr - store->run_offsets[i] >= tail[i].length)
+	return -1;
+
+      *run = tail + i;
+      *runs_end = tail_end;
+      *index = i;
+      return addr - store->run_offsets[i];
+    }
+
+  /* Otherwise, walk the run list.  */
   while (tail < tail_end)
     {
       store_offset_t run_blocks = tail->length;
@@ -89,6 +142,178 @@ store_next_run (struct store *store, struct store_run *runs_end,
     return 1;
 }
 
+/* Requests of at least this many bytes spanning the children of a striped
+   store are done concurrently on each child.  Smaller ones aren't worth
+   handing to other threads.  */
+#define PARALLEL_MIN_AMOUNT (64 * 1024)
+
+/* Whether the runs of STORE are on different children, which can be
+   accessed concurrently, the index of a run being that of its child.  */
+static inline int
+store_is_striped (struct store *store)
+{
+  return (store->num_children > 1
+	  && (store->class->id == STORAGE_INTERLEAVE
+	      || store->class->id == STORAGE_CONCAT));
+}
+
+/* A piece of a request within a single run: LEN bytes at ADDR, to or
+   from BUF.  AMOUNT and ERR are what doing it returned.  */
+struct seg
+{
+  store_offset_t addr;
+  size_t index;
+  void *buf;
+  size_t len;
+  size_t amount;
+  error_t err;
+  struct seg *next;		/* The next piece for the same child.  */
+};
+
+/* The pieces of a request for one child of STORE, done in order.  */
+struct child_io
+{
+  struct store *store;
+  int write;
+  struct seg *segs;
+};
+
+/* Do the pieces in ARG, a struct child_io, stopping at the first which
+   fails or is short.  */
+static void
+child_io (void *arg)
+{
+  struct child_io *io = arg;
+  struct store *store = io->store;
+  struct seg *seg;
+
+  for (seg = io->segs; seg; seg = seg->next)
+    {
+      if (io->write)
+	seg->err = (*store->class->write) (store, seg->addr, seg->index,
+					   seg->buf, seg->len, &seg->amount);
+      else
+	{
+	  void *buf = seg->buf;
+	  size_t len = seg->len;
+
+	  seg->err = (*store->class->read) (store, seg->addr, seg->index,
+					    seg->len, &buf, &len);
+	  if (! seg->err && buf != seg->buf)
+	    {
+	      memcpy (seg->buf, buf, len < seg->len ? len : seg->len);
+	      munmap (buf, len);
+	    }
+	  if (len > seg->len)
+	    len = seg->len;
+	  seg->amount = len;
+	}
+
+      if (seg->err || seg->amount < seg->len)
+	break;
+    }
+}
+
+/* Read or write (if WRITE is true) the LEN bytes at BUF from or to
+   STORE, starting at the offset ADDR in RUN, as found by
+   store_find_first_run, splitting the request by runs and doing the
+   pieces of each child concurrently.  The request stops at the first
+   hole.  Return in *AMOUNT the number of bytes done before the first
+   piece which failed or was short, and the error of the first piece.
+   Pieces after a failed one may have been done as well.  */
+static error_t
+store_rdwr_striped (struct store *store, int write,
+		    store_offset_t addr, struct store_run *run,
+		    struct store_run *runs_end, store_offset_t base,
+		    size_t index, void *buf, size_t len, size_t *amount)
+{
+  int block_shift = store->log2_block_size;
+  struct child_io ios[store->num_children], *args[store->num_children];
+  struct seg *segs, **tails[store->num_children];
+  size_t num_segs, num_args, i;
+  error_t err;
+
+  /* Count the pieces, which are at most one more than the whole runs
+     the request spans.  */
+  num_segs = 1;
+  {
+    struct store_run *r = run;
+    store_offset_t b = base;
+    size_t x = index;
+    size_t left = len - ((run->length - addr) << block_shift);
+
+    while (left > 0 && store_next_run (store, runs_end, &r, &b, &x)
+	   && r->start >= 0)
+      {
+	num_segs++;
+	left -= ((left >> block_shift) <= r->length
+		 ? left : (r->length << block_shift));
+      }
+  }
+
+  *amount = 0;
+  segs = malloc (num_segs * sizeof *segs);
+  if (! segs)
+    return ENOMEM;
+
+  for (i = 0; i < store->num_children; i++)
+    {
+      ios[i].store = store;
+      ios[i].write = write;
+      ios[i].segs = 0;
+      tails[i] = &ios[i].segs;
+    }
+
+  for (i = 0; i < num_segs; i++)
+    {
+      struct seg *seg = &segs[i];
+
+      if (i == 0)
+	{
+	  seg->addr = base + run->start + addr;
+	  seg->len = (run->length - addr) << block_shift;
+	}
+      else
+	{
+	  store_next_run (store, runs_end, &run, &base, &index);
+	  seg->addr = base + run->start;
+	  seg->len = ((len >> block_shift) <= run->length
+		      ? len : (run->length << block_shift));
+	}
+      seg->index = index;
+      seg->buf = buf;
+      seg->amount = 0;
+      seg->err = 0;
+      seg->next = 0;
+
+      buf += seg->len;
+      len -= seg->len;
+
+      *tails[index] = seg;
+      tails[index] = &seg->next;
+    }
+
+  num_args = 0;
+  for (i = 0; i < store->num_children; i++)
+    if (ios[i].segs)
+      args[num_args++] = &ios[i];
+
+  _store_run_parallel (child_io, (void *const *) args, num_args);
+
+  err = segs[0].err;
+  for (i = 0; i < num_segs; i++)
+    {
+      if (segs[i].err)
+	break;
+      *amount += segs[i].amount;
+      if (segs[i].amount < segs[i].len)
+	break;
+    }
+
+  free (segs);
+  return err;
+}
+
 /* Write LEN bytes from BUF to STORE at ADDR.  Returns the amount written
    in AMOUNT.  ADDR is in BLOCKS (as defined by STORE->block_size).  */
 error_t
@@ -117,6 +342,10 @@ store_write (struct store *store,
   else if ((len >> block_shift) <= run->length - addr)
     /* The first run has it all... */
     err = (*write)(store, base + run->start + addr, index, buf, len, amount);
+  else if (store_is_striped (store) && len >= PARALLEL_MIN_AMOUNT)
+    /* Write to all the children at once.  */
+    err = store_rdwr_striped (store, 1, addr, run, runs_end, base, index,
+			      (void *) buf, len, amount);
   else
     /* ARGH, we've got to split up the write ... */
     {
@@ -245,8 +474,18 @@ store_read (struct store *store,
 
       buf_end = whole_buf;
 
-      err = seg_read (base + run->start + addr,
-		      (run->length - addr) << block_shift, &all);
+      if (store_is_striped (store) && amount >= PARALLEL_MIN_AMOUNT)
+	/* Read from all the children at once.  */
+	{
+	  size_t done;
+	  err = store_rdwr_striped (store, 0, addr, run, runs_end, base, index,
+				    buf_end, amount, &done);
+	  buf_end += done;
+	  all = 0;
+	}
+      else
+	err = seg_read (base + run->start + addr,
+			(run->length - addr) << block_shift, &all);
       while (!err && all && amount > 0
 	     && store_next_run (store, runs_end, &run, &base, &index))
 	{
@@ -273,9 +512,9 @@ store_read (struct store *store,
 	    munmap (whole_buf, whole_buf_len);
 	  else
 	    {
-	      vm_size_t unused = whole_buf_len - round_page (*len);
+	      vm_size_t unused = round_page (whole_buf_len) - round_page (*len);
 	      if (unused)
-		munmap (whole_buf + whole_buf_len - unused, unused);
+		munmap (whole_buf + round_page (*len), unused);
 	      *buf = whole_buf;
 	    }
 	}
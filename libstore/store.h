@@ -70,6 +70,14 @@ struct store
   store_offset_t wrap_src;
   store_offset_t wrap_dst;	/* Only meaningful if WRAP_SRC < END */
 
+  /* RUN_OFFSETS[I] is the sum of the lengths of the runs before RUNS[I],
+     so that the run holding an address can be found with a binary
+     search.  It is null if it couldn't be allocated, and RUNS is then
+     searched linearly.  LAST_RUN is the index of the run found last,
+     which is tried first, as is the one after it.  */
+  store_offset_t *run_offsets;	/* Malloced */
+  size_t last_run;
+
   /* Handles for the underlying storage.  */
   char *name;			/* Malloced */
   mach_port_t port;		/* Send right */
@@ -295,6 +303,12 @@ store_is_securely_returnable (struct store *store, int open_flags)
    the set of runs & the block size.  */
 void _store_derive (struct store *store);
 
+/* Call FUN on each of the NUM arguments in ARGS, using a pool of threads
+   shared by all stores to make the calls concurrently, and return when
+   all of them have returned.  */
+void _store_run_parallel (void (*fun) (void *arg), void *const *args,
+			  size_t num);
+
 /* Return in TO a copy of FROM.  */
 error_t store_clone (struct store *from, struct store **to);
 
@@ -403,10 +417,12 @@ error_t store_memobj_create (memory_object_t memobj, int flags,
 			     const struct store_run *runs, size_t num_runs,
 			     struct store **store);
 
-/* Open the network block device NAME (parsed as "HOSTNAME:PORT[/BLOCKSIZE]"),
-   and return the corresponding store in STORE.  This opens a socket and
-   initial connection handshake, which determine the size of the device,
-   and then uses _store_nbd_create with the open socket port.  */
+/* Open the network block device NAME (parsed as
+   "HOSTNAME:PORT[/BLOCKSIZE[/DEPTH]]"), and return the corresponding
+   store in STORE.  This opens a socket and initial connection handshake,
+   which determine the size of the device, and then uses _store_nbd_create
+   with the open socket port.  Up to DEPTH requests (16 by default) are
+   sent to the server before waiting for their replies.  */
 error_t store_nbd_open (const char *name, int flags, struct store **store);
 
 /* Create a store that works by talking to an nbd server on an existing
@@ -472,9 +488,11 @@ error_t store_copy_open (const char *name, int flags,
 error_t store_buffer_create (void *buf, size_t buf_len, int flags,
 			     struct store **store);
 
-/* Return a new store in STORE which contains a snapshot of the uncompressed
-   contents of the store FROM; FROM is consumed.  BLOCK_SIZE is the desired
-   block size of the result.  */
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM; FROM is consumed.  The contents are decompressed in
+   chunks as they are read, keeping only the recently used ones and those
+   written to in memory.  BLOCK_SIZE is the desired block size of the
+   result.  */
 error_t store_gunzip_create (struct store *from, int flags,
 			     struct store **store);
 
@@ -486,9 +504,11 @@ error_t store_gunzip_open (const char *name, int flags,
 			   const struct store_class *const *classes,
 			   struct store **store);
 
-/* Return a new store in STORE which contains a snapshot of the uncompressed
-   contents of the store FROM; FROM is consumed.  BLOCK_SIZE is the desired
-   block size of the result.  */
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM; FROM is consumed.  The contents are decompressed in
+   chunks as they are read, keeping only the recently used ones and those
+   written to in memory.  BLOCK_SIZE is the desired block size of the
+   result.  */
 error_t store_bunzip2_create (struct store *from, int flags,
 			      struct store **store);
 
@@ -0,0 +1,143 @@
+/* Random access to compressed stores
+
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA 02111, USA. */
+
+#ifndef __UNZIP_H__
+#define __UNZIP_H__
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "store.h"
+
+/* A place in a compressed stream where decompression can start, and the
+   uncompressed data from there up to the next such place.  */
+struct unzip_chunk
+{
+  store_offset_t out;		/* Offset of the data in the output.  */
+  size_t len;			/* Length of the data.  */
+
+  /* The bit offsets in the input of the compressed data, and of the
+     next chunk (if the format needs it).  */
+  store_offset_t in, in_end;
+
+  /* The output preceding OUT which the decompressor may refer to, if
+     any.  */
+  void *dict;			/* Malloced */
+  size_t dict_len;
+};
+
+/* The chunks of a compressed stream, in order.  */
+struct unzip_index
+{
+  struct unzip_chunk *chunks;	/* Malloced */
+  size_t num_chunks;
+  store_offset_t size;		/* Length of the whole output.  */
+  error_t read_err;		/* Why FROM couldn't be read, if it
+				   couldn't.  */
+};
+
+/* Fill in INDEX by scanning the compressed contents of FROM.  The data is
+   split into chunks of a size that the format makes convenient.  If this
+   fails because reading FROM does, INDEX->read_err is set to the error
+   as well.  */
+error_t gunzip_index (struct store *from, struct unzip_index *index);
+error_t bunzip2_index (struct store *from, struct unzip_index *index);
+
+/* Decompress CHUNK of the compressed contents of FROM to BUF, which has
+   room for CHUNK->len bytes.  This may be called by several threads at
+   once.  */
+error_t gunzip_extract (struct store *from, const struct unzip_chunk *chunk,
+			void *buf);
+error_t bunzip2_extract (struct store *from, const struct unzip_chunk *chunk,
+			 void *buf);
+
+/* Add a chunk to INDEX and return it, cleared, or return 0 if there's no
+   memory for it.  */
+static inline struct unzip_chunk *
+unzip_add_chunk (struct unzip_index *index)
+{
+  struct unzip_chunk *chunk;
+
+  /* The array starts with 8 chunks, and is doubled whenever full.  */
+  if (index->num_chunks == 0
+      || (index->num_chunks >= 8
+	  && (index->num_chunks & (index->num_chunks - 1)) == 0))
+    {
+      size_t num = index->num_chunks ? index->num_chunks * 2 : 8;
+      chunk = realloc (index->chunks, num * sizeof *chunk);
+      if (! chunk)
+	return 0;
+      index->chunks = chunk;
+    }
+
+  chunk = &index->chunks[index->num_chunks++];
+  memset (chunk, 0, sizeof *chunk);
+  return chunk;
+}
+
+/* Free the memory used by INDEX.  */
+static inline void
+unzip_free_index (struct unzip_index *index)
+{
+  size_t i;
+
+  for (i = 0; i < index->num_chunks; i++)
+    free (index->chunks[i].dict);
+  free (index->chunks);
+  index->chunks = 0;
+  index->num_chunks = 0;
+}
+
+/* Read up to LEN bytes at the byte offset OFFS of FROM into BUF, and
+   return the number read in *AMOUNT, which is less than LEN only at the
+   end of FROM.  */
+static inline error_t
+unzip_read_input (struct store *from, store_offset_t offs,
+		  void *buf, size_t len, size_t *amount)
+{
+  size_t block_mask = from->block_size - 1;
+  store_offset_t start = offs & ~(store_offset_t) block_mask;
+  size_t skip = offs - start, want, got;
+  void *data = 0;
+  error_t err;
+
+  *amount = 0;
+  if (offs >= from->size)
+    return 0;
+  if (len > from->size - offs)
+    len = from->size - offs;
+
+  want = (skip + len + block_mask) & ~block_mask;
+  got = 0;
+  err = store_read (from, start >> from->log2_block_size, want, &data, &got);
+  if (err)
+    return err;
+
+  if (got > skip)
+    {
+      *amount = got - skip < len ? got - skip : len;
+      memcpy (buf, data + skip, *amount);
+    }
+  munmap (data, got);
+  return 0;
+}
+
+#endif /* __UNZIP_H__ */
@@ -25,10 +25,15 @@
 #include <sys/mman.h>
 
 #include "store.h"
+#include "unzip.h"
 
 #define IN_BUFFERING  (256*1024)
 #define OUT_BUFFERING (512*1024)
 
+/* Keep at most this many bytes of decompressed data not in use and not
+   written to.  */
+#define CACHE_SIZE (16*1024*1024)
+
 static pthread_mutex_t unzip_lock = PTHREAD_MUTEX_INITIALIZER;
 
 #define STORE_UNZIP(name)		STORE_UNZIP_1 (UNZIP, name)
@@ -218,14 +223,444 @@ unzip_store (struct store *from, void **buf, size_t *buf_len)
 }
 
 
-/* Return a new store in STORE which contains a snapshot of the uncompressed
-   contents of the store FROM; FROM is consumed.  */
+/* A chunk of decompressed data in memory.  */
+struct cached
+{
+  struct unzip_stream *stream;
+  size_t chunk;			/* Its index.  */
+  void *data;			/* mmapped */
+  error_t err;			/* Why DATA couldn't be filled.  */
+  int refs;			/* Users of DATA.  */
+  int filling;			/* DATA is being decompressed.  */
+  int dirty;			/* DATA was written to; never drop it.  */
+  struct cached *next, *prev;	/* In the LRU list.  */
+};
+
+/* The state of a store decompressing the store FROM on demand, shared by
+   its clones.  Chunks of the output are decompressed as they are
+   needed, and the most recently used ones are kept.  */
+struct unzip_stream
+{
+  pthread_mutex_t lock;
+  pthread_cond_t filled;	/* Some chunk was decompressed.  */
+  int refs;
+
+  struct store *from;
+  struct unzip_index index;
+
+  /* The chunks in memory, by their index, and those without users or
+     writes, most recently used first, and their total length.  */
+  struct cached **cache;
+  struct cached *lru_head, *lru_tail;
+  size_t lru_bytes;
+};
+
+static void
+lru_add (struct unzip_stream *stream, struct cached *c)
+{
+  c->prev = 0;
+  c->next = stream->lru_head;
+  if (stream->lru_head)
+    stream->lru_head->prev = c;
+  else
+    stream->lru_tail = c;
+  stream->lru_head = c;
+  stream->lru_bytes += stream->index.chunks[c->chunk].len;
+}
+
+static void
+lru_remove (struct unzip_stream *stream, struct cached *c)
+{
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    stream->lru_head = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+  else
+    stream->lru_tail = c->prev;
+  stream->lru_bytes -= stream->index.chunks[c->chunk].len;
+}
+
+static void
+cached_free (struct unzip_stream *stream, struct cached *c)
+{
+  if (c->data)
+    munmap (c->data, stream->index.chunks[c->chunk].len);
+  free (c);
+}
+
+/* Decompress the chunk ARG, a struct cached.  */
+static void
+fill_chunk (void *arg)
+{
+  struct cached *c = arg;
+  struct unzip_stream *stream = c->stream;
+  size_t len = stream->index.chunks[c->chunk].len;
+
+  c->data = mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (c->data == MAP_FAILED)
+    {
+      c->data = 0;
+      c->err = errno;
+    }
+  else
+    c->err = UNZIP_EXTRACT (stream->from, &stream->index.chunks[c->chunk],
+			    c->data);
+}
+
+/* Drop a use of each of the NUM chunks in CACHED.  */
+static void
+release_chunks (struct unzip_stream *stream, struct cached **cached,
+		size_t num)
+{
+  size_t i;
+
+  pthread_mutex_lock (&stream->lock);
+  for (i = 0; i < num; i++)
+    {
+      struct cached *c = cached[i];
+      if (--c->refs > 0)
+	continue;
+      if (stream->cache[c->chunk] != c)
+	/* Failed to decompress.  */
+	cached_free (stream, c);
+      else if (! c->dirty)
+	lru_add (stream, c);
+    }
+
+  while (stream->lru_bytes > CACHE_SIZE)
+    {
+      struct cached *c = stream->lru_tail;
+      lru_remove (stream, c);
+      stream->cache[c->chunk] = 0;
+      cached_free (stream, c);
+    }
+  pthread_mutex_unlock (&stream->lock);
+}
+
+/* Return in CACHED the chunks FIRST to LAST of STREAM, with a use added to
+   each, decompressing those not in memory concurrently.  */
+static error_t
+get_chunks (struct unzip_stream *stream, size_t first, size_t last,
+	    struct cached **cached)
+{
+  size_t num = last - first + 1, num_fill = 0, i;
+  struct cached *fill[num];
+  error_t err = 0;
+
+  pthread_mutex_lock (&stream->lock);
+  for (i = 0; i < num; i++)
+    {
+      struct cached *c = stream->cache[first + i];
+
+      if (c)
+	{
+	  if (c->refs++ == 0 && ! c->dirty)
+	    lru_remove (stream, c);
+	}
+      else
+	{
+	  c = calloc (1, sizeof *c);
+	  if (! c)
+	    {
+	      err = ENOMEM;
+	      break;
+	    }
+	  c->stream = stream;
+	  c->chunk = first + i;
+	  c->refs = 1;
+	  c->filling = 1;
+	  stream->cache[first + i] = c;
+	  fill[num_fill++] = c;
+	}
+      cached[i] = c;
+    }
+  num = i;
+  pthread_mutex_unlock (&stream->lock);
+
+  if (num_fill > 0)
+    {
+      _store_run_parallel (fill_chunk, (void *const *) fill, num_fill);
+
+      pthread_mutex_lock (&stream->lock);
+      for (i = 0; i < num_fill; i++)
+	{
+	  fill[i]->filling = 0;
+	  if (fill[i]->err)
+	    /* Let the next user try again.  */
+	    stream->cache[fill[i]->chunk] = 0;
+	}
+      pthread_cond_broadcast (&stream->filled);
+      pthread_mutex_unlock (&stream->lock);
+    }
+
+  /* Wait for the chunks other users are decompressing.  */
+  pthread_mutex_lock (&stream->lock);
+  for (i = 0; i < num; i++)
+    {
+      while (cached[i]->filling)
+	pthread_cond_wait (&stream->filled, &stream->lock);
+      if (! err)
+	err = cached[i]->err;
+    }
+  pthread_mutex_unlock (&stream->lock);
+
+  if (err)
+    release_chunks (stream, cached, num);
+  return err;
+}
+
+/* Return the index of the chunk of STREAM holding the byte ADDR.  */
+static size_t
+find_chunk (struct unzip_stream *stream, store_offset_t addr)
+{
+  const struct unzip_chunk *chunks = stream->index.chunks;
+  size_t lo = 0, hi = stream->index.num_chunks;
+
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (chunks[mid].out <= addr)
+	lo = mid;
+      else
+	hi = mid;
+    }
+  return lo;
+}
+
+/* Copy AMOUNT bytes between BUF and STREAM at ADDR, to STREAM if WRITE
+   is true.  */
+static error_t
+stream_rdwr (struct unzip_stream *stream, store_offset_t addr,
+	     void *buf, size_t amount, int write)
+{
+  size_t first, last, i;
+  error_t err;
+
+  if (amount == 0)
+    return 0;
+
+  first = find_chunk (stream, addr);
+  last = find_chunk (stream, addr + amount - 1);
+
+  {
+    struct cached *cached[last - first + 1];
+
+    err = get_chunks (stream, first, last, cached);
+    if (err)
+      return err;
+
+    if (write)
+      {
+	pthread_mutex_lock (&stream->lock);
+	for (i = 0; i <= last - first; i++)
+	  cached[i]->dirty = 1;
+	pthread_mutex_unlock (&stream->lock);
+      }
+
+    for (i = 0; i <= last - first; i++)
+      {
+	const struct unzip_chunk *chunk = &stream->index.chunks[first + i];
+	size_t offs = addr - chunk->out;
+	size_t len = chunk->len - offs < amount ? chunk->len - offs : amount;
+
+	if (write)
+	  memcpy (cached[i]->data + offs, buf, len);
+	else
+	  memcpy (buf, cached[i]->data + offs, len);
+	addr += len;
+	buf += len;
+	amount -= len;
+      }
+
+    release_chunks (stream, cached, last - first + 1);
+  }
+
+  return 0;
+}
+
+static error_t
+stream_read (struct store *store, store_offset_t addr, size_t index,
+	     size_t amount, void **buf, size_t *len)
+{
+  error_t err;
+
+  if (*len < amount)
+    {
+      *buf = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+      if (*buf == MAP_FAILED)
+	return errno;
+      err = stream_rdwr (store->hook, addr, *buf, amount, 0);
+      if (err)
+	{
+	  munmap (*buf, amount);
+	  return err;
+	}
+    }
+  else
+    {
+      err = stream_rdwr (store->hook, addr, *buf, amount, 0);
+      if (err)
+	return err;
+    }
+
+  *len = amount;
+  return 0;
+}
+
+static error_t
+stream_write (struct store *store, store_offset_t addr, size_t index,
+	      const void *buf, size_t len, size_t *amount)
+{
+  error_t err = stream_rdwr (store->hook, addr, (void *) buf, len, 1);
+  if (! err)
+    *amount = len;
+  return err;
+}
+
+static error_t
+stream_set_size (struct store *store, size_t newsize)
+{
+  return EOPNOTSUPP;
+}
+
+static error_t
+stream_set_flags (struct store *store, int flags)
+{
+  if ((flags & ~(STORE_INACTIVE | STORE_ENFORCED)) != 0)
+    /* Trying to set flags we don't support.  */
+    return EINVAL;
+  store->flags |= flags;
+  return 0;
+}
+
+static error_t
+stream_clear_flags (struct store *store, int flags)
+{
+  if ((flags & ~(STORE_INACTIVE | STORE_ENFORCED)) != 0)
+    return EINVAL;
+  store->flags &= ~flags;
+  return 0;
+}
+
+static void
+stream_release (struct unzip_stream *stream)
+{
+  int last;
+  size_t i;
+
+  pthread_mutex_lock (&stream->lock);
+  last = --stream->refs == 0;
+  pthread_mutex_unlock (&stream->lock);
+
+  if (! last)
+    return;
+
+  for (i = 0; i < stream->index.num_chunks; i++)
+    if (stream->cache[i])
+      cached_free (stream, stream->cache[i]);
+  free (stream->cache);
+  unzip_free_index (&stream->index);
+  store_free (stream->from);
+  free (stream);
+}
+
+/* Called just before deallocating STORE.  */
+static void
+stream_cleanup (struct store *store)
+{
+  if (store->hook)
+    stream_release (store->hook);
+}
+
+/* Share the decompressed data of FROM, including any writes, with TO.  */
+static error_t
+stream_clone (const struct store *from, struct store *to)
+{
+  struct unzip_stream *stream = from->hook;
+
+  pthread_mutex_lock (&stream->lock);
+  stream->refs++;
+  pthread_mutex_unlock (&stream->lock);
+  to->hook = stream;
+  return 0;
+}
+
+/* Return a new store in STORE which decompresses the contents of FROM as
+   they are read; FROM is consumed.  If FROM can't be indexed for any
+   reason but an error reading it, *UNINDEXABLE is set.  */
+static error_t
+stream_create (struct store *from, int flags, struct store **store,
+	       int *unindexable)
+{
+  struct unzip_stream *stream;
+  struct store_run run;
+  error_t err;
+
+  stream = calloc (1, sizeof *stream);
+  if (! stream)
+    return ENOMEM;
+
+  err = UNZIP_INDEX (from, &stream->index);
+  if (err)
+    {
+      *unindexable = ! stream->index.read_err;
+      free (stream);
+      return err;
+    }
+
+  stream->cache = calloc (stream->index.num_chunks ?: 1,
+			  sizeof *stream->cache);
+  if (! stream->cache)
+    {
+      unzip_free_index (&stream->index);
+      free (stream);
+      return ENOMEM;
+    }
+
+  pthread_mutex_init (&stream->lock, NULL);
+  pthread_cond_init (&stream->filled, NULL);
+  stream->refs = 1;
+
+  run.start = 0;
+  run.length = stream->index.size;
+
+  flags |= STORE_ENFORCED;	/* Only uses local resources.  */
+
+  err = _store_create (&STORE_UNZIP(class),
+		       MACH_PORT_NULL, flags, 1, &run, 1, 0, store);
+  if (err)
+    {
+      free (stream->cache);
+      unzip_free_index (&stream->index);
+      free (stream);
+      return err;
+    }
+
+  /* Only consume FROM once nothing can fail anymore.  */
+  stream->from = from;
+  (*store)->hook = stream;
+  return 0;
+}
+
+/* Return a new store in STORE which contains the uncompressed contents of
+   the store FROM; FROM is consumed.  The contents are decompressed in
+   chunks as they are used, and only some are kept, as well as those
+   written to.  If FROM can't be indexed that way, the whole contents are
+   decompressed into memory at once.  */
 error_t
 STORE_UNZIP(create) (struct store *from, int flags, struct store **store)
 {
   void *buf;
   size_t buf_len;
-  error_t err = unzip_store (from, &buf, &buf_len);
+  int unindexable = 0;
+  error_t err = stream_create (from, flags, store, &unindexable);
+
+  if (! err || ! unindexable)
+    return err;
+
+  err = unzip_store (from, &buf, &buf_len);
 
   if (! err)
     {
@@ -263,5 +698,9 @@ STORE_UNZIP(open) (const char *name, int flags,
 }
 
 const struct store_class STORE_UNZIP(class) =
-{ -1, STRINGIFY(UNZIP), open: STORE_UNZIP(open) };
+{
+  -1, STRINGIFY(UNZIP), stream_read, stream_write, stream_set_size,
+  set_flags: stream_set_flags, clear_flags: stream_clear_flags,
+  cleanup: stream_cleanup, clone: stream_clone, open: STORE_UNZIP(open)
+};
 STORE_STD_CLASS_1 (UNZIP);
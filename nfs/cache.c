@@ -168,7 +168,7 @@ netfs_node_norefs (struct node *np)
       if (np->nn->dtrans == SYMLINK)
 	free (np->nn->transarg.name);
       free (np->nn);
-      free (np);
+      netfs_destroy_node (np);
     }
 }
 
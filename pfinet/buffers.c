@@ -0,0 +1,190 @@
+/* Out-of-line reply buffers
+   Copyright (C) 2014 Free Software Foundation, Inc.
+
+   This file is part of the GNU Hurd.
+
+   The GNU Hurd is free software; you can redistribute it and/or
+   modify it under the terms of the GNU General Public License as
+   published by the Free Software Foundation; either version 2, or (at
+   your option) any later version.
+
+   The GNU Hurd is distributed in the hope that it will be useful, but
+   WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   General Public License for more details.
+
+   You should have received a copy of the GNU General Public License
+   along with this program; if not, write to the Free Software
+   Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
+
+/* Data read from sockets that does not fit in the reply message goes
+   out of line, in page-aligned buffers whose pages the kernel moves to
+   the reader, so each buffer is used only once.  Rather than mapping
+   each one, we map large regions and hand out pieces of them, and take
+   back the pages a read did not fill, to give them out again.  These
+   pages have not been touched, so they cost nothing while they wait.  */
+
+#include "pfinet.h"
+
+#include <linux/sched.h>
+#include <net/sock.h>
+
+#include <string.h>
+#include <sys/mman.h>
+
+/* The size of the regions we map.  */
+#define REGION_SIZE	(1024 * 1024)
+
+/* The most pieces we keep.  Pages given back when all are taken are
+   unmapped.  */
+#define MAX_PIECES	32
+
+struct piece
+{
+  void *addr;
+  size_t len;
+};
+
+/* Protects everything below.  */
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Free pieces of mapped memory.  */
+static struct piece pieces[MAX_PIECES];
+static int npieces;
+
+/* Add the LEN bytes at ADDR to the free pieces, or unmap them if there
+   is no room.  BUFFERS_LOCK is held.  */
+static void
+add_piece (void *addr, size_t len)
+{
+  int i;
+
+  /* Merge it with the piece it continues or precedes, which is the
+     usual case: the unused end of a buffer given back right after the
+     rest was taken from the same piece.  */
+  for (i = 0; i < npieces; i++)
+    if (pieces[i].addr + pieces[i].len == addr)
+      {
+	pieces[i].len += len;
+	return;
+      }
+    else if (addr + len == pieces[i].addr)
+      {
+	pieces[i].addr = addr;
+	pieces[i].len += len;
+	return;
+      }
+
+  if (npieces < MAX_PIECES)
+    {
+      pieces[npieces].addr = addr;
+      pieces[npieces].len = len;
+      npieces++;
+    }
+  else
+    munmap (addr, len);
+}
+
+/* Return a page-aligned buffer of at least LEN bytes, whose pages are
+   untouched, or MAP_FAILED.  The buffer should go out of line with
+   deallocation, or back with free_reply_buffer.  */
+void *
+alloc_reply_buffer (size_t len)
+{
+  void *addr;
+  int i;
+
+  len = round_page (len);
+
+  pthread_mutex_lock (&buffers_lock);
+  for (i = 0; i < npieces; i++)
+    if (pieces[i].len >= len)
+      {
+	addr = pieces[i].addr;
+	pieces[i].addr += len;
+	pieces[i].len -= len;
+	if (pieces[i].len == 0)
+	  pieces[i] = pieces[--npieces];
+	pthread_mutex_unlock (&buffers_lock);
+	return addr;
+      }
+  pthread_mutex_unlock (&buffers_lock);
+
+  if (len >= REGION_SIZE)
+    return mmap (0, len, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+
+  addr = mmap (0, REGION_SIZE, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
+  if (addr == MAP_FAILED)
+    return addr;
+
+  pthread_mutex_lock (&buffers_lock);
+  add_piece (addr + len, REGION_SIZE - len);
+  pthread_mutex_unlock (&buffers_lock);
+  return addr;
+}
+
+/* Give back the pages of the buffer of LEN bytes at ADDR, from
+   alloc_reply_buffer, that are not covered by its first USED bytes,
+   which were filled and are going out of line.  Nothing may have been
+   written to the buffer after USED, so that the pages given back are
+   still clean when the next reader gets them.  */
+void
+free_reply_buffer (void *addr, size_t len, size_t used)
+{
+  len = round_page (len);
+  used = round_page (used);
+  if (used >= len)
+    return;
+
+  pthread_mutex_lock (&buffers_lock);
+  add_piece (addr + used, len - used);
+  pthread_mutex_unlock (&buffers_lock);
+}
+
+/* Make room for reading at most *AMOUNT bytes from the socket of USER
+   with the recvmsg FLAGS into *DATA, which has room for *DATALEN bytes,
+   and set *AMOUNT to the room there is.  If only what is queued fits in
+   *DATA, leave it at that, else put a reply buffer of the size of what
+   is queued there, or of *AMOUNT if nothing is, and set *ALLOCED.  With
+   MSG_WAITALL the read waits for all of *AMOUNT, so the room is not cut
+   down to what is queued.  (The low-water mark is always one byte in
+   this stack.)  global_lock is held, but released while mapping memory;
+   return ENOMEM if that fails.  */
+error_t
+make_reply_buffer (struct sock_user *user, char **data, size_t *datalen,
+		   size_t *amount, int flags, int *alloced)
+{
+  size_t queued = atomic_read (&user->sock->sk->rmem_alloc);
+  size_t len = *amount;
+  void *buf;
+
+  *alloced = 0;
+  if (len <= *datalen)
+    return 0;
+
+  /* The queued skbs take at least as much memory as their data.  */
+  if (queued > 0 && queued < len && ! (flags & MSG_WAITALL))
+    len = queued;
+  if (len <= *datalen)
+    {
+      *amount = *datalen;
+      return 0;
+    }
+
+  pthread_mutex_unlock (&global_lock);
+  buf = alloc_reply_buffer (len);
+  pthread_mutex_lock (&global_lock);
+  become_task (user);
+  if (buf == MAP_FAILED)
+    /* Should check whether errno is indeed ENOMEM --
+       but this can't be done in a straightforward way,
+       because the glue headers #undef errno. */
+    return ENOMEM;
+
+  /* The rest of the last page comes for free.  */
+  if (round_page (len) < *amount)
+    *amount = round_page (len);
+  *data = buf;
+  *alloced = 1;
+  return 0;
+}
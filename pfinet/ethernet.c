@@ -98,29 +98,16 @@ static int bpf_ether_filter_len = sizeof (bpf_ether_filter) / sizeof (short);
 static struct port_bucket *etherport_bucket;
 
 
-static void *
-ethernet_thread (void *arg)
-{
-  ports_manage_port_operations_one_thread (etherport_bucket,
-					   ethernet_demuxer,
-					   0);
-  return NULL;
-}
+/* The most frames the receiver thread hands to the stack at once.  */
+#define RCV_BATCH	16
 
-int
-ethernet_demuxer (mach_msg_header_t *inp,
-		  mach_msg_header_t *outp)
+/* Return the device the frame in MSG was sent to, or null.  */
+static struct device *
+ethernet_find_device (mach_msg_header_t *inp)
 {
-  struct net_rcv_msg *msg = (struct net_rcv_msg *) inp;
-  struct sk_buff *skb;
-  int datalen;
   struct ether_device *edev;
-  struct device *dev = 0;
   mach_port_t local_port;
 
-  if (inp->msgh_id != NET_RCV_MSG_ID)
-    return 0;
-
   if (MACH_MSGH_BITS_LOCAL (inp->msgh_bits) ==
       MACH_MSG_TYPE_PROTECTED_PAYLOAD)
     {
@@ -140,37 +127,97 @@ ethernet_demuxer (mach_msg_header_t *inp,
 
   for (edev = ether_dev; edev; edev = edev->next)
     if (local_port == edev->readptname)
-      dev = &edev->dev;
+      return &edev->dev;
+  return 0;
+}
+
+/* Hand the NMSGS frames in MSGS to the stack, taking net_bh_lock only
+   once for all of them.  */
+static void
+ethernet_receive (struct net_rcv_msg *msgs, int nmsgs)
+{
+  struct device *devs[nmsgs];
+  int i;
 
-  if (! dev)
+  for (i = 0; i < nmsgs; i++)
     {
-      if (inp->msgh_remote_port != MACH_PORT_NULL)
+      mach_msg_header_t *inp = &msgs[i].msg_hdr;
+
+      if (inp->msgh_id != NET_RCV_MSG_ID)
+	{
+	  mach_msg_destroy (inp);
+	  devs[i] = 0;
+	  continue;
+	}
+
+      devs[i] = ethernet_find_device (inp);
+      if (! devs[i] && inp->msgh_remote_port != MACH_PORT_NULL)
 	mach_port_deallocate (mach_task_self (), inp->msgh_remote_port);
-      return 1;
     }
 
-  datalen = ETH_HLEN
-    + msg->packet_type.msgt_number - sizeof (struct packet_header);
-
   pthread_mutex_lock (&net_bh_lock);
-  skb = alloc_skb (datalen, GFP_ATOMIC);
-  skb_put (skb, datalen);
-  skb->dev = dev;
-
-  /* Copy the two parts of the frame into the buffer. */
-  memcpy (skb->data, msg->header, ETH_HLEN);
-  memcpy (skb->data + ETH_HLEN,
-	  msg->packet + sizeof (struct packet_header),
-	  datalen - ETH_HLEN);
-
-  /* Drop it on the queue. */
-  skb->protocol = eth_type_trans (skb, dev);
-  netif_rx (skb);
+  for (i = 0; i < nmsgs; i++)
+    {
+      struct net_rcv_msg *msg = &msgs[i];
+      struct sk_buff *skb;
+      int datalen;
+
+      if (! devs[i])
+	continue;
+
+      datalen = ETH_HLEN
+	+ msg->packet_type.msgt_number - sizeof (struct packet_header);
+
+      skb = alloc_skb (datalen, GFP_ATOMIC);
+      if (! skb)
+	/* Drop it.  */
+	continue;
+      skb_put (skb, datalen);
+      skb->dev = devs[i];
+
+      /* Copy the two parts of the frame into the buffer. */
+      memcpy (skb->data, msg->header, ETH_HLEN);
+      memcpy (skb->data + ETH_HLEN,
+	      msg->packet + sizeof (struct packet_header),
+	      datalen - ETH_HLEN);
+
+      /* Drop it on the queue. */
+      skb->protocol = eth_type_trans (skb, devs[i]);
+      netif_rx (skb);
+    }
   pthread_mutex_unlock (&net_bh_lock);
-
-  return 1;
 }
 
+/* Receive the frames of all ethernet devices.  After waiting for one,
+   take the others queued by then as well, so that a burst of frames
+   costs a single round of locking.  */
+static void *
+ethernet_thread (void *arg)
+{
+  static struct net_rcv_msg msgs[RCV_BATCH];
+  mach_port_t portset = etherport_bucket->portset;
+
+  for (;;)
+    {
+      int nmsgs = 0;
+      error_t err;
+
+      do
+	{
+	  err = mach_msg (&msgs[nmsgs].msg_hdr,
+			  MACH_RCV_MSG | (nmsgs ? MACH_RCV_TIMEOUT : 0),
+			  0, sizeof msgs[nmsgs], portset,
+			  0, MACH_PORT_NULL);
+	  if (err == MACH_MSG_SUCCESS)
+	    nmsgs++;
+	}
+      while (nmsgs == 0 || (nmsgs < RCV_BATCH && err == MACH_MSG_SUCCESS));
+
+      ethernet_receive (msgs, nmsgs);
+    }
+
+  return NULL;
+}
 
 void
 ethernet_initialize (void)
@@ -53,6 +53,8 @@ struct task_struct
   int isroot;
   char *comm;
   struct wait_queue **next_wait;
+  struct socket *data_sock;	/* Whose data we have locked, and how;  */
+  int data_bits;		/* see sock_lock_data.  */
 };
 
 static inline void
@@ -60,6 +62,8 @@ prepare_current (int isroot)
 {
   current->signal = 0;
   current->isroot = isroot;
+  current->data_sock = 0;
+  current->data_bits = 0;
   /* All other members are constant zero and ignored.  */
 }
 #define become_task(user)		prepare_current ((user)->isroot)
@@ -93,13 +97,14 @@ capable(int cap)
 
 extern pthread_mutex_t global_lock;
 
-static inline int
-interruptible_sleep_on_timeout (struct wait_queue **p, struct timespec *tsp)
+extern void loopback_sleep (void);
+
+/* Return the condition variable behind the wait queue *P, making it if
+   there is none yet.  */
+static inline pthread_cond_t *
+wait_queue_cond (struct wait_queue **p)
 {
   pthread_cond_t **condp = (void *) p, *c;
-  int isroot;
-  struct wait_queue **next_wait;
-  error_t err;
 
   c = *condp;
   if (c == 0)
@@ -109,18 +114,75 @@ interruptible_sleep_on_timeout (struct wait_queue **p, struct timespec *tsp)
       pthread_cond_init (c, NULL);
       *condp = c;
     }
+  return c;
+}
+
+static inline int
+interruptible_sleep_on_timeout (struct wait_queue **p, struct timespec *tsp)
+{
+  pthread_cond_t *c = wait_queue_cond (p);
+  int isroot;
+  struct wait_queue **next_wait;
+  struct socket *data_sock;
+  int data_bits;
+  error_t err;
 
   isroot = current->isroot;	/* This is our context that needs switched.  */
   next_wait = current->next_wait; /* This too, for multiple schedule calls.  */
   current->next_wait = 0;
+
+  /* Like release_sock in Linux, let others at the socket's data while we
+     sleep, so that nonblocking callers don't wait for us to get data or
+     buffer space.  */
+  data_sock = current->data_sock;
+  data_bits = current->data_bits;
+  if (data_bits)
+    {
+      data_sock->data_busy &= ~data_bits;
+      if (data_sock->data_wait)
+	pthread_cond_broadcast ((pthread_cond_t *) data_sock->data_wait);
+    }
+
+  loopback_sleep ();		/* Don't keep what we sent waiting.  */
   err = pthread_hurd_cond_timedwait_np(c, &global_lock, tsp);
   if (err == EINTR)
     current->signal = 1;	/* We got cancelled, mark it for later.  */
+
+  /* Take the data back; whoever has it is not sleeping, so this is
+     short, and can't be given up, as our caller will unlock it.  */
+  if (data_bits)
+    {
+      while (data_sock->data_busy & data_bits)
+	pthread_cond_wait (wait_queue_cond (&data_sock->data_wait),
+			   &global_lock);
+      data_sock->data_busy |= data_bits;
+    }
+
   current->isroot = isroot;	/* Switch back to our context.  */
   current->next_wait = next_wait;
+  current->data_sock = data_sock;
+  current->data_bits = data_bits;
   return (err == ETIMEDOUT);
 }
 
+/* Evaluate EXPR, which copies data from or to the user's buffer, without
+   holding global_lock, so that copies for different sockets, and the
+   page faults they take on fresh RPC buffers, go on in parallel.  Linux
+   expects such copies to sleep, and keeps what they refer to in place
+   meanwhile: the socket is locked, which makes the bottom half and the
+   timers leave it alone, and the skb holds a reference.  Our context is
+   switched back afterwards, as when sleeping.  */
+#define user_copy_unlocked(expr)					      \
+  ({									      \
+    struct task_struct __saved = current_contents;			      \
+    typeof (expr) __ret;						      \
+    pthread_mutex_unlock (&global_lock);				      \
+    __ret = (expr);							      \
+    pthread_mutex_lock (&global_lock);					      \
+    current_contents = __saved;						      \
+    __ret;								      \
+  })
+
 static inline void
 wake_up_interruptible (struct wait_queue **p)
 {
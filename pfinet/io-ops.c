@@ -51,9 +51,18 @@ S_io_write (struct sock_user *user,
 
   pthread_mutex_lock (&global_lock);
   become_task (user);
-  if (user->sock->flags & O_NONBLOCK)
-    m.msg_flags |= MSG_DONTWAIT;
-  err = (*user->sock->ops->sendmsg) (user->sock, &m, datalen, 0);
+  err = - sock_lock_data (user->sock, SOCK_DATA_WRITING);
+  if (err == 0)
+    {
+      if (user->sock->flags & O_NONBLOCK)
+	m.msg_flags |= MSG_DONTWAIT;
+      /* If the peer is local, hand it the data before we return,
+	 rather than waking the net_bh worker for it.  */
+      loopback_defer ();
+      err = (*user->sock->ops->sendmsg) (user->sock, &m, datalen, 0);
+      loopback_deliver ();
+      sock_unlock_data (user->sock, SOCK_DATA_WRITING);
+    }
   pthread_mutex_unlock (&global_lock);
 
   if (err < 0)
@@ -76,6 +85,7 @@ S_io_read (struct sock_user *user,
 {
   error_t err;
   int alloced = 0;
+  size_t room = amount;
   struct iovec iov;
   struct msghdr m = { msg_name: 0, msg_namelen: 0, msg_flags: 0,
 		      msg_controllen: 0, msg_iov: &iov, msg_iovlen: 1 };
@@ -83,42 +93,38 @@ S_io_read (struct sock_user *user,
   if (!user)
     return EOPNOTSUPP;
 
-  /* Instead of this, we should peek and the socket and only
-     allocate as much as necessary. */
-  if (amount > *datalen)
-    {
-      *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-      if (*data == MAP_FAILED)
-        /* Should check whether errno is indeed ENOMEM --
-           but this can't be done in a straightforward way,
-           because the glue headers #undef errno. */
-        return ENOMEM;
-      alloced = 1;
-    }
-
-  iov.iov_base = *data;
-  iov.iov_len = amount;
-
   pthread_mutex_lock (&global_lock);
   become_task (user);
-  err = (*user->sock->ops->recvmsg) (user->sock, &m, amount,
-				     ((user->sock->flags & O_NONBLOCK)
-    				      ? MSG_DONTWAIT : 0),
-				     0);
+  err = - sock_lock_data (user->sock, SOCK_DATA_READING);
+  if (err == 0)
+    {
+      err = - make_reply_buffer (user, data, datalen, &room, 0, &alloced);
+      if (err == 0)
+	{
+	  iov.iov_base = *data;
+	  iov.iov_len = room;
+	  loopback_defer ();
+	  err = (*user->sock->ops->recvmsg) (user->sock, &m, room,
+					     ((user->sock->flags & O_NONBLOCK)
+					      ? MSG_DONTWAIT : 0),
+					     0);
+	  loopback_deliver ();
+	}
+      sock_unlock_data (user->sock, SOCK_DATA_READING);
+    }
   pthread_mutex_unlock (&global_lock);
 
   if (err < 0)
     {
       err = -err;
       if (alloced)
-	munmap (*data, amount);
+	free_reply_buffer (*data, room, 0);
     }
   else
     {
       *datalen = err;
-      if (alloced && round_page (*datalen) < round_page (amount))
-	munmap (*data + round_page (*datalen),
-		round_page (amount) - round_page (*datalen));
+      if (alloced)
+	free_reply_buffer (*data, room, *datalen);
       err = 0;
     }
   return err;
@@ -1,5 +1,5 @@
-/* Hack replacement for Linux's kmem_cache_t allocator
-   Copyright (C) 2000 Free Software Foundation, Inc.
+/* Replacement for Linux's kmem_cache_t allocator
+   Copyright (C) 2000, 2014 Free Software Foundation, Inc.
 
    This file is part of the GNU Hurd.
 
@@ -17,23 +17,43 @@
    along with this program; if not, write to the Free Software
    Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111, USA. */
 
-/* Hack replacement for Linux's kmem_cache_t allocator, using plain malloc
-   and cthreads locking.  The locking here is probably unnecessary.  */
+/* Replacement for Linux's kmem_cache_t allocator, using the slab spaces
+   of libhurd-slab.  Like Linux's slab caches, these construct objects
+   only once and expect them back in their constructed state.  Each
+   thread keeps a magazine of free objects of each cache, where Linux
+   keeps one per CPU, so that the packet receiver thread, the net_bh
+   worker and the RPC threads, which allocate and free skbs under
+   different locks, rarely need the lock of the cache.  */
 
 #include <pthread.h>
+#include <hurd/slab.h>
 #include <linux/malloc.h>
 
 struct kmem_cache_s
 {
-  pthread_mutex_t lock;
-
-  void *freelist;
-  size_t item_size;
+  struct hurd_slab_space space;
 
   void (*ctor) (void *, kmem_cache_t *, unsigned long);
   void (*dtor) (void *, kmem_cache_t *, unsigned long);
 };
 
+static error_t
+kmem_cache_construct (void *hook, void *buffer)
+{
+  kmem_cache_t *cache = hook;
+
+  (*cache->ctor) (buffer, cache, 0);
+  return 0;
+}
+
+static void
+kmem_cache_destruct (void *hook, void *buffer)
+{
+  kmem_cache_t *cache = hook;
+
+  (*cache->dtor) (buffer, cache, 0);
+}
+
 kmem_cache_t *
 kmem_cache_create (const char *name, size_t item_size,
 		   size_t something, unsigned long flags,
@@ -43,12 +63,17 @@ kmem_cache_create (const char *name, size_t item_size,
   kmem_cache_t *new = malloc (sizeof *new);
   if (!new)
     return 0;
-  pthread_mutex_init (&new->lock, NULL);
-  new->freelist = 0;
-  new->item_size = item_size;
   new->ctor = ctor;
   new->dtor = dtor;
 
+  if (hurd_slab_init (&new->space, item_size, 0,
+		      ctor ? kmem_cache_construct : 0,
+		      dtor ? kmem_cache_destruct : 0, new))
+    {
+      free (new);
+      return 0;
+    }
+
   return new;
 }
 
@@ -58,18 +83,8 @@ kmem_cache_alloc (kmem_cache_t *cache, int flags)
 {
   void *p;
 
-  pthread_mutex_lock (&cache->lock);
-  p = cache->freelist;
-  if (p != 0) {
-    cache->freelist = *(void **)(p + cache->item_size);
-    pthread_mutex_unlock (&cache->lock);
-    return p;
-  }
-  pthread_mutex_unlock (&cache->lock);
-
-  p = malloc (cache->item_size + sizeof (void *));
-  if (p && cache->ctor)
-    (*cache->ctor) (p, cache, flags);
+  if (hurd_slab_alloc (&cache->space, &p))
+    return 0;
   return p;
 }
 
@@ -77,12 +92,5 @@ kmem_cache_alloc (kmem_cache_t *cache, int flags)
 void
 kmem_cache_free (kmem_cache_t *cache, void *p)
 {
-  void **const nextp = (void **) (p + cache->item_size);
-
-  pthread_mutex_lock (&cache->lock);
-  *nextp = cache->freelist;
-  cache->freelist = p;
-  pthread_mutex_unlock (&cache->lock);
-
-  /* XXX eventually destroy some... */
+  hurd_slab_dealloc (&cache->space, p);
 }
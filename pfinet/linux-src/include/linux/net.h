@@ -70,6 +70,8 @@ struct socket
  	uint_fast32_t		refcnt;	/* # of sock_user's pointing to this */
 	mach_port_t 		identity; /* for io_identity */
   	ino_t			st_ino;
+	int			data_busy; /* SOCK_DATA_* bits, see pfinet.h */
+	struct wait_queue	*data_wait; /* for data_busy */
 #else
 	struct fasync_struct	*fasync_list;	/* Asynchronous wake up list	*/
 	struct file		*file;		/* File back pointer for gc	*/
@@ -78,6 +78,50 @@ extern atomic_t ip_frag_mem;
 
 static kmem_cache_t *skbuff_head_cache;
 
+#ifdef _HURD_
+/*
+ *	Caches of data buffers, by powers of two like kmalloc's in Linux,
+ *	from small packets up to loopback frames, which take a page.
+ *	Larger buffers come from kmalloc.
+ */
+#define SKB_DATA_MIN_SHIFT	7
+#define SKB_DATA_MAX_SHIFT	13
+
+static kmem_cache_t *skbuff_data_cache[SKB_DATA_MAX_SHIFT
+				       - SKB_DATA_MIN_SHIFT + 1];
+
+/* Return the cache for data buffers of SIZE bytes, or NULL.  */
+static inline kmem_cache_t *skb_data_cache(unsigned int size)
+{
+	int shift = SKB_DATA_MIN_SHIFT;
+
+	while (size > 1U << shift)
+		if (++shift > SKB_DATA_MAX_SHIFT)
+			return NULL;
+	return skbuff_data_cache[shift - SKB_DATA_MIN_SHIFT];
+}
+
+static inline u8 *skb_data_alloc(unsigned int size, int gfp_mask)
+{
+	kmem_cache_t *cache = skb_data_cache(size + sizeof(atomic_t));
+
+	if (cache)
+		return kmem_cache_alloc(cache, gfp_mask);
+	return kmalloc(size + sizeof(atomic_t), gfp_mask);
+}
+
+/* Free DATA, of SIZE bytes, as allocated by skb_data_alloc.  */
+static inline void skb_data_free(u8 *data, unsigned int size)
+{
+	kmem_cache_t *cache = skb_data_cache(size + sizeof(atomic_t));
+
+	if (cache)
+		kmem_cache_free(cache, data);
+	else
+		kfree(data);
+}
+#endif
+
 /*
  *	Keep out-of-line to prevent kernel bloat.
  *	__builtin_return_address is not used because it is not always
@@ -137,7 +181,11 @@ struct sk_buff *alloc_skb(unsigned int size,int gfp_mask)
 
 	/* Get the DATA. Size must match skb_add_mtu(). */
 	size = ((size + 15) & ~15); 
+#ifdef _HURD_
+	data = skb_data_alloc(size, gfp_mask);
+#else
 	data = kmalloc(size + sizeof(atomic_t), gfp_mask);
+#endif
 	if (data == NULL)
 		goto nodata;
 
@@ -205,7 +253,11 @@ static inline void skb_headerinit(void *p, kmem_cache_t *cache,
 void kfree_skbmem(struct sk_buff *skb)
 {
 	if (!skb->cloned || atomic_dec_and_test(skb_datarefp(skb)))  
+#ifdef _HURD_
+		skb_data_free(skb->head, skb->end - skb->head);
+#else
 		kfree(skb->head);
+#endif
 
 	kmem_cache_free(skbuff_head_cache, skb);
 	atomic_dec(&net_skbcount);
@@ -382,4 +434,18 @@ void __init skb_init(void)
 					      skb_headerinit, NULL);
 	if (!skbuff_head_cache)
 		panic("cannot create skbuff cache");
+#ifdef _HURD_
+	{
+		int i;
+
+		for (i = 0; i <= SKB_DATA_MAX_SHIFT - SKB_DATA_MIN_SHIFT; i++) {
+			skbuff_data_cache[i] = kmem_cache_create(
+				"skbuff_data_cache",
+				1U << (SKB_DATA_MIN_SHIFT + i),
+				0, SLAB_HWCACHE_ALIGN, NULL, NULL);
+			if (!skbuff_data_cache[i])
+				panic("cannot create skbuff data cache");
+		}
+	}
+#endif
 }
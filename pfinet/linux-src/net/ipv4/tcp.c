@@ -764,6 +764,17 @@ static int wait_for_buffer(struct sock *sk)
 /* When all user supplied data has been queued set the PSH bit */
 #define PSH_NEEDED (seglen == 0 && iovlen == 0)
 
+#ifdef _HURD_
+/* Whether SK sends over the loopback device, which marks what it
+ * receives as needing no checksum check, so that the sums of the
+ * data need not be computed either.
+ */
+static __inline__ int tcp_sends_to_self(struct sock *sk)
+{
+	return sk->dst_cache && (sk->dst_cache->dev->flags & IFF_LOOPBACK);
+}
+#endif
+
 /*
  *	This routine copies from a user buffer into a socket,
  *	and starts the transmit system.
@@ -975,8 +986,34 @@ int tcp_do_sendmsg(struct sock *sk, struct msghdr *msg)
 			 * Reserve header space and checksum the data.
 			 */
 			skb_reserve(skb, MAX_HEADER + sk->prot->max_header);
+#ifdef _HURD_
+			/* Nothing else knows about SKB yet.  */
+			if (tcp_sends_to_self(sk)) {
+				if (user_copy_unlocked(copy_from_user(
+					skb_put(skb, copy), from, copy)))
+					err = -EFAULT;
+				skb->csum = 0;
+			} else
+				skb->csum = user_copy_unlocked(
+					csum_and_copy_from_user(from,
+						skb_put(skb, copy), copy,
+						0, &err));
+
+			/* Another thread may have shut us down meanwhile;
+			 * then don't queue data behind the FIN.
+			 */
+			if (!err && sk->err) {
+				kfree_skb(skb);
+				goto do_sock_err;
+			}
+			if (!err && (sk->shutdown & SEND_SHUTDOWN)) {
+				kfree_skb(skb);
+				goto do_shutdown;
+			}
+#else
 			skb->csum = csum_and_copy_from_user(from,
 					skb_put(skb, copy), copy, 0, &err);
+#endif
 
 			if (err)
 				goto do_fault;
@@ -1333,7 +1370,11 @@ int tcp_recvmsg(struct sock *sk, struct msghdr *msg,
 		 *	do a second read it relies on the skb->users to avoid
 		 *	a crash when cleanup_rbuf() gets called.
 		 */
+#ifdef _HURD_
+		err = user_copy_unlocked(memcpy_toiovec(msg->msg_iov, ((unsigned char *)skb->h.th) + skb->h.th->doff*4 + offset, used));
+#else
 		err = memcpy_toiovec(msg->msg_iov, ((unsigned char *)skb->h.th) + skb->h.th->doff*4 + offset, used);
+#endif
 		if (err) {
 			/* Exception. Bailout! */
 			atomic_dec(&skb->users);
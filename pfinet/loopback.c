@@ -30,9 +30,26 @@
 #include <net/sock.h>
 #include <linux/if_ether.h>	/* For the statistics structure. */
 #include <linux/if_arp.h>	/* For ARPHRD_ETHER */
+#include <linux/interrupt.h>
+#include <net/ip.h>
+#include <net/ipv6.h>
 
 #define LOOPBACK_MTU	(vm_page_size - 172)
 
+/*
+ *	Frames sent over the loopback device wait here, under global_lock,
+ *	until they can be received: the sender is usually in the middle of
+ *	its protocol's output, which the input the frame causes must not
+ *	enter.  They are received either by the thread which sent them,
+ *	from loopback_deliver, if it said it would with loopback_defer, or
+ *	else by the net_bh worker.  Either way they skip the backlog queue,
+ *	net_bh_lock and the packet type lookup of net_bh.
+ */
+static struct sk_buff_head loopback_queue;
+
+/* Whether this thread will call loopback_deliver.  */
+static __thread int loopback_deferring;
+
 /*
  * The higher levels take care of making this non-reentrant (it's
  * called with bh's disabled).
@@ -72,22 +89,90 @@ static int loopback_xmit(struct sk_buff *skb, struct device *dev)
 	skb->ip_summed = CHECKSUM_UNNECESSARY;
 #endif
 
-	/*
-	 *	Calling netif_rx() requires locking net_bh_lock, which
-	 *	has already been done since this function is called by
-	 *	the net_bh worker thread.
-	 */
-
-	netif_rx(skb);
-
 	stats->rx_bytes+=skb->len;
 	stats->tx_bytes+=skb->len;
 	stats->rx_packets++;
 	stats->tx_packets++;
 
+	__skb_queue_tail(&loopback_queue, skb);
+	if (!loopback_deferring)
+		mark_bh(NET_BH);
+
 	return(0);
 }
 
+/*
+ *	Receive a frame sent over the loopback device.  IP output built
+ *	its header and gave it the route of its local destination, so
+ *	the checks, sum and route lookup of ip_rcv are needed only for
+ *	the rare headers with options.
+ */
+static void loopback_receive(struct sk_buff *skb)
+{
+	struct iphdr *iph;
+
+	skb->h.raw = skb->nh.raw = skb->data;
+
+	switch (skb->protocol) {
+	case __constant_htons(ETH_P_IP):
+		iph = skb->nh.iph;
+		if (skb->dst == NULL || iph->ihl != 5) {
+			ip_rcv(skb, skb->dev, NULL);
+			break;
+		}
+		ip_statistics.IpInReceives++;
+		__skb_trim(skb, ntohs(iph->tot_len));
+		skb->dst->input(skb);
+		break;
+#ifdef CONFIG_IPV6
+	case __constant_htons(ETH_P_IPV6):
+		ipv6_rcv(skb, skb->dev, NULL);
+		break;
+#endif
+	default:
+		/* Nothing else is sent over the loopback device.  */
+		kfree_skb(skb);
+		break;
+	}
+}
+
+/*
+ *	Have the frames this thread sends over the loopback device wait
+ *	for it to call loopback_deliver, without waking the net_bh worker.
+ *	This saves a thread switch for each of them, and lets a reply be
+ *	sent right away, while the request is still in the cache.
+ */
+void loopback_defer(void)
+{
+	loopback_deferring = 1;
+}
+
+/*
+ *	Receive all frames sent over the loopback device, including those
+ *	sent in reply meanwhile, and stop deferring.  This must be called
+ *	with global_lock held, outside any protocol code: at the end of an
+ *	RPC, or where the net_bh worker would run.
+ */
+void loopback_deliver(void)
+{
+	struct sk_buff *skb;
+
+	loopback_deferring = 1;
+	while ((skb = __skb_dequeue(&loopback_queue)) != NULL)
+		loopback_receive(skb);
+	loopback_deferring = 0;
+}
+
+/*
+ *	Leave the frames waiting on the loopback device to the net_bh
+ *	worker, because this thread is about to sleep.
+ */
+void loopback_sleep(void)
+{
+	if (!skb_queue_empty(&loopback_queue))
+		mark_bh(NET_BH);
+}
+
 static struct net_device_stats *get_stats(struct device *dev)
 {
 	return (struct net_device_stats *)dev->priv;
@@ -121,6 +206,8 @@ static int loopback_init(struct device *dev)
 	memset(dev->priv, 0, sizeof(struct net_device_stats));
 	dev->get_stats = get_stats;
 
+	skb_queue_head_init(&loopback_queue);
+
 	/*
 	 *	Fill in the generic fields of the device structure.
 	 */
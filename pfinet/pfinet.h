@@ -67,14 +67,26 @@ uid_t pfinet_owner;
 uid_t pfinet_group;
 
 void ethernet_initialize (void);
-int ethernet_demuxer (mach_msg_header_t *, mach_msg_header_t *);
 void setup_ethernet_device (char *, struct device **);
 void setup_dummy_device (char *, struct device **);
 void setup_tunnel_device (char *, struct device **);
 struct sock_user *make_sock_user (struct socket *, int, int, int);
+
+/* Bits of the data_busy member of struct socket: a thread is reading or
+   writing the socket's data.  */
+#define SOCK_DATA_READING	0x1
+#define SOCK_DATA_WRITING	0x2
+error_t sock_lock_data (struct socket *, int);
+void sock_unlock_data (struct socket *, int);
+void *alloc_reply_buffer (size_t);
+void free_reply_buffer (void *, size_t, size_t);
+error_t make_reply_buffer (struct sock_user *, char **, size_t *,
+			   size_t *, int, int *);
 error_t make_sockaddr_port (struct socket *, int,
 			    mach_port_t *, mach_msg_type_name_t *);
 void init_devices (void);
+void loopback_defer (void);
+void loopback_deliver (void);
 void *net_bh_worker (void *);
 void init_time (void);
 void ip_rt_add (short, u_long, u_long, u_long, struct device *,
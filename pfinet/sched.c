@@ -55,7 +55,9 @@ sock_wake_async (struct socket *sock, int how)
    are quickly moved from the Mach port's message queue to the `backlog'
    queue, or dropped, without synchronizing with RPC service threads.
    (The RPC service threads lock out the running of net_bh, but not
-   the queuing/dropping of packets in netif_rx.)  */
+   the queuing/dropping of packets in netif_rx.)
+   We also receive the frames sent over the loopback device by threads
+   which do not do that themselves; see loopback.c.  */
 void *
 net_bh_worker (void *arg)
 {
@@ -68,7 +70,9 @@ net_bh_worker (void *arg)
       net_bh_raised = 0;
 
       pthread_mutex_lock (&global_lock);
+      loopback_defer ();
       net_bh ();
+      loopback_deliver ();
       pthread_mutex_unlock (&global_lock);
     }
   /*NOTREACHED*/
@@ -454,9 +454,16 @@ S_socket_send (struct sock_user *user,
 
   pthread_mutex_lock (&global_lock);
   become_task (user);
-  if (user->sock->flags & O_NONBLOCK)
-    m.msg_flags |= MSG_DONTWAIT;
-  sent = (*user->sock->ops->sendmsg) (user->sock, &m, datalen, 0);
+  sent = - sock_lock_data (user->sock, SOCK_DATA_WRITING);
+  if (sent == 0)
+    {
+      if (user->sock->flags & O_NONBLOCK)
+	m.msg_flags |= MSG_DONTWAIT;
+      loopback_defer ();
+      sent = (*user->sock->ops->sendmsg) (user->sock, &m, datalen, 0);
+      loopback_deliver ();
+      sock_unlock_data (user->sock, SOCK_DATA_WRITING);
+    }
   pthread_mutex_unlock (&global_lock);
 
   /* MiG should do this for us, but it doesn't. */
@@ -490,6 +497,7 @@ S_socket_recv (struct sock_user *user,
   error_t err;
   union { struct sockaddr_storage storage; struct sockaddr sa; } addr;
   int alloced = 0;
+  size_t room = amount;
   struct iovec iov;
   struct msghdr m = { msg_name: &addr.sa, msg_namelen: sizeof addr,
 		      msg_controllen: 0, msg_iov: &iov, msg_iovlen: 1 };
@@ -497,37 +505,38 @@ S_socket_recv (struct sock_user *user,
   if (!user)
     return EOPNOTSUPP;
 
-  /* Instead of this, we should peek and the socket and only
-     allocate as much as necessary. */
-  if (amount > *datalen)
-    {
-      *data = mmap (0, amount, PROT_READ|PROT_WRITE, MAP_ANON, 0, 0);
-      if (*data == MAP_FAILED)
-        /* Should check whether errno is indeed ENOMEM --
-           but this can't be done in a straightforward way,
-           because the glue headers #undef errno. */
-        return ENOMEM;
-      alloced = 1;
-    }
-
-  iov.iov_base = *data;
-  iov.iov_len = amount;
-
   pthread_mutex_lock (&global_lock);
   become_task (user);
-  if (user->sock->flags & O_NONBLOCK)
-    flags |= MSG_DONTWAIT;
-  err = (*user->sock->ops->recvmsg) (user->sock, &m, amount, flags, 0);
+  err = - sock_lock_data (user->sock, SOCK_DATA_READING);
+  if (err == 0)
+    {
+      err = - make_reply_buffer (user, data, datalen, &room, flags,
+				 &alloced);
+      if (err == 0)
+	{
+	  iov.iov_base = *data;
+	  iov.iov_len = room;
+	  if (user->sock->flags & O_NONBLOCK)
+	    flags |= MSG_DONTWAIT;
+	  loopback_defer ();
+	  err = (*user->sock->ops->recvmsg) (user->sock, &m, room, flags, 0);
+	  loopback_deliver ();
+	}
+      sock_unlock_data (user->sock, SOCK_DATA_READING);
+    }
   pthread_mutex_unlock (&global_lock);
 
   if (err < 0)
-    err = -err;
+    {
+      err = -err;
+      if (alloced)
+	free_reply_buffer (*data, room, 0);
+    }
   else
     {
       *datalen = err;
-      if (alloced && round_page (*datalen) < round_page (amount))
-	munmap (*data + round_page (*datalen),
-		round_page (amount) - round_page (*datalen));
+      if (alloced)
+	free_reply_buffer (*data, room, *datalen);
       err = S_socket_create_address (0, addr.sa.sa_family,
 				     (void *) &addr.sa, m.msg_namelen,
 				     addrport, addrporttype);
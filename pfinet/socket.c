@@ -22,6 +22,7 @@
 
 #include <linux/socket.h>
 #include <linux/net.h>
+#include <linux/sched.h>
 
 #ifndef NPROTO
 #define NPROTO (PF_INET + 1)
@@ -94,6 +95,40 @@ make_sock_user (struct socket *sock, int isroot, int noinstall, int consume)
   return user;
 }
 
+/* Wait until no other thread does any of BITS, SOCK_DATA_READING or
+   SOCK_DATA_WRITING, with the data of SOCK, and mark that we do.  The
+   protocols drop global_lock while copying data from or to the user's
+   buffer, so this keeps the readers of a socket from running into each
+   other there, and the writers, while reads and writes of a socket, and
+   of different sockets, go on in parallel.  The lock is given up while
+   the protocol sleeps, waiting for data or buffer space, as Linux's
+   release_sock does.  global_lock must be held, and the task context set
+   up; return EINTR if interrupted.  */
+error_t
+sock_lock_data (struct socket *sock, int bits)
+{
+  while (sock->data_busy & bits)
+    {
+      interruptible_sleep_on_timeout (&sock->data_wait, NULL);
+      if (signal_pending (current))
+	return EINTR;
+    }
+  sock->data_busy |= bits;
+  current->data_sock = sock;
+  current->data_bits = bits;
+  return 0;
+}
+
+/* Undo sock_lock_data (SOCK, BITS).  global_lock must be held.  */
+void
+sock_unlock_data (struct socket *sock, int bits)
+{
+  sock->data_busy &= ~bits;
+  current->data_sock = 0;
+  current->data_bits = 0;
+  wake_up_interruptible (&sock->data_wait);
+}
+
 /* This is called from the port cleanup function below, and on
    a newly allocated socket when something went wrong in its creation.  */
 void
@@ -111,6 +146,11 @@ sock_release (struct socket *sock)
   if (sock->identity != MACH_PORT_NULL)
     mach_port_destroy (mach_task_self (), sock->identity);
 
+  if (sock->data_wait)
+    {
+      pthread_cond_destroy ((pthread_cond_t *) sock->data_wait);
+      free (sock->data_wait);
+    }
   free (sock);
 }
 
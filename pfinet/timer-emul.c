@@ -64,6 +64,10 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 
       pthread_mutex_lock (&global_lock);
 
+      /* Receive what the timers send over the loopback device, such as
+	 delayed acknowledgements, here rather than in the net_bh worker.  */
+      loopback_defer ();
+
       while (timers->expires <= jiffies)
 	{
 	  struct timer_list *tp;
@@ -79,6 +83,8 @@ timer_function (void *this_is_a_pointless_variable_with_a_rather_long_name)
 
 	  (*tp->function) (tp->data);
 	}
+
+      loopback_deliver ();
     }
 
   return NULL;
@@ -225,7 +225,7 @@ void netfs_node_norefs (struct node *np)
   pthread_spin_unlock (&netfs_node_refcnt_lock);
 
   procfs_cleanup (np);
-  free (np);
+  netfs_destroy_node (np);
 
   pthread_spin_lock (&netfs_node_refcnt_lock);
 }
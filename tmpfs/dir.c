@@ -24,6 +24,47 @@
 #include "tmpfs.h"
 #include <stdlib.h>
 
+/* Hash function and comparison for the name index of directories.  The
+   keys are the NUL-terminated names of the entries.  */
+static hurd_ihash_key_t
+dirent_hash (const void *key)
+{
+  return hurd_ihash_hash32 (key, strlen (key), 0);
+}
+
+static int
+dirent_cmp (const void *a, const void *b)
+{
+  return strcmp (a, b) == 0;
+}
+
+/* Index the entries of directory DN by name.  If this fails, DN just
+   stays unindexed.  */
+static void
+dir_make_hash (struct disknode *dn)
+{
+  struct tmpfs_dirent *d;
+  hurd_ihash_t hash;
+
+  if (hurd_ihash_create (&hash, offsetof (struct tmpfs_dirent, hash_locp)))
+    return;
+  hurd_ihash_set_gki (hash, dirent_hash, dirent_cmp);
+  if (hurd_ihash_reserve (hash, 2 * dn->u.dir.count))
+    {
+      hurd_ihash_free (hash);
+      return;
+    }
+
+  for (d = dn->u.dir.entries; d != 0; d = d->next)
+    if (hurd_ihash_add (hash, (hurd_ihash_key_t) d->name, d))
+      {
+	hurd_ihash_free (hash);
+	return;
+      }
+
+  dn->u.dir.hash = hash;
+}
+
 error_t
 diskfs_init_dir (struct node *dp, struct node *pdp, struct protid *cred)
 {
@@ -114,8 +155,17 @@ diskfs_get_directs (struct node *dp, int entry, int n,
       entp = (void *) entp + entp->d_reclen;
     }
 
-  /* Skip ahead to the desired entry.  */
-  for (d = dp->dn->u.dir.entries; i < entry && d != 0; d = d->next)
+  /* Skip ahead to the desired entry, starting where the last call
+     stopped if that is not past it.  */
+  d = dp->dn->u.dir.entries;
+  if (dp->dn->u.dir.cursor != 0
+      && i <= dp->dn->u.dir.cursor_entry
+      && dp->dn->u.dir.cursor_entry <= entry)
+    {
+      d = dp->dn->u.dir.cursor;
+      i = dp->dn->u.dir.cursor_entry;
+    }
+  for (; i < entry && d != 0; d = d->next)
     ++i;
 
   if (i < entry)
@@ -140,6 +190,10 @@ diskfs_get_directs (struct node *dp, int entry, int n,
       entp = (void *) entp + rlen;
     }
 
+  /* Remember where to continue.  */
+  dp->dn->u.dir.cursor = d;
+  dp->dn->u.dir.cursor_entry = i;
+
   *datacnt = (char *) entp - *data;
   *amt = i - entry;
 
@@ -149,7 +203,7 @@ diskfs_get_directs (struct node *dp, int entry, int n,
 
 struct dirstat
 {
-  struct tmpfs_dirent **prevp;
+  struct tmpfs_dirent *entry;	/* the entry found, if any */
   int dotdot;
 };
 const size_t diskfs_dirstat_size = sizeof (struct dirstat);
@@ -157,7 +211,7 @@ const size_t diskfs_dirstat_size = sizeof (struct dirstat);
 void
 diskfs_null_dirstat (struct dirstat *ds)
 {
-  ds->prevp = 0;
+  ds->entry = 0;
 }
 
 error_t
@@ -174,7 +228,7 @@ diskfs_lookup_hard (struct node *dp,
 		    struct protid *cred)
 {
   const size_t namelen = strlen (name);
-  struct tmpfs_dirent *d, **prevp;
+  struct tmpfs_dirent *d;
 
   if (type == REMOVE || type == RENAME)
     assert (np);
@@ -225,24 +279,27 @@ diskfs_lookup_hard (struct node *dp,
 	}
     }
 
-  for (d = *(prevp = &dp->dn->u.dir.entries); d != 0;
-       d = *(prevp = &d->next))
-    if (d->namelen == namelen && !memcmp (d->name, name, namelen))
-      {
-	if (ds)
-	  ds->prevp = prevp;
-
-	if (np)
-	  return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
-	else
-	  return 0;
-      }
+  if (dp->dn->u.dir.hash)
+    d = hurd_ihash_find (dp->dn->u.dir.hash, (hurd_ihash_key_t) name);
+  else
+    for (d = dp->dn->u.dir.entries; d != 0; d = d->next)
+      if (d->namelen == namelen && !memcmp (d->name, name, namelen))
+	break;
 
   if (ds)
-    ds->prevp = prevp;
+    ds->entry = d;
+
+  if (d == 0)
+    {
+      if (np)
+	*np = 0;
+      return ENOENT;
+    }
+
   if (np)
-    *np = 0;
-  return ENOENT;
+    return diskfs_cached_lookup ((ino_t) (uintptr_t) d->dn, np);
+  else
+    return 0;
 }
 
 
@@ -264,11 +321,30 @@ diskfs_direnter_hard (struct node *dp, const char *name,
   if (new == 0)
     return ENOSPC;
 
-  new->next = 0;
   new->dn = np->dn;
   new->namelen = namelen;
   memcpy (new->name, name, namelen + 1);
-  *ds->prevp = new;
+  new->seq = dp->dn->u.dir.next_seq++;
+
+  if (dp->dn->u.dir.hash
+      && hurd_ihash_add (dp->dn->u.dir.hash,
+			 (hurd_ihash_key_t) new->name, new))
+    {
+      /* Go on without the index rather than failing.  */
+      hurd_ihash_free (dp->dn->u.dir.hash);
+      dp->dn->u.dir.hash = 0;
+    }
+
+  /* Append the new entry, so that readers of the directory see it
+     last.  */
+  new->next = 0;
+  new->prevp = dp->dn->u.dir.lastp;
+  *dp->dn->u.dir.lastp = new;
+  dp->dn->u.dir.lastp = &new->next;
+
+  if (++dp->dn->u.dir.count >= TMPFS_DIR_HASH_THRESHOLD
+      && dp->dn->u.dir.hash == 0)
+    dir_make_hash (dp->dn);
 
   dp->dn_stat.st_size += entsize;
   adjust_used (entsize);
@@ -286,7 +362,7 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
   if (ds->dotdot)
     dp->dn->u.dir.dotdot = np->dn;
   else
-    (*ds->prevp)->dn = np->dn;
+    ds->entry->dn = np->dn;
 
   return 0;
 }
@@ -294,11 +370,35 @@ diskfs_dirrewrite_hard (struct node *dp, struct node *np,
 error_t
 diskfs_dirremove_hard (struct node *dp, struct dirstat *ds)
 {
-  struct tmpfs_dirent *d = *ds->prevp;
+  struct tmpfs_dirent *d = ds->entry;
+  struct tmpfs_dirent *cursor = dp->dn->u.dir.cursor;
   const size_t entsize
 	  = (offsetof (struct dirent, d_name[1]) + d->namelen + 7) & ~7;
 
-  *ds->prevp = d->next;
+  /* Entries after D move up by one.  Keep the readdir cursor on the
+     entry it points to.  */
+  if (d == cursor)
+    dp->dn->u.dir.cursor = d->next;
+  else if (cursor != 0 && (int) (d->seq - cursor->seq) < 0)
+    dp->dn->u.dir.cursor_entry--;
+
+  *d->prevp = d->next;
+  if (d->next)
+    d->next->prevp = d->prevp;
+  else
+    dp->dn->u.dir.lastp = d->prevp;
+
+  if (dp->dn->u.dir.hash)
+    {
+      hurd_ihash_locp_remove (dp->dn->u.dir.hash, d->hash_locp);
+      if (--dp->dn->u.dir.count == 0)
+	{
+	  hurd_ihash_free (dp->dn->u.dir.hash);
+	  dp->dn->u.dir.hash = 0;
+	}
+    }
+  else
+    dp->dn->u.dir.count--;
 
   if (dp->dirmod_reqs != 0)
     diskfs_notice_dirchange (dp, DIR_CHANGED_UNLINK, d->name);
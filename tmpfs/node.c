@@ -54,6 +54,8 @@ diskfs_alloc_node (struct node *dp, mode_t mode, struct node **npp)
   pthread_spin_unlock (&diskfs_node_refcnt_lock);
 
   dn->type = IFTODT (mode & S_IFMT);
+  if (dn->type == DT_DIR)
+    dn->u.dir.lastp = &dn->u.dir.entries;
   return diskfs_cached_lookup ((ino_t) (uintptr_t) dn, npp);
 }
 
@@ -127,7 +129,7 @@ diskfs_node_norefs (struct node *np)
       np->dn->hprevp = 0;
     }
 
-  free (np);
+  diskfs_destroy_node (np);
 }
 
 static void
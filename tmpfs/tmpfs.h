@@ -21,6 +21,7 @@ the Free Software Foundation, 675 Mass Ave, Cambridge, MA 02139, USA.  */
 #define _tmpfs_h 1
 
 #include <hurd/diskfs.h>
+#include <hurd/ihash.h>
 #include <sys/types.h>
 #include <dirent.h>
 #include <stdint.h>
@@ -52,8 +53,19 @@ struct disknode
     } reg;
     struct
     {
-      struct tmpfs_dirent *entries;
+      /* Entries in the order they were added, which is the order
+	 diskfs_get_directs returns them in.  */
+      struct tmpfs_dirent *entries, **lastp;
       struct disknode *dotdot;
+      unsigned int count;	/* number of entries */
+      unsigned int next_seq;	/* sequence number of the next entry */
+      /* Index of the entries by name, made once the directory has
+	 TMPFS_DIR_HASH_THRESHOLD entries, or null.  */
+      hurd_ihash_t hash;
+      /* Where the last diskfs_get_directs call stopped: the entry
+	 CURSOR is entry number CURSOR_ENTRY, or CURSOR is null.  */
+      struct tmpfs_dirent *cursor;
+      int cursor_entry;
     } dir;
     dev_t chr, blk;
   } u;
@@ -63,12 +75,17 @@ struct disknode
 
 struct tmpfs_dirent
 {
-  struct tmpfs_dirent *next;
+  struct tmpfs_dirent *next, **prevp;
+  hurd_ihash_locp_t hash_locp;	/* location in the directory's hash */
+  unsigned int seq;		/* order in the directory */
   struct disknode *dn;
   uint8_t namelen;
   char name[0];
 };
 
+/* Directories with this many entries are indexed by name.  */
+#define TMPFS_DIR_HASH_THRESHOLD 16
+
 extern unsigned int num_files;
 extern off_t tmpfs_page_limit, tmpfs_space_used;
 
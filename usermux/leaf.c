@@ -138,7 +138,7 @@ create_user_node (struct usermux *mux, struct usermux_name *name,
   if (err)
     {
       free (nn);
-      free (new);
+      netfs_destroy_node (new);
       return err;
     }
 
@@ -37,7 +37,7 @@ netfs_node_norefs (struct node *node)
   if (node->nn->trans_len > 0)
     free (node->nn->trans);
   free (node->nn);
-  free (node);
+  netfs_destroy_node (node);
 }
 
 /* Attempt to create a file named NAME in DIR for USER with MODE.  Set *NODE